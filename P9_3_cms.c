@@ -13,6 +13,24 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <stdint.h>
+#include <signal.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 
 //ANSI color codes
@@ -24,11 +42,370 @@
 #define BOLD "\033[1m"
 
 #define MAX_STR 128 //Maximum length for strings (e.g. name, programme)
-#define INIT_CAP 16 //Initial capacity for student array (can be resized)
-#define LOGFILE "P9_3-CMS.log" //Default Filename for audit log
+#define INIT_CAP 16 //Initial capacity for the row order array (can be resized)
+#define CHUNK_ROWS 1024 //Records per storage chunk (chunks never move once allocated)
+#define CHUNK_POOL_MAX 8 //Empty chunks kept for reuse instead of being freed
+#define COMPACT_MIN_FREE (2 * CHUNK_ROWS) //Free slots needed before DELETE auto-compacts
+#define UNDO_BATCH_SHOW_MAX 20 //Records UNDO lists when reverting a COMMIT / MERGE
+#define LOGFILE "P9_3-CMS.log" //Default Filename for audit log (active segment)
+#define LOGINDEX "P9_3-CMS.log.idx" //Sidecar index: (timestamp, student ID) -> segment + byte offset
+#define LOG_SEGMENT_MAX_BYTES (4L * 1024 * 1024) //Rotate the active log segment above this size
+#define LOG_SEGMENT_MAX_AGE (7L * 24 * 60 * 60) //...or once its first entry is this old (seconds)
 #define FILENAME "P9_3-CMS.txt" //Default Filename for student record database
+#define SNAPSHOT_POINTER "P9_3-CMS.snap" //Names the newest replica snapshot (P9_3-CMS.snap.<n>.cmsa)
 static const char* CURRENT_USER = "P9_3-Admin"; //For audit logging (current user)
 
+//Thread primitives (thread pool, background tasks)
+#ifdef _WIN32
+typedef CRITICAL_SECTION thread_mutex;
+typedef CONDITION_VARIABLE thread_cond;
+typedef HANDLE thread_handle;
+#define thread_mutex_init(m) InitializeCriticalSection(m)
+#define thread_mutex_lock(m) EnterCriticalSection(m)
+#define thread_mutex_unlock(m) LeaveCriticalSection(m)
+#define thread_cond_init(c) InitializeConditionVariable(c)
+#define thread_cond_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define thread_cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t thread_mutex;
+typedef pthread_cond_t thread_cond;
+typedef pthread_t thread_handle;
+#define thread_mutex_init(m) pthread_mutex_init(m, NULL)
+#define thread_mutex_lock(m) pthread_mutex_lock(m)
+#define thread_mutex_unlock(m) pthread_mutex_unlock(m)
+#define thread_cond_init(c) pthread_cond_init(c, NULL)
+#define thread_cond_wait(c, m) pthread_cond_wait(c, m)
+#define thread_cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+
+/* ---------------------------------------------------- */
+/* Tracing (TRACE START / TRACE STOP)                   */
+/* ---------------------------------------------------- */
+//
+// Build with -DCMS_TRACE to time the internal phases of a command. A phase
+// is marked with TRACE_BEGIN(span, "name") ... TRACE_END(span); while a
+// recording runs (TRACE START) each finished span is appended to a buffer
+// owned by the thread that ran it, so threads never share a lock or cache
+// line. TRACE STOP writes every buffer as Chrome trace-event JSON (open it
+// in chrome://tracing or ui.perfetto.dev).
+//
+// Every span also fires the USDT probes cms:span_begin / cms:span_end
+// (argument: the span name) when <sys/sdt.h> is available, so perf and
+// bpftrace can attach without a recording, e.g.
+//   bpftrace -e 'usdt:./P9_3_CMS:cms:span_begin { @[str(arg0)] = count(); }'
+//
+// Without CMS_TRACE the macros expand to nothing. With it, a span outside a
+// recording costs one relaxed load (plus the probe's single nop).
+
+#ifdef CMS_TRACE
+
+#ifndef __GNUC__
+#error "CMS_TRACE needs GCC or Clang (atomic builtins, _Thread_local)"
+#endif
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE_BEGIN(name) DTRACE_PROBE1(cms, span_begin, name)
+#define TRACE_PROBE_END(name) DTRACE_PROBE1(cms, span_end, name)
+#endif
+#endif
+#ifndef TRACE_PROBE_BEGIN
+#define TRACE_PROBE_BEGIN(name) ((void)0)
+#define TRACE_PROBE_END(name) ((void)0)
+#endif
+
+#define TRACE_BLOCK_EVENTS 8192         //Spans per buffer block (192 KB)
+#define TRACE_EVENTS_MAX (1u << 20)     //Spans one thread keeps per recording; later ones are dropped
+#define TRACE_DEFAULT_FILE "P9_3-CMS.trace.json"
+
+//One finished span (name must be a string literal: only the pointer is kept)
+typedef struct {
+    const char *name;
+    uint64_t start, end; //trace_now_ns()
+} TraceEvent;
+
+//Fixed-size block: blocks never move, so TRACE STOP can read them while
+//a straggling span is appended
+typedef struct TraceBlock {
+    TraceEvent events[TRACE_BLOCK_EVENTS];
+    size_t count;            //published with release: events [0, count) are complete
+    struct TraceBlock *next;
+} TraceBlock;
+
+//Spans of one thread
+typedef struct TraceBuffer {
+    TraceBlock *head, *tail;
+    size_t total, dropped;
+    unsigned generation;     //recording the spans belong to
+    int tid;
+    int retired;             //thread has exited: freed by the next TRACE START
+    const char *threadName;
+    struct TraceBuffer *next;
+} TraceBuffer;
+
+static struct {
+    thread_mutex lock;       //guards the buffer list
+    TraceBuffer *buffers;
+    int threads;             //tids handed out so far
+    int active;              //1 -> recording
+    unsigned generation;     //bumped by TRACE START
+    uint64_t epoch;          //trace_now_ns() at TRACE START
+} trace_state;
+
+static _Thread_local TraceBuffer *trace_local;
+static _Thread_local const char *trace_local_name;
+
+typedef struct {
+    const char *name;
+    uint64_t start; //0 -> not recording when the span began
+} TraceSpan;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trace_now_ns
+// PURPOSE : Monotonic clock in nanoseconds (never 0).
+// -----------------------------------------------------------------------------
+static uint64_t trace_now_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart) | 1u;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec) | 1u;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trace_buffer_create
+// PURPOSE : First span of a thread in a recording: gives it a buffer.
+// RETURNS : the buffer, NULL -> out of memory (the span is lost)
+// -----------------------------------------------------------------------------
+static TraceBuffer *trace_buffer_create(void)
+{
+    TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+    TraceBlock *block = malloc(sizeof(TraceBlock));
+    if (buffer == NULL || block == NULL) {
+        free(buffer);
+        free(block);
+        return NULL;
+    }
+    block->count = 0;
+    block->next = NULL;
+    buffer->head = buffer->tail = block;
+    buffer->threadName = trace_local_name ? trace_local_name : "thread";
+
+    thread_mutex_lock(&trace_state.lock);
+    buffer->tid = ++trace_state.threads;
+    buffer->generation = __atomic_load_n(&trace_state.generation, __ATOMIC_RELAXED);
+    buffer->next = trace_state.buffers;
+    trace_state.buffers = buffer;
+    thread_mutex_unlock(&trace_state.lock);
+
+    trace_local = buffer;
+    return buffer;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trace_record
+// PURPOSE : Appends a finished span to the calling thread's buffer. Spans
+//           left over from an earlier recording are dropped first.
+// -----------------------------------------------------------------------------
+static void trace_record(const char *name, uint64_t start, uint64_t end)
+{
+    TraceBuffer *buffer = trace_local ? trace_local : trace_buffer_create();
+    if (buffer == NULL) return;
+
+    unsigned generation = __atomic_load_n(&trace_state.generation, __ATOMIC_ACQUIRE);
+    if (buffer->generation != generation) { //new recording: reuse the blocks
+        for (TraceBlock *block = buffer->head; block != NULL; block = block->next) {
+            __atomic_store_n(&block->count, 0, __ATOMIC_RELEASE);
+        }
+        buffer->tail = buffer->head;
+        buffer->total = 0;
+        __atomic_store_n(&buffer->dropped, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&buffer->generation, generation, __ATOMIC_RELEASE);
+    }
+
+    TraceBlock *block = buffer->tail;
+    if (block->count == TRACE_BLOCK_EVENTS) {
+        TraceBlock *next = block->next;
+        if (next == NULL && buffer->total < TRACE_EVENTS_MAX) {
+            next = malloc(sizeof(TraceBlock));
+            if (next != NULL) {
+                next->count = 0;
+                next->next = NULL;
+                __atomic_store_n(&block->next, next, __ATOMIC_RELEASE);
+            }
+        }
+        if (next == NULL || buffer->total >= TRACE_EVENTS_MAX) {
+            __atomic_store_n(&buffer->dropped, buffer->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        block = buffer->tail = next;
+    }
+
+    TraceEvent *event = &block->events[block->count];
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    __atomic_store_n(&block->count, block->count + 1, __ATOMIC_RELEASE);
+    buffer->total++;
+}
+
+static inline void trace_span_begin(TraceSpan *span, const char *name)
+{
+    TRACE_PROBE_BEGIN(name);
+    span->name = name;
+    span->start = __atomic_load_n(&trace_state.active, __ATOMIC_RELAXED) ? trace_now_ns() : 0;
+}
+
+static inline void trace_span_end(TraceSpan *span)
+{
+    TRACE_PROBE_END(span->name);
+    if (span->start != 0) trace_record(span->name, span->start, trace_now_ns());
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trace_thread_name / trace_thread_exit
+// PURPOSE : Label the calling thread in the trace (string literal), and
+//           hand its buffer back when the thread ends.
+// -----------------------------------------------------------------------------
+static void trace_thread_name(const char *name)
+{
+    trace_local_name = name;
+    if (trace_local) trace_local->threadName = name;
+}
+
+static void trace_thread_exit(void)
+{
+    if (trace_local) __atomic_store_n(&trace_local->retired, 1, __ATOMIC_RELEASE);
+    trace_local = NULL;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trace_start
+// PURPOSE : TRACE START. Starts a new recording; buffers of threads that
+//           have exited are freed (their spans were already written or
+//           dropped).
+// -----------------------------------------------------------------------------
+static void trace_start(void)
+{
+    thread_mutex_lock(&trace_state.lock);
+    TraceBuffer **link = &trace_state.buffers;
+    while (*link != NULL) {
+        TraceBuffer *buffer = *link;
+        if (!__atomic_load_n(&buffer->retired, __ATOMIC_ACQUIRE)) {
+            link = &buffer->next;
+            continue;
+        }
+        *link = buffer->next;
+        while (buffer->head != NULL) {
+            TraceBlock *next = buffer->head->next;
+            free(buffer->head);
+            buffer->head = next;
+        }
+        free(buffer);
+    }
+    trace_state.epoch = trace_now_ns();
+    __atomic_store_n(&trace_state.generation, trace_state.generation + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace_state.active, 1, __ATOMIC_RELEASE);
+    thread_mutex_unlock(&trace_state.lock);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trace_spans
+// PURPOSE : Counts the spans of the current recording.
+// RETURNS : spans recorded (*dropped: spans lost to full buffers,
+//           *threads: threads that recorded any)
+// -----------------------------------------------------------------------------
+static size_t trace_spans(size_t *dropped, int *threads)
+{
+    size_t spans = 0;
+    *dropped = 0;
+    *threads = 0;
+
+    thread_mutex_lock(&trace_state.lock);
+    for (TraceBuffer *buffer = trace_state.buffers; buffer != NULL; buffer = buffer->next) {
+        if (__atomic_load_n(&buffer->generation, __ATOMIC_ACQUIRE) != trace_state.generation) continue;
+        size_t count = 0;
+        for (TraceBlock *block = buffer->head; block != NULL; block = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE)) {
+            count += __atomic_load_n(&block->count, __ATOMIC_ACQUIRE);
+        }
+        spans += count;
+        *dropped += __atomic_load_n(&buffer->dropped, __ATOMIC_RELAXED);
+        if (count > 0) (*threads)++;
+    }
+    thread_mutex_unlock(&trace_state.lock);
+    return spans;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trace_stop
+// PURPOSE : TRACE STOP. Ends the recording and writes it to filePath as
+//           Chrome trace-event JSON: one complete ("X") event per span,
+//           times in microseconds since TRACE START, plus the thread names.
+// RETURNS : 1 -> written, 0 -> file could not be written
+// -----------------------------------------------------------------------------
+static int trace_stop(const char *filePath)
+{
+    __atomic_store_n(&trace_state.active, 0, __ATOMIC_RELEASE);
+
+    FILE *filePtr = fopen(filePath, "w");
+    if (filePtr == NULL) return 0;
+
+#ifdef _WIN32
+    unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    fprintf(filePtr, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(filePtr, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"args\":{\"name\":\"P9_3 CMS\"}}", pid);
+
+    thread_mutex_lock(&trace_state.lock);
+    for (TraceBuffer *buffer = trace_state.buffers; buffer != NULL; buffer = buffer->next) {
+        if (__atomic_load_n(&buffer->generation, __ATOMIC_ACQUIRE) != trace_state.generation) continue;
+        fprintf(filePtr, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, buffer->tid, buffer->threadName);
+
+        for (TraceBlock *block = buffer->head; block != NULL; block = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE)) {
+            size_t count = __atomic_load_n(&block->count, __ATOMIC_ACQUIRE);
+            for (size_t i = 0; i < count; i++) {
+                const TraceEvent *event = &block->events[i];
+                if (event->start < trace_state.epoch) continue; //began before this recording
+                fprintf(filePtr, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        event->name, pid, buffer->tid,
+                        (double)(event->start - trace_state.epoch) / 1000.0,
+                        (double)(event->end - event->start) / 1000.0);
+            }
+        }
+    }
+    thread_mutex_unlock(&trace_state.lock);
+
+    fprintf(filePtr, "\n]}\n");
+    return fclose(filePtr) == 0;
+}
+
+#define TRACE_BEGIN(span, name) TraceSpan span; trace_span_begin(&span, name)
+#define TRACE_END(span) trace_span_end(&span)
+#define TRACE_INIT() thread_mutex_init(&trace_state.lock)
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#define TRACE_THREAD_EXIT() trace_thread_exit()
+
+#else
+
+#define TRACE_BEGIN(span, name)
+#define TRACE_END(span)
+#define TRACE_INIT()
+#define TRACE_THREAD_NAME(name)
+#define TRACE_THREAD_EXIT()
+
+#endif
+
 
 //Student Object
 typedef struct {
@@ -38,9 +415,54 @@ typedef struct {
     float mark;              //Final marks
 } Student;
 
-Student *arr = NULL; //Student Object Array
-size_t arr_size = 0; //Student record number tracker
-size_t arr_cap = 0; //Array capacity tracker
+//Record handle: slot number inside the chunked store (chunk * CHUNK_ROWS + offset)
+typedef uint32_t RecHandle;
+#define NO_HANDLE 0x7FFFFFFFu //"no record" / end of free list
+#define SLOT_FREE 0x80000000u //rowPos flag: slot is on the free list
+
+//Collation key of a text field: the first COLLATE_KEY_BYTES bytes of the
+//case-folded, whitespace-collapsed text packed big-endian, so comparing keys
+//as integers orders the texts. Longer texts fall back to the full string.
+#define COLLATE_KEY_BYTES 15    //Normalised bytes kept in a key
+#define COLLATE_KEY_LONGER 1u   //tail flag: the text continues past the key
+typedef struct {
+    uint64_t head; //Normalised bytes 0-7
+    uint64_t tail; //Normalised bytes 8-14, low byte = COLLATE_KEY_LONGER or 0
+} CollationKey;
+
+//Collation keys of one record, kept in step with it by the store
+typedef struct {
+    CollationKey name;
+    CollationKey programme;
+} RecordKeys;
+
+//Fixed-size block of records
+typedef struct StudentChunk {
+    Student rows[CHUNK_ROWS];      //Record storage
+    RecordKeys keys[CHUNK_ROWS];   //Collation keys of each slot (SORT BY NAME / PROGRAMME)
+    uint32_t rowPos[CHUNK_ROWS];   //Row position of each slot, or SLOT_FREE | next free slot
+    struct StudentChunk *nextFree; //Link while sitting in the chunk pool
+} StudentChunk;
+
+//Student Table (replaces the single realloc'd array)
+typedef struct {
+    StudentChunk **chunks; //Chunk directory
+    size_t chunkCount;     //Chunks in use
+    size_t chunkCap;       //Directory capacity
+    RecHandle *order;      //Table order: order[i] = handle of the i-th row
+    size_t orderCap;       //Capacity of order[]
+    size_t size;           //Student record number tracker
+    size_t slotsUsed;      //Slots handed out so far (live + free)
+    RecHandle freeHead;    //First free slot (NO_HANDLE if none)
+    size_t freeCount;      //Number of free slots
+} StudentStore;
+
+static StudentStore db = {NULL, 0, 0, NULL, 0, 0, 0, NO_HANDLE, 0}; //The open table
+static StudentChunk *chunk_pool = NULL; //Empty chunks kept for reuse
+static size_t chunk_pool_count = 0;
+static thread_mutex chunk_pool_lock; //a background OPEN fills its table while the REPL uses db
+static unsigned long table_generation = 1; //Bumped whenever table contents or row order change
+static int table_unsaved = 0; //1 -> records changed since the table was opened or saved
 
 
 //Last Operation EnumType (for undo)
@@ -48,251 +470,2650 @@ typedef enum {
     OP_NONE,   //No operation
     OP_INSERT, //Insert operation
     OP_DELETE, //Delete operation
-    OP_UPDATE  //Update operation
+    OP_UPDATE, //Update operation
+    OP_BATCH   //Several changes undone together (e.g. a committed transaction)
 } OpType;
 
+//One record change inside a batch (transaction write set / batch undo unit)
+typedef struct {
+    int id;         //Student ID the change applies to
+    int hadBefore;  //1 -> record existed before the batch
+    int hasAfter;   //1 -> record exists after the batch (0 -> deleted)
+    Student before; //Record before the batch (valid if hadBefore)
+    Student after;  //Record after the batch (valid if hasAfter)
+} BatchChange;
+
 //Undo Object
 typedef struct {
     OpType op;      //Type of last operation
     Student before; //Student record before change
     Student after;  //Student record after change
+    BatchChange *batch; //OP_BATCH: changes in the order they were applied
+    size_t batchCount;
+    const char *batchLabel; //OP_BATCH: what made the batch ("COMMIT", "MERGE")
 } UndoRecord;
 UndoRecord last_op = {OP_NONE}; //Initialise last_op
 
+// -----------------------------------------------------------------------------
+// FUNCTION: undo_set
+// PURPOSE : Starts a new undo record of the given type, releasing the change
+//           list of a previous OP_BATCH.
+// -----------------------------------------------------------------------------
+static void undo_set(OpType op)
+{
+    free(last_op.batch);
+    last_op.batch = NULL;
+    last_op.batchCount = 0;
+    last_op.op = op;
+}
+
 
 /* ---------------------------------------------------- */
-/* Utility Functions                                    */
+/* Collation Keys                                       */
 /* ---------------------------------------------------- */
 
 // -----------------------------------------------------------------------------
-// FUNCTION: query_exists
-// PURPOSE : Checks if a given student ID is already present in the array.
-// RETURNS : 1 -> ID found
-//           0 -> ID not found
+// FUNCTION: collate_start / collate_next
+// PURPOSE : Walk a text in collation order: lower-cased, leading and trailing
+//           whitespace dropped, every inner run of whitespace read as one ' '.
+//           The one text-folding rule: normalize_text is built on it.
+// RETURNS : collate_next -> next normalised byte, 0 at the end of the text
 // -----------------------------------------------------------------------------
-int query_exists(int id) {
-    for (size_t i = 0; i < arr_size; i++){
-        if (arr[i].id == id) {
-            return 1; //ID matched
-        }
+static inline const char *collate_start(const char *text)
+{
+    while (isspace((unsigned char)*text)) text++;
+    return text;
+}
+
+static inline int collate_next(const char **text)
+{
+    const char *p = *text;
+    if (isspace((unsigned char)*p)) {
+        while (isspace((unsigned char)*p)) p++;
+        *text = p;
+        return *p ? ' ' : 0; //trailing whitespace is not part of the text
     }
-    return 0; //ID not found
+    if (*p == '\0') return 0;
+    *text = p + 1;
+    return tolower((unsigned char)*p);
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: audit_log
-// PURPOSE : Writes an entry to the audit log file with:
-//           - timestamp
-//           - username
-//           - current record count
-//           - custom log message
-// ACCEPTS : printf-style format string + variable arguments (...)
+// FUNCTION: collate_compare
+// PURPOSE : Full-string collation compare, used when two keys are equal and
+//           at least one text is longer than the key.
+// RETURNS : <0, 0, >0 like strcmp
 // -----------------------------------------------------------------------------
-void audit_log(const char *formatString, ...) {
-    FILE *logFilePointer = fopen(LOGFILE, "a"); //append mode
+static int collate_compare(const char *a, const char *b)
+{
+    a = collate_start(a);
+    b = collate_start(b);
+    while (1) {
+        int x = collate_next(&a);
+        int y = collate_next(&b);
+        if (x != y || x == 0) return x - y;
+    }
+}
 
-    if (!logFilePointer) { //NULL file
-        printf(RED "CMS Error: Failed to open or write to audit log file \"%s\"." RESET "\n", LOGFILE);
-        return;
+// -----------------------------------------------------------------------------
+// FUNCTION: collation_key_build
+// PURPOSE : Builds the collation key of a text (see CollationKey).
+// -----------------------------------------------------------------------------
+static void collation_key_build(CollationKey *key, const char *text)
+{
+    uint64_t bytes[2] = {0, 0};
+    size_t length = 0;
+    int c;
+
+    text = collate_start(text);
+    while ((c = collate_next(&text)) != 0) {
+        if (length == COLLATE_KEY_BYTES) {
+            bytes[1] |= COLLATE_KEY_LONGER;
+            break;
+        }
+        bytes[length / 8] |= (uint64_t)(unsigned char)c << (56 - 8 * (length % 8));
+        length++;
     }
+    key->head = bytes[0];
+    key->tail = bytes[1];
+}
 
-    //Generate Current Timestamp
-    time_t currentRawTime = time(NULL); //Current time (unix epoch)
-    struct tm *tm = localtime(&currentRawTime); //Convert to local timezone
-    char timeStamp[32];
-    strftime(timeStamp, sizeof(timeStamp), "%Y-%m-%d %H:%M:%S", tm); //Readable format
+// -----------------------------------------------------------------------------
+// COMPARATOR: collation_key_compare
+// PURPOSE   : Orders two texts by their keys, reading the texts themselves
+//             only when the keys tie and one of them was cut short.
+// -----------------------------------------------------------------------------
+static inline int collation_key_compare(const CollationKey *a, const CollationKey *b,
+                                        const char *textA, const char *textB)
+{
+    if (a->head != b->head) return a->head < b->head ? -1 : 1;
+    uint64_t tailA = a->tail & ~(uint64_t)0xFF;
+    uint64_t tailB = b->tail & ~(uint64_t)0xFF;
+    if (tailA != tailB) return tailA < tailB ? -1 : 1;
+    if (!((a->tail | b->tail) & COLLATE_KEY_LONGER)) return 0; //both texts fit: equal
+    if (strcmp(textA, textB) == 0) return 0; //same spelling (the usual tie, e.g. programmes)
+    return collate_compare(textA, textB);
+}
 
-    //Log prefix
-    //Example:
-    //[2025-02-01 10:12:34] [P9_3-Admin] (Records: 12)
-    fprintf(logFilePointer, "[%s] [%s] (Records: %zu) ", timeStamp, CURRENT_USER, arr_size);
 
-    //Handle variable arguments
-    va_list argList;
-    va_start(argList, formatString);
-    vfprintf(logFilePointer, formatString, argList);  //Append formatted message into audit log
-    fprintf(logFilePointer, "\n");
-    va_end(argList);
+/* ---------------------------------------------------- */
+/* Chunked Student Storage                              */
+/* ---------------------------------------------------- */
 
-    fclose(logFilePointer); //Close file
+// -----------------------------------------------------------------------------
+// FUNCTION: chunk_acquire
+// PURPOSE : Takes a chunk from the pool, or allocates a fresh one.
+// RETURNS : chunk pointer, or NULL when out of memory
+// -----------------------------------------------------------------------------
+static StudentChunk *chunk_acquire(void)
+{
+    thread_mutex_lock(&chunk_pool_lock);
+    StudentChunk *chunk = chunk_pool;
+    if (chunk) {
+        chunk_pool = chunk->nextFree;
+        chunk_pool_count--;
+    }
+    thread_mutex_unlock(&chunk_pool_lock);
+    return chunk ? chunk : malloc(sizeof(StudentChunk));
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: ensure_cap
-// PURPOSE : Ensures student array has enough memory capacity to store new records
+// FUNCTION: chunk_release
+// PURPOSE : Returns a chunk to the pool (up to CHUNK_POOL_MAX), else frees it.
 // -----------------------------------------------------------------------------
-void ensure_cap() {
-    //Allocate initial buffer
-    if (arr_cap == 0) {
-        arr_cap = INIT_CAP;
-        arr = malloc(arr_cap * sizeof(Student));
-    }
-    // If student array is full (size >= capacity), expand capacity
-    else if (arr_size >= arr_cap) {
-        arr_cap *= 2; //Double capacity
-        arr = realloc(arr, arr_cap * sizeof(Student)); //Reallocate memory
+static void chunk_release(StudentChunk *chunk)
+{
+    thread_mutex_lock(&chunk_pool_lock);
+    if (chunk_pool_count < CHUNK_POOL_MAX) {
+        chunk->nextFree = chunk_pool;
+        chunk_pool = chunk;
+        chunk_pool_count++;
+        chunk = NULL;
     }
+    thread_mutex_unlock(&chunk_pool_lock);
+    free(chunk);
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: discard_rest_of_line
-// PURPOSE : Discards any remaining characters in the input buffer
-//          until a newline or EOF is encountered.
-// BEHAVIOR: Used to handle overly long user input.
+// FUNCTION: chunk_pool_trim
+// PURPOSE : Gives every pooled chunk back to the operating system.
 // -----------------------------------------------------------------------------
-
-static void discard_rest_of_line(void)
+static void chunk_pool_trim(void)
 {
-    int ch;
-    while ((ch = getchar()) != '\n' && ch != EOF) {
-        // just throw characters away
+    thread_mutex_lock(&chunk_pool_lock);
+    while (chunk_pool) {
+        StudentChunk *next = chunk_pool->nextFree;
+        free(chunk_pool);
+        chunk_pool = next;
     }
+    chunk_pool_count = 0;
+    thread_mutex_unlock(&chunk_pool_lock);
 }
 
-
 // -----------------------------------------------------------------------------
-// FUNCTION: find_index_by_id
-// PURPOSE : Searches the array for a matching student ID.
-// RETURNS : index (0..arr_size-1) -> if found
-//           -1 -> if not found
+// FUNCTION: store_slot / store_row / store_keys / store_pos_of / row_at
+// PURPOSE : Record access. A handle never changes while the record lives
+//           (until COMPACT); the row position changes with sorts and deletes.
 // -----------------------------------------------------------------------------
-int find_index_by_id(int id) {
-    for (size_t i = 0; i < arr_size; i++) {
-        if (arr[i].id == id) //compare student ID
-            return (int)i;   //return matching index
-    }
+static inline Student *store_slot(const StudentStore *store, RecHandle handle)
+{
+    return &store->chunks[handle / CHUNK_ROWS]->rows[handle % CHUNK_ROWS];
+}
 
-    return -1; //if no match found
+static inline Student *store_row(const StudentStore *store, size_t pos)
+{
+    return store_slot(store, store->order[pos]);
+}
+
+static inline RecordKeys *store_keys(const StudentStore *store, RecHandle handle)
+{
+    return &store->chunks[handle / CHUNK_ROWS]->keys[handle % CHUNK_ROWS];
+}
+
+static inline size_t store_pos_of(const StudentStore *store, RecHandle handle)
+{
+    return store->chunks[handle / CHUNK_ROWS]->rowPos[handle % CHUNK_ROWS];
 }
 
+static inline Student *row_at(size_t pos)
+{
+    return store_row(&db, pos);
+}
 
 // -----------------------------------------------------------------------------
-// FUNCTION: print_student_record
-// PURPOSE : Displays a single student's details in a formatted table row.
-//           Different colour output based on student's mark:
-//           - RED(50) < YELLOW < GREEN(80)
-//           - Excellent Grade: 80 and above
-//           - Average Grade: between 50 and 80
-//           - Failing Grade: below 50
-// ACCEPTS : Student Object
+// FUNCTION: store_set_pos
+// PURPOSE : Records which row position a slot currently occupies.
 // -----------------------------------------------------------------------------
-void print_student_record(const Student *currentStudent) {
-    const char *colour = RESET; //Default Colour: White
+static inline void store_set_pos(StudentStore *store, RecHandle handle, size_t pos)
+{
+    store->chunks[handle / CHUNK_ROWS]->rowPos[handle % CHUNK_ROWS] = (uint32_t)pos;
+}
 
-    if (currentStudent->mark >= 80) { //excellent
-        colour = GREEN;
+// -----------------------------------------------------------------------------
+// FUNCTION: store_write
+// PURPOSE : Stores a record in a slot and rebuilds its collation keys. Every
+//           write to a live record goes through here so the keys never go stale.
+// -----------------------------------------------------------------------------
+static void store_write(StudentStore *store, RecHandle handle, const Student *studentObject)
+{
+    RecordKeys *keys = store_keys(store, handle);
+    *store_slot(store, handle) = *studentObject;
+    collation_key_build(&keys->name, studentObject->name);
+    collation_key_build(&keys->programme, studentObject->programme);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: store_append
+// PURPOSE : Copies a record into a free slot and adds it at the end of the
+//           row order. Growing never moves existing records: a full store
+//           just gets one more chunk.
+// RETURNS : handle of the new record, NO_HANDLE when out of memory
+// -----------------------------------------------------------------------------
+static RecHandle store_append(StudentStore *store, const Student *studentObject)
+{
+    //Make sure the row order has room (4 bytes per row, cheap to double)
+    if (store->size == store->orderCap) {
+        TRACE_BEGIN(span, "store_grow");
+        size_t newCap = store->orderCap ? store->orderCap * 2 : INIT_CAP;
+        RecHandle *order = realloc(store->order, newCap * sizeof(RecHandle));
+        TRACE_END(span);
+        if (order == NULL) return NO_HANDLE;
+        store->order = order;
+        store->orderCap = newCap;
     }
-    else if (currentStudent->mark < 50) { //failing
-        colour = RED;
+
+    RecHandle handle;
+    if (store->freeHead != NO_HANDLE) {
+        //Reuse a slot freed by DELETE
+        handle = store->freeHead;
+        store->freeHead = store->chunks[handle / CHUNK_ROWS]->rowPos[handle % CHUNK_ROWS] & ~SLOT_FREE;
+        store->freeCount--;
     }
-    else { //average
-        colour = YELLOW;
+    else {
+        if (store->slotsUsed == store->chunkCount * CHUNK_ROWS) {
+            if (store->slotsUsed + CHUNK_ROWS > NO_HANDLE) return NO_HANDLE; //handle space exhausted
+
+            //Grow the chunk directory (pointers only) when it is full
+            if (store->chunkCount == store->chunkCap) {
+                size_t newCap = store->chunkCap ? store->chunkCap * 2 : 16;
+                StudentChunk **chunks = realloc(store->chunks, newCap * sizeof(StudentChunk *));
+                if (chunks == NULL) return NO_HANDLE;
+                store->chunks = chunks;
+                store->chunkCap = newCap;
+            }
+
+            TRACE_BEGIN(span, "chunk_acquire");
+            StudentChunk *chunk = chunk_acquire();
+            TRACE_END(span);
+            if (chunk == NULL) return NO_HANDLE;
+            store->chunks[store->chunkCount++] = chunk;
+        }
+        handle = (RecHandle)store->slotsUsed++;
     }
 
-    //Print data in aligned columns
-    printf("%-10d %-20s %-30s %s%-6.1f%s\n",
-           currentStudent->id,
-           currentStudent->name,
-           currentStudent->programme,
-           colour, currentStudent->mark, RESET);
+    store_write(store, handle, studentObject);
+    store->order[store->size] = handle;
+    store_set_pos(store, handle, store->size);
+    store->size++;
+    return handle;
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: parse_line
-// PURPOSE : Reads a line from the database file (.txt) and extracts:
-//           - Student ID (tokens[0])
-//           - First name + Last name (tokens[1] + tokens[2])
-//           - Programme (tokens[3] + ... + tokens[n-2])
-//           - Mark (tokens[n-1])
-// RETURNS : 1 -> successful parse into studentObject
-//           0 -> line does not contain enough data
+// FUNCTION: store_remove_at
+// PURPOSE : Removes the row at 'pos'. The last row takes its place in the
+//           order (same swap-delete as before, but only a 4-byte handle moves)
+//           and the slot goes on the free list for the next insert.
 // -----------------------------------------------------------------------------
-int parse_line(const char *line, Student *studentObject) {
-    char tempBuf[512]; //temporary buffer to store line for edit
-    strncpy(tempBuf, line, sizeof(tempBuf) - 1);
-    tempBuf[sizeof(tempBuf) - 1] = '\0'; //Null terminate Buffer
-    tempBuf[strcspn(tempBuf, "\n")] = '\0'; //replace newline
+static void store_remove_at(StudentStore *store, size_t pos)
+{
+    RecHandle handle = store->order[pos];
+    RecHandle last = store->order[store->size - 1];
 
-    //Split buffer into tokens by space and tabs
-    char *tokens[64]; //64 character pointers
-    int tokenCount = 0;
+    store->order[pos] = last;
+    store_set_pos(store, last, pos);
+    store->size--;
 
-    char *currentToken = strtok(tempBuf, " \t"); //First token
-    while (currentToken != NULL && tokenCount < 64) { //store tokens until NULL or count reaches 64
-        tokens[tokenCount] = currentToken;
-        tokenCount++;
-        currentToken = strtok(NULL, " \t"); //Continue searching for next token
+    store->chunks[handle / CHUNK_ROWS]->rowPos[handle % CHUNK_ROWS] = SLOT_FREE | store->freeHead;
+    store->freeHead = handle;
+    store->freeCount++;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: store_clear
+// PURPOSE : Empties the store; chunks go back to the pool for the next OPEN.
+// -----------------------------------------------------------------------------
+static void store_clear(StudentStore *store)
+{
+    for (size_t i = 0; i < store->chunkCount; i++) {
+        chunk_release(store->chunks[i]);
     }
+    free(store->chunks);
+    free(store->order);
 
-    if (tokenCount < 4) return 0; //must have 5 properties in Student Object, if not -> exit
+    memset(store, 0, sizeof(*store));
+    store->freeHead = NO_HANDLE;
+}
 
-    //Store ID into studentObject
-    char *endPtr;
-    long parsedId = strtol(tokens[0], &endPtr, 10);
-    if (endPtr == tokens[0] || *endPtr != '\0' || parsedId < 0 || parsedId > INT_MAX) {
-        return 0; //Invalid ID: checks nochange, non-numeric, negative, overflow
-    }
-    studentObject->id = (int)parsedId;
+// -----------------------------------------------------------------------------
+// FUNCTION: store_compact
+// PURPOSE : Moves live records out of the highest slots into free slots below
+//           'size', then frees every chunk that is left empty.
+// NOTES   : Moved records get new handles, so the caller must rebuild any
+//           handle-based index afterwards (see table_compact).
+// RETURNS : number of records moved
+// -----------------------------------------------------------------------------
+static size_t store_compact(StudentStore *store)
+{
+    size_t moved = 0;
+    size_t low = 0;
+    size_t high = store->slotsUsed;
 
-    //Store marks into studentObject
-    char *endPtr2;
-    float parsedMark = strtof(tokens[tokenCount - 1], &endPtr2);
-    if (endPtr2 == tokens[tokenCount - 1] || *endPtr2 != '\0' || parsedMark < 0.0f || parsedMark > 100.0f) {
-        return 0; //Invalid marks: checks nochange, non-numeric, out of range
+    while (1) {
+        //Next free slot in the part we keep
+        while (low < store->size && !(store->chunks[low / CHUNK_ROWS]->rowPos[low % CHUNK_ROWS] & SLOT_FREE))
+            low++;
+        //Next live slot in the part we give back
+        while (high > store->size && (store->chunks[(high - 1) / CHUNK_ROWS]->rowPos[(high - 1) % CHUNK_ROWS] & SLOT_FREE))
+            high--;
+        if (low >= store->size || high <= store->size)
+            break;
+
+        RecHandle from = (RecHandle)(high - 1);
+        RecHandle to = (RecHandle)low;
+        size_t pos = store_pos_of(store, from);
+
+        *store_slot(store, to) = *store_slot(store, from);
+        *store_keys(store, to) = *store_keys(store, from);
+        store->order[pos] = to;
+        store_set_pos(store, to, pos);
+        store->chunks[from / CHUNK_ROWS]->rowPos[from % CHUNK_ROWS] = SLOT_FREE;
+        moved++;
+        low++;
+        high--;
     }
-    studentObject->mark = parsedMark;
 
-    //Store name into studentObject
-    char nameBuffer[128] = "";
-    snprintf(nameBuffer, sizeof(nameBuffer), "%s %s", tokens[1], tokens[2]); //combine first and last name
-    strncpy(studentObject->name, nameBuffer, MAX_STR - 1);
-    studentObject->name[MAX_STR - 1] = '\0'; //Null terminate name
+    //Every live record now sits below 'size': no free slots remain
+    store->slotsUsed = store->size;
+    store->freeHead = NO_HANDLE;
+    store->freeCount = 0;
 
-    //Store programme into studentObject
-    char programmeBuffer[256] = "";
-    for (int i = 3; i < tokenCount - 1; i++) {
-        strcat(programmeBuffer, tokens[i]); //append token to buffer
-        if (i < tokenCount - 2) //append space, but not for last word
-            strcat(programmeBuffer, " "); 
+    size_t keepChunks = (store->size + CHUNK_ROWS - 1) / CHUNK_ROWS;
+    while (store->chunkCount > keepChunks) {
+        free(store->chunks[--store->chunkCount]);
     }
-    strncpy(studentObject->programme, programmeBuffer, MAX_STR - 1);
-    studentObject->programme[MAX_STR - 1] = '\0';
 
-    return 1;
+    //Shrink the row order too if it is mostly empty
+    if (store->orderCap > INIT_CAP && store->orderCap > store->size * 4) {
+        size_t newCap = store->size * 2 > INIT_CAP ? store->size * 2 : INIT_CAP;
+        RecHandle *order = realloc(store->order, newCap * sizeof(RecHandle));
+        if (order) {
+            store->order = order;
+            store->orderCap = newCap;
+        }
+    }
+    return moved;
 }
 
 
-/* --------------------------------------------------- */
-/*  Helper functions for update & delete operations    */
-/* --------------------------------------------------- */
+/* ---------------------------------------------------- */
+/* ID Hash Index                                        */
+/* ---------------------------------------------------- */
 
-// -----------------------------------------------------------------------------
-// FUNCTION: trim_newline
-// PURPOSE : Removes trailing '\n' or '\r' for string pointer
-// -----------------------------------------------------------------------------
-static void trim_newline(char *string) {
+//ID Index Slot (open addressing, linear probing)
+typedef struct {
+    int id;           //Student ID (ID_SLOT_EMPTY = unused slot)
+    RecHandle handle; //Stable handle of the record in the store
+} IdSlot;
 
-    if (string == NULL) return; 
+#define ID_SLOT_EMPTY (-1) //IDs are never negative (see parse_line)
+#define ID_BATCH_WIDTH 16  //lookups in flight at once (find_index_by_id_batch)
 
-    size_t stringLength = strlen(string);
+//Cache prefetch hint; a no-op on compilers without the builtin
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void)(address))
+#endif
 
-    while (stringLength != 0 && (string[stringLength-1] == '\n' || string[stringLength-1] == '\r'))
-    {
-        stringLength--;
-        string[stringLength] = '\0';
-    }
-}
+static IdSlot *id_slots = NULL;   //Hash table storage
+static size_t id_slot_cap = 0;    //Number of slots (always a power of two)
+static size_t id_slot_used = 0;   //Number of occupied slots
+static int id_index_valid = 0;    //0 -> fall back to linear scans (e.g. out of memory)
 
 // -----------------------------------------------------------------------------
-// FUNCTION: print_diff_row
-// PURPOSE : Shows a side-by-side comparison of BEFORE vs AFTER values 
-//           for a single field, highlighting changed fields in GREEN.
+// FUNCTION: id_hash
+// PURPOSE : Scrambles an ID so consecutive IDs spread across the table.
 // -----------------------------------------------------------------------------
-static void print_diff_row(const char *label, const char *before, const char *after)
+static size_t id_hash(int id)
 {
-    int isChanged = strcmp(before, after) != 0;
+    uint32_t x = (uint32_t)id;
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
 
-    //Print:
+// -----------------------------------------------------------------------------
+// FUNCTION: id_index_reset
+// PURPOSE : Allocates an empty table with room for at least 'expected' IDs.
+// RETURNS : 1 -> success
+//           0 -> out of memory (index disabled, lookups fall back to scans)
+// -----------------------------------------------------------------------------
+static int id_index_reset(size_t expected)
+{
+    size_t cap = 64;
+    while (cap * 3 < expected * 4 + 4) { //keep load factor under 75%
+        cap *= 2;
+    }
+
+    IdSlot *slots = malloc(cap * sizeof(IdSlot));
+    if (slots == NULL) {
+        free(id_slots);
+        id_slots = NULL;
+        id_slot_cap = id_slot_used = 0;
+        id_index_valid = 0;
+        return 0;
+    }
+    for (size_t i = 0; i < cap; i++) {
+        slots[i].id = ID_SLOT_EMPTY;
+    }
+
+    free(id_slots);
+    id_slots = slots;
+    id_slot_cap = cap;
+    id_slot_used = 0;
+    id_index_valid = 1;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: id_index_find_slot
+// PURPOSE : Locates the slot holding 'id', or the empty slot where it would go.
+// -----------------------------------------------------------------------------
+static size_t id_index_find_slot(int id)
+{
+    size_t mask = id_slot_cap - 1;
+    size_t i = id_hash(id) & mask;
+
+    while (id_slots[i].id != ID_SLOT_EMPTY && id_slots[i].id != id) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: id_index_put
+// PURPOSE : Records the store handle of a student ID.
+//           Grows the table when it gets 75% full.
+// -----------------------------------------------------------------------------
+static void id_index_put(int id, RecHandle handle)
+{
+    if (!id_index_valid) return;
+
+    if ((id_slot_used + 1) * 4 > id_slot_cap * 3) {
+        IdSlot *old = id_slots;
+        size_t oldCap = id_slot_cap;
+
+        id_slots = NULL; //keep old table alive until rehashed
+        if (!id_index_reset(oldCap * 2)) {
+            free(old);
+            printf(YELLOW "CMS Warning: Out of memory, ID index disabled.\n" RESET);
+            return;
+        }
+        for (size_t i = 0; i < oldCap; i++) {
+            if (old[i].id != ID_SLOT_EMPTY) {
+                size_t slot = id_index_find_slot(old[i].id);
+                id_slots[slot] = old[i];
+                id_slot_used++;
+            }
+        }
+        free(old);
+    }
+
+    size_t slot = id_index_find_slot(id);
+    if (id_slots[slot].id == ID_SLOT_EMPTY) {
+        id_slot_used++;
+    }
+    id_slots[slot].id = id;
+    id_slots[slot].handle = handle;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: id_index_remove
+// PURPOSE : Removes an ID from the table. Uses backward-shift deletion so
+//           linear probing never needs tombstones.
+// -----------------------------------------------------------------------------
+static void id_index_remove(int id)
+{
+    if (!id_index_valid) return;
+
+    size_t mask = id_slot_cap - 1;
+    size_t hole = id_index_find_slot(id);
+    if (id_slots[hole].id == ID_SLOT_EMPTY) return; //not present
+
+    size_t next = (hole + 1) & mask;
+    while (id_slots[next].id != ID_SLOT_EMPTY) {
+        size_t home = id_hash(id_slots[next].id) & mask;
+
+        //Move the entry back if its home slot is not between hole and next (cyclically)
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            id_slots[hole] = id_slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    id_slots[hole].id = ID_SLOT_EMPTY;
+    id_slot_used--;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: id_index_rebuild
+// PURPOSE : Re-creates the ID index from scratch (after OPEN or COMPACT).
+// -----------------------------------------------------------------------------
+static void id_index_rebuild(void)
+{
+    if (!id_index_reset(db.size)) {
+        printf(YELLOW "CMS Warning: Out of memory, ID index disabled.\n" RESET);
+        return;
+    }
+    for (size_t i = 0; i < db.size; i++) {
+        id_index_put(row_at(i)->id, db.order[i]);
+    }
+}
+
+
+/* ---------------------------------------------------- */
+/* Utility Functions                                    */
+/* ---------------------------------------------------- */
+
+int find_index_by_id(int id);
+static int record_visible(int id, Student *out);
+
+// -----------------------------------------------------------------------------
+// FUNCTION: query_exists
+// PURPOSE : Checks if a given student ID is already present in the array.
+// RETURNS : 1 -> ID found
+//           0 -> ID not found
+// -----------------------------------------------------------------------------
+int query_exists(int id) {
+    return record_visible(id, NULL); //sees uncommitted changes inside a transaction
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: audit_log
+// PURPOSE : Writes an entry to the audit log file with:
+//           - timestamp
+//           - username
+//           - current record count
+//           - custom log message
+// ACCEPTS : printf-style format string + variable arguments (...)
+// -----------------------------------------------------------------------------
+static int log_append(const char *entries, size_t length, int durable, time_t timestamp);
+
+void audit_log(const char *formatString, ...) {
+    TRACE_BEGIN(span, "audit_log");
+
+    //Generate Current Timestamp
+    time_t currentRawTime = time(NULL); //Current time (unix epoch)
+    struct tm *tm = localtime(&currentRawTime); //Convert to local timezone
+    char timeStamp[32];
+    strftime(timeStamp, sizeof(timeStamp), "%Y-%m-%d %H:%M:%S", tm); //Readable format
+
+    //Log prefix
+    //Example:
+    //[2025-02-01 10:12:34] [P9_3-Admin] (Records: 12)
+    char entry[1024];
+    int prefixLength = snprintf(entry, sizeof(entry), "[%s] [%s] (Records: %zu) ", timeStamp, CURRENT_USER, db.size);
+
+    //Handle variable arguments
+    va_list argList;
+    va_start(argList, formatString);
+    int messageLength = vsnprintf(entry + prefixLength, sizeof(entry) - (size_t)prefixLength - 1, formatString, argList);
+    va_end(argList);
+
+    size_t entryLength = (size_t)prefixLength + (size_t)(messageLength < 0 ? 0 : messageLength);
+    if (entryLength > sizeof(entry) - 2) entryLength = sizeof(entry) - 2; //message truncated
+    entry[entryLength++] = '\n';
+
+    //Append to the current log segment and index it
+    log_append(entry, entryLength, 0, currentRawTime);
+    TRACE_END(span);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: audit_log_batch
+// PURPOSE : Writes a header entry followed by one entry per line of 'lines'
+//           ('\n' separated) with a single write, then flushes it to disk.
+//           Used by COMMIT so a transaction costs one durable log write
+//           instead of one per change.
+// RETURNS : 1 -> written, 0 -> log could not be written
+// -----------------------------------------------------------------------------
+int audit_log_batch(const char *lines, size_t length, const char *formatString, ...) {
+    //Same prefix as audit_log(), shared by every entry of the batch
+    time_t currentRawTime = time(NULL);
+    struct tm *tm = localtime(&currentRawTime);
+    char timeStamp[32];
+    strftime(timeStamp, sizeof(timeStamp), "%Y-%m-%d %H:%M:%S", tm);
+
+    char prefix[96];
+    int prefixLength = snprintf(prefix, sizeof(prefix), "[%s] [%s] (Records: %zu) ", timeStamp, CURRENT_USER, db.size);
+
+    char header[256];
+    va_list argList;
+    va_start(argList, formatString);
+    int headerLength = vsnprintf(header, sizeof(header), formatString, argList);
+    va_end(argList);
+    if (headerLength >= (int)sizeof(header)) headerLength = (int)sizeof(header) - 1;
+
+    //Upper bound: every line gets a prefix and a newline
+    size_t lineCount = 1;
+    for (size_t i = 0; i < length; i++) {
+        if (lines[i] == '\n') lineCount++;
+    }
+    char *block = malloc((size_t)prefixLength * (lineCount + 1) + (size_t)headerLength + length + lineCount + 2);
+    if (block == NULL) {
+        printf(RED "CMS Error: Out of memory writing audit log.\n" RESET);
+        return 0;
+    }
+
+    size_t used = 0;
+    memcpy(block + used, prefix, (size_t)prefixLength); used += (size_t)prefixLength;
+    memcpy(block + used, header, (size_t)headerLength); used += (size_t)headerLength;
+    block[used++] = '\n';
+
+    const char *line = lines;
+    const char *end = lines + length;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        size_t lineLength = newline ? (size_t)(newline - line) : (size_t)(end - line);
+        memcpy(block + used, prefix, (size_t)prefixLength); used += (size_t)prefixLength;
+        memcpy(block + used, line, lineLength); used += lineLength;
+        block[used++] = '\n';
+        line += lineLength + 1;
+    }
+
+    TRACE_BEGIN(span, "audit_log_batch");
+    int ok = log_append(block, used, 1, currentRawTime); //one write + flush to disk
+    TRACE_END(span);
+    free(block);
+    return ok;
+}
+
+//Scripted answers for the interactive prompts (REPLAY); answers == NULL -> read stdin
+static struct {
+    const char *const *answers;
+    size_t count, next;
+} scripted_input;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: read_input_line
+// PURPOSE : fgets() for the interactive prompts. While REPLAY feeds a
+//           command, returns its next scripted answer instead of reading
+//           stdin; running out of answers behaves like EOF.
+// RETURNS : buffer, or NULL on EOF
+// -----------------------------------------------------------------------------
+static char *read_input_line(char *buffer, size_t size)
+{
+    if (scripted_input.answers == NULL) {
+        return fgets(buffer, (int)size, stdin);
+    }
+    if (scripted_input.next >= scripted_input.count || size < 2) {
+        return NULL;
+    }
+    snprintf(buffer, size, "%s\n", scripted_input.answers[scripted_input.next++]);
+    return buffer;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: discard_rest_of_line
+// PURPOSE : Discards any remaining characters in the input buffer
+//          until a newline or EOF is encountered.
+// BEHAVIOR: Used to handle overly long user input.
+// -----------------------------------------------------------------------------
+
+static void discard_rest_of_line(void)
+{
+    if (scripted_input.answers != NULL) return; //scripted answers are whole lines
+
+    int ch;
+    while ((ch = getchar()) != '\n' && ch != EOF) {
+        // just throw characters away
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// FUNCTION: find_index_by_id
+// PURPOSE : Searches the array for a matching student ID.
+//           Uses the ID hash index (O(1)); scans only if the index is disabled.
+// RETURNS : row position (0..size-1) -> if found
+//           -1 -> if not found
+// -----------------------------------------------------------------------------
+int find_index_by_id(int id) {
+    if (id_index_valid) {
+        size_t slot = id_index_find_slot(id);
+        return id_slots[slot].id == ID_SLOT_EMPTY ? -1 : (int)store_pos_of(&db, id_slots[slot].handle);
+    }
+
+    for (size_t i = 0; i < db.size; i++) {
+        if (row_at(i)->id == id) //compare student ID
+            return (int)i;   //return matching index
+    }
+
+    return -1; //if no match found
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: find_index_by_id_batch
+// PURPOSE : find_index_by_id() for many IDs (QUERY id,id,... / FROM <file>).
+//           Looks up ID_BATCH_WIDTH IDs at a time in three passes: prefetch
+//           every home slot, probe every slot and prefetch the record it
+//           points to, then read the row positions. The cache misses of a
+//           group overlap instead of each lookup waiting on the one before.
+// RETURNS : positions[i] = row position of ids[i], or -1
+// -----------------------------------------------------------------------------
+static void find_index_by_id_batch(const int *ids, size_t count, long *positions)
+{
+    if (!id_index_valid) {
+        for (size_t i = 0; i < count; i++) positions[i] = find_index_by_id(ids[i]);
+        return;
+    }
+
+    size_t mask = id_slot_cap - 1;
+    size_t slots[ID_BATCH_WIDTH];
+
+    for (size_t start = 0; start < count; start += ID_BATCH_WIDTH) {
+        size_t width = count - start < ID_BATCH_WIDTH ? count - start : ID_BATCH_WIDTH;
+
+        for (size_t j = 0; j < width; j++) {
+            slots[j] = id_hash(ids[start + j]) & mask;
+            PREFETCH(&id_slots[slots[j]]);
+        }
+        for (size_t j = 0; j < width; j++) {
+            size_t slot = slots[j];
+            while (id_slots[slot].id != ID_SLOT_EMPTY && id_slots[slot].id != ids[start + j]) {
+                slot = (slot + 1) & mask;
+            }
+            slots[j] = slot;
+            if (id_slots[slot].id != ID_SLOT_EMPTY) {
+                RecHandle handle = id_slots[slot].handle;
+                PREFETCH(&db.chunks[handle / CHUNK_ROWS]->rowPos[handle % CHUNK_ROWS]);
+                PREFETCH(store_slot(&db, handle));
+            }
+        }
+        for (size_t j = 0; j < width; j++) {
+            positions[start + j] = id_slots[slots[j]].id == ID_SLOT_EMPTY
+                                 ? -1 : (long)store_pos_of(&db, id_slots[slots[j]].handle);
+        }
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// FUNCTION: print_student_record
+// PURPOSE : Displays a single student's details in a formatted table row.
+//           Different colour output based on student's mark:
+//           - RED(50) < YELLOW < GREEN(80)
+//           - Excellent Grade: 80 and above
+//           - Average Grade: between 50 and 80
+//           - Failing Grade: below 50
+// ACCEPTS : Student Object
+// -----------------------------------------------------------------------------
+void print_student_record(const Student *currentStudent) {
+    const char *colour = RESET; //Default Colour: White
+
+    if (currentStudent->mark >= 80) { //excellent
+        colour = GREEN;
+    }
+    else if (currentStudent->mark < 50) { //failing
+        colour = RED;
+    }
+    else { //average
+        colour = YELLOW;
+    }
+
+    //Print data in aligned columns
+    printf("%-10d %-20s %-30s %s%-6.1f%s\n",
+           currentStudent->id,
+           currentStudent->name,
+           currentStudent->programme,
+           colour, currentStudent->mark, RESET);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: student_equal
+// PURPOSE : Field-by-field record compare (memcmp would also compare the
+//           unused bytes after each string).
+// RETURNS : 1 -> same ID, name, programme and mark
+// -----------------------------------------------------------------------------
+static int student_equal(const Student *a, const Student *b)
+{
+    return a->id == b->id && a->mark == b->mark &&
+           strcmp(a->name, b->name) == 0 && strcmp(a->programme, b->programme) == 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: parse_mark_span
+// PURPOSE : Hand-rolled fixed-point parser for marks: [+]digits[.digits].
+//           Whole and fractional parts are accumulated as integers (up to
+//           6 decimal places) and combined once, so no strtof call is needed.
+// RETURNS : 1 -> valid mark between 0 and 100, 0 -> invalid
+// -----------------------------------------------------------------------------
+static int parse_mark_span(const char *text, size_t length, float *outMark)
+{
+    size_t i = 0;
+    uint32_t whole = 0, fraction = 0, scale = 1;
+    size_t digitCount = 0;
+
+    if (i < length && text[i] == '+') i++;
+
+    while (i < length && text[i] >= '0' && text[i] <= '9') {
+        whole = whole * 10 + (uint32_t)(text[i++] - '0');
+        if (whole > 100) return 0; //out of range, no need to read further
+        digitCount++;
+    }
+    if (i < length && text[i] == '.') {
+        i++;
+        while (i < length && text[i] >= '0' && text[i] <= '9') {
+            if (scale < 1000000) { //further digits are below float precision
+                fraction = fraction * 10 + (uint32_t)(text[i] - '0');
+                scale *= 10;
+            }
+            i++;
+            digitCount++;
+        }
+    }
+    if (i != length || digitCount == 0) return 0; //non-numeric characters
+
+    float mark = (float)((double)whole + (double)fraction / (double)scale);
+    if (mark > 100.0f) return 0;
+
+    *outMark = mark;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: parse_line
+// PURPOSE : Parses one database line, given as a span (no '\0' needed), into:
+//           - Student ID (token 0)
+//           - First name + Last name (tokens 1 + 2)
+//           - Programme (token 3 ... token n-2, joined by single spaces)
+//           - Mark (token n-1)
+// DETAILS : Single forward pass over the span. Tokens are copied straight
+//           into the Student fields; a token after the name is held back one
+//           step because it could be the mark, and only added to the programme
+//           once another token follows it. No temporary line copy, no line
+//           length limit. Stops at '\n'; spaces, tabs and '\r' separate tokens.
+//           Works on fgets buffers, LineReader blocks and whole files in memory.
+// RETURNS : 1 -> successful parse into studentObject
+//           0 -> line does not contain enough data
+// -----------------------------------------------------------------------------
+int parse_line(const char *line, size_t length, Student *studentObject) {
+    const char *p = line;
+    const char *end = line + length;
+    const char *pending = NULL; //last token seen: programme word or the mark
+    size_t pendingLength = 0;
+    size_t nameLength = 0, programmeLength = 0;
+    int tokenCount = 0;
+
+    while (p < end && *p != '\n') {
+        //Skip separators
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            p++;
+            continue;
+        }
+
+        //Find the end of the token
+        const char *token = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+        size_t tokenLength = (size_t)(p - token);
+
+        if (tokenCount == 0) {
+            //Student ID: digits only, 0..INT_MAX
+            long long parsedId = 0;
+            for (size_t i = 0; i < tokenLength; i++) {
+                if (token[i] < '0' || token[i] > '9') return 0;
+                parsedId = parsedId * 10 + (token[i] - '0');
+                if (parsedId > INT_MAX) return 0;
+            }
+            studentObject->id = (int)parsedId;
+        }
+        else if (tokenCount <= 2) {
+            //First name, then " " + last name (truncated to MAX_STR - 1)
+            if (tokenCount == 2 && nameLength < MAX_STR - 1) {
+                studentObject->name[nameLength++] = ' ';
+            }
+            size_t room = MAX_STR - 1 - nameLength;
+            size_t copy = tokenLength < room ? tokenLength : room;
+            memcpy(studentObject->name + nameLength, token, copy);
+            nameLength += copy;
+        }
+        else {
+            //The previous held-back token was not the last one: it is programme
+            if (pending) {
+                if (programmeLength > 0 && programmeLength < MAX_STR - 1) {
+                    studentObject->programme[programmeLength++] = ' ';
+                }
+                size_t room = MAX_STR - 1 - programmeLength;
+                size_t copy = pendingLength < room ? pendingLength : room;
+                memcpy(studentObject->programme + programmeLength, pending, copy);
+                programmeLength += copy;
+            }
+            pending = token;
+            pendingLength = tokenLength;
+        }
+        tokenCount++;
+    }
+
+    if (tokenCount < 4) return 0; //must have ID, 2 name parts and a mark
+
+    //The held-back token is the mark
+    if (!parse_mark_span(pending, pendingLength, &studentObject->mark)) {
+        return 0; //Invalid marks: non-numeric or out of range
+    }
+
+    studentObject->name[nameLength] = '\0';
+    studentObject->programme[programmeLength] = '\0';
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// LineReader: streams a file in large blocks and hands out one line at a time
+// as a (pointer, length) span into its buffer. The buffer only grows when a
+// single line is longer than it, so there is no line length limit.
+// -----------------------------------------------------------------------------
+#define LINE_READER_BLOCK (64 * 1024)
+
+typedef struct {
+    FILE *file;
+    char *buf;
+    size_t cap;
+    size_t start;       //First unread byte in buf
+    size_t end;         //One past the last valid byte in buf
+    long long offset;   //File offset of buf[start]
+    int eof;
+} LineReader;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: line_reader_init
+// RETURNS : 1 -> ready, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int line_reader_init(LineReader *reader, FILE *file)
+{
+    reader->file = file;
+    reader->cap = LINE_READER_BLOCK;
+    reader->buf = malloc(reader->cap);
+    reader->start = reader->end = 0;
+    reader->offset = 0;
+    reader->eof = 0;
+    return reader->buf != NULL;
+}
+
+static void line_reader_free(LineReader *reader)
+{
+    free(reader->buf);
+    reader->buf = NULL;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: line_reader_next
+// PURPOSE : Returns the next line (without its '\n') and the file offset at
+//           which it starts. The span stays valid until the next call.
+// RETURNS : 1 -> line returned, 0 -> end of file (or out of memory)
+// -----------------------------------------------------------------------------
+static int line_reader_next(LineReader *reader, const char **line, size_t *length, long long *lineOffset)
+{
+    while (1) {
+        char *unread = reader->buf + reader->start;
+        size_t available = reader->end - reader->start;
+        char *newline = available ? memchr(unread, '\n', available) : NULL;
+
+        if (newline || (reader->eof && available > 0)) {
+            size_t lineLength = newline ? (size_t)(newline - unread) : available;
+            size_t consumed = newline ? lineLength + 1 : available;
+
+            *line = unread;
+            *length = lineLength;
+            if (lineOffset) *lineOffset = reader->offset;
+
+            reader->start += consumed;
+            reader->offset += (long long)consumed;
+            return 1;
+        }
+        if (reader->eof) return 0;
+
+        //Keep the partial line, move it to the front and read another block
+        memmove(reader->buf, unread, available);
+        reader->start = 0;
+        reader->end = available;
+
+        if (reader->end == reader->cap) { //one line fills the whole buffer
+            char *grown = realloc(reader->buf, reader->cap * 2);
+            if (grown == NULL) return 0;
+            reader->buf = grown;
+            reader->cap *= 2;
+        }
+
+        TRACE_BEGIN(span, "read");
+        size_t got = fread(reader->buf + reader->end, 1, reader->cap - reader->end, reader->file);
+        TRACE_END(span);
+        reader->end += got;
+        if (got == 0) reader->eof = 1;
+    }
+}
+
+/* ---------------------------------------------------- */
+/* Audit Log Segments and Index (HISTORY / LOG)         */
+/* ---------------------------------------------------- */
+//
+// The audit log is split into segments. New entries go to LOGFILE (the
+// active segment); when it grows past maxBytes or its first entry is older
+// than maxAge it is renamed to LOGFILE.<n> and a new one is started.
+// Every entry also gets a fixed-size record in LOGINDEX, in write order
+// (so sorted by time), saying which segment and byte offset holds the
+// line and which student it is about. HISTORY and LOG BETWEEN use the
+// index and then seek straight to the lines they need.
+
+//One index record per log line (fixed size, so the file can be binary searched)
+typedef struct {
+    int64_t timestamp;  //seconds since epoch
+    uint64_t offset;    //byte offset of the line in its segment
+    int32_t studentId;  //-1 -> entry is not about a single student
+    uint32_t segment;   //segment number
+    uint32_t length;    //line length without the newline
+    uint32_t reserved;
+} LogIndexEntry;
+
+//All index records of one student (HISTORY)
+typedef struct {
+    int id;
+    LogIndexEntry *entries;
+    size_t count, cap;
+} LogHistory;
+
+static struct {
+    int ready;
+    uint32_t activeSegment; //segment number of LOGFILE; older ones are LOGFILE.<n>
+    long long activeSize;   //bytes in LOGFILE
+    time_t activeStart;     //time of the first entry in LOGFILE (0 -> empty)
+    long long maxBytes;     //rotation size, 0 -> never
+    long maxAge;            //rotation age in seconds, 0 -> never
+    int readOnly;           //1 -> --follow replica: the log is the primary's, never written
+    int suspended;          //1 -> REPLAY running: the commands it re-runs are not logged
+
+    int historyLoaded;      //student ID -> entries map built from the index
+    LogHistory *histories;
+    size_t historyCount, historyCap;
+    int *slots;             //open addressing: ID -> index in histories, -1 empty
+    size_t slotCap;
+} log_state = {.maxBytes = LOG_SEGMENT_MAX_BYTES, .maxAge = LOG_SEGMENT_MAX_AGE};
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_segment_path
+// PURPOSE : File name of a log segment.
+// -----------------------------------------------------------------------------
+static void log_segment_path(uint32_t segment, char *path, size_t cap)
+{
+    if (segment == log_state.activeSegment) {
+        snprintf(path, cap, "%s", LOGFILE);
+    } else {
+        snprintf(path, cap, "%s.%u", LOGFILE, (unsigned)segment);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: parse_log_time
+// PURPOSE : Parses "YYYY-MM-DD", "YYYY-MM-DD HH:MM" or "YYYY-MM-DD HH:MM:SS"
+//           ('T' may replace the space) as local time. A date without a
+//           time means the start of the day, or its last second when
+//           endOfRange is set.
+// RETURNS : 1 -> parsed into *out, 0 -> invalid
+// -----------------------------------------------------------------------------
+static int parse_log_time(const char *text, int endOfRange, time_t *out)
+{
+    int year, month, day, hour = 0, minute = 0, second = 0, used = 0;
+    if (sscanf(text, "%4d-%2d-%2d%n", &year, &month, &day, &used) != 3) return 0;
+
+    const char *rest = text + used;
+    int hasTime = 0;
+    if (*rest == ' ' || *rest == 'T') {
+        int fields = sscanf(rest + 1, "%2d:%2d:%2d%n", &hour, &minute, &second, &used);
+        if (fields == 3) {
+            rest += 1 + used;
+        } else if (sscanf(rest + 1, "%2d:%2d%n", &hour, &minute, &used) == 2) {
+            second = endOfRange ? 59 : 0;
+            rest += 1 + used;
+        } else {
+            return 0;
+        }
+        hasTime = 1;
+    }
+    if (*rest != '\0' && *rest != ']') return 0;
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return 0;
+
+    if (!hasTime && endOfRange) {
+        hour = 23; minute = 59; second = 59;
+    }
+
+    struct tm when;
+    memset(&when, 0, sizeof(when));
+    when.tm_year = year - 1900;
+    when.tm_mon = month - 1;
+    when.tm_mday = day;
+    when.tm_hour = hour;
+    when.tm_min = minute;
+    when.tm_sec = second;
+    when.tm_isdst = -1;
+    *out = mktime(&when);
+    return *out != (time_t)-1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_line_parse
+// PURPOSE : Splits an audit log line into its timestamp and message. Handles
+//           both "[time] message" and "[time] [user] (Records: n) message".
+// RETURNS : 1 -> parsed, 0 -> not a log entry (e.g. continuation line)
+// -----------------------------------------------------------------------------
+static int log_line_parse(const char *line, size_t length, time_t *timestamp, const char **message, size_t *messageLength)
+{
+    char stamp[20];
+    if (length < 22 || line[0] != '[' || line[20] != ']') return 0;
+    memcpy(stamp, line + 1, 19);
+    stamp[19] = '\0';
+    if (!parse_log_time(stamp, 0, timestamp)) return 0;
+
+    const char *p = line + 21;
+    const char *end = line + length;
+    while (p < end && *p == ' ') p++;
+
+    //Optional "[user] "
+    if (p < end && *p == '[') {
+        const char *close = memchr(p, ']', (size_t)(end - p));
+        if (close) {
+            p = close + 1;
+            while (p < end && *p == ' ') p++;
+        }
+    }
+    //Optional "(Records: n) "
+    if ((size_t)(end - p) > 9 && strncmp(p, "(Records:", 9) == 0) {
+        const char *close = memchr(p, ')', (size_t)(end - p));
+        if (close) {
+            p = close + 1;
+            while (p < end && *p == ' ') p++;
+        }
+    }
+    while (end > p && (end[-1] == '\r' || end[-1] == '\n')) end--;
+
+    *message = p;
+    *messageLength = (size_t)(end - p);
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_message_student_id
+// PURPOSE : Finds the student a log message is about:
+//           "INSERT|UPDATE|DELETE <id> ..." or "... (ID <id> ...)".
+// RETURNS : student ID, or -1
+// -----------------------------------------------------------------------------
+static int log_message_student_id(const char *message, size_t length)
+{
+    static const char *const verbs[] = {"INSERT ", "UPDATE ", "DELETE "};
+    const char *digits = NULL;
+
+    for (size_t i = 0; i < sizeof(verbs) / sizeof(verbs[0]); i++) {
+        size_t verbLength = strlen(verbs[i]);
+        if (length > verbLength && strncmp(message, verbs[i], verbLength) == 0) {
+            digits = message + verbLength;
+            break;
+        }
+    }
+    if (digits == NULL) {
+        for (size_t i = 0; i + 4 < length; i++) {
+            if (memcmp(message + i, "(ID ", 4) == 0) {
+                digits = message + i + 4;
+                break;
+            }
+        }
+    }
+    if (digits == NULL) return -1;
+
+    const char *end = message + length;
+    long long id = 0;
+    const char *p = digits;
+    while (p < end && *p >= '0' && *p <= '9' && id <= INT_MAX) {
+        id = id * 10 + (*p++ - '0');
+    }
+    if (p == digits || id > INT_MAX || (p < end && *p != ' ' && *p != ')' && *p != '\r')) return -1;
+    return (int)id;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_quoted_fields
+// PURPOSE : Collects the "..." strings of an INSERT/UPDATE/DELETE log message.
+// RETURNS : number of fields found (at most maxFields)
+// -----------------------------------------------------------------------------
+static int log_quoted_fields(const char *message, size_t length, const char **fields, size_t *lengths, int maxFields)
+{
+    int count = 0;
+    const char *p = message;
+    const char *end = message + length;
+
+    while (count < maxFields && (p = memchr(p, '"', (size_t)(end - p))) != NULL) {
+        const char *close = memchr(p + 1, '"', (size_t)(end - p - 1));
+        if (close == NULL) break;
+        fields[count] = p + 1;
+        lengths[count] = (size_t)(close - p - 1);
+        count++;
+        p = close + 1;
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_history_add
+// PURPOSE : Adds an index record to the in-memory ID -> entries map.
+// -----------------------------------------------------------------------------
+static void log_history_add(const LogIndexEntry *entry)
+{
+    if (entry->studentId < 0) return;
+
+    //Grow the slot table (load factor <= 0.5)
+    if ((log_state.historyCount + 1) * 2 > log_state.slotCap) {
+        size_t newCap = log_state.slotCap ? log_state.slotCap * 2 : 256;
+        int *slots = malloc(newCap * sizeof(int));
+        if (slots == NULL) return;
+        for (size_t i = 0; i < newCap; i++) slots[i] = -1;
+        for (size_t i = 0; i < log_state.historyCount; i++) {
+            size_t slot = id_hash(log_state.histories[i].id) & (newCap - 1);
+            while (slots[slot] >= 0) slot = (slot + 1) & (newCap - 1);
+            slots[slot] = (int)i;
+        }
+        free(log_state.slots);
+        log_state.slots = slots;
+        log_state.slotCap = newCap;
+    }
+
+    size_t slot = id_hash(entry->studentId) & (log_state.slotCap - 1);
+    while (log_state.slots[slot] >= 0 && log_state.histories[log_state.slots[slot]].id != entry->studentId) {
+        slot = (slot + 1) & (log_state.slotCap - 1);
+    }
+
+    if (log_state.slots[slot] < 0) {
+        if (log_state.historyCount == log_state.historyCap) {
+            size_t newCap = log_state.historyCap ? log_state.historyCap * 2 : 128;
+            LogHistory *grown = realloc(log_state.histories, newCap * sizeof(LogHistory));
+            if (grown == NULL) return;
+            log_state.histories = grown;
+            log_state.historyCap = newCap;
+        }
+        LogHistory *history = &log_state.histories[log_state.historyCount];
+        memset(history, 0, sizeof(*history));
+        history->id = entry->studentId;
+        log_state.slots[slot] = (int)log_state.historyCount++;
+    }
+
+    LogHistory *history = &log_state.histories[log_state.slots[slot]];
+    if (history->count == history->cap) {
+        size_t newCap = history->cap ? history->cap * 2 : 4;
+        LogIndexEntry *grown = realloc(history->entries, newCap * sizeof(LogIndexEntry));
+        if (grown == NULL) return;
+        history->entries = grown;
+        history->cap = newCap;
+    }
+    history->entries[history->count++] = *entry;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_history_free
+// -----------------------------------------------------------------------------
+static void log_history_free(void)
+{
+    for (size_t i = 0; i < log_state.historyCount; i++) {
+        free(log_state.histories[i].entries);
+    }
+    free(log_state.histories);
+    free(log_state.slots);
+    log_state.histories = NULL;
+    log_state.slots = NULL;
+    log_state.historyCount = log_state.historyCap = log_state.slotCap = 0;
+    log_state.historyLoaded = 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_index_file_entries
+// RETURNS : number of records in the index file (0 if missing)
+// -----------------------------------------------------------------------------
+static size_t log_index_file_entries(FILE *indexFile)
+{
+    if (fseek(indexFile, 0, SEEK_END) != 0) return 0;
+    long size = ftell(indexFile);
+    return size > 0 ? (size_t)size / sizeof(LogIndexEntry) : 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_reindex
+// PURPOSE : Rebuilds LOGINDEX by scanning every segment once. Used for logs
+//           written before the index existed, or by LOG REINDEX.
+// RETURNS : number of entries indexed
+// -----------------------------------------------------------------------------
+static size_t log_reindex(void)
+{
+    FILE *indexFile = fopen(LOGINDEX, "wb");
+    if (indexFile == NULL) {
+        printf(RED "CMS Error: Cannot write log index \"%s\".\n" RESET, LOGINDEX);
+        return 0;
+    }
+    log_history_free();
+
+    LogIndexEntry block[1024];
+    size_t blockCount = 0, total = 0;
+
+    for (uint32_t segment = 1; segment <= log_state.activeSegment; segment++) {
+        char path[64];
+        log_segment_path(segment, path, sizeof(path));
+        FILE *segmentFile = fopen(path, "rb");
+        if (segmentFile == NULL) continue;
+
+        LineReader reader;
+        if (!line_reader_init(&reader, segmentFile)) {
+            fclose(segmentFile);
+            break;
+        }
+
+        const char *line, *message;
+        size_t lineLength, messageLength;
+        long long lineStart;
+        time_t timestamp;
+        while (line_reader_next(&reader, &line, &lineLength, &lineStart)) {
+            if (!log_line_parse(line, lineLength, &timestamp, &message, &messageLength)) continue;
+
+            LogIndexEntry *entry = &block[blockCount++];
+            memset(entry, 0, sizeof(*entry));
+            entry->timestamp = (int64_t)timestamp;
+            entry->offset = (uint64_t)lineStart;
+            entry->studentId = log_message_student_id(message, messageLength);
+            entry->segment = segment;
+            entry->length = (uint32_t)lineLength;
+
+            if (segment == log_state.activeSegment && log_state.activeStart == 0) {
+                log_state.activeStart = timestamp;
+            }
+            if (blockCount == sizeof(block) / sizeof(block[0])) {
+                fwrite(block, sizeof(LogIndexEntry), blockCount, indexFile);
+                total += blockCount;
+                blockCount = 0;
+            }
+        }
+        line_reader_free(&reader);
+        fclose(segmentFile);
+    }
+
+    fwrite(block, sizeof(LogIndexEntry), blockCount, indexFile);
+    total += blockCount;
+    fclose(indexFile);
+    return total;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_init
+// PURPOSE : Finds the active segment number and size on first use, and
+//           indexes an existing log that has no index yet.
+// -----------------------------------------------------------------------------
+static void log_init(void)
+{
+    if (log_state.ready) return;
+    log_state.ready = 1;
+
+    //Rotated segments are LOGFILE.1, LOGFILE.2, ...; the active one comes next
+    uint32_t segment = 1;
+    while (1) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s.%u", LOGFILE, (unsigned)segment);
+        FILE *probe = fopen(path, "rb");
+        if (probe == NULL) break;
+        fclose(probe);
+        segment++;
+    }
+    log_state.activeSegment = segment;
+
+    FILE *active = fopen(LOGFILE, "rb");
+    if (active != NULL) {
+        char firstLine[64];
+        const char *message;
+        size_t messageLength;
+        if (fgets(firstLine, sizeof(firstLine), active)) {
+            log_line_parse(firstLine, strlen(firstLine), &log_state.activeStart, &message, &messageLength);
+        }
+        fseek(active, 0, SEEK_END);
+        log_state.activeSize = ftell(active);
+        fclose(active);
+    }
+
+    FILE *indexFile = fopen(LOGINDEX, "rb");
+    if (indexFile != NULL) {
+        fclose(indexFile);
+    } else if (!log_state.readOnly && (log_state.activeSize > 0 || log_state.activeSegment > 1)) {
+        log_reindex(); //log predates the index
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_rotate
+// PURPOSE : Closes the active segment by renaming it to LOGFILE.<n>.
+// RETURNS : 1 -> rotated, 0 -> rename failed (keep appending to LOGFILE)
+// -----------------------------------------------------------------------------
+static int log_rotate(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "%s.%u", LOGFILE, (unsigned)log_state.activeSegment);
+    if (rename(LOGFILE, path) != 0) {
+        printf(RED "CMS Error: Could not rotate audit log to \"%s\".\n" RESET, path);
+        return 0;
+    }
+    log_state.activeSegment++;
+    log_state.activeSize = 0;
+    log_state.activeStart = 0;
+    return 1;
+}
+
+static void version_store_feed(const char *entries, size_t length);
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_append
+// PURPOSE : Appends complete log lines to the active segment (rotating it
+//           first if it is too big or too old), adds one index record per
+//           line and passes the lines on to the AS OF version store.
+//           durable -> flushed to disk before returning.
+// RETURNS : 1 -> written, 0 -> log could not be written
+// -----------------------------------------------------------------------------
+static int log_append(const char *entries, size_t length, int durable, time_t timestamp)
+{
+    if (log_state.readOnly || log_state.suspended) return 1;
+    log_init();
+
+    if (log_state.activeSize > 0 &&
+        ((log_state.maxBytes > 0 && log_state.activeSize + (long long)length > log_state.maxBytes) ||
+         (log_state.maxAge > 0 && log_state.activeStart != 0 && timestamp - log_state.activeStart >= log_state.maxAge))) {
+        log_rotate();
+    }
+
+    //Binary append so the offsets we record are exact byte positions
+    FILE *logFilePointer = fopen(LOGFILE, "ab");
+    if (!logFilePointer) { //NULL file
+        printf(RED "CMS Error: Failed to open or write to audit log file \"%s\"." RESET "\n", LOGFILE);
+        return 0;
+    }
+    fseek(logFilePointer, 0, SEEK_END);
+    long long offset = ftell(logFilePointer);
+
+    int ok = fwrite(entries, 1, length, logFilePointer) == length && fflush(logFilePointer) == 0;
+    if (ok && durable) {
+#ifdef _WIN32
+        ok = _commit(_fileno(logFilePointer)) == 0;
+#else
+        ok = fsync(fileno(logFilePointer)) == 0;
+#endif
+    }
+    if (fclose(logFilePointer) != 0) ok = 0;
+    if (!ok) {
+        printf(RED "CMS Error: Failed to open or write to audit log file \"%s\"." RESET "\n", LOGFILE);
+        return 0;
+    }
+
+    //Index records for the lines written, in one write. Like log_reindex,
+    //only lines log_line_parse accepts are indexed (not continuation lines)
+    size_t lineCount = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (entries[i] == '\n') lineCount++;
+    }
+    LogIndexEntry *records = malloc((lineCount ? lineCount : 1) * sizeof(LogIndexEntry));
+    if (records != NULL) {
+        size_t count = 0;
+        const char *line = entries;
+        const char *end = entries + length;
+        const char *newline;
+        while (line < end && (newline = memchr(line, '\n', (size_t)(end - line))) != NULL) {
+            size_t lineLength = (size_t)(newline - line);
+            const char *message;
+            size_t messageLength;
+            time_t lineTime;
+
+            if (log_line_parse(line, lineLength, &lineTime, &message, &messageLength)) {
+                LogIndexEntry *record = &records[count++];
+                memset(record, 0, sizeof(*record));
+                record->timestamp = (int64_t)lineTime;
+                record->offset = (uint64_t)(offset + (line - entries));
+                record->studentId = log_message_student_id(message, messageLength);
+                record->segment = log_state.activeSegment;
+                record->length = (uint32_t)lineLength;
+            }
+            line = newline + 1;
+        }
+
+        FILE *indexFile = fopen(LOGINDEX, "ab");
+        int indexed = indexFile != NULL && fwrite(records, sizeof(LogIndexEntry), count, indexFile) == count &&
+                      fflush(indexFile) == 0;
+        if (indexed && durable) {
+#ifdef _WIN32
+            indexed = _commit(_fileno(indexFile)) == 0;
+#else
+            indexed = fsync(fileno(indexFile)) == 0;
+#endif
+        }
+        if (indexFile != NULL && fclose(indexFile) != 0) indexed = 0;
+        if (!indexed) {
+            printf(YELLOW "CMS Warning: Could not update the log index \"%s\"; LOG REINDEX rebuilds it.\n" RESET, LOGINDEX);
+        }
+        if (log_state.historyLoaded) {
+            for (size_t i = 0; i < count; i++) log_history_add(&records[i]);
+        }
+        free(records);
+    }
+
+    if (log_state.activeStart == 0) log_state.activeStart = timestamp;
+    log_state.activeSize = offset + (long long)length;
+    version_store_feed(entries, length);
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: log_print_entry
+// PURPOSE : Seeks to one indexed line and prints it. Keeps the last
+//           segment file open between calls (*file / *fileSegment).
+// -----------------------------------------------------------------------------
+static void log_print_entry(const LogIndexEntry *entry, FILE **file, uint32_t *fileSegment)
+{
+    if (*file == NULL || *fileSegment != entry->segment) {
+        char path[64];
+        if (*file) fclose(*file);
+        log_segment_path(entry->segment, path, sizeof(path));
+        *file = fopen(path, "rb");
+        *fileSegment = entry->segment;
+        if (*file == NULL) {
+            printf(YELLOW "CMS Warning: Log segment \"%s\" is missing.\n" RESET, path);
+            return;
+        }
+    }
+
+    char line[1024];
+    size_t wanted = entry->length < sizeof(line) - 1 ? entry->length : sizeof(line) - 1;
+    if (fseek(*file, (long)entry->offset, SEEK_SET) != 0) return;
+    size_t got = fread(line, 1, wanted, *file);
+    while (got > 0 && (line[got - 1] == '\r' || line[got - 1] == '\n')) got--;
+    line[got] = '\0';
+    printf("%s\n", line);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_history
+// PURPOSE : HISTORY <ID>. Every audit entry about one student, oldest first.
+//           The ID map is built from the index on first use.
+// -----------------------------------------------------------------------------
+void show_history(int studentId)
+{
+    log_init();
+
+    if (!log_state.historyLoaded) {
+        FILE *indexFile = fopen(LOGINDEX, "rb");
+        if (indexFile != NULL) {
+            LogIndexEntry block[1024];
+            size_t got;
+            while ((got = fread(block, sizeof(LogIndexEntry), 1024, indexFile)) > 0) {
+                for (size_t i = 0; i < got; i++) log_history_add(&block[i]);
+            }
+            fclose(indexFile);
+        }
+        log_state.historyLoaded = 1;
+    }
+
+    const LogHistory *history = NULL;
+    if (log_state.slotCap > 0) {
+        size_t slot = id_hash(studentId) & (log_state.slotCap - 1);
+        for (; log_state.slots[slot] >= 0; slot = (slot + 1) & (log_state.slotCap - 1)) {
+            if (log_state.histories[log_state.slots[slot]].id == studentId) {
+                history = &log_state.histories[log_state.slots[slot]];
+                break;
+            }
+        }
+    }
+
+    if (history == NULL || history->count == 0) {
+        printf("CMS: No audit log entries for ID %d.\n", studentId);
+        return;
+    }
+
+    printf(CYAN "===== History of ID %d (%zu entries) =====\n" RESET, studentId, history->count);
+    FILE *file = NULL;
+    uint32_t fileSegment = 0;
+    for (size_t i = 0; i < history->count; i++) {
+        log_print_entry(&history->entries[i], &file, &fileSegment);
+    }
+    if (file) fclose(file);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_log_between
+// PURPOSE : LOG BETWEEN <t1> <t2>. Binary searches the index (records are in
+//           time order) for the first entry at or after t1, then reads
+//           forward until t2.
+// -----------------------------------------------------------------------------
+void show_log_between(time_t from, time_t to)
+{
+    log_init();
+
+    FILE *indexFile = fopen(LOGINDEX, "rb");
+    if (indexFile == NULL) {
+        printf("CMS: The audit log is empty.\n");
+        return;
+    }
+
+    //Lower bound on timestamp
+    size_t low = 0, high = log_index_file_entries(indexFile);
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        LogIndexEntry entry;
+        fseek(indexFile, (long)(mid * sizeof(LogIndexEntry)), SEEK_SET);
+        if (fread(&entry, sizeof(entry), 1, indexFile) != 1) break;
+        if (entry.timestamp < (int64_t)from) low = mid + 1;
+        else high = mid;
+    }
+
+    fseek(indexFile, (long)(low * sizeof(LogIndexEntry)), SEEK_SET);
+    FILE *file = NULL;
+    uint32_t fileSegment = 0;
+    size_t shown = 0;
+    LogIndexEntry block[256];
+    size_t got;
+    int done = 0;
+
+    while (!done && (got = fread(block, sizeof(LogIndexEntry), 256, indexFile)) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            if (block[i].timestamp > (int64_t)to) { done = 1; break; }
+            log_print_entry(&block[i], &file, &fileSegment);
+            shown++;
+        }
+    }
+    if (file) fclose(file);
+    fclose(indexFile);
+
+    printf("CMS: %zu audit log entr%s.\n", shown, shown == 1 ? "y" : "ies");
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_log_status
+// PURPOSE : LOG. Segments, index size and rotation settings.
+// -----------------------------------------------------------------------------
+void show_log_status(void)
+{
+    log_init();
+
+    size_t indexed = 0;
+    FILE *indexFile = fopen(LOGINDEX, "rb");
+    if (indexFile != NULL) {
+        indexed = log_index_file_entries(indexFile);
+        fclose(indexFile);
+    }
+
+    printf(CYAN "===== Audit Log =====\n" RESET);
+    printf("Active segment : %s (#%u, %lld bytes)\n", LOGFILE, (unsigned)log_state.activeSegment, log_state.activeSize);
+    if (log_state.activeSegment > 1) {
+        printf("Older segments : %u (%s.1 .. %s.%u)\n", (unsigned)(log_state.activeSegment - 1),
+               LOGFILE, LOGFILE, (unsigned)(log_state.activeSegment - 1));
+    } else {
+        printf("Older segments : 0\n");
+    }
+    printf("Index          : %s, %zu entries\n", LOGINDEX, indexed);
+    printf("Rotate at      : %lld bytes or %ld seconds (0 = never)\n", log_state.maxBytes, log_state.maxAge);
+    printf(CYAN "=====================\n" RESET);
+}
+
+/* ---------------------------------------------------- */
+/* Trigram Text Index (FIND NAME / FIND PROGRAMME)      */
+/* ---------------------------------------------------- */
+
+//Posting list for one trigram: sorted IDs of the students whose text contains it
+typedef struct {
+    uint32_t key;  //packed trigram (0 = empty slot)
+    uint32_t count;
+    uint32_t cap;
+    int *ids;      //sorted ascending, no duplicates
+} TrigramPosting;
+
+//Queued text index edit of a bulk batch: 'order' = sequence number << 1 | 1 for add
+typedef struct {
+    uint32_t key;
+    int id;
+    uint32_t order;
+} TrigramEdit;
+
+//Hash table from trigram -> posting list
+typedef struct {
+    TrigramPosting *slots;
+    size_t cap;    //power of two
+    size_t used;
+    int deferred;          //1 -> add/remove only queue edits (bulk batch)
+    int editsLost;         //1 -> out of memory while queueing: rebuild on flush
+    TrigramEdit *edits;
+    size_t editCount, editCap;
+} TrigramIndex;
+
+#define BULK_CHANGE_MIN 1024 //Batches this large update the text indexes in one pass
+
+static TrigramIndex name_trigrams;      //over Student.name
+static TrigramIndex programme_trigrams; //over Student.programme
+
+#define MAX_TRIGRAMS (MAX_STR + 2) //padded text of MAX_STR chars cannot produce more
+#define FUZZY_MAX_RESULTS 10       //rows printed by FIND FUZZY
+#define FUZZY_MIN_SCORE 0.3        //fraction of query trigrams that must match
+
+// -----------------------------------------------------------------------------
+// FUNCTION: normalize_text
+// PURPOSE : Writes out text the way collate_next reads it: lower-cased, runs
+//           of spaces/tabs as one space, no leading/trailing spaces.
+//           "  Joshua   LIM " -> "joshua lim"
+// RETURNS : length of the normalized string
+// -----------------------------------------------------------------------------
+static size_t normalize_text(const char *text, char *out, size_t cap)
+{
+    size_t len = 0;
+    int c;
+
+    text = collate_start(text);
+    while (len + 1 < cap && (c = collate_next(&text)) != 0) {
+        if (c == ' ' && len + 2 >= cap) break; //no room for what follows the space
+        out[len++] = (char)c;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: compare_u32
+// PURPOSE : qsort comparator for trigram keys.
+// -----------------------------------------------------------------------------
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: compare_int
+// PURPOSE : qsort comparator for posting lists (ascending IDs).
+// -----------------------------------------------------------------------------
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: collect_trigrams
+// PURPOSE : Extracts the distinct trigrams of already-normalized text.
+//           padded = 1 adds a space on both ends (used for indexing and fuzzy
+//           search, so word starts/ends become trigrams of their own).
+// RETURNS : number of distinct trigram keys written to 'keys'
+// -----------------------------------------------------------------------------
+static size_t collect_trigrams(const char *normalized, int padded, uint32_t *keys)
+{
+    char buf[MAX_STR + 3];
+    size_t len = 0;
+
+    if (padded) buf[len++] = ' ';
+    for (const char *p = normalized; *p && len < MAX_STR + 1; p++) {
+        buf[len++] = *p;
+    }
+    if (padded) buf[len++] = ' ';
+
+    size_t count = 0;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        keys[count++] = (1U << 24) //never 0, so 0 can mark an empty slot
+                      | ((uint32_t)(unsigned char)buf[i] << 16)
+                      | ((uint32_t)(unsigned char)buf[i + 1] << 8)
+                      | (uint32_t)(unsigned char)buf[i + 2];
+    }
+
+    //Sort and drop duplicates ("banana" has "ana" twice)
+    qsort(keys, count, sizeof(uint32_t), compare_u32);
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (distinct == 0 || keys[distinct - 1] != keys[i]) {
+            keys[distinct++] = keys[i];
+        }
+    }
+    return distinct;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_hash
+// PURPOSE : Hash for packed trigram keys.
+// -----------------------------------------------------------------------------
+static size_t trigram_hash(uint32_t key)
+{
+    return (size_t)(key * 2654435761U) ^ (key >> 13);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_lookup
+// PURPOSE : Finds the posting list of a trigram.
+// RETURNS : posting list, or NULL if the trigram never occurs
+// -----------------------------------------------------------------------------
+static TrigramPosting *trigram_lookup(const TrigramIndex *index, uint32_t key)
+{
+    if (index->cap == 0) return NULL;
+
+    size_t mask = index->cap - 1;
+    for (size_t i = trigram_hash(key) & mask; index->slots[i].key != 0; i = (i + 1) & mask) {
+        if (index->slots[i].key == key) {
+            return &index->slots[i];
+        }
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_get_or_add
+// PURPOSE : Returns the posting list of a trigram, creating an empty one
+//           (and growing the hash table) when needed.
+// RETURNS : posting list, or NULL when out of memory
+// -----------------------------------------------------------------------------
+static TrigramPosting *trigram_get_or_add(TrigramIndex *index, uint32_t key)
+{
+    TrigramPosting *posting = trigram_lookup(index, key);
+    if (posting) return posting;
+
+    if ((index->used + 1) * 2 > index->cap) { //keep under half full
+        size_t newCap = index->cap ? index->cap * 2 : 1024;
+        TrigramPosting *slots = calloc(newCap, sizeof(TrigramPosting));
+        if (slots == NULL) return NULL;
+
+        for (size_t i = 0; i < index->cap; i++) {
+            if (index->slots[i].key == 0) continue;
+            size_t j = trigram_hash(index->slots[i].key) & (newCap - 1);
+            while (slots[j].key != 0) j = (j + 1) & (newCap - 1);
+            slots[j] = index->slots[i];
+        }
+        free(index->slots);
+        index->slots = slots;
+        index->cap = newCap;
+    }
+
+    size_t mask = index->cap - 1;
+    size_t i = trigram_hash(key) & mask;
+    while (index->slots[i].key != 0) i = (i + 1) & mask;
+
+    index->slots[i].key = key;
+    index->used++;
+    return &index->slots[i];
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: posting_lower_bound
+// PURPOSE : Binary search for the first position whose ID is >= id.
+// -----------------------------------------------------------------------------
+static size_t posting_lower_bound(const int *ids, size_t count, int id)
+{
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: posting_reserve
+// PURPOSE : Makes room for one more ID in a posting list.
+// RETURNS : 1 -> success, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int posting_reserve(TrigramPosting *posting)
+{
+    if (posting->count < posting->cap) return 1;
+
+    uint32_t newCap = posting->cap ? posting->cap * 2 : 4;
+    int *ids = realloc(posting->ids, newCap * sizeof(int));
+    if (ids == NULL) return 0;
+
+    posting->ids = ids;
+    posting->cap = newCap;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_index_free
+// PURPOSE : Releases every posting list and the hash table itself.
+// -----------------------------------------------------------------------------
+static void trigram_index_free(TrigramIndex *index)
+{
+    for (size_t i = 0; i < index->cap; i++) {
+        free(index->slots[i].ids);
+    }
+    free(index->slots);
+    index->slots = NULL;
+    index->cap = index->used = 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_index_queue
+// PURPOSE : Bulk batch: records that 'id' gains (add = 1) or loses each key.
+// -----------------------------------------------------------------------------
+static void trigram_index_queue(TrigramIndex *index, int id, const uint32_t *keys, size_t keyCount, int add)
+{
+    if (index->editsLost) return;
+    if (index->editCount + keyCount > index->editCap) {
+        size_t newCap = index->editCap ? index->editCap * 2 : 4096;
+        while (newCap < index->editCount + keyCount) newCap *= 2;
+        TrigramEdit *edits = realloc(index->edits, newCap * sizeof(TrigramEdit));
+        if (edits == NULL) {
+            index->editsLost = 1;
+            return;
+        }
+        index->edits = edits;
+        index->editCap = newCap;
+    }
+    uint32_t sequence = (uint32_t)index->editCount;
+    for (size_t k = 0; k < keyCount; k++) {
+        TrigramEdit *edit = &index->edits[index->editCount++];
+        edit->key = keys[k];
+        edit->id = id;
+        edit->order = (sequence << 1) | (uint32_t)add;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_index_add
+// PURPOSE : Adds a student's text to the index (keeps posting lists sorted).
+// -----------------------------------------------------------------------------
+static void trigram_index_add(TrigramIndex *index, int id, const char *text)
+{
+    char normalized[MAX_STR];
+    uint32_t keys[MAX_TRIGRAMS];
+
+    normalize_text(text, normalized, sizeof(normalized));
+    size_t keyCount = collect_trigrams(normalized, 1, keys);
+    if (index->deferred) {
+        trigram_index_queue(index, id, keys, keyCount, 1);
+        return;
+    }
+
+    for (size_t k = 0; k < keyCount; k++) {
+        TrigramPosting *posting = trigram_get_or_add(index, keys[k]);
+        if (posting == NULL || !posting_reserve(posting)) {
+            printf(YELLOW "CMS Warning: Out of memory while indexing ID %d.\n" RESET, id);
+            return;
+        }
+
+        size_t pos = posting_lower_bound(posting->ids, posting->count, id);
+        if (pos < posting->count && posting->ids[pos] == id) continue; //already there
+
+        memmove(&posting->ids[pos + 1], &posting->ids[pos], (posting->count - pos) * sizeof(int));
+        posting->ids[pos] = id;
+        posting->count++;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_index_remove
+// PURPOSE : Removes a student's text from the index.
+//           'text' must be the same text that was added for this ID.
+// -----------------------------------------------------------------------------
+static void trigram_index_remove(TrigramIndex *index, int id, const char *text)
+{
+    char normalized[MAX_STR];
+    uint32_t keys[MAX_TRIGRAMS];
+
+    normalize_text(text, normalized, sizeof(normalized));
+    size_t keyCount = collect_trigrams(normalized, 1, keys);
+    if (index->deferred) {
+        trigram_index_queue(index, id, keys, keyCount, 0);
+        return;
+    }
+
+    for (size_t k = 0; k < keyCount; k++) {
+        TrigramPosting *posting = trigram_lookup(index, keys[k]);
+        if (posting == NULL) continue;
+
+        size_t pos = posting_lower_bound(posting->ids, posting->count, id);
+        if (pos < posting->count && posting->ids[pos] == id) {
+            memmove(&posting->ids[pos], &posting->ids[pos + 1], (posting->count - pos - 1) * sizeof(int));
+            posting->count--;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_index_build
+// PURPOSE : Bulk (re)build after OPEN: append IDs unsorted, sort each list once.
+//           Much cheaper than inserting into sorted lists one by one.
+// ACCEPTS : useProgramme = 0 -> index names, 1 -> index programmes
+// -----------------------------------------------------------------------------
+static void trigram_index_build(TrigramIndex *index, int useProgramme)
+{
+    char normalized[MAX_STR];
+    uint32_t keys[MAX_TRIGRAMS];
+
+    trigram_index_free(index);
+
+    for (size_t i = 0; i < db.size; i++) {
+        const Student *current = row_at(i);
+        normalize_text(useProgramme ? current->programme : current->name, normalized, sizeof(normalized));
+        size_t keyCount = collect_trigrams(normalized, 1, keys);
+
+        for (size_t k = 0; k < keyCount; k++) {
+            TrigramPosting *posting = trigram_get_or_add(index, keys[k]);
+            if (posting == NULL || !posting_reserve(posting)) {
+                printf(YELLOW "CMS Warning: Out of memory while building text index.\n" RESET);
+                return;
+            }
+            posting->ids[posting->count++] = current->id;
+        }
+    }
+
+    for (size_t i = 0; i < index->cap; i++) {
+        TrigramPosting *posting = &index->slots[i];
+        if (posting->key != 0 && posting->count > 1) {
+            qsort(posting->ids, posting->count, sizeof(int), compare_int);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// COMPARATOR: compare_trigram_edits
+// PURPOSE   : Groups queued edits by key, then ID, in the order they were made.
+// -----------------------------------------------------------------------------
+static int compare_trigram_edits(const void *a, const void *b)
+{
+    const TrigramEdit *x = (const TrigramEdit *)a;
+    const TrigramEdit *y = (const TrigramEdit *)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    if (x->id != y->id) return x->id < y->id ? -1 : 1;
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+//Radix key of an edit: 24-bit trigram, then the ID (sign bit flipped so it sorts as unsigned)
+static inline uint64_t trigram_edit_radix(const TrigramEdit *edit)
+{
+    return ((uint64_t)(edit->key & 0xFFFFFFu) << 32) | ((uint32_t)edit->id ^ 0x80000000u);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_edits_sort
+// PURPOSE : Sorts queued edits like compare_trigram_edits with an LSD radix
+//           sort on (24-bit trigram, ID): edits are queued in order, and a
+//           stable sort keeps that order within each (key, ID). Falls back to
+//           qsort when the second buffer cannot be allocated.
+// -----------------------------------------------------------------------------
+static void trigram_edits_sort(TrigramEdit *edits, size_t count)
+{
+    if (count < 2) return; //edits may be NULL when nothing is queued
+    TrigramEdit *buffer = malloc(count * sizeof(TrigramEdit));
+    if (buffer == NULL) {
+        qsort(edits, count, sizeof(TrigramEdit), compare_trigram_edits);
+        return;
+    }
+
+    TrigramEdit *from = edits, *to = buffer;
+    for (int shift = 0; shift < 56; shift += 8) {
+        size_t counts[256] = {0};
+        for (size_t i = 0; i < count; i++) {
+            counts[(trigram_edit_radix(&from[i]) >> shift) & 0xFF]++;
+        }
+        if (counts[(trigram_edit_radix(&from[0]) >> shift) & 0xFF] == count)
+            continue; //every edit has the same byte here
+
+        size_t offset = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t bucketSize = counts[b];
+            counts[b] = offset;
+            offset += bucketSize;
+        }
+        for (size_t i = 0; i < count; i++) {
+            to[counts[(trigram_edit_radix(&from[i]) >> shift) & 0xFF]++] = from[i];
+        }
+        TrigramEdit *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != edits) memcpy(edits, from, count * sizeof(TrigramEdit));
+    free(buffer);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_index_flush
+// PURPOSE : Ends a bulk batch. The queued edits are sorted, and every touched
+//           posting list is rebuilt by one merge with its edits (the last
+//           edit of an ID decides whether it stays), so the cost is the
+//           batch plus the lists it touches, not one memmove per record.
+// ACCEPTS : useProgramme -> which field a full rebuild would read
+// -----------------------------------------------------------------------------
+static void trigram_index_flush(TrigramIndex *index, int useProgramme)
+{
+    int *scratch = NULL;
+    uint32_t scratchCap = 0;
+
+    if (!index->deferred) return;
+    index->deferred = 0;
+    trigram_edits_sort(index->edits, index->editCount);
+
+    for (size_t e = 0; e < index->editCount && !index->editsLost; ) {
+        uint32_t key = index->edits[e].key;
+        size_t groupEnd = e;
+        size_t adds = 0;
+        while (groupEnd < index->editCount && index->edits[groupEnd].key == key) {
+            adds += index->edits[groupEnd].order & 1u;
+            groupEnd++;
+        }
+
+        TrigramPosting *posting = adds ? trigram_get_or_add(index, key) : trigram_lookup(index, key);
+        size_t needed = (posting ? posting->count : 0) + adds;
+        if (posting && needed > scratchCap) {
+            int *grown = realloc(scratch, needed * sizeof(int));
+            if (grown == NULL) {
+                index->editsLost = 1;
+                break;
+            }
+            scratch = grown;
+            scratchCap = (uint32_t)needed;
+        }
+
+        if (posting) {
+            size_t i = 0, out = 0;
+            while (e < groupEnd) {
+                //Last edit of this ID decides
+                int id = index->edits[e].id;
+                int present = 0;
+                while (e < groupEnd && index->edits[e].id == id) present = index->edits[e++].order & 1u;
+
+                while (i < posting->count && posting->ids[i] < id) scratch[out++] = posting->ids[i++];
+                if (i < posting->count && posting->ids[i] == id) i++;
+                if (present) scratch[out++] = id;
+            }
+            while (i < posting->count) scratch[out++] = posting->ids[i++];
+
+            //The merged list becomes the posting list; the old one is the next scratch buffer
+            int *old = posting->ids;
+            uint32_t oldCap = posting->cap;
+            posting->ids = scratch;
+            posting->cap = scratchCap;
+            posting->count = (uint32_t)out;
+            scratch = old;
+            scratchCap = oldCap;
+        }
+        e = groupEnd;
+    }
+    free(scratch);
+
+    if (index->editsLost) {
+        index->editsLost = 0;
+        trigram_index_build(index, useProgramme);
+    }
+    free(index->edits);
+    index->edits = NULL;
+    index->editCount = index->editCap = 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: compare_posting_size
+// PURPOSE : Orders posting lists shortest first, so intersections stay small.
+// -----------------------------------------------------------------------------
+static int compare_posting_size(const void *a, const void *b)
+{
+    const TrigramPosting *x = *(TrigramPosting * const *)a;
+    const TrigramPosting *y = *(TrigramPosting * const *)b;
+    return (x->count > y->count) - (x->count < y->count);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_candidates
+// PURPOSE : Intersects the posting lists of every trigram of the query.
+//           The result is a superset of the real matches (must be verified).
+// RETURNS : number of candidate IDs (malloc'd sorted array in *out, may be NULL)
+//           SIZE_MAX -> query too short for the index (caller must scan)
+// -----------------------------------------------------------------------------
+static size_t trigram_candidates(const TrigramIndex *index, const char *normalizedQuery, int **out)
+{
+    uint32_t keys[MAX_TRIGRAMS];
+    TrigramPosting *lists[MAX_TRIGRAMS];
+
+    *out = NULL;
+    size_t keyCount = collect_trigrams(normalizedQuery, 0, keys);
+    if (keyCount == 0) return SIZE_MAX;
+
+    for (size_t k = 0; k < keyCount; k++) {
+        lists[k] = trigram_lookup(index, keys[k]);
+        if (lists[k] == NULL || lists[k]->count == 0) return 0; //trigram never occurs
+    }
+    qsort(lists, keyCount, sizeof(lists[0]), compare_posting_size);
+
+    //Start from the shortest list, then keep only IDs present in every other list
+    size_t count = lists[0]->count;
+    int *result = malloc(count * sizeof(int));
+    if (result == NULL) return SIZE_MAX;
+    memcpy(result, lists[0]->ids, count * sizeof(int));
+
+    for (size_t k = 1; k < keyCount && count > 0; k++) {
+        const TrigramPosting *posting = lists[k];
+        size_t kept = 0;
+        size_t from = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            //Binary search in the longer list, resuming where the last search ended
+            from += posting_lower_bound(posting->ids + from, posting->count - from, result[i]);
+            if (from < posting->count && posting->ids[from] == result[i]) {
+                result[kept++] = result[i];
+            }
+        }
+        count = kept;
+    }
+
+    *out = result;
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: text_matches
+// PURPOSE : Final check for a candidate: does its normalized text contain
+//           the normalized query?
+// -----------------------------------------------------------------------------
+static int text_matches(const char *text, const char *normalizedQuery)
+{
+    char normalized[MAX_STR];
+    normalize_text(text, normalized, sizeof(normalized));
+    return strstr(normalized, normalizedQuery) != NULL;
+}
+
+
+/* ---------------------------------------------------- */
+/* Ordered Key Index (paging)                           */
+/* ---------------------------------------------------- */
+//
+// Sorted copies of the table's keys for keyset paging (SHOW ALL ... LIMIT,
+// QUERY <prefix> LIMIT, NEXT): IDs ascending, and (mark, ID) pairs packed
+// into one integer, ascending. A page is a binary search for the cursor
+// plus a walk over the page, O(log n + page), whatever the table size.
+// Built by the first paged command, then kept in sync by Table Maintenance
+// (binary search + memmove per change, like the text posting lists). OPEN
+// and large batches drop it, so it is rebuilt once when next needed.
+
+static struct {
+    int built;
+    int *ids;          //ascending
+    uint64_t *marks;   //mark_key() values, ascending
+    size_t count, cap;
+} key_index;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: mark_order_bits
+// PURPOSE : Maps a mark to an unsigned integer with the same order
+//           (-0.0 sorts as 0.0).
+// -----------------------------------------------------------------------------
+static uint32_t mark_order_bits(float mark)
+{
+    if (mark == 0.0f) mark = 0.0f;
+    uint32_t bits;
+    memcpy(&bits, &mark, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: mark_key
+// PURPOSE : (mark, ID) as one integer: by mark, then by ID.
+// -----------------------------------------------------------------------------
+static inline uint64_t mark_key(float mark, int id)
+{
+    return ((uint64_t)mark_order_bits(mark) << 32) | (uint32_t)((int64_t)id - (int64_t)INT_MIN);
+}
+
+static inline int mark_key_id(uint64_t key)
+{
+    return (int)((int64_t)(uint32_t)key + (int64_t)INT_MIN);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: key_ids_lower_bound / key_marks_lower_bound
+// RETURNS : first position whose key is >= the one given
+// -----------------------------------------------------------------------------
+static size_t key_ids_lower_bound(int id)
+{
+    size_t lo = 0, hi = key_index.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (key_index.ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static size_t key_marks_lower_bound(uint64_t key)
+{
+    size_t lo = 0, hi = key_index.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (key_index.marks[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: key_index_drop
+// PURPOSE : Frees the index; the next paged command rebuilds it.
+// -----------------------------------------------------------------------------
+static void key_index_drop(void)
+{
+    free(key_index.ids);
+    free(key_index.marks);
+    memset(&key_index, 0, sizeof(key_index));
+}
+
+// -----------------------------------------------------------------------------
+// COMPARATOR: compare_int_asc / compare_u64_asc
+// -----------------------------------------------------------------------------
+static int compare_int_asc(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_u64_asc(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: key_index_build
+// PURPOSE : Builds the index from the table if it is not built yet.
+// RETURNS : 1 -> ready, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int key_index_build(void)
+{
+    if (key_index.built) return 1;
+
+    size_t cap = db.size ? db.size : 1;
+    int *ids = malloc(cap * sizeof(int));
+    uint64_t *marks = malloc(cap * sizeof(uint64_t));
+    if (ids == NULL || marks == NULL) {
+        free(ids);
+        free(marks);
+        return 0;
+    }
+    for (size_t i = 0; i < db.size; i++) {
+        const Student *record = row_at(i);
+        ids[i] = record->id;
+        marks[i] = mark_key(record->mark, record->id);
+    }
+    qsort(ids, db.size, sizeof(int), compare_int_asc);
+    qsort(marks, db.size, sizeof(uint64_t), compare_u64_asc);
+
+    key_index_drop();
+    key_index.ids = ids;
+    key_index.marks = marks;
+    key_index.count = db.size;
+    key_index.cap = cap;
+    key_index.built = 1;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: key_index_add
+// PURPOSE : Registers a new record. Drops the index if it cannot grow.
+// -----------------------------------------------------------------------------
+static void key_index_add(int id, float mark)
+{
+    if (!key_index.built) return;
+
+    if (key_index.count == key_index.cap) {
+        size_t newCap = key_index.cap * 2;
+        int *ids = realloc(key_index.ids, newCap * sizeof(int));
+        if (ids != NULL) key_index.ids = ids;
+        uint64_t *marks = ids ? realloc(key_index.marks, newCap * sizeof(uint64_t)) : NULL;
+        if (marks == NULL) {
+            key_index_drop();
+            return;
+        }
+        key_index.marks = marks;
+        key_index.cap = newCap;
+    }
+
+    size_t pos = key_ids_lower_bound(id);
+    memmove(&key_index.ids[pos + 1], &key_index.ids[pos], (key_index.count - pos) * sizeof(int));
+    key_index.ids[pos] = id;
+
+    uint64_t key = mark_key(mark, id);
+    pos = key_marks_lower_bound(key);
+    memmove(&key_index.marks[pos + 1], &key_index.marks[pos], (key_index.count - pos) * sizeof(uint64_t));
+    key_index.marks[pos] = key;
+
+    key_index.count++;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: key_index_remove
+// PURPOSE : Unregisters a record (its current mark locates the mark entry).
+// -----------------------------------------------------------------------------
+static void key_index_remove(int id, float mark)
+{
+    if (!key_index.built) return;
+
+    size_t pos = key_ids_lower_bound(id);
+    size_t markPos = key_marks_lower_bound(mark_key(mark, id));
+    if (pos == key_index.count || key_index.ids[pos] != id ||
+        markPos == key_index.count || key_index.marks[markPos] != mark_key(mark, id)) {
+        key_index_drop(); //out of step: rebuild on next use
+        return;
+    }
+
+    key_index.count--;
+    memmove(&key_index.ids[pos], &key_index.ids[pos + 1], (key_index.count - pos) * sizeof(int));
+    memmove(&key_index.marks[markPos], &key_index.marks[markPos + 1], (key_index.count - markPos) * sizeof(uint64_t));
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: key_index_set_mark
+// PURPOSE : Moves a record's mark entry after UPDATE changed the mark.
+// -----------------------------------------------------------------------------
+static void key_index_set_mark(int id, float oldMark, float newMark)
+{
+    if (!key_index.built || mark_key(oldMark, id) == mark_key(newMark, id)) return;
+
+    uint64_t oldKey = mark_key(oldMark, id), newKey = mark_key(newMark, id);
+    size_t from = key_marks_lower_bound(oldKey);
+    if (from == key_index.count || key_index.marks[from] != oldKey) {
+        key_index_drop();
+        return;
+    }
+
+    //Shift the entries between the old and the new place by one
+    size_t to = key_marks_lower_bound(newKey);
+    if (to > from) {
+        to--;
+        memmove(&key_index.marks[from], &key_index.marks[from + 1], (to - from) * sizeof(uint64_t));
+    } else {
+        memmove(&key_index.marks[to + 1], &key_index.marks[to], (from - to) * sizeof(uint64_t));
+    }
+    key_index.marks[to] = newKey;
+}
+
+
+/* ---------------------------------------------------- */
+/* Table Maintenance (keeps indexes in sync)            */
+/* ---------------------------------------------------- */
+
+// -----------------------------------------------------------------------------
+// FUNCTION: table_rebuild_indexes
+// PURPOSE : Rebuilds the ID index and both text indexes from the table
+//           (the ordered key index is rebuilt when next needed).
+//           Called after OPEN replaces the whole table.
+// -----------------------------------------------------------------------------
+static void table_rebuild_indexes(void)
+{
+    table_generation++;
+    table_unsaved = 0;
+    id_index_rebuild();
+    key_index_drop(); //rebuilt by the next paged command
+    trigram_index_build(&name_trigrams, 0);
+    trigram_index_build(&programme_trigrams, 1);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: table_append
+// PURPOSE : Adds a record at the end of the table and registers it in every
+//           index. All inserts (INSERT, UNDO DELETE) go through here.
+// RETURNS : 1 -> success
+//           0 -> out of memory (table unchanged, error printed)
+// -----------------------------------------------------------------------------
+static int table_append(const Student *studentObject)
+{
+    RecHandle handle = store_append(&db, studentObject);
+    if (handle == NO_HANDLE) {
+        printf(RED "CMS Error: Out of memory, record %d not stored.\n" RESET, studentObject->id);
+        return 0;
+    }
+
+    table_generation++;
+    table_unsaved = 1;
+    id_index_put(studentObject->id, handle);
+    key_index_add(studentObject->id, studentObject->mark);
+    trigram_index_add(&name_trigrams, studentObject->id, studentObject->name);
+    trigram_index_add(&programme_trigrams, studentObject->id, studentObject->programme);
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: table_compact
+// PURPOSE : Runs store_compact() and re-points the ID index at the new
+//           handles. Text indexes hold IDs, so they are unaffected.
+// RETURNS : number of records moved
+// -----------------------------------------------------------------------------
+static size_t table_compact(void)
+{
+    size_t moved = store_compact(&db);
+    if (moved > 0) {
+        id_index_rebuild();
+    }
+    chunk_pool_trim(); //Actually give the memory back
+    return moved;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: table_remove_at
+// PURPOSE : Removes the record at 'pos' (swap-delete, O(1)) and keeps the
+//           indexes in sync. Compacts automatically once more than half of
+//           the allocated slots are free.
+// -----------------------------------------------------------------------------
+static void table_remove_at(size_t pos)
+{
+    const Student *removed = row_at(pos);
+
+    table_generation++;
+    table_unsaved = 1;
+    id_index_remove(removed->id);
+    key_index_remove(removed->id, removed->mark);
+    trigram_index_remove(&name_trigrams, removed->id, removed->name);
+    trigram_index_remove(&programme_trigrams, removed->id, removed->programme);
+
+    store_remove_at(&db, pos);
+
+    if (db.freeCount >= COMPACT_MIN_FREE && db.freeCount > db.size) {
+        table_compact();
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: table_replace_at
+// PURPOSE : Overwrites the record at 'pos' (same ID) and re-indexes any
+//           text field that changed. Used by UPDATE and UNDO UPDATE.
+// -----------------------------------------------------------------------------
+static void table_replace_at(size_t pos, const Student *studentObject)
+{
+    Student *current = row_at(pos);
+
+    table_generation++;
+    table_unsaved = 1;
+    key_index_set_mark(current->id, current->mark, studentObject->mark);
+    if (strcmp(current->name, studentObject->name) != 0) {
+        trigram_index_remove(&name_trigrams, current->id, current->name);
+        trigram_index_add(&name_trigrams, studentObject->id, studentObject->name);
+    }
+    if (strcmp(current->programme, studentObject->programme) != 0) {
+        trigram_index_remove(&programme_trigrams, current->id, current->programme);
+        trigram_index_add(&programme_trigrams, studentObject->id, studentObject->programme);
+    }
+
+    store_write(&db, db.order[pos], studentObject);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: table_bulk_begin / table_bulk_end
+// PURPOSE : Bracket a batch of table changes (COMMIT, MERGE, their UNDO).
+//           A large batch queues its text index edits and merges them into
+//           the posting lists in one pass at the end (see trigram_index_flush).
+// -----------------------------------------------------------------------------
+static void table_bulk_begin(size_t changeCount)
+{
+    int bulk = changeCount >= BULK_CHANGE_MIN;
+    name_trigrams.deferred = bulk;
+    programme_trigrams.deferred = bulk;
+    if (bulk) key_index_drop(); //one rebuild beats a memmove per change
+}
+
+static void table_bulk_end(void)
+{
+    trigram_index_flush(&name_trigrams, 0);
+    trigram_index_flush(&programme_trigrams, 1);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trigram_index_bytes
+// PURPOSE : Heap memory used by a text index (for the MEMORY command).
+// -----------------------------------------------------------------------------
+static size_t trigram_index_bytes(const TrigramIndex *index)
+{
+    size_t bytes = index->cap * sizeof(TrigramPosting);
+    for (size_t i = 0; i < index->cap; i++) {
+        bytes += index->slots[i].cap * sizeof(int);
+    }
+    return bytes;
+}
+
+/* --------------------------------------------------- */
+/*  Helper functions for update & delete operations    */
+/* --------------------------------------------------- */
+
+// -----------------------------------------------------------------------------
+// FUNCTION: trim_newline
+// PURPOSE : Removes trailing '\n' or '\r' for string pointer
+// -----------------------------------------------------------------------------
+static void trim_newline(char *string) {
+
+    if (string == NULL) return; 
+
+    size_t stringLength = strlen(string);
+
+    while (stringLength != 0 && (string[stringLength-1] == '\n' || string[stringLength-1] == '\r'))
+    {
+        stringLength--;
+        string[stringLength] = '\0';
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: print_diff_row
+// PURPOSE : Shows a side-by-side comparison of BEFORE vs AFTER values 
+//           for a single field, highlighting changed fields in GREEN.
+// -----------------------------------------------------------------------------
+static void print_diff_row(const char *label, const char *before, const char *after)
+{
+    int isChanged = strcmp(before, after) != 0;
+
+    //Print:
     //Field | BeforeValue | AfterValue (coloured if changed)
     printf("%-12s | %-30s | %s%-30s%s\n",
            label,
@@ -303,988 +3124,9777 @@ static void print_diff_row(const char *label, const char *before, const char *af
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: prompt_edit_str
-// PURPOSE : Asks the user whether they want to edit a field's string value.
-// USE     : Press ENTER -> keep old value
-// RETURNS : 1 -> value changed
-//           0 -> kept old value
+// FUNCTION: prompt_edit_str
+// PURPOSE : Asks the user whether they want to edit a field's string value.
+// USE     : Press ENTER -> keep old value
+// RETURNS : 1 -> value changed
+//           0 -> kept old value
+// -----------------------------------------------------------------------------
+static int prompt_edit_str(const char *fieldLabel, char *stringDestination, size_t cap, const char *current)
+{
+    char userBuffer[256];
+
+    printf("%s (Enter to keep \"%s\"): ", fieldLabel, current); //ask user
+
+    //User Input
+    if (!read_input_line(userBuffer, sizeof(userBuffer))) { //If read fails(etc interrupts) -> no change
+        return 0;
+    }
+
+    if (userBuffer[0] == '\n') //User presses enter -> no change
+        return 0;
+
+    trim_newline(userBuffer);
+    snprintf(stringDestination, cap, "%s", userBuffer); //truncates to cap - 1 characters
+
+    return 1;
+}
+
+
+// -----------------------------------------------------------------------------
+// FUNCTION: prompt_edit_mark
+// PURPOSE : Allows the user to update a student's mark, with validation.
+// USE     : Press ENTER -> keep old mark
+//           Otherwise, must enter a valid number between 0 and 100.
+// RETURNS : 1 -> marks changed
+//           0 -> kept old marks
+// -----------------------------------------------------------------------------
+static int prompt_edit_mark(float *outputMark, float currentMark)
+{
+    char userBuffer[128];
+
+    printf("Mark (Enter to keep %.1f): ", currentMark);
+
+    if (!read_input_line(userBuffer, sizeof(userBuffer)) || userBuffer[0] == '\n') //User presses enter -> no change
+    {
+        return 0;
+    }
+    trim_newline(userBuffer);
+
+    //Convert string input to number
+    char *endPtr = NULL;
+    double markValue = strtod(userBuffer, &endPtr);
+
+    //Validate input:
+    //Check endPtr != '\0' means non-numeric, endPtr == userBuffer means no conversion
+    //Ensures marks are between 0 and 100
+    if (endPtr == userBuffer || *endPtr != '\0' || markValue < 0.0 || markValue > 100.0) {
+        printf(RED "Invalid mark. Please enter a number from 0 to 100.\n" RESET);
+        return prompt_edit_mark(outputMark, currentMark);
+    }
+    *outputMark = (float)markValue;
+
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: is_all_digits
+// PURPOSE : Checks if a string consists entirely of digit characters.
+// RETURNS : 1 → all characters are digits
+//           0 → contains non-digit characters or is empty
+// -----------------------------------------------------------------------------
+static int is_all_digits(const char *s)
+{
+    if (!s || !*s) return 0;
+
+    for (const char *p = s; *p; ++p) {
+        if (!isdigit((unsigned char)*p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: parse_exact_id_arg
+// PURPOSE : For DELETE / UPDATE where we require an exact 7-digit ID.
+//           - Must be all digits
+//           - Must be length 7
+// RETURNS : 1 on success, 0 on invalid input
+// -----------------------------------------------------------------------------
+static int parse_exact_id_arg(const char *arg, int *out_id)
+{
+    if (!arg || !*arg) {
+        printf("Enter a valid 7-digit ID.\n");
+        return 0;
+    }
+
+    // Check all digits
+    const char *p = arg;
+    int len = 0;
+    while (*p) {
+        if (!isdigit((unsigned char)*p)) {
+            printf(RED "Not a valid ID.\n" RESET);
+            return 0;
+        }
+        len++;
+        p++;
+    }
+
+    // Enforce exactly 7 digits
+    if (len != 7) {
+        printf("Enter a valid 7-digit ID.\n");
+        return 0;
+    }
+
+    *out_id = atoi(arg);
+    return 1;
+}
+
+
+// -----------------------------------------------------------------------------
+// FUNCTION: confirm_delete_by_id
+// PURPOSE : Protects against accidental deletion by requiring user to type the exact ID to confirm
+//           Typing 'N' cancels the operation
+// RETURNS : 1 -> confirmed (user entered matching ID)
+//           0 -> cancelled / mismatch
+// -----------------------------------------------------------------------------
+static int confirm_delete_by_id(int expectedId)
+{
+    printf("Type the ID " BOLD "%d" RESET " to confirm delete (or 'N' to cancel): ", expectedId);
+
+    char userBuffer[64];
+    if (!read_input_line(userBuffer, sizeof(userBuffer))) //check if userbuffer is null
+    {
+        return 0;
+    }
+    trim_newline(userBuffer);
+
+    //Condition for cancelling operation
+    if (userBuffer[0] && (userBuffer[0] == 'n' || userBuffer[0] == 'N') && userBuffer[1] == '\0')
+    {
+        return 0;
+    }
+
+    //Convert string input to number
+    char *endPtr = NULL;
+    long inputID = strtol(userBuffer, &endPtr, 10);
+
+    //Check endPtr != '\0' means non-numeric, endPtr == userBuffer means no conversion
+    if (endPtr == userBuffer || *endPtr != '\0')
+    {
+        return 0;
+    }
+
+    //Returns TRUE if the number matches expected ID
+    return (inputID == expectedId);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: read_valid_id
+// PURPOSE : Prompts user to enter a valid 7-digit student ID.
+// RETURNS: positive ID on success, -1 on EOF
+// -----------------------------------------------------------------------------
+static int read_valid_id(void)
+{
+    char buf[256];
+
+    while (1) {
+        printf("ID: ");
+        if (!read_input_line(buf, sizeof(buf))) {
+            // Input stream closed (EOF)
+            return -1;
+        }
+
+        trim_newline(buf);
+
+        // Skip leading spaces
+        char *p = buf;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        // Empty input
+        if (*p == '\0') {
+            printf(RED "Invalid ID. Please enter an ID with 7 digits.\n" RESET);
+            continue;
+        }
+
+        // Check all characters are digits and length is exactly 7
+        int len = 0;
+        int allDigits = 1;
+        for (; p[len]; len++) {
+            if (!isdigit((unsigned char)p[len])) {
+                allDigits = 0;
+                break;
+            }
+        }
+
+        if (!allDigits || len != 7) {
+            printf(RED "Invalid ID. Please enter an ID with 7 digits.\n" RESET);
+            continue;
+        }
+
+        int id = atoi(p);
+
+        // Check duplicate
+        if (query_exists(id)) {
+            printf(RED "Error: Student with ID %d already exists.\n" RESET, id);
+            continue;
+        }
+
+        return id;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: read_nonempty_field (Name / Programme)
+// PURPOSE: Prompts user to enter a non-empty string for the given label.
+// RETURNS: 1 on success, 0 on EOF
+// -----------------------------------------------------------------------------
+static int read_nonempty_field(const char *label, char *out, size_t cap)
+{
+    char buf[256];
+
+    while (1) {
+        printf("%s: ", label);
+        if (!read_input_line(buf, sizeof(buf))) {
+            return 0;   // EOF
+        }
+
+        // Check if the input line was longer than our buffer
+        size_t len_buf = strlen(buf);
+        if (len_buf > 0 && buf[len_buf - 1] != '\n') {
+            // Input too long, discard rest of line
+            discard_rest_of_line();
+        }
+
+        trim_newline(buf);
+
+        // Skip leading spaces
+        char *p = buf;
+        while (*p && isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        if (*p == '\0') {
+            printf(RED "Invalid %s. Please enter a valid %s.\n" RESET, label, label);
+            continue;
+        }
+
+        // If input is longer than our destination buffer, truncate and warn
+        if (strlen(p) >= cap) {
+            printf(YELLOW "%s is too long, it will be truncated to %zu characters.\n" RESET,
+                   label, cap - 1);
+        }
+
+        strncpy(out, p, cap - 1);
+        out[cap - 1] = '\0';
+        return 1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: read_valid_mark (0 to 100, non-empty)
+// PURPOSE: Prompts user to enter a valid mark between 0 and 100.
+// RETURNS: mark value on success, -1.0f on EOF
+// -----------------------------------------------------------------------------
+static float read_valid_mark(void)
+{
+    char buf[128];
+
+    while (1) {
+        printf("Mark: ");
+        if (!read_input_line(buf, sizeof(buf))) {
+            return -1.0f;  // EOF
+        }
+
+        trim_newline(buf);
+
+        // Empty input
+        if (buf[0] == '\0') {
+            printf(RED "Invalid Mark. Please enter a number from 0 to 100.\n" RESET);
+            continue;
+        }
+
+        char *endp = NULL;
+        double mv = strtod(buf, &endp);
+
+        // Invalid number or extra characters or out of range
+        if (endp == buf || *endp != '\0' || mv < 0.0 || mv > 100.0) {
+            printf(RED "Invalid Mark. Please enter a number from 0 to 100.\n" RESET);
+            continue;
+        }
+
+        return (float)mv;
+    }
+}
+
+
+/* ---------------------------------------------------- */
+/* Result Cache (repeated read commands)                */
+/* ---------------------------------------------------- */
+//
+// SHOW ALL [SORT BY ...], SHOW SUMMARY and QUERY <prefix> are cached as the
+// exact text they printed, keyed on the normalised command line. An entry is
+// only valid while table_generation is unchanged, so any mutation, OPEN, UNDO
+// or re-sort invalidates it without having to track what changed.
+
+#define RESULT_CACHE_SLOTS 32
+#define RESULT_CACHE_DEFAULT_LIMIT (8u * 1024u * 1024u) //bytes of cached output
+#define RESULT_KEY_MAX 96
+
+typedef struct {
+    char key[RESULT_KEY_MAX];  //normalised command, "" -> unused slot
+    unsigned long generation;  //table_generation when the output was produced
+    char *output;              //rendered output, exactly as printed
+    size_t length;
+    unsigned long lastUsed;    //LRU tick
+} ResultCacheEntry;
+
+static struct {
+    ResultCacheEntry entries[RESULT_CACHE_SLOTS];
+    size_t bytes;              //sum of output lengths
+    size_t limit;              //0 -> cache disabled
+    size_t hits, misses;
+    unsigned long tick;
+
+    int capturing;             //1 -> out_printf also appends to capture
+    char captureKey[RESULT_KEY_MAX];
+    char *capture;
+    size_t captureLength, captureCap;
+    int captureFailed;
+} result_cache = {.limit = RESULT_CACHE_DEFAULT_LIMIT};
+
+// -----------------------------------------------------------------------------
+// FUNCTION: out_printf
+// PURPOSE : printf for cacheable commands. Prints as usual and, while a
+//           result is being captured, keeps a copy of the text.
+// -----------------------------------------------------------------------------
+static void out_printf(const char *formatString, ...)
+{
+    va_list args;
+    va_start(args, formatString);
+
+    if (!result_cache.capturing) {
+        vprintf(formatString, args);
+        va_end(args);
+        return;
+    }
+
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(NULL, 0, formatString, copy);
+    va_end(copy);
+
+    if (length >= 0 && !result_cache.captureFailed) {
+        size_t needed = result_cache.captureLength + (size_t)length + 1;
+        if (needed > result_cache.captureCap) {
+            size_t newCap = result_cache.captureCap ? result_cache.captureCap : 4096;
+            while (newCap < needed) newCap *= 2;
+            char *grown = realloc(result_cache.capture, newCap);
+            if (grown == NULL) {
+                result_cache.captureFailed = 1;
+            } else {
+                result_cache.capture = grown;
+                result_cache.captureCap = newCap;
+            }
+        }
+        if (!result_cache.captureFailed) {
+            vsnprintf(result_cache.capture + result_cache.captureLength, (size_t)length + 1, formatString, args);
+            fputs(result_cache.capture + result_cache.captureLength, stdout);
+            result_cache.captureLength += (size_t)length;
+            va_end(args);
+            return;
+        }
+    }
+
+    vprintf(formatString, args);
+    va_end(args);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: result_cache_key
+// PURPOSE : Builds the normalised cache key (upper case, single spaces,
+//           defaults filled in) for the cacheable command forms:
+//             SHOW ALL
+//             SHOW ALL SORT BY ID|NAME|PROGRAMME|MARK [ASC|DESC]
+//             SHOW SUMMARY
+//             QUERY <4-6 digit prefix>
+// RETURNS : 1 -> cacheable, key written; 0 -> not cacheable
+// -----------------------------------------------------------------------------
+static int result_cache_key(const char *commandLine, char key[RESULT_KEY_MAX])
+{
+    char words[7][16];
+    int count = 0;
+    const char *p = commandLine;
+
+    while (*p) {
+        while (isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+        if (count == 7) return 0;
+
+        size_t length = 0;
+        while (*p && !isspace((unsigned char)*p)) {
+            if (length == sizeof(words[0]) - 1) return 0;
+            words[count][length++] = (char)toupper((unsigned char)*p++);
+        }
+        words[count++][length] = '\0';
+    }
+
+    if (count == 2 && strcmp(words[0], "SHOW") == 0 &&
+        (strcmp(words[1], "ALL") == 0 || strcmp(words[1], "SUMMARY") == 0)) {
+        snprintf(key, RESULT_KEY_MAX, "SHOW %s", words[1]);
+        return 1;
+    }
+    if ((count == 5 || count == 6) && strcmp(words[0], "SHOW") == 0 && strcmp(words[1], "ALL") == 0 &&
+        strcmp(words[2], "SORT") == 0 && strcmp(words[3], "BY") == 0 &&
+        (strcmp(words[4], "ID") == 0 || strcmp(words[4], "MARK") == 0 ||
+         strcmp(words[4], "NAME") == 0 || strcmp(words[4], "PROGRAMME") == 0) &&
+        (count == 5 || strcmp(words[5], "ASC") == 0 || strcmp(words[5], "DESC") == 0)) {
+        snprintf(key, RESULT_KEY_MAX, "SHOW ALL SORT BY %s %s", words[4], count == 6 ? words[5] : "ASC");
+        return 1;
+    }
+    if (count == 2 && strcmp(words[0], "QUERY") == 0 && is_all_digits(words[1]) &&
+        strlen(words[1]) >= 4 && strlen(words[1]) <= 6) {
+        snprintf(key, RESULT_KEY_MAX, "QUERY %s", words[1]);
+        return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: result_cache_evict
+// PURPOSE : Frees one entry's output and marks the slot unused.
+// -----------------------------------------------------------------------------
+static void result_cache_evict(ResultCacheEntry *entry)
+{
+    result_cache.bytes -= entry->length;
+    free(entry->output);
+    entry->output = NULL;
+    entry->length = 0;
+    entry->key[0] = '\0';
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: result_cache_clear
+// -----------------------------------------------------------------------------
+static void result_cache_clear(void)
+{
+    for (int i = 0; i < RESULT_CACHE_SLOTS; i++) {
+        if (result_cache.entries[i].key[0]) result_cache_evict(&result_cache.entries[i]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: result_cache_begin
+// PURPOSE : Called before a command runs. If the command is cacheable and a
+//           current entry exists, prints it and counts a hit. Otherwise
+//           counts a miss and starts capturing the command's output.
+// RETURNS : 1 -> served from cache (skip the command), 0 -> run the command
+// -----------------------------------------------------------------------------
+static int result_cache_begin(const char *commandLine, int tableOpen)
+{
+    char key[RESULT_KEY_MAX];
+    if (result_cache.limit == 0 || !tableOpen || !result_cache_key(commandLine, key)) {
+        return 0;
+    }
+
+    for (int i = 0; i < RESULT_CACHE_SLOTS; i++) {
+        ResultCacheEntry *entry = &result_cache.entries[i];
+        if (entry->key[0] && strcmp(entry->key, key) == 0) {
+            if (entry->generation == table_generation) {
+                fwrite(entry->output, 1, entry->length, stdout);
+                entry->lastUsed = ++result_cache.tick;
+                result_cache.hits++;
+                return 1;
+            }
+            result_cache_evict(entry); //stale
+            break;
+        }
+    }
+
+    result_cache.misses++;
+    result_cache.capturing = 1;
+    result_cache.captureFailed = 0;
+    result_cache.captureLength = 0;
+    memcpy(result_cache.captureKey, key, RESULT_KEY_MAX);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: result_cache_end
+// PURPOSE : Called after every command. Stores the captured output, stamped
+//           with the generation the table has now (SHOW ALL SORT BY re-sorts
+//           first, so its output matches the post-sort table). Least recently
+//           used entries are evicted to stay within the size limit.
+// -----------------------------------------------------------------------------
+static void result_cache_end(void)
+{
+    if (!result_cache.capturing) return;
+    result_cache.capturing = 0;
+
+    size_t length = result_cache.captureLength;
+    if (result_cache.captureFailed || length > result_cache.limit) return;
+
+    char *output = malloc(length ? length : 1);
+    if (output == NULL) return;
+    memcpy(output, result_cache.capture, length);
+
+    //Shrink the capture buffer again after a very large result
+    if (result_cache.captureCap > 1024 * 1024) {
+        free(result_cache.capture);
+        result_cache.capture = NULL;
+        result_cache.captureCap = 0;
+    }
+
+    //Make room: free slot + bytes under the limit
+    while (1) {
+        ResultCacheEntry *oldest = NULL;
+        int freeSlot = 0;
+        for (int i = 0; i < RESULT_CACHE_SLOTS; i++) {
+            ResultCacheEntry *entry = &result_cache.entries[i];
+            if (!entry->key[0]) { freeSlot = 1; continue; }
+            if (oldest == NULL || entry->lastUsed < oldest->lastUsed) oldest = entry;
+        }
+        if (freeSlot && result_cache.bytes + length <= result_cache.limit) break;
+        result_cache_evict(oldest);
+    }
+
+    for (int i = 0; i < RESULT_CACHE_SLOTS; i++) {
+        ResultCacheEntry *entry = &result_cache.entries[i];
+        if (entry->key[0]) continue;
+
+        memcpy(entry->key, result_cache.captureKey, RESULT_KEY_MAX);
+        entry->generation = table_generation;
+        entry->output = output;
+        entry->length = length;
+        entry->lastUsed = ++result_cache.tick;
+        result_cache.bytes += length;
+        return;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_cache_stats
+// PURPOSE : CACHE / CACHE STATS. Entry count, size, limit and hit rate.
+// -----------------------------------------------------------------------------
+static void show_cache_stats(void)
+{
+    int used = 0;
+    for (int i = 0; i < RESULT_CACHE_SLOTS; i++) {
+        if (result_cache.entries[i].key[0]) used++;
+    }
+    size_t lookups = result_cache.hits + result_cache.misses;
+
+    printf(CYAN "===== Result Cache =====\n" RESET);
+    printf("Entries        : %d/%d\n", used, RESULT_CACHE_SLOTS);
+    printf("Size           : %zu / %zu bytes\n", result_cache.bytes, result_cache.limit);
+    printf("Hits / misses  : %zu / %zu (%.1f%% hit rate)\n", result_cache.hits, result_cache.misses,
+           lookups ? 100.0 * result_cache.hits / lookups : 0.0);
+    printf("Generation     : %lu\n", table_generation);
+    for (int i = 0; i < RESULT_CACHE_SLOTS; i++) {
+        const ResultCacheEntry *entry = &result_cache.entries[i];
+        if (!entry->key[0]) continue;
+        printf("  %-30s %10zu bytes %s\n", entry->key, entry->length,
+               entry->generation == table_generation ? "" : YELLOW "(stale)" RESET);
+    }
+    printf(CYAN "========================\n" RESET);
+}
+
+/* ---------------------------------------------------- */
+/* Core Operations                                      */
+/* ---------------------------------------------------- */
+
+// -----------------------------------------------------------------------------
+// FUNCTION: open_db
+// PURPOSE : Opens a .txt database file, reads student records, parses them, and loads them into Student array.
+//
+// DETAILS :
+//   - Validates that the file exists and ends with ".txt"
+//   - Skips the metadata/header (first 5 lines)
+//   - Calls parse_line() to extract data for each line
+//   - Stores records in the chunked store (grows a chunk at a time, no copying)
+//   - Logs the action in the audit log
+//
+// RETURNS : 1 -> success
+//           0 -> failure (file missing or wrong format)
+// -----------------------------------------------------------------------------
+
+static int db_opened = 0; // Track if a DB is currently opened
+static int db_lazy = 0;   // 1 -> opened with OPEN LAZY, rows are parsed on demand
+static void lazy_close(void);
+int open_archive(const char *filePath);
+static void snapshot_publish(void);
+static int has_archive_extension(const char *filePath);
+
+// -----------------------------------------------------------------------------
+// FUNCTION: has_txt_extension
+// PURPOSE : Database files must end with ".txt".
+// -----------------------------------------------------------------------------
+static int has_txt_extension(const char *filePath)
+{
+    size_t filePathLength = strlen(filePath);
+    return filePathLength > 4 && strcmp(filePath + filePathLength - 4, ".txt") == 0;
+}
+
+//Progress of a long OPEN/SAVE. When it runs as a background task the worker
+//updates it and the REPL reads it (JOBS / WAIT), both under lock.
+typedef struct {
+    thread_mutex lock;
+    long long bytesDone, bytesTotal; //OPEN: file bytes
+    size_t rowsDone, rowsTotal;      //SAVE: rows written of rowsTotal
+    size_t skippedLines;             //OPEN: invalid lines (reported when the task ends)
+    int cancelRequested;
+    int finished, ok;                //set by the worker when it returns
+} TaskProgress;
+
+#define TASK_REPORT_ROWS 4096 //rows between progress updates / cancel checks
+
+static volatile sig_atomic_t interrupt_requested = 0; //Ctrl-C during a background task
+
+// -----------------------------------------------------------------------------
+// FUNCTION: task_progress_update
+// PURPOSE : Publishes progress and checks for CANCEL / Ctrl-C.
+// RETURNS : 1 -> keep going, 0 -> stop (cancelled)
+// -----------------------------------------------------------------------------
+static int task_progress_update(TaskProgress *progress, size_t rows, long long bytes)
+{
+    thread_mutex_lock(&progress->lock);
+    progress->rowsDone = rows;
+    progress->bytesDone = bytes;
+    if (interrupt_requested) progress->cancelRequested = 1;
+    int keepGoing = !progress->cancelRequested;
+    thread_mutex_unlock(&progress->lock);
+    return keepGoing;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: load_rows
+// PURPOSE : Reads every record line of an open database file into store,
+//           skipping the 5 header lines. progress == NULL -> invalid lines
+//           are reported as they are found; otherwise (background OPEN,
+//           nothing may print) they are counted and the load stops early
+//           when cancelled.
+// RETURNS : 1 -> whole file read, 0 -> cancelled or out of memory
+// -----------------------------------------------------------------------------
+static int load_rows(StudentStore *store, FILE *filePtr, TaskProgress *progress)
+{
+    LineReader reader;
+    const char *currentFileLine;
+    size_t lineLength;
+    long long lineOffset;
+    int lineNumber = 0; // Line number tracker, to skip headers
+    int complete = 1;
+
+    if (!line_reader_init(&reader, filePtr)) {
+        if (!progress) printf(RED "CMS Error: Out of memory.\n" RESET);
+        return 0;
+    }
+
+    TRACE_BEGIN(span, "load_rows");
+    while (line_reader_next(&reader, &currentFileLine, &lineLength, &lineOffset)) {
+        lineNumber++; // increment per line
+        if (lineNumber <= 5) { // Skip metadata and table header
+            continue;
+        }
+
+        Student currentStudent;
+        TRACE_BEGIN(parseSpan, "parse_line");
+        int parsed = parse_line(currentFileLine, lineLength, &currentStudent);
+        TRACE_END(parseSpan);
+        if (parsed) {
+            if (store_append(store, &currentStudent) == NO_HANDLE) {
+                if (!progress) printf(RED "CMS Error: Out of memory at line %d, remaining lines not loaded.\n" RESET, lineNumber);
+                complete = 0;
+                break;
+            }
+        } else if (progress) {
+            progress->skippedLines++;
+        } else {
+            TRACE_BEGIN(warnSpan, "warning");
+            printf(YELLOW "CMS Warning: Skipping invalid line %d in file.\n" RESET, lineNumber);
+            TRACE_END(warnSpan);
+        }
+
+        if (progress && lineNumber % TASK_REPORT_ROWS == 0 &&
+            !task_progress_update(progress, store->size, lineOffset + (long long)lineLength)) {
+            complete = 0;
+            break;
+        }
+    }
+    TRACE_END(span);
+
+    line_reader_free(&reader);
+    return complete;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: load_table_rows
+// PURPOSE : Loads a database file into the (already cleared) table.
+// -----------------------------------------------------------------------------
+static void load_table_rows(FILE *filePtr)
+{
+    load_rows(&db, filePtr, NULL);
+
+    TRACE_BEGIN(span, "rebuild_indexes");
+    table_rebuild_indexes(); //Bulk-build ID + text indexes once, not per line
+    TRACE_END(span);
+}
+
+int open_db(const char *filePath) {
+    if (has_archive_extension(filePath)) { //Compressed archive written by ARCHIVE
+        return open_archive(filePath);
+    }
+
+    FILE *filePtr = fopen(filePath, "r"); // open file in read mode
+
+    if (!filePtr) { // file not found or cannot be opened.
+        printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
+        return 0;
+    }
+
+    // Validate .txt extension
+    if (!has_txt_extension(filePath)) {
+
+        printf("CMS: File is not a txt file.\n");
+        fclose(filePtr);
+        return 0;
+    }
+
+    // Reset Student table before loading (chunks are pooled for reuse)
+    lazy_close();
+    store_clear(&db);
+    load_table_rows(filePtr);
+
+    fclose(filePtr);
+
+    printf("CMS: \"%s\" opened (%zu records)\n", filePath, db.size);
+    audit_log("OPEN %s (%zu records)", filePath, db.size);
+    snapshot_publish(); //starting point for --follow replicas
+
+    undo_set(OP_NONE); // Reset Undo history
+
+    db_opened = 1; // Mark DB as opened
+    return 1;
+}
+
+
+/* ---------------------------------------------------- */
+/* Lazy Open (OPEN LAZY)                                */
+/* ---------------------------------------------------- */
+
+#define LAZY_CACHE_ROWS 256 //Materialised rows kept in the LRU cache
+
+//Where a record line lives in the file
+typedef struct {
+    int id;          //Student ID (read during the scan, nothing else is parsed)
+    uint32_t length; //Line length in bytes
+    long offset;     //Byte offset of the line
+} LazyEntry;
+
+//One materialised row in the LRU cache
+typedef struct {
+    Student row;
+    size_t entry; //Index into lazy.entries
+    int prev;     //More recently used node (-1 = head)
+    int next;     //Less recently used node (-1 = tail)
+} LazyCacheNode;
+
+//State of a lazily opened file
+static struct {
+    FILE *file;
+    char path[256];
+    LazyEntry *entries;   //Sorted by ID
+    size_t count;
+    int *cacheSlotOf;     //entry index -> cache node (-1 = not cached)
+    LazyCacheNode cache[LAZY_CACHE_ROWS];
+    int cacheUsed;
+    int head, tail;       //Most / least recently used node
+    size_t hits, misses;  //Cache statistics (MEMORY)
+} lazy; //zero-initialised; lazy_close() sets up the empty list
+
+// -----------------------------------------------------------------------------
+// COMPARATOR: lazyEntryIdAsc
+// PURPOSE   : Sorts the lazy offset index by ID for binary search.
+// -----------------------------------------------------------------------------
+static int lazyEntryIdAsc(const void *a, const void *b)
+{
+    int x = ((const LazyEntry *)a)->id;
+    int y = ((const LazyEntry *)b)->id;
+    return (x > y) - (x < y);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: lazy_close
+// PURPOSE : Drops the offset index and cache of a lazily opened file.
+// -----------------------------------------------------------------------------
+static void lazy_close(void)
+{
+    if (lazy.file) fclose(lazy.file);
+    free(lazy.entries);
+    free(lazy.cacheSlotOf);
+
+    lazy.file = NULL;
+    lazy.entries = NULL;
+    lazy.cacheSlotOf = NULL;
+    lazy.count = 0;
+    lazy.cacheUsed = 0;
+    lazy.head = lazy.tail = -1;
+    lazy.hits = lazy.misses = 0;
+    db_lazy = 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: scan_line_id
+// PURPOSE : Reads just the leading ID of a record line (same rules as
+//           parse_line: digits only, 0..INT_MAX).
+// RETURNS : 1 -> ID found, 0 -> line does not start with a valid ID
+// -----------------------------------------------------------------------------
+static int scan_line_id(const char *line, size_t length, int *outId)
+{
+    const char *p = line;
+    const char *end = line + length;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+    long long value = 0;
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        if (value > INT_MAX) return 0;
+        p++;
+    }
+    if (p == digits || p == end || (*p != ' ' && *p != '\t')) return 0;
+
+    *outId = (int)value;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: open_db_lazy
+// PURPOSE : OPEN LAZY <file>. One fast pass records each line's ID and byte
+//           offset; full rows are parsed only when a command needs them.
+//           QUERY works directly on the offset index; any other command
+//           loads the whole table first (see lazy_materialize).
+// RETURNS : 1 -> success, 0 -> failure
+// -----------------------------------------------------------------------------
+int open_db_lazy(const char *filePath)
+{
+    //Binary mode so byte offsets from ftell/fseek match what we counted
+    FILE *filePtr = fopen(filePath, "rb");
+    if (!filePtr) {
+        printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
+        return 0;
+    }
+    if (!has_txt_extension(filePath)) {
+        printf("CMS: File is not a txt file.\n");
+        fclose(filePtr);
+        return 0;
+    }
+
+    lazy_close();
+    store_clear(&db);
+    table_rebuild_indexes(); //empty indexes until rows are materialised
+
+    size_t cap = 1024;
+    lazy.entries = malloc(cap * sizeof(LazyEntry));
+    if (lazy.entries == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        fclose(filePtr);
+        return 0;
+    }
+
+    LineReader reader;
+    if (!line_reader_init(&reader, filePtr)) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        fclose(filePtr);
+        lazy_close();
+        return 0;
+    }
+
+    const char *line;
+    size_t lineLength;
+    long long lineStart;
+    int lineNumber = 0;
+    int currentId = 0;
+
+    while (line_reader_next(&reader, &line, &lineLength, &lineStart)) {
+        lineNumber++;
+        if (lineNumber <= 5) continue; // Skip metadata and table header
+
+        if (!scan_line_id(line, lineLength, &currentId)) {
+            printf(YELLOW "CMS Warning: Skipping invalid line %d in file.\n" RESET, lineNumber);
+            continue;
+        }
+
+        if (lazy.count == cap) {
+            LazyEntry *grown = realloc(lazy.entries, cap * 2 * sizeof(LazyEntry));
+            if (grown == NULL) {
+                printf(RED "CMS Error: Out of memory at line %d, remaining lines not indexed.\n" RESET, lineNumber);
+                break;
+            }
+            lazy.entries = grown;
+            cap *= 2;
+        }
+        lazy.entries[lazy.count].id = currentId;
+        lazy.entries[lazy.count].offset = (long)lineStart;
+        lazy.entries[lazy.count].length = (uint32_t)lineLength;
+        lazy.count++;
+    }
+    line_reader_free(&reader);
+
+    qsort(lazy.entries, lazy.count, sizeof(LazyEntry), lazyEntryIdAsc);
+
+    lazy.cacheSlotOf = malloc((lazy.count ? lazy.count : 1) * sizeof(int));
+    if (lazy.cacheSlotOf == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        fclose(filePtr);
+        lazy_close();
+        return 0;
+    }
+    for (size_t i = 0; i < lazy.count; i++) {
+        lazy.cacheSlotOf[i] = -1;
+    }
+
+    lazy.file = filePtr;
+    strncpy(lazy.path, filePath, sizeof(lazy.path) - 1);
+    lazy.path[sizeof(lazy.path) - 1] = '\0';
+
+    printf("CMS: \"%s\" opened lazily (%zu records indexed)\n", filePath, lazy.count);
+    audit_log("OPEN LAZY %s (%zu records)", filePath, lazy.count);
+
+    undo_set(OP_NONE); // Reset Undo history
+    db_opened = 1;
+    db_lazy = 1;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: lazy_cache_unlink / lazy_cache_push_front
+// PURPOSE : Doubly linked LRU list maintenance.
+// -----------------------------------------------------------------------------
+static void lazy_cache_unlink(int node)
+{
+    LazyCacheNode *n = &lazy.cache[node];
+    if (n->prev >= 0) lazy.cache[n->prev].next = n->next; else lazy.head = n->next;
+    if (n->next >= 0) lazy.cache[n->next].prev = n->prev; else lazy.tail = n->prev;
+}
+
+static void lazy_cache_push_front(int node)
+{
+    lazy.cache[node].prev = -1;
+    lazy.cache[node].next = lazy.head;
+    if (lazy.head >= 0) lazy.cache[lazy.head].prev = node;
+    lazy.head = node;
+    if (lazy.tail < 0) lazy.tail = node;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: lazy_fetch
+// PURPOSE : Returns the parsed row for an offset-index entry, reading and
+//           parsing the line only on a cache miss.
+// RETURNS : row pointer (valid until the next lazy_fetch), NULL if the line
+//           turns out to be invalid or cannot be read
+// -----------------------------------------------------------------------------
+static const Student *lazy_fetch(size_t entry)
+{
+    int node = lazy.cacheSlotOf[entry];
+    if (node >= 0) {
+        lazy.hits++;
+        lazy_cache_unlink(node);
+        lazy_cache_push_front(node);
+        return &lazy.cache[node].row;
+    }
+    lazy.misses++;
+
+    //Read the line
+    const LazyEntry *e = &lazy.entries[entry];
+    char stackBuf[512];
+    char *line = e->length <= sizeof(stackBuf) ? stackBuf : malloc(e->length);
+    if (line == NULL) return NULL;
+
+    Student parsed;
+    int ok = fseek(lazy.file, e->offset, SEEK_SET) == 0 &&
+             fread(line, 1, e->length, lazy.file) == e->length;
+    if (ok) {
+        ok = parse_line(line, e->length, &parsed); //'\r' of "\r\n" endings is skipped
+    }
+    if (line != stackBuf) free(line);
+    if (!ok) return NULL;
+
+    //Take a free node, or evict the least recently used row
+    if (lazy.cacheUsed < LAZY_CACHE_ROWS) {
+        node = lazy.cacheUsed++;
+    }
+    else {
+        node = lazy.tail;
+        lazy_cache_unlink(node);
+        lazy.cacheSlotOf[lazy.cache[node].entry] = -1;
+    }
+
+    lazy.cache[node].row = parsed;
+    lazy.cache[node].entry = entry;
+    lazy.cacheSlotOf[entry] = node;
+    lazy_cache_push_front(node);
+    return &lazy.cache[node].row;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: lazy_find_entry
+// PURPOSE : Binary search of the offset index.
+// RETURNS : entry index, or -1 if the ID is not in the file
+// -----------------------------------------------------------------------------
+static long lazy_find_entry(int id)
+{
+    size_t lo = 0, hi = lazy.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (lazy.entries[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < lazy.count && lazy.entries[lo].id == id) ? (long)lo : -1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: lazy_materialize
+// PURPOSE : Loads every row of a lazily opened file into the table, for
+//           commands that need the whole table (SHOW, INSERT, SAVE, ...).
+//           If the file can no longer be opened the table stays lazy, so
+//           QUERY keeps working from the still-open handle.
+// RETURNS : 1 -> table loaded (or was not lazy), 0 -> failure, command not run
+// -----------------------------------------------------------------------------
+static int lazy_materialize(void)
+{
+    if (!db_lazy) return 1;
+
+    char path[256];
+    strcpy(path, lazy.path);
+    size_t indexed = lazy.count;
+
+    FILE *filePtr = fopen(path, "r");
+    if (filePtr == NULL) {
+        printf(RED "CMS Error: \"%s\" can no longer be read; the table stays lazily opened (QUERY only).\n" RESET, path);
+        return 0;
+    }
+    printf(YELLOW "CMS: Loading all %zu rows of \"%s\" for this command...\n" RESET, indexed, path);
+
+    lazy_close();
+    store_clear(&db);
+    load_table_rows(filePtr);
+    fclose(filePtr);
+    //Not audit-logged: the data is what OPEN LAZY already logged. Replicas
+    //get it now, as a snapshot (they cannot follow a lazy table)
+    snapshot_publish();
+    return 1;
+}
+
+
+/* ---------------------------------------------------- */
+/* Transactions (BEGIN / COMMIT / ROLLBACK)             */
+/* ---------------------------------------------------- */
+//
+// Between BEGIN and COMMIT, INSERT / UPDATE / DELETE only touch a private
+// write set (one BatchChange per student ID) and QUERY <ID> reads through
+// it. The table and its indexes stay untouched, so SHOW, FIND etc. keep
+// showing the committed data. COMMIT applies the write set in one go,
+// writes all audit entries with one durable write and records the whole
+// transaction as a single undo step.
+
+static struct {
+    int active;
+    BatchChange *changes;  //write set, in first-touch order
+    size_t count, cap;
+    int *slots;            //open addressing: student ID -> index in changes, -1 empty
+    size_t slotCap;        //power of two, at least twice count
+    char *log;             //pending audit entries, '\n' separated
+    size_t logLength, logCap;
+} txn;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: txn_reset
+// PURPOSE : Frees the write set and leaves transaction mode.
+// -----------------------------------------------------------------------------
+static void txn_reset(void)
+{
+    free(txn.changes);
+    free(txn.slots);
+    free(txn.log);
+    memset(&txn, 0, sizeof(txn));
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: txn_find
+// RETURNS : the write set entry for 'id', or NULL if the ID is untouched
+// -----------------------------------------------------------------------------
+static BatchChange *txn_find(int id)
+{
+    if (txn.slotCap == 0) { //not indexed since a compaction: txn_touch re-indexes
+        for (size_t i = 0; i < txn.count; i++) {
+            if (txn.changes[i].id == id) return &txn.changes[i];
+        }
+        return NULL;
+    }
+    for (size_t slot = id_hash(id) & (txn.slotCap - 1); txn.slots[slot] >= 0; slot = (slot + 1) & (txn.slotCap - 1)) {
+        if (txn.changes[txn.slots[slot]].id == id) return &txn.changes[txn.slots[slot]];
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: txn_touch
+// PURPOSE : Returns the write set entry for 'id', creating it from the
+//           committed table on first use.
+// RETURNS : entry, or NULL when out of memory
+// -----------------------------------------------------------------------------
+static BatchChange *txn_touch(int id)
+{
+    BatchChange *change = txn_find(id);
+    if (change) return change;
+
+    if (txn.count == txn.cap) {
+        size_t newCap = txn.cap ? txn.cap * 2 : 64;
+        BatchChange *grown = realloc(txn.changes, newCap * sizeof(BatchChange));
+        if (grown == NULL) return NULL;
+        txn.changes = grown;
+        txn.cap = newCap;
+    }
+    if ((txn.count + 1) * 2 > txn.slotCap) { //keep load factor <= 0.5
+        size_t newCap = txn.slotCap ? txn.slotCap * 2 : 128;
+        int *slots = malloc(newCap * sizeof(int));
+        if (slots == NULL) return NULL;
+        for (size_t i = 0; i < newCap; i++) slots[i] = -1;
+        for (size_t i = 0; i < txn.count; i++) {
+            size_t slot = id_hash(txn.changes[i].id) & (newCap - 1);
+            while (slots[slot] >= 0) slot = (slot + 1) & (newCap - 1);
+            slots[slot] = (int)i;
+        }
+        free(txn.slots);
+        txn.slots = slots;
+        txn.slotCap = newCap;
+    }
+
+    change = &txn.changes[txn.count];
+    memset(change, 0, sizeof(*change));
+    change->id = id;
+    int pos = find_index_by_id(id);
+    if (pos >= 0) {
+        change->hadBefore = change->hasAfter = 1;
+        change->before = change->after = *row_at((size_t)pos);
+    }
+
+    size_t slot = id_hash(id) & (txn.slotCap - 1);
+    while (txn.slots[slot] >= 0) slot = (slot + 1) & (txn.slotCap - 1);
+    txn.slots[slot] = (int)txn.count++;
+    return change;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: record_visible
+// PURPOSE : Looks up a student as the current command should see it: through
+//           the write set inside a transaction, otherwise in the table.
+// RETURNS : 1 -> found (copied to out if not NULL), 0 -> not found / deleted
+// -----------------------------------------------------------------------------
+static int record_visible(int id, Student *out)
+{
+    const BatchChange *change = txn.active ? txn_find(id) : NULL;
+    if (change) {
+        if (change->hasAfter && out) *out = change->after;
+        return change->hasAfter;
+    }
+
+    int pos = find_index_by_id(id);
+    if (pos >= 0 && out) *out = *row_at((size_t)pos);
+    return pos >= 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: record_put
+// PURPOSE : Inserts the student, or replaces the one with the same ID.
+//           Goes to the write set while a transaction is open.
+// RETURNS : 1 -> success, 0 -> out of memory (error printed)
+// -----------------------------------------------------------------------------
+static int record_put(const Student *studentObject)
+{
+    if (txn.active) {
+        BatchChange *change = txn_touch(studentObject->id);
+        if (change == NULL) {
+            printf(RED "CMS Error: Out of memory, change not recorded.\n" RESET);
+            return 0;
+        }
+        change->hasAfter = 1;
+        change->after = *studentObject;
+        return 1;
+    }
+
+    int pos = find_index_by_id(studentObject->id);
+    if (pos >= 0) {
+        table_replace_at((size_t)pos, studentObject);
+        return 1;
+    }
+    return table_append(studentObject);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: record_delete
+// PURPOSE : Deletes the student with this ID (write set inside a transaction).
+// RETURNS : 1 -> deleted, 0 -> not found / out of memory
+// -----------------------------------------------------------------------------
+static int record_delete(int id)
+{
+    if (txn.active) {
+        if (!record_visible(id, NULL)) return 0;
+        BatchChange *change = txn_touch(id);
+        if (change == NULL) {
+            printf(RED "CMS Error: Out of memory, change not recorded.\n" RESET);
+            return 0;
+        }
+        change->hasAfter = 0;
+        return 1;
+    }
+
+    int pos = find_index_by_id(id);
+    if (pos < 0) return 0;
+    table_remove_at((size_t)pos);
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: txn_log_appendv / txn_log_append
+// PURPOSE : Adds one line to txn.log, the entries audit_log_batch() writes
+//           after the COMMIT or MERGE header.
+// -----------------------------------------------------------------------------
+static void txn_log_appendv(const char *formatString, va_list argList)
+{
+    va_list copy;
+    va_copy(copy, argList);
+    int length = vsnprintf(NULL, 0, formatString, copy);
+    va_end(copy);
+
+    if (length >= 0) {
+        size_t needed = txn.logLength + (size_t)length + 2;
+        if (needed > txn.logCap) {
+            size_t newCap = txn.logCap ? txn.logCap : 4096;
+            while (newCap < needed) newCap *= 2;
+            char *grown = realloc(txn.log, newCap);
+            if (grown != NULL) {
+                txn.log = grown;
+                txn.logCap = newCap;
+            }
+        }
+        if (needed <= txn.logCap) {
+            vsnprintf(txn.log + txn.logLength, (size_t)length + 1, formatString, argList);
+            txn.logLength += (size_t)length;
+            txn.log[txn.logLength++] = '\n';
+        }
+    }
+}
+
+static void txn_log_append(const char *formatString, ...)
+{
+    va_list argList;
+    va_start(argList, formatString);
+    txn_log_appendv(formatString, argList);
+    va_end(argList);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: audit_change
+// PURPOSE : audit_log() for record changes. Inside a transaction the entry
+//           is held back and written by COMMIT together with the others.
+// -----------------------------------------------------------------------------
+static void audit_change(const char *formatString, ...)
+{
+    va_list argList;
+    va_start(argList, formatString);
+
+    if (!txn.active) {
+        char message[512];
+        vsnprintf(message, sizeof(message), formatString, argList);
+        va_end(argList);
+        audit_log("%s", message);
+        return;
+    }
+
+    txn_log_appendv(formatString, argList);
+    va_end(argList);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: batch_revert_rows / batch_revert
+// PURPOSE : Undoes the first 'count' changes of a batch, newest first.
+//           Used by UNDO of a batch and by a COMMIT that fails half way.
+//           batch_revert also brackets the rows with table_bulk_begin/end.
+// -----------------------------------------------------------------------------
+static void batch_revert_rows(const BatchChange *changes, size_t count)
+{
+    for (size_t i = count; i-- > 0; ) {
+        const BatchChange *change = &changes[i];
+        int pos = find_index_by_id(change->id);
+
+        if (change->hadBefore && pos >= 0) {
+            table_replace_at((size_t)pos, &change->before);
+        }
+        else if (change->hadBefore) {
+            table_append(&change->before);
+        }
+        else if (pos >= 0) {
+            table_remove_at((size_t)pos);
+        }
+    }
+}
+
+static void batch_revert(const BatchChange *changes, size_t count)
+{
+    table_bulk_begin(count);
+    batch_revert_rows(changes, count);
+    table_bulk_end();
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: batch_apply
+// PURPOSE : Applies a list of changes to the table. On failure the changes
+//           already applied are reverted, so the table is left as it was.
+// RETURNS : 1 -> all applied, 0 -> out of memory, nothing applied
+// -----------------------------------------------------------------------------
+static int batch_apply(const BatchChange *changes, size_t count)
+{
+    table_bulk_begin(count);
+    for (size_t i = 0; i < count; i++) {
+        const BatchChange *change = &changes[i];
+        int pos = find_index_by_id(change->id);
+
+        if (change->hasAfter && pos >= 0) {
+            table_replace_at((size_t)pos, &change->after);
+        }
+        else if (change->hasAfter) {
+            if (!table_append(&change->after)) {
+                batch_revert_rows(changes, i);
+                table_bulk_end();
+                return 0;
+            }
+        }
+        else if (pos >= 0) {
+            table_remove_at((size_t)pos);
+        }
+    }
+    table_bulk_end();
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: txn_begin
+// PURPOSE : BEGIN. Starts collecting changes in a private write set.
+// -----------------------------------------------------------------------------
+void txn_begin(void)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (txn.active) {
+        printf(YELLOW "CMS: A transaction is already in progress.\n" RESET);
+        return;
+    }
+
+    txn_reset();
+    txn.active = 1;
+    printf("CMS: Transaction started. Changes are applied on COMMIT.\n");
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: write_set_apply
+// PURPOSE : Drops write set entries that end where they started (e.g.
+//           inserted then deleted), applies the rest to the table and makes
+//           them the undo step, labelled for UNDO. Used by COMMIT and MERGE.
+// RETURNS : 1 -> applied (*applied = changes kept), 0 -> out of memory,
+//           nothing applied (the write set is kept, compacted)
+// -----------------------------------------------------------------------------
+static int write_set_apply(const char *undoLabel, size_t *applied)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < txn.count; i++) {
+        const BatchChange *change = &txn.changes[i];
+        if (!change->hadBefore && !change->hasAfter) continue;
+        if (change->hadBefore && change->hasAfter && student_equal(&change->before, &change->after)) continue;
+        txn.changes[kept++] = *change;
+    }
+
+    if (!batch_apply(txn.changes, kept)) {
+        txn.count = kept;
+        free(txn.slots); //indexes into changes[] are stale after compaction
+        txn.slots = NULL;
+        txn.slotCap = 0;
+        return 0;
+    }
+
+    //The whole batch becomes one undo step; the change list moves into last_op
+    undo_set(kept ? OP_BATCH : OP_NONE);
+    if (kept) {
+        last_op.batch = txn.changes;
+        last_op.batchCount = kept;
+        last_op.batchLabel = undoLabel;
+        txn.changes = NULL;
+        txn.count = txn.cap = 0;
+    }
+    *applied = kept;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: write_set_unapply
+// PURPOSE : The audit entries of a batch write_set_apply just applied could
+//           not be written: reverts the batch and hands its changes back to
+//           the write set, so the table holds nothing the log does not.
+//           The undo step is cleared.
+// -----------------------------------------------------------------------------
+static void write_set_unapply(void)
+{
+    if (last_op.op != OP_BATCH) return; //nothing was applied
+
+    batch_revert(last_op.batch, last_op.batchCount);
+    free(txn.changes);
+    free(txn.slots); //rebuilt from changes[] by the next txn_touch
+    txn.slots = NULL;
+    txn.slotCap = 0;
+    txn.changes = last_op.batch;
+    txn.count = txn.cap = last_op.batchCount;
+    last_op.batch = NULL;
+    last_op.batchCount = 0;
+    undo_set(OP_NONE);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: txn_commit
+// PURPOSE : COMMIT. Applies the write set to the table, writes its audit
+//           entries in one batch and makes it the undo step.
+// -----------------------------------------------------------------------------
+void txn_commit(void)
+{
+    if (!txn.active) {
+        printf(YELLOW "CMS: No transaction in progress.\n" RESET);
+        return;
+    }
+
+    size_t kept = 0;
+    if (!write_set_apply("COMMIT", &kept)) {
+        printf(RED "CMS Error: Out of memory, transaction not committed (still open).\n" RESET);
+        return;
+    }
+
+    if (!audit_log_batch(txn.log, txn.logLength, "COMMIT (%zu change(s))", kept)) {
+        write_set_unapply();
+        printf(RED "CMS Error: Audit log not written, transaction not committed (still open).\n" RESET);
+        return;
+    }
+    printf(GREEN "CMS: Transaction committed (%zu change(s)).\n" RESET, kept);
+    txn_reset();
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: txn_rollback
+// PURPOSE : ROLLBACK. Discards the write set; the table was never touched.
+// -----------------------------------------------------------------------------
+void txn_rollback(void)
+{
+    if (!txn.active) {
+        printf(YELLOW "CMS: No transaction in progress.\n" RESET);
+        return;
+    }
+
+    size_t discarded = txn.count;
+    txn_reset();
+    printf("CMS: Transaction rolled back (%zu record(s) unchanged).\n", discarded);
+    audit_log("ROLLBACK (%zu change(s) discarded)", discarded);
+}
+
+static size_t version_store_bytes(size_t *versions);
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_memory
+// PURPOSE : MEMORY command. Reports how much memory the table and its
+//           indexes hold, and how much of the record storage is free.
+// -----------------------------------------------------------------------------
+void show_memory(void)
+{
+    const double MB = 1024.0 * 1024.0;
+    size_t chunkBytes = db.chunkCount * sizeof(StudentChunk);
+    size_t poolBytes = chunk_pool_count * sizeof(StudentChunk);
+    size_t orderBytes = db.orderCap * sizeof(RecHandle) + db.chunkCap * sizeof(StudentChunk *);
+    size_t idBytes = id_slot_cap * sizeof(IdSlot);
+    size_t nameBytes = trigram_index_bytes(&name_trigrams);
+    size_t progBytes = trigram_index_bytes(&programme_trigrams);
+
+    printf(CYAN "===== Memory Usage =====\n" RESET);
+    printf("Records        : %zu live, %zu free slot(s)\n", db.size, db.freeCount);
+    printf("Record chunks  : %zu x %d rows = %.2f MB\n", db.chunkCount, CHUNK_ROWS, chunkBytes / MB);
+    printf("Chunk pool     : %zu chunk(s) = %.2f MB\n", chunk_pool_count, poolBytes / MB);
+    printf("Row order      : %.2f MB\n", orderBytes / MB);
+    printf("ID index       : %.2f MB\n", idBytes / MB);
+    printf("Name index     : %.2f MB\n", nameBytes / MB);
+    printf("Programme index: %.2f MB\n", progBytes / MB);
+    size_t keyBytes = key_index.cap * (sizeof(int) + sizeof(uint64_t));
+    if (key_index.built) {
+        printf("Ordered index  : %.2f MB\n", keyBytes / MB);
+    }
+    size_t lazyBytes = 0;
+    if (db_lazy) {
+        lazyBytes = lazy.count * (sizeof(LazyEntry) + sizeof(int)) + sizeof(lazy.cache);
+        printf("Lazy index     : %zu rows indexed, %.2f MB\n", lazy.count, lazyBytes / MB);
+        printf("Lazy row cache : %d/%d rows, %zu hit(s), %zu miss(es)\n",
+               lazy.cacheUsed, LAZY_CACHE_ROWS, lazy.hits, lazy.misses);
+    }
+    size_t cacheBytes = result_cache.bytes + result_cache.captureCap;
+    printf("Result cache   : %.2f MB\n", cacheBytes / MB);
+    size_t versions = 0;
+    size_t versionBytes = version_store_bytes(&versions);
+    if (versionBytes > 0) {
+        printf("Version history: %zu version(s), %.2f MB\n", versions, versionBytes / MB);
+    }
+    printf(BOLD "Total          : %.2f MB\n" RESET,
+           (chunkBytes + poolBytes + orderBytes + idBytes + nameBytes + progBytes + keyBytes + lazyBytes +
+            cacheBytes + versionBytes) / MB);
+    printf(CYAN "========================\n" RESET);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_all
+// PURPOSE : Prints a nicely formatted table of all student records currently stored in memory.
+// -----------------------------------------------------------------------------
+void show_all(void) {
+    if (!db_opened) { //No records in memory
+        out_printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    //Print table header with formatting and colour
+    out_printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET,
+           "ID", "Name", "Programme", "Mark");
+
+    //Loop through each record and print
+    for (size_t i = 0; i < db.size; i++) {
+        const Student *current = row_at(i);
+
+        //Decide colour based on marks
+        const char *colour = RESET;
+        if (current->mark >= 80)
+            colour = GREEN;
+        else if (current->mark < 50)
+            colour = RED;
+        else
+            colour = YELLOW;
+
+        //Print row in formatted columns
+        out_printf("%-10d %-20s %-30s %s%-6.1f%s\n",
+               current->id,
+               current->name,
+               current->programme,
+               colour, current->mark, RESET);
+    }
+}
+
+/* ---------------------------------------------------- */
+/* Work-Stealing Thread Pool                            */
+/* ---------------------------------------------------- */
+//
+// pool_run(count, fn, context) calls fn(context, i) for i = 0 .. count-1
+// on every worker plus the calling thread and returns when all are done.
+// Task indexes are dealt out to the workers' queues as contiguous ranges;
+// a worker takes from the front of its own range and, once empty, steals
+// from the back of another worker's range.
+
+#define POOL_MAX_THREADS 64
+
+typedef void (*PoolTaskFn)(void *context, size_t task);
+
+//Task range owned by one thread: owner takes next++, thieves take --end
+typedef struct {
+    thread_mutex lock;
+    size_t next, end;
+} PoolQueue;
+
+static struct {
+    int ready;
+    int threads;                 //workers + the calling thread
+    thread_handle handles[POOL_MAX_THREADS];
+    PoolQueue queues[POOL_MAX_THREADS];
+
+    thread_mutex lock;             //guards everything below
+    thread_cond wake, done;
+    PoolTaskFn fn;
+    void *context;
+    size_t remaining;            //tasks of the current job not finished yet
+    unsigned long job;           //bumped for every pool_run, wakes the workers
+    int shutdown;
+} pool;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pool_cpu_count
+// RETURNS : number of online processors (at least 1)
+// -----------------------------------------------------------------------------
+static int pool_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long count = (long)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (count < 1) count = 1;
+    if (count > POOL_MAX_THREADS) count = POOL_MAX_THREADS;
+    return (int)count;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pool_take
+// PURPOSE : Next task for thread 'self': its own queue first, then steals.
+// RETURNS : 1 -> *task set, 0 -> no tasks left anywhere
+// -----------------------------------------------------------------------------
+static int pool_take(int self, size_t *task)
+{
+    PoolQueue *own = &pool.queues[self];
+    thread_mutex_lock(&own->lock);
+    if (own->next < own->end) {
+        *task = own->next++;
+        thread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    thread_mutex_unlock(&own->lock);
+
+    for (int i = 1; i < pool.threads; i++) {
+        PoolQueue *victim = &pool.queues[(self + i) % pool.threads];
+        thread_mutex_lock(&victim->lock);
+        if (victim->next < victim->end) {
+            *task = --victim->end;
+            thread_mutex_unlock(&victim->lock);
+            return 1;
+        }
+        thread_mutex_unlock(&victim->lock);
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pool_work
+// PURPOSE : Runs tasks of the current job until none are left.
+// -----------------------------------------------------------------------------
+static void pool_work(int self)
+{
+    size_t task;
+    while (pool_take(self, &task)) {
+        pool.fn(pool.context, task);
+
+        thread_mutex_lock(&pool.lock);
+        if (--pool.remaining == 0) thread_cond_broadcast(&pool.done);
+        thread_mutex_unlock(&pool.lock);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pool_worker
+// PURPOSE : Worker thread: sleeps until a job is posted, helps with it.
+// -----------------------------------------------------------------------------
+#ifdef _WIN32
+static DWORD WINAPI pool_worker(LPVOID argument)
+#else
+static void *pool_worker(void *argument)
+#endif
+{
+    int self = (int)(intptr_t)argument;
+    TRACE_THREAD_NAME("pool worker");
+
+    thread_mutex_lock(&pool.lock);
+    unsigned long seen = pool.job; //only jobs posted after start-up
+    while (!pool.shutdown) {
+        if (pool.job == seen) {
+            thread_cond_wait(&pool.wake, &pool.lock);
+            continue;
+        }
+        seen = pool.job;
+        thread_mutex_unlock(&pool.lock);
+        TRACE_BEGIN(span, "pool_work");
+        pool_work(self);
+        TRACE_END(span);
+        thread_mutex_lock(&pool.lock);
+    }
+    thread_mutex_unlock(&pool.lock);
+    TRACE_THREAD_EXIT();
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pool_start
+// PURPOSE : Starts threads-1 workers (the caller is thread 0). threads <= 0
+//           -> one per processor. Falls back to fewer threads if creating
+//           one fails.
+// -----------------------------------------------------------------------------
+static void pool_start(int threads)
+{
+    if (threads <= 0) threads = pool_cpu_count();
+    if (threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+
+    if (!pool.ready) {
+        thread_mutex_init(&pool.lock);
+        thread_cond_init(&pool.wake);
+        thread_cond_init(&pool.done);
+        for (int i = 0; i < POOL_MAX_THREADS; i++) thread_mutex_init(&pool.queues[i].lock);
+        pool.ready = 1;
+    }
+    pool.shutdown = 0;
+
+    int started = 1;
+    for (int i = 1; i < threads; i++) {
+#ifdef _WIN32
+        pool.handles[i] = CreateThread(NULL, 0, pool_worker, (LPVOID)(intptr_t)i, 0, NULL);
+        if (pool.handles[i] == NULL) break;
+#else
+        if (pthread_create(&pool.handles[i], NULL, pool_worker, (void *)(intptr_t)i) != 0) break;
+#endif
+        started++;
+    }
+
+    thread_mutex_lock(&pool.lock); //workers read it once the next job is posted
+    pool.threads = started;
+    thread_mutex_unlock(&pool.lock);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pool_stop
+// PURPOSE : Stops and joins the workers (THREADS <n>, exit).
+// -----------------------------------------------------------------------------
+static void pool_stop(void)
+{
+    if (!pool.ready || pool.threads <= 1) return;
+
+    thread_mutex_lock(&pool.lock);
+    pool.shutdown = 1;
+    thread_cond_broadcast(&pool.wake);
+    thread_mutex_unlock(&pool.lock);
+
+    for (int i = 1; i < pool.threads; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(pool.handles[i], INFINITE);
+        CloseHandle(pool.handles[i]);
+#else
+        pthread_join(pool.handles[i], NULL);
+#endif
+    }
+    pool.threads = 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pool_size
+// RETURNS : threads pool_run uses (starts the pool on first use)
+// -----------------------------------------------------------------------------
+static int pool_size(void)
+{
+    if (!pool.ready) pool_start(0);
+    return pool.threads;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pool_run
+// PURPOSE : Runs fn(context, 0 .. count-1) in parallel and waits for all.
+//           The pool starts with one thread per processor on first use.
+// -----------------------------------------------------------------------------
+static void pool_run(size_t count, PoolTaskFn fn, void *context)
+{
+    if (pool_size() <= 1 || count <= 1) {
+        for (size_t i = 0; i < count; i++) fn(context, i);
+        return;
+    }
+
+    thread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.context = context;
+    pool.remaining = count;
+
+    //Deal out contiguous ranges, one per thread
+    for (int t = 0; t < pool.threads; t++) {
+        PoolQueue *queue = &pool.queues[t];
+        thread_mutex_lock(&queue->lock);
+        queue->next = count * (size_t)t / (size_t)pool.threads;
+        queue->end = count * (size_t)(t + 1) / (size_t)pool.threads;
+        thread_mutex_unlock(&queue->lock);
+    }
+    pool.job++;
+    thread_cond_broadcast(&pool.wake);
+    thread_mutex_unlock(&pool.lock);
+
+    pool_work(0); //calling thread helps
+
+    thread_mutex_lock(&pool.lock);
+    while (pool.remaining > 0) thread_cond_wait(&pool.done, &pool.lock);
+    thread_mutex_unlock(&pool.lock);
+}
+
+
+/* ---------------------------------------------------- */
+/* Sorting (SHOW ALL SORT BY)                           */
+/* ---------------------------------------------------- */
+
+//Fields SHOW ALL SORT BY can order on
+typedef enum { SORT_FIELD_ID, SORT_FIELD_NAME, SORT_FIELD_PROGRAMME, SORT_FIELD_MARK } SortField;
+
+typedef struct {
+    SortField field;
+    int descending;
+} SortKey;
+
+#define SORT_KEYS_MAX 4
+#define PARALLEL_SORT_MIN 32768   //smaller tables are sorted on the calling thread
+#define SORT_BUCKETS_PER_THREAD 4 //extra buckets so work stealing can even out uneven ones
+#define SORT_OVERSAMPLE 32        //sample elements per bucket when choosing splitters
+
+//Row reference used while sorting: records stay in their chunks, only handles move.
+//prefix is the first sort key packed into an integer, so most comparisons
+//never have to look at the records; text keys come from the stored collation keys.
+typedef struct {
+    uint64_t prefix;
+    const Student *record;
+    const RecordKeys *keys;
+    RecHandle handle;
+} RowRef;
+
+static SortKey sort_keys[SORT_KEYS_MAX]; //ordering in use (read-only while sorting)
+static int sort_key_count = 0;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: sort_prefix
+// PURPOSE : Packs the first sort key of a record so that comparing prefixes
+//           as unsigned integers agrees with compare_sort_keys: IDs and
+//           marks exactly, names/programmes by the head of their collation key
+//           (first 8 normalised bytes), already computed when the row was stored.
+// -----------------------------------------------------------------------------
+static uint64_t sort_prefix(const Student *record, const RecordKeys *keys)
+{
+    uint64_t prefix = 0;
+
+    switch (sort_keys[0].field) {
+    case SORT_FIELD_ID:
+        prefix = (uint64_t)((int64_t)record->id - (int64_t)INT_MIN);
+        break;
+    case SORT_FIELD_MARK:
+        prefix = mark_order_bits(record->mark);
+        break;
+    case SORT_FIELD_NAME:
+        prefix = keys->name.head;
+        break;
+    case SORT_FIELD_PROGRAMME:
+        prefix = keys->programme.head;
+        break;
+    }
+    return sort_keys[0].descending ? ~prefix : prefix;
+}
+
+// -----------------------------------------------------------------------------
+// COMPARATOR: compare_sort_keys
+// PURPOSE   : Orders two rows by sort_keys; ties go by ascending ID so the
+//             result never depends on the order rows were in before.
+//             Names and programmes compare by collation (case and extra
+//             whitespace ignored).
+// -----------------------------------------------------------------------------
+static int compare_sort_keys(const RowRef *x, const RowRef *y)
+{
+    const Student *a = x->record;
+    const Student *b = y->record;
+    for (int k = 0; k < sort_key_count; k++) {
+        int result = 0;
+        switch (sort_keys[k].field) {
+        case SORT_FIELD_ID:        result = (a->id > b->id) - (a->id < b->id); break;
+        case SORT_FIELD_MARK:      result = (a->mark > b->mark) - (a->mark < b->mark); break;
+        case SORT_FIELD_NAME:
+            result = collation_key_compare(&x->keys->name, &y->keys->name, a->name, b->name);
+            break;
+        case SORT_FIELD_PROGRAMME:
+            result = collation_key_compare(&x->keys->programme, &y->keys->programme, a->programme, b->programme);
+            break;
+        }
+        if (result != 0) return sort_keys[k].descending ? -result : result;
+    }
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+// -----------------------------------------------------------------------------
+// COMPARATOR: compare_row_refs
+// -----------------------------------------------------------------------------
+static int compare_row_refs(const void *a, const void *b) {
+    const RowRef *x = (const RowRef *)a;
+    const RowRef *y = (const RowRef *)b;
+    if (x->prefix != y->prefix) return x->prefix < y->prefix ? -1 : 1;
+    return compare_sort_keys(x, y);
+}
+
+//Shared state of one parallel sample sort
+typedef struct {
+    RowRef *input, *output;
+    size_t count;
+    size_t blockCount;       //input blocks for the fill / classify / scatter passes
+    RowRef *splitters;       //bucketCount - 1 values in ascending order
+    size_t bucketCount;
+    uint32_t *bucketOf;      //bucket of every input element
+    size_t *counts;          //blockCount x bucketCount: sizes, then write positions
+    size_t *bucketStart;     //bucketCount + 1 offsets into output
+} SampleSort;
+
+static void sample_sort_block(const SampleSort *sort, size_t block, size_t *begin, size_t *end)
+{
+    *begin = sort->count * block / sort->blockCount;
+    *end = sort->count * (block + 1) / sort->blockCount;
+}
+
+//Task: build the (prefix, record, keys, handle) entries of one block of rows
+static void sample_sort_fill(void *context, size_t block)
+{
+    SampleSort *sort = (SampleSort *)context;
+    size_t begin, end;
+    sample_sort_block(sort, block, &begin, &end);
+    for (size_t i = begin; i < end; i++) {
+        sort->input[i].record = row_at(i);
+        sort->input[i].keys = store_keys(&db, db.order[i]);
+        sort->input[i].handle = db.order[i];
+        sort->input[i].prefix = sort_prefix(sort->input[i].record, sort->input[i].keys);
+    }
+}
+
+//Task: find the bucket of every element of one block and count bucket sizes
+static void sample_sort_classify(void *context, size_t block)
+{
+    SampleSort *sort = (SampleSort *)context;
+    size_t *counts = sort->counts + block * sort->bucketCount;
+    size_t begin, end;
+    sample_sort_block(sort, block, &begin, &end);
+
+    for (size_t i = begin; i < end; i++) {
+        size_t low = 0, high = sort->bucketCount - 1; //first splitter greater than the element
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (compare_row_refs(&sort->splitters[mid], &sort->input[i]) <= 0) low = mid + 1;
+            else high = mid;
+        }
+        sort->bucketOf[i] = (uint32_t)low;
+        counts[low]++;
+    }
+}
+
+//Task: copy one block's elements to their buckets
+static void sample_sort_scatter(void *context, size_t block)
+{
+    SampleSort *sort = (SampleSort *)context;
+    size_t *positions = sort->counts + block * sort->bucketCount;
+    size_t begin, end;
+    sample_sort_block(sort, block, &begin, &end);
+    for (size_t i = begin; i < end; i++) {
+        sort->output[positions[sort->bucketOf[i]]++] = sort->input[i];
+    }
+}
+
+//Task: sort one bucket
+static void sample_sort_bucket(void *context, size_t bucket)
+{
+    SampleSort *sort = (SampleSort *)context;
+    size_t begin = sort->bucketStart[bucket];
+    qsort(sort->output + begin, sort->bucketStart[bucket + 1] - begin, sizeof(RowRef), compare_row_refs);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: sort_table_refs
+// PURPOSE : Builds and sorts the row references of the whole table. Large
+//           tables use a parallel sample sort on the thread pool: pick
+//           splitters from an evenly spaced sample, split the rows into
+//           buckets (classify + scatter, one task per block), then sort the
+//           buckets independently. Every row has a distinct key (ties go by
+//           ID), so the result equals a single-threaded sort.
+// RETURNS : sorted array (refs or scratch), NULL -> out of memory
+// -----------------------------------------------------------------------------
+static RowRef *sort_table_refs(RowRef *refs, RowRef *scratch)
+{
+    SampleSort sort;
+    memset(&sort, 0, sizeof(sort));
+    sort.input = refs;
+    sort.output = scratch;
+    sort.count = db.size;
+
+    int threads = pool_size();
+    sort.blockCount = (threads > 1 && db.size >= PARALLEL_SORT_MIN) ? (size_t)threads * SORT_BUCKETS_PER_THREAD : 1;
+    pool_run(sort.blockCount, sample_sort_fill, &sort);
+
+    if (sort.blockCount == 1) {
+        qsort(refs, db.size, sizeof(RowRef), compare_row_refs);
+        return refs;
+    }
+
+    sort.bucketCount = sort.blockCount;
+    size_t sampleCount = sort.bucketCount * SORT_OVERSAMPLE;
+    RowRef *sample = malloc(sampleCount * sizeof(RowRef));
+    sort.splitters = malloc(sort.bucketCount * sizeof(RowRef));
+    sort.bucketOf = malloc(db.size * sizeof(uint32_t));
+    sort.counts = calloc(sort.blockCount * sort.bucketCount, sizeof(size_t));
+    sort.bucketStart = malloc((sort.bucketCount + 1) * sizeof(size_t));
+    RowRef *result = NULL;
+
+    if (sample && sort.splitters && sort.bucketOf && sort.counts && sort.bucketStart) {
+        //Splitters: every SORT_OVERSAMPLE-th element of a sorted, evenly spaced sample
+        for (size_t i = 0; i < sampleCount; i++) sample[i] = refs[i * (db.size / sampleCount)];
+        qsort(sample, sampleCount, sizeof(RowRef), compare_row_refs);
+        for (size_t b = 1; b < sort.bucketCount; b++) sort.splitters[b - 1] = sample[b * SORT_OVERSAMPLE];
+
+        pool_run(sort.blockCount, sample_sort_classify, &sort);
+
+        //Bucket b of block k starts after bucket b of blocks 0..k-1
+        size_t position = 0;
+        for (size_t b = 0; b < sort.bucketCount; b++) {
+            sort.bucketStart[b] = position;
+            for (size_t k = 0; k < sort.blockCount; k++) {
+                size_t size = sort.counts[k * sort.bucketCount + b];
+                sort.counts[k * sort.bucketCount + b] = position;
+                position += size;
+            }
+        }
+        sort.bucketStart[sort.bucketCount] = position;
+
+        pool_run(sort.blockCount, sample_sort_scatter, &sort);
+        pool_run(sort.bucketCount, sample_sort_bucket, &sort);
+        result = scratch;
+    }
+
+    free(sample);
+    free(sort.splitters);
+    free(sort.bucketOf);
+    free(sort.counts);
+    free(sort.bucketStart);
+    return result;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: sort_rows
+// PURPOSE : Reorders the table by sort_keys. Sorts (prefix, record, handle)
+//           references instead of swapping whole records.
+// -----------------------------------------------------------------------------
+static void sort_rows(void)
+{
+    RowRef *refs = malloc((db.size ? db.size : 1) * sizeof(RowRef));
+    RowRef *scratch = malloc((db.size ? db.size : 1) * sizeof(RowRef));
+    TRACE_BEGIN(span, "sort_rows");
+    RowRef *sorted = (refs && scratch) ? sort_table_refs(refs, scratch) : NULL;
+    TRACE_END(span);
+    if (sorted == NULL) {
+        printf(RED "CMS Error: Out of memory, table not sorted.\n" RESET);
+        free(refs);
+        free(scratch);
+        return;
+    }
+
+    int changed = 0;
+    for (size_t i = 0; i < db.size; i++) {
+        changed |= db.order[i] != sorted[i].handle;
+        db.order[i] = sorted[i].handle;
+        store_set_pos(&db, sorted[i].handle, i);
+    }
+    free(refs);
+    free(scratch);
+
+    if (changed) {
+        table_generation++; //Already-sorted tables keep their cached results
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: parse_sort_keys
+// PURPOSE : Parses "<field> [ASC|DESC] [, <field> [ASC|DESC]] ..." into
+//           sort_keys. Fields: ID, NAME, PROGRAMME, MARK.
+// RETURNS : 1 -> valid, 0 -> invalid (sort_keys unchanged)
+// -----------------------------------------------------------------------------
+static int parse_sort_keys(const char *spec)
+{
+    static const char *const fieldNames[] = {"ID", "NAME", "PROGRAMME", "MARK"};
+    SortKey keys[SORT_KEYS_MAX];
+    int count = 0;
+    const char *p = spec;
+
+    while (1) {
+        char field[16] = "", order[16] = "";
+        int used = 0;
+        const char *comma = strchr(p, ',');
+        size_t partLength = comma ? (size_t)(comma - p) : strlen(p);
+        char part[64];
+        if (partLength >= sizeof(part) || count == SORT_KEYS_MAX) return 0;
+        memcpy(part, p, partLength);
+        part[partLength] = '\0';
+
+        int words = sscanf(part, "%15s %15s %n", field, order, &used);
+        if (words < 1 || (words == 2 && part[used] != '\0')) return 0;
+
+        int f = 0;
+        while (f < 4 && strcasecmp(field, fieldNames[f]) != 0) f++;
+        if (f == 4) return 0;
+        if (words == 2 && strcasecmp(order, "ASC") != 0 && strcasecmp(order, "DESC") != 0) return 0;
+
+        keys[count].field = (SortField)f;
+        keys[count].descending = words == 2 && strcasecmp(order, "DESC") == 0;
+        count++;
+
+        if (comma == NULL) break;
+        p = comma + 1;
+    }
+
+    memcpy(sort_keys, keys, sizeof(keys));
+    sort_key_count = count;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: showSorted
+// PURPOSE : Sorts the table by one or more keys then reprints all records.
+// ACCEPTS : spec = "<field> [ASC|DESC]" list separated by commas,
+//           e.g. "PROGRAMME, MARK DESC". Equal rows are ordered by ID.
+// -----------------------------------------------------------------------------
+void showSorted(const char *spec) {
+    if (!parse_sort_keys(spec)) {
+        printf("Usage: SHOW ALL SORT BY ID|NAME|PROGRAMME|MARK [ASC|DESC] [, ...]\n");
+        return;
+    }
+
+    TRACE_BEGIN(span, "showSorted");
+    sort_rows();
+
+    //After sorting, print the updated table
+    show_all();
+    TRACE_END(span);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: rank_before
+// PURPOSE : Ranking rule used by SHOW TOP / SHOW BOTTOM.
+//           TOP lists the largest values first, BOTTOM the smallest first.
+//           Equal marks are listed by ascending ID so output is deterministic.
+// RETURNS : 1 -> a is listed before b
+//           0 -> otherwise
+// -----------------------------------------------------------------------------
+static int rank_before(const Student *a, const Student *b, int byMark, int highest)
+{
+    if (byMark && a->mark != b->mark) {
+        return highest ? (a->mark > b->mark) : (a->mark < b->mark);
+    }
+    if (!byMark) {
+        return highest ? (a->id > b->id) : (a->id < b->id);
+    }
+    return a->id < b->id; //tie on mark
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: rank_heap_sift_down
+// PURPOSE : Restores the heap property from position 'pos' downwards.
+//           The root of the heap is the kept record that would be listed LAST,
+//           so a new candidate only has to beat the root to get in.
+// -----------------------------------------------------------------------------
+static void rank_heap_sift_down(const Student **heap, size_t count, size_t pos, int byMark, int highest)
+{
+    while (1) {
+        size_t left = 2 * pos + 1;
+        size_t right = left + 1;
+        size_t last = pos; //child that is listed last
+
+        if (left < count && rank_before(heap[last], heap[left], byMark, highest))
+            last = left;
+        if (right < count && rank_before(heap[last], heap[right], byMark, highest))
+            last = right;
+        if (last == pos)
+            return;
+
+        const Student *tmp = heap[pos];
+        heap[pos] = heap[last];
+        heap[last] = tmp;
+        pos = last;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_top_k
+// PURPOSE : Prints the best (TOP) or worst (BOTTOM) k records by mark or ID.
+// DETAILS :
+//   - Keeps a bounded heap of k record pointers, O(n log k) overall
+//   - Optional programme filter (case-insensitive, NULL = all programmes)
+//   - Never reorders the table, unlike SHOW ALL SORT BY
+// -----------------------------------------------------------------------------
+void show_top_k(size_t k, int byMark, int highest, const char *programme)
+{
+    if (!db_opened) { //No records in memory
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    if (k > db.size) k = db.size; //Cannot list more than we have
+
+    const Student **heap = malloc((k ? k : 1) * sizeof(*heap));
+    if (heap == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        return;
+    }
+
+    //Single pass: fill the heap, then only replace the root when a better record shows up
+    size_t count = 0;
+    for (size_t i = 0; i < db.size && k > 0; i++) {
+        const Student *candidate = row_at(i);
+
+        if (programme && strcasecmp(candidate->programme, programme) != 0)
+            continue;
+
+        if (count < k) {
+            //Sift up new element
+            size_t pos = count++;
+            heap[pos] = candidate;
+            while (pos > 0) {
+                size_t parent = (pos - 1) / 2;
+                if (!rank_before(heap[parent], heap[pos], byMark, highest))
+                    break;
+                const Student *tmp = heap[pos];
+                heap[pos] = heap[parent];
+                heap[parent] = tmp;
+                pos = parent;
+            }
+        }
+        else if (rank_before(candidate, heap[0], byMark, highest)) {
+            heap[0] = candidate;
+            rank_heap_sift_down(heap, count, 0, byMark, highest);
+        }
+    }
+
+    //Heap-sort the survivors in place: popping the root gives the last-listed record
+    for (size_t remaining = count; remaining > 1; remaining--) {
+        const Student *tmp = heap[0];
+        heap[0] = heap[remaining - 1];
+        heap[remaining - 1] = tmp;
+        rank_heap_sift_down(heap, remaining - 1, 0, byMark, highest);
+    }
+
+    if (count == 0) {
+        if (programme)
+            printf("CMS: No records found in programme \"%s\".\n", programme);
+        else
+            printf("CMS: No records to show.\n");
+        free(heap);
+        return;
+    }
+
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+    for (size_t i = 0; i < count; i++) {
+        print_student_record(heap[i]);
+    }
+
+    free(heap);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: insert_record
+// PURPOSE : Inserts a new student object into the dynamic array.
+// BEHAVIOUR:
+//   - Prevents duplicate IDs
+//   - Expands array if needed
+//   - Logs the insertion
+//   - Stores undo information
+// -----------------------------------------------------------------------------
+void insert_record(Student studentObject) {
+    if (!db_opened) { //No records in memory
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    //Reject duplicate IDs
+    if (record_visible(studentObject.id, NULL)) {
+        printf("CMS: ID already exists!\n");
+        return;
+    }
+
+    //Insert new student to the array (expands array + updates indexes)
+    if (!record_put(&studentObject)) {
+        return;
+    }
+
+    printf("CMS: Record inserted successfully!%s\n", txn.active ? " (pending COMMIT)" : "");
+
+    audit_change("INSERT %d \"%s\" \"%s\" %.1f", studentObject.id, studentObject.name, studentObject.programme, studentObject.mark); //Audit Log
+
+    //Prepare for undo (a transaction is undone as a whole after COMMIT)
+    if (!txn.active) {
+        undo_set(OP_INSERT);
+        last_op.after = studentObject;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: query
+// PURPOSE : Looks up a student by ID and prints their record.
+// -----------------------------------------------------------------------------
+void query(int studentId) {
+    if (!db_opened) { //No records in memory
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    const Student *record = NULL;
+    Student visible;
+
+    if (db_lazy) { //Lazily opened: seek to the line and parse just this row
+        long entry = lazy_find_entry(studentId);
+        record = entry >= 0 ? lazy_fetch((size_t)entry) : NULL;
+    }
+    else { //Inside a transaction this includes uncommitted changes
+        record = record_visible(studentId, &visible) ? &visible : NULL;
+    }
+
+    if (record == NULL) { //If student ID not found, exit
+        printf("CMS: The record with ID %d does not exist.\n", studentId);
+        return;
+    }
+
+    //Print Header
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+
+    //Decide colour based on marks
+    const char *colour = RESET;
+    if (record->mark >= 80)
+        colour = GREEN;
+    else if (record->mark < 50)
+        colour = RED;
+    else
+        colour = YELLOW;
+
+    //Print the student record
+    printf("%-10d %-20s %-30s %s%-6.1f%s\n",
+           record->id,
+           record->name,
+           record->programme,
+           colour, record->mark, RESET);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: query_prefix
+// PURPOSE : Lists all records whose ID starts with the given digit prefix.
+// INPUT   : prefix - a string of 4–6 digits
+// -----------------------------------------------------------------------------
+void query_prefix(const char *prefix)
+{
+    if (!db_opened) {
+        out_printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    size_t prefix_len = strlen(prefix);
+    int found = 0;
+
+    // Header
+    out_printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET,
+           "ID", "Name", "Programme", "Mark");
+
+    //Lazily opened: match on the offset index, parse only the matching rows
+    size_t rowCount = db_lazy ? lazy.count : db.size;
+
+    for (size_t i = 0; i < rowCount; ++i) {
+        char idbuf[32];
+        snprintf(idbuf, sizeof(idbuf), "%d", db_lazy ? lazy.entries[i].id : row_at(i)->id);
+
+        if (strncmp(idbuf, prefix, prefix_len) == 0) {
+            const Student *current = db_lazy ? lazy_fetch(i) : row_at(i);
+            if (current == NULL) continue; //line failed to parse
+            // Colour logic same as show_all()
+            const char *color = RESET;
+            if (current->mark >= 80)
+                color = GREEN;
+            else if (current->mark < 50)
+                color = RED;
+            else
+                color = YELLOW;
+
+            out_printf("%-10d %-20s %-30s %s%-6.1f%s\n",
+                   current->id,
+                   current->name,
+                   current->programme,
+                   color, current->mark, RESET);
+
+            found = 1;
+        }
+    }
+
+    if (!found) {
+        out_printf("CMS: No records found with ID starting with %s.\n", prefix);
+    }
+}
+
+//IDs collected for QUERY id,id,... / QUERY FROM <file>
+typedef struct {
+    int *ids;
+    size_t count, cap;
+    size_t invalid; //tokens that are not 7-digit IDs
+} IdList;
+
+#define QUERY_MISSING_SHOW 10 //IDs listed by name when a batch has missing ones
+
+// -----------------------------------------------------------------------------
+// FUNCTION: id_list_add_text
+// PURPOSE : Adds the IDs in 'text', separated by commas and/or whitespace.
+// RETURNS : 1 -> added, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int id_list_add_text(IdList *list, const char *text, size_t length)
+{
+    const char *p = text;
+    const char *end = text + length;
+
+    while (p < end) {
+        while (p < end && (*p == ',' || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        if (p == end) break;
+        const char *token = p;
+        while (p < end && !(*p == ',' || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+
+        size_t tokenLength = (size_t)(p - token);
+        int id = 0;
+        int valid = tokenLength == 7;
+        for (size_t i = 0; valid && i < tokenLength; i++) {
+            valid = token[i] >= '0' && token[i] <= '9';
+            id = id * 10 + (token[i] - '0');
+        }
+        if (!valid) {
+            list->invalid++;
+            continue;
+        }
+
+        if (list->count == list->cap) {
+            size_t newCap = list->cap ? list->cap * 2 : 64;
+            int *grown = realloc(list->ids, newCap * sizeof(int));
+            if (grown == NULL) return 0;
+            list->ids = grown;
+            list->cap = newCap;
+        }
+        list->ids[list->count++] = id;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: query_batch
+// PURPOSE : QUERY id,id,... / QUERY FROM <file>. Looks all IDs up with
+//           find_index_by_id_batch() and prints one table, in the order
+//           given, then lists the IDs that were not found.
+// -----------------------------------------------------------------------------
+void query_batch(const IdList *list)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (list->invalid > 0) {
+        printf(YELLOW "CMS Warning: %zu entr%s skipped (an ID is exactly 7 digits).\n" RESET,
+               list->invalid, list->invalid == 1 ? "y" : "ies");
+    }
+    if (list->count == 0) {
+        printf("CMS: No IDs to look up.\n");
+        return;
+    }
+
+    long *positions = malloc(list->count * sizeof(long));
+    if (positions == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        return;
+    }
+    if (!db_lazy) {
+        find_index_by_id_batch(list->ids, list->count, positions);
+    }
+
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+
+    size_t found = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const Student *record = NULL;
+        const BatchChange *change = txn.active ? txn_find(list->ids[i]) : NULL;
+
+        if (change) { //uncommitted change inside a transaction
+            record = change->hasAfter ? &change->after : NULL;
+        }
+        else if (db_lazy) {
+            long entry = lazy_find_entry(list->ids[i]);
+            record = entry >= 0 ? lazy_fetch((size_t)entry) : NULL;
+        }
+        else if (positions[i] >= 0) {
+            record = row_at((size_t)positions[i]);
+        }
+
+        positions[i] = record != NULL; //reused: 1 -> found
+        if (record) {
+            print_student_record(record);
+            found++;
+        }
+    }
+
+    printf("CMS: %zu of %zu record(s) found.\n", found, list->count);
+    if (found < list->count) {
+        size_t shown = 0;
+        printf(YELLOW "CMS: Not found:");
+        for (size_t i = 0; i < list->count && shown < QUERY_MISSING_SHOW; i++) {
+            if (!positions[i]) {
+                printf("%s %d", shown ? "," : "", list->ids[i]);
+                shown++;
+            }
+        }
+        size_t missing = list->count - found;
+        if (missing > shown) printf(" ... and %zu more", missing - shown);
+        printf("\n" RESET);
+    }
+    free(positions);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: query_from_file
+// PURPOSE : QUERY FROM <file>: the IDs of a text file (one or more per line,
+//           separated by commas or spaces), looked up as one batch.
+// -----------------------------------------------------------------------------
+void query_from_file(const char *filePath)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    FILE *filePtr = fopen(filePath, "rb");
+    if (!filePtr) {
+        printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
+        return;
+    }
+
+    LineReader reader;
+    if (!line_reader_init(&reader, filePtr)) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        fclose(filePtr);
+        return;
+    }
+
+    IdList list = {0};
+    const char *line;
+    size_t lineLength;
+    int ok = 1;
+    while (ok && line_reader_next(&reader, &line, &lineLength, NULL)) {
+        ok = id_list_add_text(&list, line, lineLength);
+    }
+    line_reader_free(&reader);
+    fclose(filePtr);
+
+    if (ok) {
+        query_batch(&list);
+    } else {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+    }
+    free(list.ids);
+}
+
+//What a page walks over (SHOW ALL ... LIMIT, QUERY <prefix> LIMIT)
+typedef enum { PAGE_NONE, PAGE_BY_ID, PAGE_BY_MARK, PAGE_PREFIX } PageKind;
+
+//Keyset cursor: NEXT continues after the last row shown, so rows inserted
+//or deleted in between never shift a page (no OFFSET to go stale)
+static struct {
+    PageKind kind;
+    int descending;
+    size_t limit;
+    char prefix[8];     //PAGE_PREFIX
+    int started;        //0 -> no row shown yet, start at the beginning
+    int done;           //1 -> the last page has been shown
+    uint64_t last;      //last row shown: its ID, or its mark_key() for PAGE_BY_MARK
+} page_cursor;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: page_id_at / page_id_count / page_id_lower_bound
+// PURPOSE : IDs in ascending order: the lazy offset index (already sorted by
+//           ID) when the file was opened lazily, else the ordered key index.
+// -----------------------------------------------------------------------------
+static inline int page_id_at(size_t i)
+{
+    return db_lazy ? lazy.entries[i].id : key_index.ids[i];
+}
+
+static inline size_t page_id_count(void)
+{
+    return db_lazy ? lazy.count : key_index.count;
+}
+
+static size_t page_id_lower_bound(int64_t id)
+{
+    size_t lo = 0, hi = page_id_count();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (page_id_at(mid) < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: page_collect
+// PURPOSE : Finds the positions of the next 'want' rows after the cursor
+//           (in page_id_at() order, or key_index.marks for PAGE_BY_MARK).
+// RETURNS : number of positions written to picked[]
+// -----------------------------------------------------------------------------
+static size_t page_collect(size_t *picked, size_t want)
+{
+    size_t n = 0;
+
+    if (page_cursor.kind == PAGE_BY_ID && !page_cursor.descending) {
+        size_t p = page_cursor.started ? page_id_lower_bound((int64_t)(int)page_cursor.last + 1) : 0;
+        while (n < want && p < page_id_count()) picked[n++] = p++;
+    }
+    else if (page_cursor.kind == PAGE_BY_ID) {
+        size_t p = page_cursor.started ? page_id_lower_bound((int)page_cursor.last) : page_id_count();
+        while (n < want && p > 0) picked[n++] = --p;
+    }
+    else if (page_cursor.kind == PAGE_BY_MARK && !page_cursor.descending) {
+        size_t p = page_cursor.started ? key_marks_lower_bound(page_cursor.last + 1) : 0;
+        while (n < want && p < key_index.count) picked[n++] = p++;
+    }
+    else if (page_cursor.kind == PAGE_BY_MARK) {
+        //Highest mark first, but equal marks by ascending ID (as SORT BY MARK DESC):
+        //walk each group of equal marks forwards, the groups backwards
+        if (key_index.count == 0) return 0;
+        uint64_t group = page_cursor.started ? page_cursor.last : key_index.marks[key_index.count - 1];
+        group &= ~(uint64_t)UINT32_MAX;
+        size_t start = key_marks_lower_bound(group);
+        size_t end = key_marks_lower_bound(group + ((uint64_t)1 << 32));
+        size_t p = page_cursor.started ? key_marks_lower_bound(page_cursor.last + 1) : start;
+        while (n < want) {
+            if (p < end) {
+                picked[n++] = p++;
+            }
+            else if (start == 0) {
+                break;
+            }
+            else {
+                end = start;
+                start = key_marks_lower_bound(key_index.marks[end - 1] & ~(uint64_t)UINT32_MAX);
+                p = start;
+            }
+        }
+    }
+    else if (page_cursor.kind == PAGE_PREFIX && page_cursor.prefix[0] != '0') {
+        //IDs starting with the prefix: one range per ID length, ascending
+        size_t prefixLength = strlen(page_cursor.prefix);
+        int64_t low = atoi(page_cursor.prefix), high = low + 1;
+        int64_t from = page_cursor.started ? (int64_t)(int)page_cursor.last + 1 : 0;
+        for (size_t length = prefixLength; length <= 10 && low <= INT_MAX && n < want; length++) {
+            if (high > from) {
+                size_t p = page_id_lower_bound(low > from ? low : from);
+                while (n < want && p < page_id_count() && page_id_at(p) < high) picked[n++] = p++;
+            }
+            low *= 10;
+            high *= 10;
+        }
+    }
+    return n;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: page_show
+// PURPOSE : Prints the page after the cursor and moves the cursor to its
+//           last row. Reads one row past the page to know whether NEXT
+//           has anything left.
+// -----------------------------------------------------------------------------
+static void page_show(void)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (db_lazy && page_cursor.kind != PAGE_PREFIX && !lazy_materialize()) return; //NEXT after OPEN LAZY
+    if (!db_lazy && !key_index_build()) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        return;
+    }
+    if (page_cursor.done) {
+        printf("CMS: No more rows.\n");
+        return;
+    }
+
+    size_t want = page_cursor.limit < page_id_count() ? page_cursor.limit : page_id_count();
+    size_t *picked = malloc((want + 1) * sizeof(size_t));
+    int *ids = malloc((want + 1) * sizeof(int));
+    long *positions = malloc((want + 1) * sizeof(long));
+    if (picked == NULL || ids == NULL || positions == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        free(picked);
+        free(ids);
+        free(positions);
+        return;
+    }
+
+    size_t count = page_collect(picked, want + 1);
+    int more = count > want;
+    if (more) count = want;
+
+    //The table's rows are found by ID, a batch at a time
+    if (!db_lazy) {
+        for (size_t i = 0; i < count; i++) {
+            ids[i] = page_cursor.kind == PAGE_BY_MARK ? mark_key_id(key_index.marks[picked[i]])
+                                                      : key_index.ids[picked[i]];
+        }
+        find_index_by_id_batch(ids, count, positions);
+    }
+
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+    for (size_t i = 0; i < count; i++) {
+        const Student *current = db_lazy ? lazy_fetch(picked[i]) : positions[i] >= 0 ? row_at((size_t)positions[i]) : NULL;
+        if (current == NULL) continue; //line failed to parse
+
+        const char *colour = RESET;
+        if (current->mark >= 80)
+            colour = GREEN;
+        else if (current->mark < 50)
+            colour = RED;
+        else
+            colour = YELLOW;
+
+        printf("%-10d %-20s %-30s %s%-6.1f%s\n",
+               current->id,
+               current->name,
+               current->programme,
+               colour, current->mark, RESET);
+    }
+
+    if (count > 0) {
+        page_cursor.started = 1;
+        page_cursor.last = page_cursor.kind == PAGE_BY_MARK ? key_index.marks[picked[count - 1]]
+                                                            : (uint64_t)(uint32_t)page_id_at(picked[count - 1]);
+    }
+    page_cursor.done = !more;
+    if (more) {
+        printf("CMS: %zu row(s) shown. Type NEXT for the next %zu.\n", count, page_cursor.limit);
+    } else {
+        printf("CMS: %zu row(s) shown, end of results.\n", count);
+    }
+
+    free(picked);
+    free(ids);
+    free(positions);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_page
+// PURPOSE : SHOW ALL [SORT BY ID|MARK [ASC|DESC]] LIMIT <n> [AFTER <ID>] and
+//           QUERY <prefix> LIMIT <n> [AFTER <ID>]: starts a new cursor and
+//           prints its first page. The table order is left alone.
+// ACCEPTS : afterId = NULL -> from the beginning
+// -----------------------------------------------------------------------------
+void show_page(PageKind kind, int descending, const char *prefix, size_t limit, const int *afterId)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    page_cursor.kind = kind;
+    page_cursor.descending = descending;
+    page_cursor.limit = limit;
+    snprintf(page_cursor.prefix, sizeof(page_cursor.prefix), "%s", prefix ? prefix : "");
+    page_cursor.started = afterId != NULL;
+    page_cursor.done = 0;
+
+    if (afterId != NULL) {
+        page_cursor.last = (uint64_t)(uint32_t)*afterId;
+        if (kind == PAGE_BY_MARK) { //continue after that student's mark
+            int pos = find_index_by_id(*afterId);
+            if (pos < 0) {
+                printf("CMS: The record with ID %d does not exist.\n", *afterId);
+                page_cursor.kind = PAGE_NONE;
+                return;
+            }
+            page_cursor.last = mark_key(row_at((size_t)pos)->mark, *afterId);
+        }
+    }
+    page_show();
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: page_next
+// PURPOSE : NEXT. Prints the page after the last one shown.
+// -----------------------------------------------------------------------------
+void page_next(void)
+{
+    if (page_cursor.kind == PAGE_NONE) {
+        printf("CMS: Nothing to continue. Use SHOW ALL LIMIT <n> or QUERY <prefix> LIMIT <n> first.\n");
+        return;
+    }
+    page_show();
+}
+
+//Cursor over one posting list, used by the fuzzy k-way merge
+typedef struct {
+    const int *ids;
+    uint32_t pos;
+    uint32_t count;
+} PostingCursor;
+
+//Ranked fuzzy match
+typedef struct {
+    int pos;      //row position in the table
+    double score; //fraction of query trigrams found in the record
+    double tie;   //Jaccard similarity, breaks ties between equal scores
+} FuzzyMatch;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: cursor_sift_down
+// PURPOSE : Min-heap on the current ID of each posting cursor.
+// -----------------------------------------------------------------------------
+static void cursor_sift_down(PostingCursor *heap, size_t count, size_t pos)
+{
+    while (1) {
+        size_t left = 2 * pos + 1, right = left + 1, smallest = pos;
+        if (left < count && heap[left].ids[heap[left].pos] < heap[smallest].ids[heap[smallest].pos])
+            smallest = left;
+        if (right < count && heap[right].ids[heap[right].pos] < heap[smallest].ids[heap[smallest].pos])
+            smallest = right;
+        if (smallest == pos) return;
+
+        PostingCursor tmp = heap[pos];
+        heap[pos] = heap[smallest];
+        heap[smallest] = tmp;
+        pos = smallest;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: find_fuzzy
+// PURPOSE : Ranked typo-tolerant search. Every record sharing enough trigrams
+//           with the query is scored; the best FUZZY_MAX_RESULTS are printed.
+// DETAILS : The posting lists of the query trigrams are merged with a min-heap,
+//           so hit counts come out per ID without any extra hash table.
+// -----------------------------------------------------------------------------
+static void find_fuzzy(const TrigramIndex *index, int useProgramme, const char *normalizedQuery)
+{
+    uint32_t keys[MAX_TRIGRAMS];
+    PostingCursor heap[MAX_TRIGRAMS];
+    FuzzyMatch best[FUZZY_MAX_RESULTS];
+    size_t bestCount = 0;
+
+    size_t keyCount = collect_trigrams(normalizedQuery, 1, keys);
+    size_t heapCount = 0;
+    for (size_t k = 0; k < keyCount; k++) {
+        const TrigramPosting *posting = trigram_lookup(index, keys[k]);
+        if (posting && posting->count > 0) {
+            heap[heapCount].ids = posting->ids;
+            heap[heapCount].pos = 0;
+            heap[heapCount].count = posting->count;
+            heapCount++;
+        }
+    }
+    for (size_t i = heapCount / 2; i-- > 0;) {
+        cursor_sift_down(heap, heapCount, i);
+    }
+
+    size_t minHits = (size_t)(keyCount * FUZZY_MIN_SCORE + 0.999);
+    if (minHits == 0) minHits = 1;
+
+    while (heapCount > 0) {
+        int id = heap[0].ids[heap[0].pos];
+        size_t hits = 0;
+
+        //Pop every cursor sitting on this ID
+        while (heapCount > 0 && heap[0].ids[heap[0].pos] == id) {
+            hits++;
+            if (++heap[0].pos == heap[0].count) {
+                heap[0] = heap[--heapCount];
+            }
+            cursor_sift_down(heap, heapCount, 0);
+        }
+        if (hits < minHits) continue;
+
+        int pos = find_index_by_id(id);
+        if (pos < 0) continue;
+
+        char normalized[MAX_STR];
+        uint32_t recordKeys[MAX_TRIGRAMS];
+        normalize_text(useProgramme ? row_at(pos)->programme : row_at(pos)->name, normalized, sizeof(normalized));
+        size_t recordCount = collect_trigrams(normalized, 1, recordKeys);
+
+        FuzzyMatch match;
+        match.pos = pos;
+        match.score = (double)hits / (double)keyCount;
+        match.tie = (double)hits / (double)(keyCount + recordCount - hits);
+
+        //Insertion into the small sorted "best" list
+        size_t slot = bestCount;
+        while (slot > 0 && (best[slot - 1].score < match.score ||
+                            (best[slot - 1].score == match.score && best[slot - 1].tie < match.tie))) {
+            slot--;
+        }
+        if (slot >= FUZZY_MAX_RESULTS) continue;
+        if (bestCount < FUZZY_MAX_RESULTS) bestCount++;
+        memmove(&best[slot + 1], &best[slot], (bestCount - 1 - slot) * sizeof(FuzzyMatch));
+        best[slot] = match;
+    }
+
+    if (bestCount == 0) {
+        printf("CMS: No close matches for \"%s\".\n", normalizedQuery);
+        return;
+    }
+
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+    for (size_t i = 0; i < bestCount; i++) {
+        print_student_record(row_at((size_t)best[i].pos));
+    }
+    printf("CMS: %zu closest match(es), best first.\n", bestCount);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: find_text
+// PURPOSE : FIND [FUZZY] NAME|PROGRAMME <text>
+//           - Substring mode: trigram posting-list intersection, then each
+//             candidate is verified (case-insensitive, spacing-insensitive)
+//           - Queries shorter than 3 characters fall back to a full scan
+//           - Fuzzy mode: ranked by trigram similarity (see find_fuzzy)
+// -----------------------------------------------------------------------------
+void find_text(int useProgramme, const char *text, int fuzzy)
+{
+    if (!db_opened) { //No records in memory
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    char query[MAX_STR];
+    if (normalize_text(text, query, sizeof(query)) == 0) {
+        printf("Usage: FIND [FUZZY] NAME|PROGRAMME <text>\n");
+        return;
+    }
+
+    const TrigramIndex *index = useProgramme ? &programme_trigrams : &name_trigrams;
+
+    if (fuzzy) {
+        find_fuzzy(index, useProgramme, query);
+        return;
+    }
+
+    int *candidates = NULL;
+    size_t candidateCount = trigram_candidates(index, query, &candidates);
+    size_t found = 0;
+
+    if (candidateCount == SIZE_MAX) {
+        //Too short for trigrams: check every row
+        for (size_t i = 0; i < db.size; i++) {
+            if (text_matches(useProgramme ? row_at(i)->programme : row_at(i)->name, query)) {
+                if (found++ == 0)
+                    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+                print_student_record(row_at(i));
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i < candidateCount; i++) {
+            int pos = find_index_by_id(candidates[i]);
+            if (pos < 0) continue;
+
+            if (text_matches(useProgramme ? row_at(pos)->programme : row_at(pos)->name, query)) {
+                if (found++ == 0)
+                    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+                print_student_record(row_at(pos));
+            }
+        }
+        free(candidates);
+    }
+
+    if (found == 0)
+        printf("CMS: No records found containing \"%s\".\n", query);
+    else
+        printf("CMS: %zu record(s) found.\n", found);
+}
+
+
+
+// -----------------------------------------------------------------------------
+// FUNCTION: update
+// PURPOSE : Modifies an existing student record.
+// DETAILS :
+//   1. Look up student by ID
+//   2. Show current data
+//   3. Ask user which fields to edit
+//   4. Show a BEFORE/AFTER comparison (diff)
+//   5. Ask for confirmation
+//   6. Save changes and update undo log
+// -----------------------------------------------------------------------------
+void update(int studentID) {
+    if (!db_opened) { //No records in memory
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    //Save copies of BEFORE and AFTER states for diff & undo
+    Student before;
+    if (!record_visible(studentID, &before)) {
+        printf("CMS: The record with ID %d does not exist.\n", studentID);
+        return;
+    }
+    Student after  = before;
+
+    //Display current record
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+
+    print_student_record(&before);
+
+    //Allow user to edit fields (ENTER == keep old value)
+    int changed = 0;
+
+    changed |= prompt_edit_str("Name",
+                               after.name, MAX_STR,
+                               before.name);
+
+    changed |= prompt_edit_str("Programme",
+                               after.programme, MAX_STR,
+                               before.programme);
+
+    changed |= prompt_edit_mark(&after.mark,
+                                before.mark);
+
+    //If no field changed, abort update
+    if (!changed) {
+        printf(YELLOW "No changes detected. Update cancelled.\n" RESET);
+        return;
+    }
+
+    // --------------------------------------------
+    // Show before/after diff table for confirmation
+    // --------------------------------------------
+    printf("\n" BOLD "Review changes:" RESET "\n");
+    printf("%-12s | %-30s | %-30s\n",
+           "Field", "Before", "After");
+    printf("-------------+--------------------------------+--------------------------------\n");
+
+    print_diff_row("Name",      before.name,      after.name);
+    print_diff_row("Programme", before.programme, after.programme);
+
+    char bmark[32], amark[32];
+    snprintf(bmark, sizeof(bmark), "%.1f", before.mark);
+    snprintf(amark, sizeof(amark), "%.1f", after.mark);
+    print_diff_row("Mark", bmark, amark);
+
+    //Confirm if user wants to apply changes
+    char confirm[32];
+    printf("\nConfirm update (Y/N)? ");
+    if (!read_input_line(confirm, sizeof(confirm))) { //Check if NULL
+        printf("Cancelled.\n");
+        return;
+    }
+    //Convert lowercase and check 'y'
+    for (char *confirmPtr = confirm; *confirmPtr; ++confirmPtr)
+    {
+        *confirmPtr = (char)tolower((unsigned char)*confirmPtr);
+    }
+    if (confirm[0] != 'y') {
+        printf("Cancelled.\n");
+        return;
+    }
+
+    //Apply changes
+    if (!record_put(&after)) {
+        return;
+    }
+
+    printf(GREEN "CMS: Record updated.%s\n" RESET, txn.active ? " (pending COMMIT)" : "");
+
+    //Log update details
+    audit_change("UPDATE %d | \"%s\" -> \"%s\" | \"%s\" -> \"%s\" | %.1f -> %.1f", 
+        studentID,
+        before.name, after.name,
+        before.programme, after.programme,
+        before.mark, after.mark);
+
+    //Prepare for undo
+    if (!txn.active) {
+        undo_set(OP_UPDATE);
+        last_op.before = before;
+        last_op.after  = after;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: delete
+// PURPOSE : Removes a student record from the system.
+// DETAILS :
+//   1. Look up student by ID
+//   2. Display record about to be deleted
+//   3. Require user to type ID to confirm
+//   4. Remove from array (swap-delete method)
+//   5. Write to audit log
+//   6. Save undo info
+// -----------------------------------------------------------------------------
+void delete(int studentID) {
+    if (!db_opened) { //No records in memory
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    //Backup the record so UNDO can restore it
+    Student before;
+    if (!record_visible(studentID, &before)) {
+        printf("CMS: The record with ID %d does not exist.\n", studentID);
+        return;
+    }
+
+    //Show record before deletion
+    printf("\n" BOLD "About to delete this record:" RESET "\n");
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+
+    print_student_record(&before);
+
+    //Require exact ID confirmation
+    if (!confirm_delete_by_id(before.id)) {
+        printf(YELLOW "Cancelled.\n" RESET);
+        return;
+    }
+
+    //Delete by overwriting this index with last record (O(1))
+    if (!record_delete(before.id)) {
+        return;
+    }
+
+    printf(GREEN "CMS: Record deleted.%s\n" RESET, txn.active ? " (pending COMMIT)" : "");
+
+    audit_change("DELETE %d | \"%s\" | \"%s\" | %.1f",
+        before.id, before.name,
+        before.programme, before.mark);
+
+    //Prepare undo record
+    if (!txn.active) {
+        undo_set(OP_DELETE);
+        last_op.before = before;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: write_table_file
+// PURPOSE : Writes the metadata, column header and every record in the
+//           database file layout. progress != NULL -> reports rows written
+//           and stops early when cancelled (background SAVE).
+// RETURNS : 1 -> all rows written, 0 -> cancelled or write error
+// -----------------------------------------------------------------------------
+static int write_table_file(FILE *filePtr, TaskProgress *progress)
+{
+    //Write Metadata Headers
+    fprintf(filePtr, "Database Name: P9_3-CMS\n");
+    fprintf(filePtr, "Authors: Ryan, Glenn, Min Han, Jordan, Ben\n");
+    fprintf(filePtr, "Table Name: StudentRecords\n\n");
+
+    //Write Column Header
+    fprintf(filePtr, "%-10s %-15s %-25s %-6s\n", "ID", "Name", "Programme", "Mark");
+
+    //Iterate student array and write to each row
+    for (size_t i = 0; i < db.size; i++) {
+        const Student *current = row_at(i);
+        fprintf(filePtr, "%-10d %-15s %-25s %-6.1f\n",
+            current->id,
+            current->name,
+            current->programme,
+            current->mark);
+
+        if (progress && (i + 1) % TASK_REPORT_ROWS == 0 && !task_progress_update(progress, i + 1, 0)) {
+            return 0;
+        }
+    }
+    return !ferror(filePtr);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: save
+// PURPOSE : Writes the current student array into a .txt file in formatted table form, with metadata.
+// DETAILS :
+//   - Opens output file in write mode
+//   - Writes database name + author list + table name
+//   - Writes table header
+//   - Writes every student record in formatted columns
+//   - Write to audit log
+// -----------------------------------------------------------------------------
+void save() {
+    if (!db_opened) { //No records in memory
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    FILE *filePtr = fopen(FILENAME, "w"); //will overwrite existing *.txt file
+    if (filePtr == NULL) {
+        printf("Save failed.\n");
+        return;
+    }
+
+    TRACE_BEGIN(span, "save");
+    write_table_file(filePtr, NULL);
+    fclose(filePtr);
+    TRACE_END(span);
+
+    printf("CMS: Saved to \"%s\".\n", FILENAME);
+    table_unsaved = 0;
+
+    audit_log("SAVE %s", FILENAME); //Audit Logging Purposes
+}
+
+/* ---------------------------------------------------- */
+/* Compressed Archive (ARCHIVE / OPEN *.cmsa)           */
+/* ---------------------------------------------------- */
+//
+// Columnar, block-based binary format. All integers are LEB128 varints
+// unless noted.
+//
+//   "P93A" version(1 byte)
+//   rowCount blockRows
+//   dictBytes dictCount  [dictionary payload]
+//   repeated: blockRowCount payloadBytes [block payload]
+//
+// Dictionary payload: sorted distinct programmes, front-coded
+//   (shared prefix length, suffix length, suffix bytes).
+// Block payload (rows sorted by ID, every block decodes on its own):
+//   IDs      first ID, then delta to previous ID
+//   marks    16-bit little-endian tenths (0..1000)
+//   programme dictionary code per row
+//   names    front-coded against the previous name in the block
+//
+// Loads read one block at a time, so memory use does not depend on file size.
+
+#define ARCHIVE_MAGIC "P93A"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_BLOCK_ROWS CHUNK_ROWS //one decoded block fills one storage chunk
+
+//Growable byte buffer for encoding
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t cap;
+} ByteBuf;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: bytebuf_put / bytebuf_put_varint
+// RETURNS : 1 -> appended, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int bytebuf_put(ByteBuf *buffer, const void *bytes, size_t count)
+{
+    if (buffer->length + count > buffer->cap) {
+        size_t newCap = buffer->cap ? buffer->cap : 4096;
+        while (newCap < buffer->length + count) newCap *= 2;
+        unsigned char *grown = realloc(buffer->data, newCap);
+        if (grown == NULL) return 0;
+        buffer->data = grown;
+        buffer->cap = newCap;
+    }
+    memcpy(buffer->data + buffer->length, bytes, count);
+    buffer->length += count;
+    return 1;
+}
+
+static int bytebuf_put_varint(ByteBuf *buffer, uint64_t value)
+{
+    unsigned char bytes[10];
+    size_t count = 0;
+    do {
+        unsigned char byte = (unsigned char)(value & 0x7F);
+        value >>= 7;
+        bytes[count++] = (unsigned char)(byte | (value ? 0x80 : 0));
+    } while (value);
+    return bytebuf_put(buffer, bytes, count);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: get_varint
+// PURPOSE : Decodes one varint from [*p, end) and advances *p.
+// RETURNS : 1 -> ok, 0 -> truncated or too long
+// -----------------------------------------------------------------------------
+static int get_varint(const unsigned char **p, const unsigned char *end, uint64_t *out)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        unsigned char byte = *(*p)++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *out = value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: file_get_varint
+// PURPOSE : Same as get_varint, reading straight from a file (section headers).
+// -----------------------------------------------------------------------------
+static int file_get_varint(FILE *filePtr, uint64_t *out)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(filePtr);
+        if (byte == EOF) return 0;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *out = value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: put_front_coded
+// PURPOSE : Appends text as (shared prefix with previous, suffix length, suffix).
+// -----------------------------------------------------------------------------
+static int put_front_coded(ByteBuf *buffer, const char *previous, const char *text)
+{
+    size_t shared = 0;
+    while (previous[shared] != '\0' && previous[shared] == text[shared]) shared++;
+    size_t suffixLength = strlen(text + shared);
+
+    return bytebuf_put_varint(buffer, shared) &&
+           bytebuf_put_varint(buffer, suffixLength) &&
+           bytebuf_put(buffer, text + shared, suffixLength);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: get_front_coded
+// PURPOSE : Decodes a front-coded string in place: text holds the previous
+//           value on entry and the decoded value on return.
+// RETURNS : 1 -> ok, 0 -> corrupt
+// -----------------------------------------------------------------------------
+static int get_front_coded(const unsigned char **p, const unsigned char *end, char text[MAX_STR])
+{
+    uint64_t shared, suffixLength;
+    if (!get_varint(p, end, &shared) || !get_varint(p, end, &suffixLength)) return 0;
+    if (shared > strlen(text) || shared + suffixLength > MAX_STR - 1) return 0;
+    if (suffixLength > (uint64_t)(end - *p)) return 0;
+
+    memcpy(text + shared, *p, (size_t)suffixLength);
+    text[shared + suffixLength] = '\0';
+    *p += suffixLength;
+    return 1;
+}
+
+static int compare_student_ptr_id(const void *a, const void *b)
+{
+    const Student *x = *(const Student * const *)a;
+    const Student *y = *(const Student * const *)b;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int compare_str_ptr(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: write_section
+// PURPOSE : Writes "rowCount payloadBytes payload" for one dictionary/block.
+// -----------------------------------------------------------------------------
+static int write_section(FILE *filePtr, size_t count, const ByteBuf *payload)
+{
+    ByteBuf header = {NULL, 0, 0};
+    int ok = bytebuf_put_varint(&header, count) &&
+             bytebuf_put_varint(&header, payload->length) &&
+             fwrite(header.data, 1, header.length, filePtr) == header.length &&
+             fwrite(payload->data, 1, payload->length, filePtr) == payload->length;
+    free(header.data);
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: archive_write
+// PURPOSE : Writes the table to filePath in the compressed archive format.
+//           The table itself is not reordered. Prints nothing.
+//           The archive is written to <filePath>.tmp and renamed over
+//           filePath only when complete, so a failed write keeps the old file.
+// RETURNS : 1 -> written (*fileBytes, *programmes set), 0 -> write failed,
+//           -1 -> file could not be created
+// -----------------------------------------------------------------------------
+static int archive_write(const char *filePath, long *fileBytes, size_t *programmes)
+{
+    size_t count = db.size;
+    const Student **rows = malloc((count ? count : 1) * sizeof(*rows));
+    const char **dict = malloc((count ? count : 1) * sizeof(*dict));
+    char *temp = malloc(strlen(filePath) + 5);
+    ByteBuf payload = {NULL, 0, 0};
+    FILE *filePtr = NULL;
+    size_t dictCount = 0;
+    int ok = rows != NULL && dict != NULL && temp != NULL;
+
+    if (ok) {
+        for (size_t i = 0; i < count; i++) {
+            rows[i] = row_at(i);
+            dict[i] = rows[i]->programme;
+        }
+        qsort(rows, count, sizeof(*rows), compare_student_ptr_id);
+
+        //Programme dictionary: sorted, distinct
+        qsort(dict, count, sizeof(*dict), compare_str_ptr);
+        for (size_t i = 0; i < count; i++) {
+            if (dictCount == 0 || strcmp(dict[dictCount - 1], dict[i]) != 0) {
+                dict[dictCount++] = dict[i];
+            }
+        }
+    }
+
+    if (ok) sprintf(temp, "%s.tmp", filePath);
+    if (ok && (filePtr = fopen(temp, "wb")) == NULL) {
+        free(rows);
+        free(dict);
+        free(temp);
+        return -1;
+    }
+
+    //File header
+    if (ok) {
+        unsigned char version = ARCHIVE_VERSION;
+        ok = bytebuf_put(&payload, ARCHIVE_MAGIC, 4) &&
+             bytebuf_put(&payload, &version, 1) &&
+             bytebuf_put_varint(&payload, count) &&
+             bytebuf_put_varint(&payload, ARCHIVE_BLOCK_ROWS) &&
+             fwrite(payload.data, 1, payload.length, filePtr) == payload.length;
+    }
+
+    //Dictionary section
+    if (ok) {
+        payload.length = 0;
+        for (size_t i = 0; ok && i < dictCount; i++) {
+            ok = put_front_coded(&payload, i ? dict[i - 1] : "", dict[i]);
+        }
+        ok = ok && write_section(filePtr, dictCount, &payload);
+    }
+
+    //Row blocks
+    for (size_t blockStart = 0; ok && blockStart < count; blockStart += ARCHIVE_BLOCK_ROWS) {
+        size_t blockRows = count - blockStart < ARCHIVE_BLOCK_ROWS ? count - blockStart : ARCHIVE_BLOCK_ROWS;
+        const Student **block = rows + blockStart;
+        payload.length = 0;
+
+        for (size_t i = 0; ok && i < blockRows; i++) {
+            ok = bytebuf_put_varint(&payload, i ? (uint64_t)(block[i]->id - block[i - 1]->id) : (uint64_t)block[0]->id);
+        }
+        for (size_t i = 0; ok && i < blockRows; i++) {
+            unsigned tenths = (unsigned)(block[i]->mark * 10.0f + 0.5f);
+            unsigned char bytes[2] = {(unsigned char)(tenths & 0xFF), (unsigned char)(tenths >> 8)};
+            ok = bytebuf_put(&payload, bytes, 2);
+        }
+        for (size_t i = 0; ok && i < blockRows; i++) {
+            const char *key = block[i]->programme;
+            const char **code = bsearch(&key, dict, dictCount, sizeof(*dict), compare_str_ptr);
+            ok = bytebuf_put_varint(&payload, (uint64_t)(code - dict));
+        }
+        for (size_t i = 0; ok && i < blockRows; i++) {
+            ok = put_front_coded(&payload, i ? block[i - 1]->name : "", block[i]->name);
+        }
+        ok = ok && write_section(filePtr, blockRows, &payload);
+    }
+
+    *fileBytes = filePtr ? ftell(filePtr) : 0;
+    *programmes = dictCount;
+    if (filePtr && fclose(filePtr) != 0) ok = 0;
+    if (ok) {
+        remove(filePath); //rename() does not replace files on Windows
+        ok = rename(temp, filePath) == 0;
+    }
+    if (filePtr && !ok) remove(temp);
+    free(payload.data);
+    free(rows);
+    free(dict);
+    free(temp);
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: archive_db
+// PURPOSE : ARCHIVE <file>. Writes the open table as an archive.
+// -----------------------------------------------------------------------------
+void archive_db(const char *filePath)
+{
+    if (!db_opened) { //No records in memory
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (!has_archive_extension(filePath)) { //never overwrite a text database with archive bytes
+        printf(RED "CMS Error: Archive file names must end in \".cmsa\".\n" RESET);
+        return;
+    }
+
+    long fileBytes;
+    size_t programmes;
+    int written = archive_write(filePath, &fileBytes, &programmes);
+    if (written < 0) {
+        printf("CMS: Failed to write \"%s\".\n", filePath);
+        return;
+    }
+    if (!written) {
+        printf(RED "CMS Error: Archive write failed.\n" RESET);
+        return;
+    }
+
+    printf("CMS: Archived %zu records to \"%s\" (%ld bytes, %zu programmes).\n",
+           db.size, filePath, fileBytes, programmes);
+    audit_log("ARCHIVE %s (%zu records)", filePath, db.size);
+}
+
+static int replication_on = 0; //REPLICATE ON: every OPEN publishes a snapshot for --follow replicas
+
+// -----------------------------------------------------------------------------
+// FUNCTION: snapshot_publish
+// PURPOSE : Called by the primary whenever its table is replaced (OPEN, or a
+//           lazy table loaded in full) while REPLICATE is on, and by
+//           REPLICATE ON itself: writes the table as an archive and
+//           logs "SNAPSHOT <file> (<n> records)". A --follow replica loads
+//           the newest snapshot and applies the log entries after it, so it
+//           never reads the text database. Every snapshot gets a new name,
+//           so a replica still reading the previous one is not disturbed;
+//           SNAPSHOT_POINTER names the newest, and the one before it is
+//           deleted once the new one is logged.
+// -----------------------------------------------------------------------------
+static void snapshot_publish(void)
+{
+    static long long serial = 0;
+    //A replica's table belongs to the primary; what REPLAY loads is not logged
+    if (!replication_on || log_state.readOnly || log_state.suspended) return;
+
+    long long now = (long long)time(NULL);
+    serial = now > serial ? now : serial + 1;
+    char path[64], previous[64] = "";
+    snprintf(path, sizeof(path), "P9_3-CMS.snap.%lld.cmsa", serial);
+
+    FILE *pointer = fopen(SNAPSHOT_POINTER, "r");
+    if (pointer != NULL) {
+        if (fgets(previous, sizeof(previous), pointer) == NULL) previous[0] = '\0';
+        previous[strcspn(previous, "\r\n")] = '\0';
+        fclose(pointer);
+    }
+
+    long fileBytes;
+    size_t programmes;
+    int ok = archive_write(path, &fileBytes, &programmes) > 0;
+    if (ok && (pointer = fopen(SNAPSHOT_POINTER ".tmp", "w")) != NULL) {
+        ok = fprintf(pointer, "%s\n", path) > 0;
+        if (fclose(pointer) != 0) ok = 0;
+        if (ok) {
+            remove(SNAPSHOT_POINTER);
+            ok = rename(SNAPSHOT_POINTER ".tmp", SNAPSHOT_POINTER) == 0;
+        }
+    }
+    if (!ok) {
+        printf(YELLOW "CMS Warning: Could not write the replica snapshot \"%s\".\n" RESET, path);
+        return;
+    }
+
+    audit_log("SNAPSHOT %s (%zu records)", path, db.size);
+    if (previous[0] != '\0' && strcmp(previous, path) != 0) remove(previous);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: replicate_set
+// PURPOSE : REPLICATE ON | OFF. ON publishes the open table right away (a
+//           lazy table once it is loaded in full) and after every OPEN; OFF
+//           stops that and removes the last snapshot.
+// -----------------------------------------------------------------------------
+void replicate_set(int on)
+{
+    if (!on) {
+        char previous[64] = "";
+        FILE *pointer = fopen(SNAPSHOT_POINTER, "r");
+        if (pointer != NULL) {
+            if (fgets(previous, sizeof(previous), pointer) == NULL) previous[0] = '\0';
+            previous[strcspn(previous, "\r\n")] = '\0';
+            fclose(pointer);
+            if (previous[0] != '\0') remove(previous);
+            remove(SNAPSHOT_POINTER);
+        }
+        replication_on = 0;
+        printf("CMS: Replication off. Replicas keep following the log but empty at the next OPEN.\n");
+        return;
+    }
+
+    replication_on = 1;
+    if (db_opened && lazy.file == NULL) {
+        snapshot_publish();
+        printf("CMS: Replication on: snapshot of %zu records published for --follow replicas.\n", db.size);
+    }
+    else {
+        printf("CMS: Replication on: the table is published for --follow replicas once it is loaded in full.\n");
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: has_archive_extension
+// PURPOSE : Archive files end with ".cmsa".
+// -----------------------------------------------------------------------------
+static int has_archive_extension(const char *filePath)
+{
+    size_t filePathLength = strlen(filePath);
+    return filePathLength > 5 && strcmp(filePath + filePathLength - 5, ".cmsa") == 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: read_section
+// PURPOSE : Reads one "count payloadBytes payload" section into buffer
+//           (reused between blocks).
+// RETURNS : 1 -> ok, 0 -> end of file / corrupt / out of memory
+// -----------------------------------------------------------------------------
+static int read_section(FILE *filePtr, uint64_t *count, ByteBuf *buffer)
+{
+    uint64_t payloadBytes;
+    if (!file_get_varint(filePtr, count) || !file_get_varint(filePtr, &payloadBytes)) return 0;
+    if (*count > UINT32_MAX || payloadBytes > (*count + 1) * (MAX_STR + 32)) {
+        return 0; //larger than any valid section could be
+    }
+
+    buffer->length = 0;
+    if (payloadBytes > buffer->cap) {
+        unsigned char *grown = realloc(buffer->data, (size_t)payloadBytes);
+        if (grown == NULL) return 0;
+        buffer->data = grown;
+        buffer->cap = (size_t)payloadBytes;
+    }
+    if (fread(buffer->data, 1, (size_t)payloadBytes, filePtr) != payloadBytes) return 0;
+    buffer->length = (size_t)payloadBytes;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: decode_block
+// PURPOSE : Decodes one row block and appends its rows to store.
+// RETURNS : 1 -> ok, 0 -> corrupt / out of memory
+// -----------------------------------------------------------------------------
+static int decode_block(StudentStore *store, const ByteBuf *block, size_t blockRows, char (*dict)[MAX_STR], size_t dictCount)
+{
+    const unsigned char *p = block->data;
+    const unsigned char *end = block->data + block->length;
+    int ids[ARCHIVE_BLOCK_ROWS];
+    uint64_t value;
+
+    for (size_t i = 0; i < blockRows; i++) {
+        if (!get_varint(&p, end, &value)) return 0;
+        value += i ? (uint64_t)ids[i - 1] : 0;
+        if (value > INT_MAX) return 0;
+        ids[i] = (int)value;
+    }
+
+    const unsigned char *marks = p;
+    if ((size_t)(end - p) < blockRows * 2) return 0;
+    p += blockRows * 2;
+
+    const unsigned char *codes = p;
+    for (size_t i = 0; i < blockRows; i++) { //skip codes, names follow them
+        if (!get_varint(&p, end, &value)) return 0;
+    }
+
+    Student current;
+    current.name[0] = '\0';
+    for (size_t i = 0; i < blockRows; i++) {
+        current.id = ids[i];
+
+        unsigned tenths = (unsigned)marks[2 * i] | ((unsigned)marks[2 * i + 1] << 8);
+        if (tenths > 1000) return 0;
+        current.mark = (float)tenths / 10.0f;
+
+        if (!get_varint(&codes, end, &value) || value >= dictCount) return 0;
+        memcpy(current.programme, dict[value], MAX_STR);
+
+        if (!get_front_coded(&p, end, current.name)) return 0;
+
+        if (store_append(store, &current) == NO_HANDLE) return 0;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: open_archive
+// PURPOSE : OPEN <file>.cmsa. Streams the archive block by block into a
+//           staging store that replaces the table only once every block
+//           has decoded, so a corrupt or truncated archive leaves the
+//           current table untouched. Rows come back in ID order.
+// RETURNS : 1 -> success, 0 -> failure (missing, corrupt)
+// -----------------------------------------------------------------------------
+int open_archive(const char *filePath)
+{
+    FILE *filePtr = fopen(filePath, "rb");
+    if (!filePtr) {
+        printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
+        return 0;
+    }
+
+    unsigned char magic[5];
+    uint64_t rowCount, blockRows, dictCount;
+    if (fread(magic, 1, 5, filePtr) != 5 || memcmp(magic, ARCHIVE_MAGIC, 4) != 0 || magic[4] != ARCHIVE_VERSION ||
+        !file_get_varint(filePtr, &rowCount) || !file_get_varint(filePtr, &blockRows) ||
+        blockRows != ARCHIVE_BLOCK_ROWS) {
+        printf(RED "CMS Error: \"%s\" is not a P9_3 archive.\n" RESET, filePath);
+        fclose(filePtr);
+        return 0;
+    }
+
+    StudentStore staging;
+    memset(&staging, 0, sizeof(staging));
+    staging.freeHead = NO_HANDLE;
+
+    ByteBuf buffer = {NULL, 0, 0};
+    char (*dict)[MAX_STR] = NULL;
+    size_t loaded = 0;
+    int ok = read_section(filePtr, &dictCount, &buffer) && dictCount <= rowCount;
+
+    //Dictionary
+    if (ok) {
+        dict = malloc((dictCount ? dictCount : 1) * sizeof(*dict));
+        ok = dict != NULL;
+    }
+    const unsigned char *p = buffer.data;
+    for (size_t i = 0; ok && i < dictCount; i++) {
+        if (i == 0) dict[0][0] = '\0';
+        else memcpy(dict[i], dict[i - 1], MAX_STR);
+        ok = get_front_coded(&p, buffer.data + buffer.length, dict[i]);
+    }
+
+    //Row blocks, one at a time
+    while (ok && loaded < rowCount) {
+        uint64_t thisBlock;
+        ok = read_section(filePtr, &thisBlock, &buffer) &&
+             thisBlock >= 1 && thisBlock <= ARCHIVE_BLOCK_ROWS && thisBlock <= rowCount - loaded &&
+             decode_block(&staging, &buffer, (size_t)thisBlock, dict, (size_t)dictCount);
+        if (ok) loaded += (size_t)thisBlock;
+    }
+
+    long bytesRead = ftell(filePtr);
+    fclose(filePtr);
+    free(buffer.data);
+    free(dict);
+
+    if (!ok) {
+        printf(RED "CMS Error: \"%s\" is corrupt or truncated (%zu of %llu records read); the current table is unchanged.\n" RESET,
+               filePath, loaded, (unsigned long long)rowCount);
+        store_clear(&staging);
+        return 0;
+    }
+
+    //Swap in the new table; the old one is freed only now
+    lazy_close();
+    store_clear(&db);
+    db = staging;
+    table_rebuild_indexes();
+
+    printf("CMS: \"%s\" opened (%zu records, %ld bytes read)\n", filePath, db.size, bytesRead);
+    audit_log("OPEN %s (%zu records)", filePath, db.size);
+    snapshot_publish();
+
+    undo_set(OP_NONE); // Reset Undo history
+    db_opened = 1;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: summary
+// PURPOSE : Displays class-wide statistics including:
+//           - total student count
+//           - average mark
+//           - highest mark + student name
+//           - lowest mark + student name
+// DETAILS :
+//   - Iterate through all records once
+//   - Track running total, max, min, and indices
+// -----------------------------------------------------------------------------
+void summary() {
+    if (!db_opened || db.size == 0) { //No records in memory -> cannot summarise
+        out_printf("No students available.\n");
+        return;
+    }
+
+    size_t total = db.size; //Total number of students
+    double sum = 0.0; //Running total of all marks
+
+    //Initialise highest/lowest values using first student's mark
+    double highest = row_at(0)->mark;
+    double lowest  = row_at(0)->mark;
+    size_t hi_index = 0; //Index of student with highest mark
+    size_t lo_index = 0; //Index of student with lowest mark
+
+    // -----------------------------------------------------
+    // Scan through all records to compute statistics
+    // -----------------------------------------------------
+    for (size_t i = 0; i < db.size; i++) {
+
+        double m = row_at(i)->mark;
+        sum += m;     //Add mark to running sum
+
+        //Track highest mark
+        if (m > highest) {
+            highest = m;
+            hi_index = i;
+        }
+
+        //Track lowest mark
+        if (m < lowest) {
+            lowest = m;
+            lo_index = i;
+        }
+    }
+
+    double average = sum / total;   //Class average
+
+    // -----------------------------------------------------
+    // Print results in colored, formatted output
+    // -----------------------------------------------------
+    out_printf(CYAN "===== Student Summary =====\n" RESET);
+
+    out_printf("Total students :  %zu\n", total);
+
+    out_printf("Average mark   :");
+    out_printf(YELLOW " % .2f\n" RESET, average);
+
+    out_printf("Highest mark   : ");
+    out_printf(GREEN "% .1f (%s)\n" RESET, highest, row_at(hi_index)->name);
+
+    out_printf("Lowest mark    :");
+    out_printf(RED   " % .1f (%s)\n" RESET, lowest, row_at(lo_index)->name);
+
+    out_printf(CYAN "===========================\n" RESET);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: undo
+// PURPOSE : Reverts the last modifying operation.
+// SUPPORTS:
+//   - Undo INSERT: remove the last inserted student
+//   - Undo DELETE: reinsert the deleted student
+//   - Undo UPDATE: restore record to previous state
+//
+// NOTES:
+//   - Only ONE level of undo is supported
+//   - last_op struct stores the type of operation,
+//     and before/after student snapshots
+// -----------------------------------------------------------------------------
+void undo() {
+    //If no operation to undo
+    if (last_op.op == OP_NONE) {
+        printf(YELLOW "CMS: Nothing to undo.\n" RESET);
+        return;
+    }
+
+    //Visual header
+    printf("\n" BOLD "===== Performing UNDO operation =====" RESET "\n");
+
+    //Print table headers
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+
+    printf(CYAN "------------------------------------------------------------------\n" RESET);
+
+    // -------------------------------------------------------------------------
+    // CASE 1: Undo INSERT -> Remove the record that was inserted
+    // -------------------------------------------------------------------------
+    if (last_op.op == OP_INSERT) {
+
+        //Locate the inserted record using its ID
+        int i = find_index_by_id(last_op.after.id);
+
+        //Only undo if the record is still present
+        if (i >= 0 && db.size > 0) {
+
+            printf(YELLOW "Removed record:\n" RESET);
+            print_student_record(row_at(i));
+
+            //Delete using swap-delete for O(1) removal
+            table_remove_at((size_t)i);
+
+            printf(GREEN "CMS: Undo INSERT successful (Record ID %d removed).\n" RESET, last_op.after.id);
+
+            audit_log("UNDO INSERT (ID %d removed)", last_op.after.id);
+        }
+        else {
+            printf(RED "CMS Error: Undo failed. Record ID %d not found.\n" RESET, last_op.after.id);
+
+            audit_log("UNDO INSERT failed (ID %d not found)", last_op.after.id);
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    // CASE 2: Undo DELETE -> Re-insert the previously deleted record
+    // -------------------------------------------------------------------------
+    else if (last_op.op == OP_DELETE) {
+        //Reinsert deleted student (expands array + updates indexes)
+        table_append(&last_op.before);
+
+        printf(GREEN "Re-inserted record:\n" RESET);
+        print_student_record(&last_op.before);
+
+        printf(GREEN "CMS: Undo DELETE successful (Record ID %d re-inserted).\n" RESET, last_op.before.id);
+
+        audit_log("UNDO DELETE (ID %d re-inserted)", last_op.before.id);
+    }
+
+    // -------------------------------------------------------------------------
+    // CASE 3: Undo UPDATE -> Restore the BEFORE state
+    // -------------------------------------------------------------------------
+    else if (last_op.op == OP_UPDATE) {
+
+        //Find the record using ID from the "after" snapshot
+        //because the user might have edited the name/programme
+        int i = find_index_by_id(last_op.after.id);
+
+        if (i >= 0) {
+
+            printf(YELLOW "Restoring record from state before update:\n" RESET);
+            print_student_record(&last_op.before);
+
+            //Restore original version
+            table_replace_at((size_t)i, &last_op.before);
+
+            printf(GREEN "CMS: Undo UPDATE successful (Record ID %d reverted).\n" RESET, last_op.before.id);
+
+            audit_log("UNDO UPDATE (ID %d restored)", last_op.before.id);
+        }
+        else {
+
+            printf(RED "CMS Error: Undo failed. Record ID %d not found.\n" RESET, last_op.after.id);
+
+            audit_log("UNDO UPDATE failed (ID %d not found)", last_op.after.id);
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    // CASE 4: Undo BATCH -> Revert every change of a committed transaction
+    // -------------------------------------------------------------------------
+    else if (last_op.op == OP_BATCH) {
+
+        //Large batches (e.g. a MERGE) only list their first records
+        for (size_t i = 0; i < last_op.batchCount && i < UNDO_BATCH_SHOW_MAX; i++) {
+            const BatchChange *change = &last_op.batch[i];
+            print_student_record(change->hadBefore ? &change->before : &change->after);
+        }
+        if (last_op.batchCount > UNDO_BATCH_SHOW_MAX) {
+            printf("... and %zu more record(s)\n", last_op.batchCount - UNDO_BATCH_SHOW_MAX);
+        }
+
+        batch_revert(last_op.batch, last_op.batchCount);
+
+        printf(GREEN "CMS: Undo %s successful (%zu change(s) reverted).\n" RESET, last_op.batchLabel, last_op.batchCount);
+
+        audit_log("UNDO %s (%zu change(s) reverted)", last_op.batchLabel, last_op.batchCount);
+    }
+
+    //Clear undo history so cannot undo twice
+    printf(BOLD "====================================" RESET "\n");
+
+    undo_set(OP_NONE);
+}
+
+
+/* ---------------------------------------------------- */
+/* Benchmarks                                           */
+/* ---------------------------------------------------- */
+
+// -----------------------------------------------------------------------------
+// FUNCTION: now_seconds
+// PURPOSE : Monotonic wall clock in seconds, for timing commands.
+// -----------------------------------------------------------------------------
+static double now_seconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: sleep_seconds
+// -----------------------------------------------------------------------------
+static void sleep_seconds(double seconds)
+{
+    if (seconds <= 0.0) return;
+#ifdef _WIN32
+    Sleep((DWORD)(seconds * 1000.0));
+#else
+    struct timespec pause;
+    pause.tv_sec = (time_t)seconds;
+    pause.tv_nsec = (long)((seconds - (double)pause.tv_sec) * 1e9);
+    nanosleep(&pause, NULL);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: bench_parse
+// PURPOSE : BENCH PARSE <file>. Measures parse_line throughput without
+//           touching the open table:
+//           - streaming: LineReader + parse_line (what OPEN does, minus storage)
+//           - in-memory: whole file read first, then parse only (batch path)
+// -----------------------------------------------------------------------------
+void bench_parse(const char *filePath)
+{
+    FILE *filePtr = fopen(filePath, "rb");
+    if (!filePtr) {
+        printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
+        return;
+    }
+
+    //Pass 1: streaming
+    LineReader reader;
+    if (!line_reader_init(&reader, filePtr)) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        fclose(filePtr);
+        return;
+    }
+
+    const char *line;
+    size_t lineLength;
+    size_t lines = 0, parsed = 0;
+    Student scratch;
+
+    double started = now_seconds();
+    while (line_reader_next(&reader, &line, &lineLength, NULL)) {
+        if (++lines <= 5) continue; //header
+        parsed += (size_t)parse_line(line, lineLength, &scratch);
+    }
+    double streamSeconds = now_seconds() - started;
+    long long fileBytes = reader.offset;
+    line_reader_free(&reader);
+
+    //Pass 2: parse only, from memory
+    char *content = malloc((size_t)fileBytes + 1);
+    if (content == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        fclose(filePtr);
+        return;
+    }
+    rewind(filePtr);
+    size_t contentLength = fread(content, 1, (size_t)fileBytes, filePtr);
+    fclose(filePtr);
+
+    started = now_seconds();
+    size_t memoryParsed = 0;
+    const char *p = content;
+    const char *end = content + contentLength;
+    for (size_t lineNumber = 1; p < end; lineNumber++) {
+        const char *newline = memchr(p, '\n', (size_t)(end - p));
+        size_t length = newline ? (size_t)(newline - p) : (size_t)(end - p);
+        if (lineNumber > 5) {
+            memoryParsed += (size_t)parse_line(p, length, &scratch);
+        }
+        p += length + 1;
+    }
+    double memorySeconds = now_seconds() - started;
+    free(content);
+
+    const double MB = 1024.0 * 1024.0;
+    printf(CYAN "===== Parse Benchmark: %s =====\n" RESET, filePath);
+    printf("File size      : %.2f MB, %zu line(s), %zu valid record(s)\n", fileBytes / MB, lines, parsed);
+    printf("Streaming      : %.3f s, %.1f MB/s\n", streamSeconds,
+           streamSeconds > 0 ? fileBytes / MB / streamSeconds : 0.0);
+    printf("In-memory      : %.3f s, %.1f MB/s (%zu valid)\n", memorySeconds,
+           memorySeconds > 0 ? contentLength / MB / memorySeconds : 0.0, memoryParsed);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: bench_sort
+// PURPOSE : BENCH SORT. Times a sort of the open table by each single field
+//           without changing the row order, so text sorts (collation keys)
+//           can be compared with numeric ones.
+// -----------------------------------------------------------------------------
+void bench_sort(void)
+{
+    static const char *const fieldNames[] = {"ID", "NAME", "PROGRAMME", "MARK"};
+
+    if (!lazy_materialize()) return;
+    if (db.size == 0) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    RowRef *refs = malloc(db.size * sizeof(RowRef));
+    RowRef *scratch = malloc(db.size * sizeof(RowRef));
+    if (refs == NULL || scratch == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        free(refs);
+        free(scratch);
+        return;
+    }
+
+    SortKey savedKeys[SORT_KEYS_MAX];
+    int savedCount = sort_key_count;
+    memcpy(savedKeys, sort_keys, sizeof(savedKeys));
+
+    printf(CYAN "===== Sort Benchmark: %zu row(s), %d thread(s) =====\n" RESET, db.size, pool_size());
+    for (int f = 0; f < 4; f++) {
+        sort_keys[0].field = (SortField)f;
+        sort_keys[0].descending = 0;
+        sort_key_count = 1;
+
+        double started = now_seconds();
+        RowRef *sorted = sort_table_refs(refs, scratch);
+        double seconds = now_seconds() - started;
+        if (sorted == NULL) {
+            printf(RED "CMS Error: Out of memory.\n" RESET);
+            break;
+        }
+        printf("%-15s: %.3f s\n", fieldNames[f], seconds);
+    }
+
+    memcpy(sort_keys, savedKeys, sizeof(savedKeys));
+    sort_key_count = savedCount;
+    free(refs);
+    free(scratch);
+}
+
+
+/* ---------------------------------------------------- */
+/* Snapshot Diff (DIFF)                                 */
+/* ---------------------------------------------------- */
+//
+// DIFF <fileA> <fileB> is a hash join on ID. The rows of A go into a join
+// table (their line text in an arena plus an ID hash), then every row of B
+// probes it: a miss is ADDED, a hit with different fields is CHANGED, and
+// the rows of A no probe matched are REMOVED. When A is too big for the
+// memory budget, both files are first split by ID hash into partition
+// files, and each pair of partitions is joined on its own.
+
+#define DIFF_MEMORY_BUDGET (64L * 1024 * 1024) //Join table bytes allowed per partition
+#define DIFF_MAX_PARTITIONS 256
+
+//One row of A in the join table
+typedef struct {
+    int id;
+    int matched;     //1 -> a row of B had this ID
+    size_t offset;   //Line start in the arena
+    size_t length;   //Line length
+} DiffEntry;
+
+typedef struct {
+    DiffEntry *entries;   //Rows of A in file order
+    size_t count, cap;
+    uint32_t *slots;      //ID hash: entry index + 1, 0 = empty
+    size_t slotCount;     //Power of two
+    char *arena;          //Line text of every entry
+    size_t arenaUsed, arenaCap;
+} DiffTable;
+
+typedef struct {
+    size_t rowsA, rowsB;
+    size_t added, removed, changed, unchanged;
+    size_t duplicates;    //Repeated IDs inside one file (first one kept)
+    size_t skipped;       //Invalid lines
+    int summaryOnly;      //DIFF ... SUMMARY: counts only
+} DiffStats;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_table_reset / diff_table_free
+// PURPOSE : Empties the join table for the next partition (keeping its
+//           buffers), or releases it.
+// -----------------------------------------------------------------------------
+static void diff_table_reset(DiffTable *table)
+{
+    table->count = 0;
+    table->arenaUsed = 0;
+    if (table->slots) memset(table->slots, 0, table->slotCount * sizeof(uint32_t));
+}
+
+static void diff_table_free(DiffTable *table)
+{
+    free(table->entries);
+    free(table->slots);
+    free(table->arena);
+    memset(table, 0, sizeof(*table));
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_table_find
+// RETURNS : entry of 'id', NULL if A has no such row
+// -----------------------------------------------------------------------------
+static DiffEntry *diff_table_find(const DiffTable *table, int id)
+{
+    if (table->slotCount == 0) return NULL;
+    size_t mask = table->slotCount - 1;
+    for (size_t i = id_hash(id) & mask; table->slots[i] != 0; i = (i + 1) & mask) {
+        DiffEntry *entry = &table->entries[table->slots[i] - 1];
+        if (entry->id == id) return entry;
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_table_grow_slots
+// PURPOSE : Doubles the ID hash and re-inserts every entry (load <= 1/2).
+// RETURNS : 1 -> ok, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int diff_table_grow_slots(DiffTable *table)
+{
+    size_t newCount = table->slotCount ? table->slotCount * 2 : 1024;
+    uint32_t *slots = calloc(newCount, sizeof(uint32_t));
+    if (slots == NULL) return 0;
+
+    for (size_t e = 0; e < table->count; e++) {
+        size_t i = id_hash(table->entries[e].id) & (newCount - 1);
+        while (slots[i] != 0) i = (i + 1) & (newCount - 1);
+        slots[i] = (uint32_t)(e + 1);
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slotCount = newCount;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_table_add
+// PURPOSE : Adds a row of A, keeping its line text for the compare later.
+// RETURNS : 1 -> added, 0 -> ID already present (duplicate), -1 -> out of memory
+// -----------------------------------------------------------------------------
+static int diff_table_add(DiffTable *table, int id, const char *line, size_t length)
+{
+    if (diff_table_find(table, id) != NULL) return 0;
+
+    if ((table->count + 1) * 2 > table->slotCount && !diff_table_grow_slots(table)) return -1;
+    if (table->count == table->cap) {
+        size_t newCap = table->cap ? table->cap * 2 : 1024;
+        DiffEntry *entries = realloc(table->entries, newCap * sizeof(DiffEntry));
+        if (entries == NULL) return -1;
+        table->entries = entries;
+        table->cap = newCap;
+    }
+    if (table->arenaUsed + length > table->arenaCap) {
+        size_t newCap = table->arenaCap ? table->arenaCap : LINE_READER_BLOCK;
+        while (newCap < table->arenaUsed + length) newCap *= 2;
+        char *arena = realloc(table->arena, newCap);
+        if (arena == NULL) return -1;
+        table->arena = arena;
+        table->arenaCap = newCap;
+    }
+
+    DiffEntry *entry = &table->entries[table->count];
+    entry->id = id;
+    entry->matched = 0;
+    entry->offset = table->arenaUsed;
+    entry->length = length;
+    memcpy(table->arena + table->arenaUsed, line, length);
+    table->arenaUsed += length;
+
+    size_t mask = table->slotCount - 1;
+    size_t i = id_hash(id) & mask;
+    while (table->slots[i] != 0) i = (i + 1) & mask;
+    table->slots[i] = (uint32_t)(++table->count);
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_next_row
+// PURPOSE : Next valid record of a snapshot file (after 'headerLines' lines)
+//           or of a partition file (headerLines = 0). Invalid lines are counted.
+// RETURNS : 1 -> row returned (line span valid until the next call), 0 -> end
+// -----------------------------------------------------------------------------
+static int diff_next_row(LineReader *reader, int *lineNumber, int headerLines, DiffStats *stats,
+                         Student *row, const char **line, size_t *length)
+{
+    while (line_reader_next(reader, line, length, NULL)) {
+        if (++*lineNumber <= headerLines) continue;
+        if (parse_line(*line, *length, row)) return 1;
+        stats->skipped++;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_print_row
+// PURPOSE : One ADDED (+) or REMOVED (-) record, in SHOW ALL columns.
+// -----------------------------------------------------------------------------
+static void diff_print_row(char sign, const char *colour, const Student *row)
+{
+    printf("%s%c %-10d %-20s %-30s %-6.1f%s\n", colour, sign, row->id, row->name, row->programme, row->mark, RESET);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_print_changed
+// PURPOSE : One CHANGED (~) record followed by its changed fields in the
+//           BEFORE/AFTER layout of print_diff_row.
+// -----------------------------------------------------------------------------
+static void diff_print_changed(const Student *before, const Student *after)
+{
+    printf(YELLOW "~ %-10d %s\n" RESET, after->id, after->name);
+    if (strcmp(before->name, after->name) != 0) print_diff_row("  Name", before->name, after->name);
+    if (strcmp(before->programme, after->programme) != 0) print_diff_row("  Programme", before->programme, after->programme);
+    if (before->mark != after->mark) {
+        char beforeMark[32], afterMark[32];
+        snprintf(beforeMark, sizeof(beforeMark), "%.1f", before->mark);
+        snprintf(afterMark, sizeof(afterMark), "%.1f", after->mark);
+        print_diff_row("  Mark", beforeMark, afterMark);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_join
+// PURPOSE : Joins one pair of inputs: builds the table from A, probes it
+//           with every row of B, then lists the rows of A left unmatched.
+// RETURNS : 1 -> done, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int diff_join(FILE *fileA, FILE *fileB, int headerLines, DiffTable *table, DiffStats *stats)
+{
+    LineReader reader;
+    const char *line;
+    size_t length;
+    int lineNumber = 0;
+    Student rowA, rowB;
+
+    diff_table_reset(table);
+
+    //Build
+    if (!line_reader_init(&reader, fileA)) return 0;
+    while (diff_next_row(&reader, &lineNumber, headerLines, stats, &rowA, &line, &length)) {
+        stats->rowsA++;
+        int added = diff_table_add(table, rowA.id, line, length);
+        if (added < 0) {
+            line_reader_free(&reader);
+            return 0;
+        }
+        if (added == 0) stats->duplicates++;
+    }
+    line_reader_free(&reader);
+
+    //Probe
+    lineNumber = 0;
+    if (!line_reader_init(&reader, fileB)) return 0;
+    while (diff_next_row(&reader, &lineNumber, headerLines, stats, &rowB, &line, &length)) {
+        stats->rowsB++;
+        DiffEntry *entry = diff_table_find(table, rowB.id);
+        if (entry == NULL) {
+            stats->added++;
+            if (!stats->summaryOnly) diff_print_row('+', GREEN, &rowB);
+            continue;
+        }
+        if (entry->matched) {
+            stats->duplicates++;
+            continue;
+        }
+        entry->matched = 1;
+        parse_line(table->arena + entry->offset, entry->length, &rowA);
+        if (student_equal(&rowA, &rowB)) {
+            stats->unchanged++;
+        } else {
+            stats->changed++;
+            if (!stats->summaryOnly) diff_print_changed(&rowA, &rowB);
+        }
+    }
+    line_reader_free(&reader);
+
+    //Rows of A that B no longer has
+    for (size_t e = 0; e < table->count; e++) {
+        if (table->entries[e].matched) continue;
+        stats->removed++;
+        if (!stats->summaryOnly) {
+            parse_line(table->arena + table->entries[e].offset, table->entries[e].length, &rowA);
+            diff_print_row('-', RED, &rowA);
+        }
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_partition
+// PURPOSE : Splits the records of a snapshot file into partition files by
+//           ID hash (the high bits, so the join table's own hash, which uses
+//           the low bits, still spreads within a partition).
+// RETURNS : 1 -> done, 0 -> out of memory or write error
+// -----------------------------------------------------------------------------
+static int diff_partition(FILE *source, FILE **parts, size_t partCount, DiffStats *stats)
+{
+    LineReader reader;
+    const char *line;
+    size_t length;
+    int lineNumber = 0;
+    Student row;
+    int ok = 1;
+
+    if (!line_reader_init(&reader, source)) return 0;
+    while (diff_next_row(&reader, &lineNumber, 5, stats, &row, &line, &length)) {
+        size_t part = (size_t)(((uint64_t)(uint32_t)id_hash(row.id) * partCount) >> 32);
+        if (fwrite(line, 1, length, parts[part]) != length || fputc('\n', parts[part]) == EOF) {
+            ok = 0;
+            break;
+        }
+    }
+    line_reader_free(&reader);
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: diff_files
+// PURPOSE : DIFF <fileA> <fileB> [SUMMARY]. Streams the records added to,
+//           removed from and changed between two snapshots, then a summary.
+//           Memory stays near DIFF_MEMORY_BUDGET whatever the file sizes:
+//           A is split into enough partitions that each join table fits.
+// -----------------------------------------------------------------------------
+void diff_files(const char *pathA, const char *pathB, int summaryOnly)
+{
+    if (!has_txt_extension(pathA) || !has_txt_extension(pathB)) {
+        printf("CMS: File is not a txt file.\n");
+        return;
+    }
+    FILE *fileA = fopen(pathA, "rb");
+    if (!fileA) {
+        printf("CMS: Failed to open \"%s\" file not found!\n", pathA);
+        return;
+    }
+    FILE *fileB = fopen(pathB, "rb");
+    if (!fileB) {
+        printf("CMS: Failed to open \"%s\" file not found!\n", pathB);
+        fclose(fileA);
+        return;
+    }
+
+    //The join table takes roughly twice the bytes of the lines it holds
+    fseek(fileA, 0, SEEK_END);
+    long bytesA = ftell(fileA);
+    rewind(fileA);
+    size_t partCount = 1 + (size_t)(bytesA > 0 ? bytesA : 0) * 2 / DIFF_MEMORY_BUDGET;
+    if (partCount > DIFF_MAX_PARTITIONS) partCount = DIFF_MAX_PARTITIONS;
+
+    DiffStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.summaryOnly = summaryOnly;
+    DiffTable table;
+    memset(&table, 0, sizeof(table));
+    int ok = 1;
+    double started = now_seconds();
+
+    if (partCount == 1) {
+        ok = diff_join(fileA, fileB, 5, &table, &stats);
+        if (!ok) printf(RED "CMS Error: Out of memory, diff incomplete.\n" RESET);
+    }
+    else {
+        FILE *partsA[DIFF_MAX_PARTITIONS] = {NULL}, *partsB[DIFF_MAX_PARTITIONS] = {NULL};
+        for (size_t p = 0; p < partCount && ok; p++) {
+            partsA[p] = tmpfile();
+            partsB[p] = tmpfile();
+            ok = partsA[p] && partsB[p];
+        }
+        if (!ok) {
+            printf(RED "CMS Error: Cannot create temporary partition files.\n" RESET);
+        }
+        else if (!diff_partition(fileA, partsA, partCount, &stats) || !diff_partition(fileB, partsB, partCount, &stats)) {
+            printf(RED "CMS Error: Cannot write temporary partition files.\n" RESET);
+            ok = 0;
+        }
+        for (size_t p = 0; p < partCount && ok; p++) {
+            rewind(partsA[p]);
+            rewind(partsB[p]);
+            ok = diff_join(partsA[p], partsB[p], 0, &table, &stats);
+            if (!ok) printf(RED "CMS Error: Out of memory, diff incomplete.\n" RESET);
+        }
+        for (size_t p = 0; p < partCount; p++) {
+            if (partsA[p]) fclose(partsA[p]);
+            if (partsB[p]) fclose(partsB[p]);
+        }
+    }
+    double seconds = now_seconds() - started;
+    size_t tableBytes = table.cap * sizeof(DiffEntry) + table.slotCount * sizeof(uint32_t) + table.arenaCap;
+    diff_table_free(&table);
+    fclose(fileA);
+    fclose(fileB);
+    if (!ok) return;
+
+    const double MB = 1024.0 * 1024.0;
+    printf(CYAN "===== DIFF %s -> %s =====\n" RESET, pathA, pathB);
+    printf("Records        : %zu -> %zu\n", stats.rowsA, stats.rowsB);
+    printf("Added          : %zu\n", stats.added);
+    printf("Removed        : %zu\n", stats.removed);
+    printf("Changed        : %zu\n", stats.changed);
+    printf("Unchanged      : %zu\n", stats.unchanged);
+    if (stats.duplicates) printf(YELLOW "Duplicate IDs  : %zu (first occurrence compared)\n" RESET, stats.duplicates);
+    if (stats.skipped) printf(YELLOW "Invalid lines  : %zu (skipped)\n" RESET, stats.skipped);
+    printf("Partitions     : %zu (join table %.2f MB)\n", partCount, tableBytes / MB);
+    printf("Time           : %.3f s\n", seconds);
+}
+
+
+/* ---------------------------------------------------- */
+/* Merge (MERGE <file>)                                 */
+/* ---------------------------------------------------- */
+//
+// MERGE streams a database file through parse_line and probes the ID index
+// for every row. Changes collect in the transaction write set (which keeps
+// one entry per ID, so an ID repeated in the file is merged against its
+// pending value) and are applied like a COMMIT: one batch, one durable
+// audit write and one undo step. Time is linear in the file, not file x table.
+
+//What to do when a merged row has an ID the table already holds
+typedef enum {
+    MERGE_KEEP,        //keep the table's record
+    MERGE_OVERWRITE,   //take the file's record
+    MERGE_HIGHER_MARK  //take the file's record only if its mark is higher
+} MergePolicy;
+
+static const char *const merge_policy_names[] = {"KEEP", "OVERWRITE", "HIGHER_MARK"};
+
+// -----------------------------------------------------------------------------
+// FUNCTION: merge_file
+// PURPOSE : MERGE <file> [KEEP|OVERWRITE|HIGHER_MARK]. Inserts the file's
+//           new IDs and resolves existing ones by the policy.
+// -----------------------------------------------------------------------------
+void merge_file(const char *filePath, MergePolicy policy)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (!has_txt_extension(filePath)) {
+        printf("CMS: File is not a txt file.\n");
+        return;
+    }
+    FILE *filePtr = fopen(filePath, "rb");
+    if (!filePtr) {
+        printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
+        return;
+    }
+
+    LineReader reader;
+    if (!line_reader_init(&reader, filePtr)) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        fclose(filePtr);
+        return;
+    }
+
+    const char *line;
+    size_t lineLength;
+    int lineNumber = 0;
+    size_t rows = 0, kept = 0, skipped = 0;
+    int ok = 1;
+    double started = now_seconds();
+
+    txn_reset(); //MERGE never runs inside a transaction: the write set is free
+    while (line_reader_next(&reader, &line, &lineLength, NULL)) {
+        if (++lineNumber <= 5) continue; //header
+
+        Student incoming;
+        if (!parse_line(line, lineLength, &incoming)) {
+            skipped++;
+            continue;
+        }
+        rows++;
+
+        //Current value: pending change first (ID seen earlier in the file), then the table
+        Student current;
+        const BatchChange *pending = txn_find(incoming.id);
+        int exists = pending != NULL;
+        if (pending) {
+            current = pending->after;
+        }
+        else {
+            int pos = find_index_by_id(incoming.id);
+            exists = pos >= 0;
+            if (exists) current = *row_at((size_t)pos);
+        }
+
+        if (exists && (policy == MERGE_KEEP ||
+                       (policy == MERGE_HIGHER_MARK && !(incoming.mark > current.mark)))) {
+            if (!student_equal(&current, &incoming)) kept++;
+            continue;
+        }
+
+        BatchChange *change = txn_touch(incoming.id);
+        if (change == NULL) {
+            ok = 0;
+            break;
+        }
+        change->hasAfter = 1;
+        change->after = incoming;
+    }
+    line_reader_free(&reader);
+    fclose(filePtr);
+
+    size_t applied = 0;
+    if (!ok || !write_set_apply("MERGE", &applied)) {
+        printf(RED "CMS Error: Out of memory, nothing merged.\n" RESET);
+        txn_reset();
+        return;
+    }
+
+    //One entry per change after the summary, as COMMIT writes them (HISTORY, AS OF)
+    size_t inserted = 0;
+    for (size_t i = 0; i < applied; i++) {
+        const BatchChange *change = &last_op.batch[i];
+        if (!change->hadBefore) {
+            inserted++;
+            txn_log_append("INSERT %d \"%s\" \"%s\" %.1f",
+                           change->id, change->after.name, change->after.programme, change->after.mark);
+        }
+        else {
+            txn_log_append("UPDATE %d | \"%s\" -> \"%s\" | \"%s\" -> \"%s\" | %.1f -> %.1f", change->id,
+                           change->before.name, change->after.name, change->before.programme,
+                           change->after.programme, change->before.mark, change->after.mark);
+        }
+    }
+    size_t updated = applied - inserted;
+
+    if (!audit_log_batch(txn.log, txn.logLength, "MERGE %s %s (%zu inserted, %zu updated, %zu kept)",
+                         filePath, merge_policy_names[policy], inserted, updated, kept)) {
+        write_set_unapply();
+        txn_reset();
+        printf(RED "CMS Error: Audit log not written, nothing merged.\n" RESET);
+        return;
+    }
+    txn_reset();
+
+    printf(CYAN "===== MERGE %s (%s) =====\n" RESET, filePath, merge_policy_names[policy]);
+    printf("Rows read      : %zu\n", rows);
+    printf("Inserted       : %zu\n", inserted);
+    printf("Updated        : %zu\n", updated);
+    printf("Kept (table)   : %zu\n", kept);
+    if (skipped) printf(YELLOW "Invalid lines  : %zu (skipped)\n" RESET, skipped);
+    printf("Time           : %.3f s\n", now_seconds() - started);
+    if (applied) printf("CMS: UNDO reverts the whole merge.\n");
+}
+
+
+/* ---------------------------------------------------- */
+/* Predicates (SHOW / UPDATE SET / DELETE ... WHERE)    */
+/* ---------------------------------------------------- */
+//
+// A WHERE clause is parsed once into a Predicate: postfix code, with no
+// parsing or string work left per row (text tests compare collation keys,
+// as SORT BY does). Grammar:
+//   predicate  := term { OR term }
+//   term       := factor { AND factor }
+//   factor     := NOT factor | ( predicate ) | field op value
+//                 | NAME | PROGRAMME LIKE 'text%'
+//   field      := ID | NAME | PROGRAMME | MARK
+//   op         := = | != | <> | < | <= | > | >=
+// Text values are quoted ('Business' or "Business") and compare in
+// collation order (case and extra spaces ignored); LIKE takes a prefix.
+//
+// Rows are evaluated a block at a time: the block's IDs and marks are
+// copied into column arrays, and each test narrows a selection vector (the
+// block rows still in play) in one tight loop. AND runs its right side on
+// what the left side kept; OR runs it on what the left side dropped; NOT
+// keeps what its operand dropped.
+//
+// Before scanning, the conjuncts (tests joined to the root by AND only) are
+// checked for an index: ID = n probes the ID index, ID / MARK ranges read a
+// slice of the ordered key index, NAME / PROGRAMME = text takes the text
+// index candidates. The smallest candidate set wins; the whole predicate is
+// still checked on each candidate. Changes go through the write set like
+// MERGE: one audit entry (plus a line per record) and one undo step.
+
+#define PRED_CODE_MAX     64   //instructions in a predicate or SET expression
+#define PRED_TOKENS_MAX   128  //tokens in one WHERE / SET text
+#define WHERE_PREVIEW_ROWS 5   //matches shown before asking to confirm
+#define PRED_BLOCK_ROWS   1024 //rows per evaluation block (fits a uint16_t selection vector)
+
+typedef enum { PRED_FIELD_ID, PRED_FIELD_NAME, PRED_FIELD_PROGRAMME, PRED_FIELD_MARK } PredField;
+typedef enum { PRED_EQ, PRED_NE, PRED_LT, PRED_LE, PRED_GT, PRED_GE, PRED_PREFIX } PredCompare;
+typedef enum { PRED_TEST, PRED_AND, PRED_OR, PRED_NOT } PredOpcode;
+
+static const char *const pred_field_names[] = {"ID", "NAME", "PROGRAMME", "MARK"};
+
+//One postfix instruction
+typedef struct {
+    PredOpcode opcode;
+    PredField field;      //PRED_TEST
+    PredCompare compare;  //PRED_TEST
+    int size;             //instructions in the subtree ending here (itself included)
+    double number;        //ID / MARK value
+    float mark;           //number as stored in a record (exact float compare)
+    CollationKey key;     //NAME / PROGRAMME value
+    CollationKey prefixMask; //PRED_PREFIX: key bits the prefix covers
+    size_t prefixLength;  //PRED_PREFIX: normalised length of the prefix
+    char text[MAX_STR];
+} PredInstr;
+
+//One block of rows, the columns the tests read copied side by side
+typedef struct {
+    size_t count;
+    int ids[PRED_BLOCK_ROWS];
+    float marks[PRED_BLOCK_ROWS];
+    const Student *rows[PRED_BLOCK_ROWS];
+    const RecordKeys *keys[PRED_BLOCK_ROWS];
+} PredBlock;
+
+typedef struct {
+    PredInstr code[PRED_CODE_MAX];
+    int length;
+} Predicate;
+
+//SET mark = <expression>: postfix arithmetic over MARK and numbers
+typedef enum { EXPR_NUMBER, EXPR_MARK, EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_NEG } ExprOpcode;
+
+typedef struct {
+    ExprOpcode opcode;
+    double number;
+} ExprInstr;
+
+//What UPDATE SET assigns
+typedef struct {
+    ExprInstr mark[PRED_CODE_MAX];
+    int markLength;                //0 -> mark unchanged
+    int setName, setProgramme;
+    char name[MAX_STR];
+    char programme[MAX_STR];
+} SetClause;
+
+typedef enum { PRED_TOKEN_END, PRED_TOKEN_WORD, PRED_TOKEN_NUMBER, PRED_TOKEN_STRING, PRED_TOKEN_SYMBOL } PredTokenKind;
+
+typedef struct {
+    PredTokenKind kind;
+    char text[MAX_STR];
+    double number;
+} PredToken;
+
+typedef struct {
+    PredToken tokens[PRED_TOKENS_MAX + 1]; //ends with PRED_TOKEN_END
+    int count, pos;
+    int failed;
+} PredParser;
+
+//Index chosen for a WHERE clause
+typedef enum { PLAN_SCAN, PLAN_ID, PLAN_ID_RANGE, PLAN_MARK_RANGE, PLAN_NAME_INDEX, PLAN_PROGRAMME_INDEX } PlanKind;
+
+static const char *const plan_names[] = {
+    "full scan", "ID index", "ordered ID index", "ordered mark index", "name index", "programme index"
+};
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_error
+// PURPOSE : Reports the first syntax error, at the token it was found.
+// -----------------------------------------------------------------------------
+static void pred_error(PredParser *parser, const char *what)
+{
+    if (parser->failed) return;
+    parser->failed = 1;
+    const PredToken *token = &parser->tokens[parser->pos];
+    if (token->kind == PRED_TOKEN_END) {
+        printf(RED "CMS Error: %s at the end of the command.\n" RESET, what);
+    } else {
+        printf(RED "CMS Error: %s near \"%s\".\n" RESET, what, token->text);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_lex
+// PURPOSE : Splits a WHERE / SET text into words, numbers, quoted strings
+//           and operator symbols.
+// RETURNS : 1 -> ok, 0 -> invalid text (message printed)
+// -----------------------------------------------------------------------------
+static int pred_lex(PredParser *parser, const char *text)
+{
+    memset(parser, 0, sizeof(*parser));
+    const char *p = text;
+
+    while (1) {
+        while (isspace((unsigned char)*p)) p++;
+        if (parser->count == PRED_TOKENS_MAX) {
+            printf(RED "CMS Error: Condition too long (at most %d words and symbols).\n" RESET, PRED_TOKENS_MAX);
+            return 0;
+        }
+        PredToken *token = &parser->tokens[parser->count];
+        size_t length = 0;
+        if (*p == '\0') {
+            token->kind = PRED_TOKEN_END;
+            return 1;
+        }
+
+        if (*p == '\'' || *p == '"') { //quoted text, a doubled quote stands for one
+            char quote = *p++;
+            while (*p && !(p[0] == quote && p[1] != quote)) {
+                if (p[0] == quote) p++;
+                if (length < MAX_STR - 1) token->text[length++] = *p;
+                p++;
+            }
+            if (*p != quote) {
+                printf(RED "CMS Error: Missing closing quote.\n" RESET);
+                return 0;
+            }
+            p++;
+            token->kind = PRED_TOKEN_STRING;
+        }
+        else if (isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1]))) {
+            char *end;
+            token->number = strtod(p, &end);
+            length = (size_t)(end - p) < MAX_STR ? (size_t)(end - p) : MAX_STR - 1;
+            memcpy(token->text, p, length);
+            p = end;
+            token->kind = PRED_TOKEN_NUMBER;
+        }
+        else if (isalpha((unsigned char)*p) || *p == '_') {
+            while ((isalnum((unsigned char)*p) || *p == '_') && length < MAX_STR - 1) token->text[length++] = *p++;
+            token->kind = PRED_TOKEN_WORD;
+        }
+        else if (strchr("=<>!+-*/(),", *p) != NULL) {
+            token->text[length++] = *p++;
+            if ((token->text[0] == '<' && (*p == '=' || *p == '>')) ||
+                ((token->text[0] == '>' || token->text[0] == '!') && *p == '=')) {
+                token->text[length++] = *p++;
+            }
+            token->kind = PRED_TOKEN_SYMBOL;
+        }
+        else {
+            printf(RED "CMS Error: Unexpected character '%c' in condition.\n" RESET, *p);
+            return 0;
+        }
+        token->text[length] = '\0';
+        parser->count++;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_accept
+// RETURNS : 1 -> the current token is that word / symbol (consumed), else 0
+// -----------------------------------------------------------------------------
+static int pred_accept(PredParser *parser, const char *text)
+{
+    const PredToken *token = &parser->tokens[parser->pos];
+    if ((token->kind == PRED_TOKEN_WORD || token->kind == PRED_TOKEN_SYMBOL) && strcasecmp(token->text, text) == 0) {
+        parser->pos++;
+        return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_field
+// RETURNS : field index of the current word (consumed), or -1
+// -----------------------------------------------------------------------------
+static int pred_field(PredParser *parser)
+{
+    const PredToken *token = &parser->tokens[parser->pos];
+    if (token->kind != PRED_TOKEN_WORD) return -1;
+    for (int f = 0; f < 4; f++) {
+        if (strcasecmp(token->text, pred_field_names[f]) == 0) {
+            parser->pos++;
+            return f;
+        }
+    }
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_emit
+// PURPOSE : Appends an instruction; 'size' covers the operands before it.
+// RETURNS : the instruction, or NULL (error reported) when the code is full
+// -----------------------------------------------------------------------------
+static PredInstr *pred_emit(PredParser *parser, Predicate *predicate, PredOpcode opcode, int size)
+{
+    if (predicate->length == PRED_CODE_MAX) {
+        pred_error(parser, "Condition too complex");
+        return NULL;
+    }
+    PredInstr *instr = &predicate->code[predicate->length++];
+    memset(instr, 0, sizeof(*instr));
+    instr->opcode = opcode;
+    instr->size = size;
+    return instr;
+}
+
+static int pred_parse_or(PredParser *parser, Predicate *predicate);
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_parse_factor
+// PURPOSE : NOT factor | ( predicate ) | field op value
+// RETURNS : size of the emitted subtree, 0 on error
+// -----------------------------------------------------------------------------
+static int pred_parse_factor(PredParser *parser, Predicate *predicate)
+{
+    static const char *const compareSymbols[] = {"=", "!=", "<", "<=", ">", ">="};
+
+    if (pred_accept(parser, "NOT")) {
+        int size = pred_parse_factor(parser, predicate);
+        return size && pred_emit(parser, predicate, PRED_NOT, size + 1) ? size + 1 : 0;
+    }
+    if (pred_accept(parser, "(")) {
+        int size = pred_parse_or(parser, predicate);
+        if (size && !pred_accept(parser, ")")) {
+            pred_error(parser, "Expected ')'");
+            return 0;
+        }
+        return size;
+    }
+
+    int field = pred_field(parser);
+    if (field < 0) {
+        pred_error(parser, "Expected ID, NAME, PROGRAMME or MARK");
+        return 0;
+    }
+    int compare = -1;
+    for (int c = 0; c < 6 && compare < 0; c++) {
+        if (pred_accept(parser, compareSymbols[c])) compare = c;
+    }
+    if (compare < 0 && pred_accept(parser, "<>")) compare = PRED_NE;
+    if (compare < 0 && pred_accept(parser, "LIKE")) {
+        compare = PRED_PREFIX;
+        if (field == PRED_FIELD_ID || field == PRED_FIELD_MARK) {
+            parser->pos--;
+            pred_error(parser, "LIKE applies to NAME and PROGRAMME");
+            return 0;
+        }
+        const PredToken *pattern = &parser->tokens[parser->pos];
+        const char *percent = pattern->kind == PRED_TOKEN_STRING ? strchr(pattern->text, '%') : NULL;
+        if (pattern->kind == PRED_TOKEN_STRING && (percent == NULL || percent[1] != '\0')) {
+            pred_error(parser, "Only prefix patterns ('text%') are supported");
+            return 0;
+        }
+    }
+    if (compare < 0) {
+        pred_error(parser, "Expected =, !=, <, <=, >, >= or LIKE");
+        return 0;
+    }
+
+    const PredToken *value = &parser->tokens[parser->pos];
+    int numeric = field == PRED_FIELD_ID || field == PRED_FIELD_MARK;
+    int negative = numeric && value->kind == PRED_TOKEN_SYMBOL && strcmp(value->text, "-") == 0;
+    if (negative) value = &parser->tokens[++parser->pos];
+    if (value->kind != (numeric ? PRED_TOKEN_NUMBER : PRED_TOKEN_STRING)) {
+        pred_error(parser, numeric ? "Expected a number" : "Expected quoted text");
+        return 0;
+    }
+    parser->pos++;
+
+    PredInstr *instr = pred_emit(parser, predicate, PRED_TEST, 1);
+    if (instr == NULL) return 0;
+    instr->field = (PredField)field;
+    instr->compare = (PredCompare)compare;
+    instr->number = negative ? -value->number : value->number;
+    instr->mark = (float)instr->number;
+    snprintf(instr->text, sizeof(instr->text), "%s", value->text);
+    if (compare == PRED_PREFIX) instr->text[strlen(instr->text) - 1] = '\0'; //drop the '%'
+    if (!numeric) collation_key_build(&instr->key, instr->text);
+
+    if (compare == PRED_PREFIX) { //the key bytes a prefix that fits in a key must match
+        const char *walk = collate_start(instr->text);
+        while (collate_next(&walk)) instr->prefixLength++;
+        for (size_t b = 0; b < instr->prefixLength && b < COLLATE_KEY_BYTES; b++) {
+            uint64_t *half = b < 8 ? &instr->prefixMask.head : &instr->prefixMask.tail;
+            *half |= (uint64_t)0xFF << (56 - 8 * (b % 8));
+        }
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_parse_and / pred_parse_or
+// RETURNS : size of the emitted subtree, 0 on error
+// -----------------------------------------------------------------------------
+static int pred_parse_and(PredParser *parser, Predicate *predicate)
+{
+    int size = pred_parse_factor(parser, predicate);
+    while (size && pred_accept(parser, "AND")) {
+        int right = pred_parse_factor(parser, predicate);
+        size = right && pred_emit(parser, predicate, PRED_AND, size + right + 1) ? size + right + 1 : 0;
+    }
+    return size;
+}
+
+static int pred_parse_or(PredParser *parser, Predicate *predicate)
+{
+    int size = pred_parse_and(parser, predicate);
+    while (size && pred_accept(parser, "OR")) {
+        int right = pred_parse_and(parser, predicate);
+        size = right && pred_emit(parser, predicate, PRED_OR, size + right + 1) ? size + right + 1 : 0;
+    }
+    return size;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_compile
+// PURPOSE : Parses the WHERE clause starting at the parser's position,
+//           which must run to the end of the text.
+// RETURNS : 1 -> *predicate holds the code, 0 -> syntax error (printed)
+// -----------------------------------------------------------------------------
+static int pred_compile(PredParser *parser, Predicate *predicate)
+{
+    predicate->length = 0;
+    if (!pred_parse_or(parser, predicate)) return 0;
+    if (parser->tokens[parser->pos].kind != PRED_TOKEN_END) {
+        pred_error(parser, "Unexpected text");
+        return 0;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_has_prefix
+// RETURNS : 1 -> the text starts with the LIKE prefix (collation order)
+// -----------------------------------------------------------------------------
+static inline int pred_has_prefix(const PredInstr *instr, const CollationKey *key, const char *text)
+{
+    if (instr->prefixLength <= COLLATE_KEY_BYTES) {
+        return ((key->head ^ instr->key.head) & instr->prefixMask.head) == 0 &&
+               ((key->tail ^ instr->key.tail) & instr->prefixMask.tail) == 0;
+    }
+    const char *prefix = collate_start(instr->text);
+    text = collate_start(text);
+    int c;
+    while ((c = collate_next(&prefix)) != 0) {
+        if (collate_next(&text) != c) return 0;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_select_test
+// PURPOSE : Keeps the selected block rows that pass one test. Each
+//           field / operator pair gets its own loop with no branch on
+//           the row: the row is written, then kept by bumping the count.
+// RETURNS : number of rows written to out[] (ascending, a subset of in[])
+// -----------------------------------------------------------------------------
+static size_t pred_select_test(const PredInstr *instr, const PredBlock *block,
+                               const uint16_t *in, size_t inCount, uint16_t *out)
+{
+    size_t count = 0;
+#define SELECT_WHERE(condition)                                       \
+    for (size_t k = 0; k < inCount; k++) {                            \
+        size_t i = in[k];                                             \
+        out[count] = (uint16_t)i;                                     \
+        count += (condition);                                         \
+    }
+
+    if (instr->field == PRED_FIELD_MARK) {
+        const float *marks = block->marks;
+        float value = instr->mark;
+        switch (instr->compare) {
+        case PRED_EQ: SELECT_WHERE(marks[i] == value); break;
+        case PRED_NE: SELECT_WHERE(marks[i] != value); break;
+        case PRED_LT: SELECT_WHERE(marks[i] < value); break;
+        case PRED_LE: SELECT_WHERE(marks[i] <= value); break;
+        case PRED_GT: SELECT_WHERE(marks[i] > value); break;
+        default:      SELECT_WHERE(marks[i] >= value); break;
+        }
+    }
+    else if (instr->field == PRED_FIELD_ID) {
+        const int *ids = block->ids;
+        double value = instr->number;
+        switch (instr->compare) {
+        case PRED_EQ: SELECT_WHERE(ids[i] == value); break;
+        case PRED_NE: SELECT_WHERE(ids[i] != value); break;
+        case PRED_LT: SELECT_WHERE(ids[i] < value); break;
+        case PRED_LE: SELECT_WHERE(ids[i] <= value); break;
+        case PRED_GT: SELECT_WHERE(ids[i] > value); break;
+        default:      SELECT_WHERE(ids[i] >= value); break;
+        }
+    }
+    else {
+        int isName = instr->field == PRED_FIELD_NAME;
+#define TEXT_KEY(i)  (isName ? &block->keys[i]->name : &block->keys[i]->programme)
+#define TEXT_OF(i)   (isName ? block->rows[i]->name : block->rows[i]->programme)
+#define TEXT_ORDER(i) collation_key_compare(TEXT_KEY(i), &instr->key, TEXT_OF(i), instr->text)
+        switch (instr->compare) {
+        case PRED_EQ:     SELECT_WHERE(TEXT_ORDER(i) == 0); break;
+        case PRED_NE:     SELECT_WHERE(TEXT_ORDER(i) != 0); break;
+        case PRED_LT:     SELECT_WHERE(TEXT_ORDER(i) < 0); break;
+        case PRED_LE:     SELECT_WHERE(TEXT_ORDER(i) <= 0); break;
+        case PRED_GT:     SELECT_WHERE(TEXT_ORDER(i) > 0); break;
+        case PRED_GE:     SELECT_WHERE(TEXT_ORDER(i) >= 0); break;
+        case PRED_PREFIX: SELECT_WHERE(pred_has_prefix(instr, TEXT_KEY(i), TEXT_OF(i))); break;
+        }
+#undef TEXT_ORDER
+#undef TEXT_OF
+#undef TEXT_KEY
+    }
+#undef SELECT_WHERE
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: selection_difference
+// PURPOSE : out = in without drop (both ascending, drop a subset of in).
+// RETURNS : number of rows written to out[]
+// -----------------------------------------------------------------------------
+static size_t selection_difference(const uint16_t *in, size_t inCount, const uint16_t *drop, size_t dropCount,
+                                   uint16_t *out)
+{
+    size_t count = 0, d = 0;
+    for (size_t k = 0; k < inCount; k++) {
+        if (d < dropCount && drop[d] == in[k]) d++;
+        else out[count++] = in[k];
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_select
+// PURPOSE : Evaluates the subtree ending at code[node] on the selected rows
+//           of a block (see the section comment).
+// RETURNS : number of passing rows written to out[] (ascending)
+// -----------------------------------------------------------------------------
+static size_t pred_select(const Predicate *predicate, int node, const PredBlock *block,
+                          const uint16_t *in, size_t inCount, uint16_t *out)
+{
+    const PredInstr *instr = &predicate->code[node];
+    if (inCount == 0) return 0;
+    if (instr->opcode == PRED_TEST) return pred_select_test(instr, block, in, inCount, out);
+
+    uint16_t kept[PRED_BLOCK_ROWS];
+    int right = node - 1;
+    int left = right - predicate->code[right].size;
+    switch (instr->opcode) {
+    case PRED_AND: {
+        size_t keptCount = pred_select(predicate, left, block, in, inCount, kept);
+        return pred_select(predicate, right, block, kept, keptCount, out);
+    }
+    case PRED_OR: {
+        uint16_t more[PRED_BLOCK_ROWS];
+        size_t keptCount = pred_select(predicate, left, block, in, inCount, kept);
+        size_t restCount = selection_difference(in, inCount, kept, keptCount, out);
+        size_t moreCount = pred_select(predicate, right, block, out, restCount, more);
+        //Merge the two ascending lists
+        size_t count = 0, a = 0, b = 0;
+        while (a < keptCount || b < moreCount) {
+            out[count++] = b == moreCount || (a < keptCount && kept[a] < more[b]) ? kept[a++] : more[b++];
+        }
+        return count;
+    }
+    default: { //PRED_NOT
+        size_t keptCount = pred_select(predicate, right, block, in, inCount, kept);
+        return selection_difference(in, inCount, kept, keptCount, out);
+    }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: pred_conjuncts
+// PURPOSE : Collects the tests every match must pass: those joined to the
+//           root through AND only.
+// RETURNS : number of test indexes written to out[]
+// -----------------------------------------------------------------------------
+static int pred_conjuncts(const Predicate *predicate, int root, int *out, int count)
+{
+    const PredInstr *instr = &predicate->code[root];
+    if (instr->opcode == PRED_TEST) {
+        out[count++] = root;
+    }
+    else if (instr->opcode == PRED_AND) {
+        int right = root - 1;
+        int left = right - predicate->code[right].size;
+        count = pred_conjuncts(predicate, left, out, count);
+        count = pred_conjuncts(predicate, right, out, count);
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: where_candidates
+// PURPOSE : Picks the index for a predicate (see the section comment) and
+//           lists the IDs it yields.
+// RETURNS : plan; for anything but PLAN_SCAN, *ids (malloc'd) and *count
+//           hold the candidates, a superset of the matches
+// -----------------------------------------------------------------------------
+static PlanKind where_candidates(const Predicate *predicate, int **ids, size_t *count)
+{
+    int tests[PRED_CODE_MAX];
+    int testCount = pred_conjuncts(predicate, predicate->length - 1, tests, 0);
+
+    *ids = NULL;
+    *count = 0;
+    PlanKind plan = PLAN_SCAN;
+    size_t best = db.size / 2; //more candidates than this: scanning in order is cheaper
+
+    //ID = n: one probe
+    for (int t = 0; t < testCount; t++) {
+        const PredInstr *instr = &predicate->code[tests[t]];
+        if (instr->field == PRED_FIELD_ID && instr->compare == PRED_EQ) {
+            *ids = malloc(sizeof(int));
+            if (*ids == NULL) return PLAN_SCAN;
+            int id = instr->number >= INT_MIN && instr->number <= INT_MAX ? (int)instr->number : 0;
+            *count = id == instr->number && find_index_by_id(id) >= 0;
+            (*ids)[0] = id;
+            return PLAN_ID;
+        }
+    }
+
+    //ID / MARK ranges: the slice of the ordered key index between the bounds
+    for (int field = PRED_FIELD_ID; field <= PRED_FIELD_MARK; field += PRED_FIELD_MARK - PRED_FIELD_ID) {
+        int bounded = 0;
+        uint64_t low = 0, high = UINT64_MAX; //keys: ID + INT_MIN offset, or mark_key()
+        for (int t = 0; t < testCount; t++) {
+            const PredInstr *instr = &predicate->code[tests[t]];
+            if ((int)instr->field != field || instr->compare == PRED_NE) continue;
+
+            uint64_t first, last; //smallest / largest key this test allows
+            if (field == PRED_FIELD_MARK) {
+                first = mark_key(instr->mark, INT_MIN);
+                last = mark_key(instr->mark, INT_MAX);
+            } else {
+                if (instr->number != (double)(int64_t)instr->number ||
+                    instr->number < INT_MIN || instr->number > INT_MAX) continue;
+                first = last = (uint64_t)((int64_t)instr->number - (int64_t)INT_MIN);
+            }
+            switch (instr->compare) {
+            case PRED_EQ: if (first > low) low = first; if (last < high) high = last; break;
+            case PRED_LT: if (first == 0) { low = 1; high = 0; } else if (first - 1 < high) high = first - 1; break;
+            case PRED_LE: if (last < high) high = last; break;
+            case PRED_GT: if (last + 1 > low) low = last + 1; break;
+            default:      if (first > low) low = first; break;
+            }
+            bounded = 1;
+        }
+        if (!bounded || !key_index_build()) continue;
+
+        size_t start, end;
+        if (field == PRED_FIELD_MARK) {
+            start = key_marks_lower_bound(low);
+            end = high == UINT64_MAX ? key_index.count : key_marks_lower_bound(high + 1);
+        } else {
+            start = low > UINT32_MAX ? key_index.count : key_ids_lower_bound(mark_key_id(low));
+            end = high >= UINT32_MAX ? key_index.count : key_ids_lower_bound(mark_key_id(high + 1));
+        }
+        size_t found = end > start ? end - start : 0;
+        if (found > best) continue;
+
+        int *slice = malloc((found ? found : 1) * sizeof(int));
+        if (slice == NULL) continue;
+        for (size_t i = 0; i < found; i++) {
+            slice[i] = field == PRED_FIELD_MARK ? mark_key_id(key_index.marks[start + i]) : key_index.ids[start + i];
+        }
+        free(*ids);
+        *ids = slice;
+        *count = best = found;
+        plan = field == PRED_FIELD_MARK ? PLAN_MARK_RANGE : PLAN_ID_RANGE;
+    }
+
+    //NAME / PROGRAMME = text or LIKE 'text%': records whose text holds all its trigrams
+    for (int t = 0; t < testCount; t++) {
+        const PredInstr *instr = &predicate->code[tests[t]];
+        if ((instr->field != PRED_FIELD_NAME && instr->field != PRED_FIELD_PROGRAMME) ||
+            (instr->compare != PRED_EQ && instr->compare != PRED_PREFIX)) {
+            continue;
+        }
+        char normalized[MAX_STR];
+        normalize_text(instr->text, normalized, sizeof(normalized));
+        int *found = NULL;
+        size_t foundCount = trigram_candidates(instr->field == PRED_FIELD_NAME ? &name_trigrams : &programme_trigrams,
+                                               normalized, &found);
+        if (foundCount == SIZE_MAX || foundCount > best) {
+            free(found);
+            continue;
+        }
+        free(*ids);
+        *ids = found;
+        *count = best = foundCount;
+        plan = instr->field == PRED_FIELD_NAME ? PLAN_NAME_INDEX : PLAN_PROGRAMME_INDEX;
+    }
+    return plan;
+}
+
+// -----------------------------------------------------------------------------
+// COMPARATOR: compare_size_asc
+// -----------------------------------------------------------------------------
+static int compare_size_asc(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: where_collect
+// PURPOSE : Finds the table records matching a predicate: the candidates of
+//           the chosen index (or every row) go through pred_select() a
+//           block at a time, in table order.
+// RETURNS : number of matches (row positions in *positions, malloc'd,
+//           ascending), or SIZE_MAX when out of memory
+// -----------------------------------------------------------------------------
+static size_t where_collect(const Predicate *predicate, size_t **positions, PlanKind *plan, size_t *candidates)
+{
+    int *ids = NULL;
+    size_t idCount = 0;
+    *plan = where_candidates(predicate, &ids, &idCount);
+
+    //Candidate row positions, ascending (NULL -> every row)
+    size_t *rows = NULL;
+    size_t rowCount = db.size;
+    if (*plan != PLAN_SCAN) {
+        long *found = malloc((idCount ? idCount : 1) * sizeof(long));
+        rows = malloc((idCount ? idCount : 1) * sizeof(size_t));
+        if (found == NULL || rows == NULL) {
+            free(found);
+            free(rows);
+            free(ids);
+            return SIZE_MAX;
+        }
+        find_index_by_id_batch(ids, idCount, found);
+        rowCount = 0;
+        for (size_t i = 0; i < idCount; i++) {
+            if (found[i] >= 0) rows[rowCount++] = (size_t)found[i];
+        }
+        qsort(rows, rowCount, sizeof(size_t), compare_size_asc);
+        free(found);
+    }
+    free(ids);
+    *candidates = rowCount;
+
+    size_t *matches = malloc((rowCount ? rowCount : 1) * sizeof(size_t));
+    PredBlock *block = malloc(sizeof(PredBlock));
+    if (matches == NULL || block == NULL) {
+        free(matches);
+        free(block);
+        free(rows);
+        return SIZE_MAX;
+    }
+
+    uint16_t all[PRED_BLOCK_ROWS], selected[PRED_BLOCK_ROWS];
+    for (size_t i = 0; i < PRED_BLOCK_ROWS; i++) all[i] = (uint16_t)i;
+
+    size_t count = 0;
+    for (size_t start = 0; start < rowCount; start += PRED_BLOCK_ROWS) {
+        //Gather the block's columns
+        block->count = rowCount - start < PRED_BLOCK_ROWS ? rowCount - start : PRED_BLOCK_ROWS;
+        for (size_t i = 0; i < block->count; i++) {
+            size_t pos = rows ? rows[start + i] : start + i;
+            const Student *record = row_at(pos);
+            block->rows[i] = record;
+            block->keys[i] = store_keys(&db, db.order[pos]);
+            block->ids[i] = record->id;
+            block->marks[i] = record->mark;
+        }
+
+        size_t kept = pred_select(predicate, predicate->length - 1, block, all, block->count, selected);
+        for (size_t k = 0; k < kept; k++) {
+            matches[count++] = rows ? rows[start + selected[k]] : start + selected[k];
+        }
+    }
+    free(block);
+    free(rows);
+    *positions = matches;
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: show_where
+// PURPOSE : SHOW WHERE <condition>: prints the matching records in table
+//           order, then how they were found.
+// -----------------------------------------------------------------------------
+void show_where(const char *text)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+
+    PredParser *parser = malloc(sizeof(PredParser));
+    Predicate *predicate = malloc(sizeof(Predicate));
+    if (parser == NULL || predicate == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+    }
+    else if (pred_lex(parser, text) && pred_compile(parser, predicate)) {
+        size_t *positions = NULL, candidates;
+        PlanKind plan;
+        double started = now_seconds();
+        size_t count = where_collect(predicate, &positions, &plan, &candidates);
+        double searched = now_seconds() - started;
+
+        if (count == SIZE_MAX) {
+            printf(RED "CMS Error: Out of memory.\n" RESET);
+        }
+        else {
+            if (count > 0) {
+                printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+                for (size_t i = 0; i < count; i++) print_student_record(row_at(positions[i]));
+            }
+            printf("CMS: %zu record(s) match (%s, %zu checked, %.3f s).\n",
+                   count, plan_names[plan], candidates, searched);
+        }
+        free(positions);
+    }
+    free(predicate);
+    free(parser);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: expr_parse_sum / expr_parse_product / expr_parse_unit
+// PURPOSE : SET mark = <expression>: + - * / over numbers, MARK and ( ).
+// RETURNS : 1 -> emitted, 0 -> syntax error (printed)
+// -----------------------------------------------------------------------------
+static int expr_parse_sum(PredParser *parser, SetClause *set);
+
+static int expr_emit(PredParser *parser, SetClause *set, ExprOpcode opcode, double number)
+{
+    if (set->markLength == PRED_CODE_MAX) {
+        pred_error(parser, "Expression too complex");
+        return 0;
+    }
+    set->mark[set->markLength].opcode = opcode;
+    set->mark[set->markLength].number = number;
+    set->markLength++;
+    return 1;
+}
+
+static int expr_parse_unit(PredParser *parser, SetClause *set)
+{
+    const PredToken *token = &parser->tokens[parser->pos];
+    if (pred_accept(parser, "-")) {
+        return expr_parse_unit(parser, set) && expr_emit(parser, set, EXPR_NEG, 0);
+    }
+    if (pred_accept(parser, "(")) {
+        if (!expr_parse_sum(parser, set)) return 0;
+        if (!pred_accept(parser, ")")) {
+            pred_error(parser, "Expected ')'");
+            return 0;
+        }
+        return 1;
+    }
+    if (token->kind == PRED_TOKEN_NUMBER) {
+        parser->pos++;
+        return expr_emit(parser, set, EXPR_NUMBER, token->number);
+    }
+    if (pred_accept(parser, "MARK")) {
+        return expr_emit(parser, set, EXPR_MARK, 0);
+    }
+    pred_error(parser, "Expected a number, MARK or '('");
+    return 0;
+}
+
+static int expr_parse_product(PredParser *parser, SetClause *set)
+{
+    if (!expr_parse_unit(parser, set)) return 0;
+    while (1) {
+        ExprOpcode opcode;
+        if (pred_accept(parser, "*")) opcode = EXPR_MUL;
+        else if (pred_accept(parser, "/")) opcode = EXPR_DIV;
+        else return 1;
+        if (!expr_parse_unit(parser, set) || !expr_emit(parser, set, opcode, 0)) return 0;
+    }
+}
+
+static int expr_parse_sum(PredParser *parser, SetClause *set)
+{
+    if (!expr_parse_product(parser, set)) return 0;
+    while (1) {
+        ExprOpcode opcode;
+        if (pred_accept(parser, "+")) opcode = EXPR_ADD;
+        else if (pred_accept(parser, "-")) opcode = EXPR_SUB;
+        else return 1;
+        if (!expr_parse_product(parser, set) || !expr_emit(parser, set, opcode, 0)) return 0;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: expr_eval
+// PURPOSE : New mark for a record: the SET expression, clamped to 0-100 and
+//           kept to one decimal like every other mark.
+// RETURNS : the mark; *clamped = 1 when it had to be clamped
+// -----------------------------------------------------------------------------
+static float expr_eval(const SetClause *set, float mark, int *clamped)
+{
+    double stack[PRED_CODE_MAX];
+    int top = 0;
+    for (int i = 0; i < set->markLength; i++) {
+        const ExprInstr *instr = &set->mark[i];
+        switch (instr->opcode) {
+        case EXPR_NUMBER: stack[top++] = instr->number; break;
+        case EXPR_MARK:   stack[top++] = mark; break;
+        case EXPR_NEG:    stack[top - 1] = -stack[top - 1]; break;
+        case EXPR_ADD:    top--; stack[top - 1] += stack[top]; break;
+        case EXPR_SUB:    top--; stack[top - 1] -= stack[top]; break;
+        case EXPR_MUL:    top--; stack[top - 1] *= stack[top]; break;
+        case EXPR_DIV:    top--; stack[top - 1] = stack[top] != 0.0 ? stack[top - 1] / stack[top] : 0.0; break;
+        }
+    }
+
+    double value = stack[0];
+    *clamped = !(value >= 0.0 && value <= 100.0); //NaN clamps too
+    if (*clamped) value = value > 100.0 ? 100.0 : 0.0;
+    return (float)((long)(value * 10.0 + 0.5) / 10.0);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: set_parse
+// PURPOSE : Parses "<assignment> [, <assignment>] ... WHERE", where an
+//           assignment is MARK = <expression>, NAME = 'text' or
+//           PROGRAMME = 'text'. Leaves the parser on the WHERE clause.
+// RETURNS : 1 -> ok, 0 -> syntax error (printed)
+// -----------------------------------------------------------------------------
+static int set_parse(PredParser *parser, SetClause *set)
+{
+    memset(set, 0, sizeof(*set));
+    do {
+        int field = pred_field(parser);
+        if (field != PRED_FIELD_MARK && field != PRED_FIELD_NAME && field != PRED_FIELD_PROGRAMME) {
+            if (field == PRED_FIELD_ID) parser->pos--; //report it at the field
+            pred_error(parser, "Expected MARK, NAME or PROGRAMME (IDs cannot be changed)");
+            return 0;
+        }
+        if (!pred_accept(parser, "=")) {
+            pred_error(parser, "Expected '='");
+            return 0;
+        }
+        if (field == PRED_FIELD_MARK) {
+            set->markLength = 0;
+            if (!expr_parse_sum(parser, set)) return 0;
+            continue;
+        }
+        const PredToken *value = &parser->tokens[parser->pos];
+        if (value->kind != PRED_TOKEN_STRING || value->text[0] == '\0') {
+            pred_error(parser, "Expected quoted text");
+            return 0;
+        }
+        parser->pos++;
+        if (field == PRED_FIELD_NAME) {
+            set->setName = 1;
+            snprintf(set->name, sizeof(set->name), "%s", value->text);
+        } else {
+            set->setProgramme = 1;
+            snprintf(set->programme, sizeof(set->programme), "%s", value->text);
+        }
+    } while (pred_accept(parser, ","));
+
+    if (!pred_accept(parser, "WHERE")) {
+        pred_error(parser, "Expected WHERE");
+        return 0;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: where_confirm
+// PURPOSE : Shows the first matches and asks before a set-based change.
+// RETURNS : 1 -> confirmed, 0 -> cancelled
+// -----------------------------------------------------------------------------
+static int where_confirm(const char *verb, const size_t *positions, size_t count, PlanKind plan, size_t candidates)
+{
+    printf("CMS: %zu record(s) match (%s, %zu checked).\n", count, plan_names[plan], candidates);
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+    for (size_t i = 0; i < count && i < WHERE_PREVIEW_ROWS; i++) {
+        print_student_record(row_at(positions[i]));
+    }
+    if (count > WHERE_PREVIEW_ROWS) printf("... and %zu more\n", count - WHERE_PREVIEW_ROWS);
+
+    char confirm[32];
+    printf("\n%s %zu record(s) (Y/N)? ", verb, count);
+    if (!read_input_line(confirm, sizeof(confirm)) || tolower((unsigned char)confirm[0]) != 'y') {
+        printf("Cancelled.\n");
+        return 0;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: where_apply
+// PURPOSE : Applies UPDATE SET (set != NULL) / DELETE to the matched rows as
+//           one batch: one audit entry and one undo step.
+// -----------------------------------------------------------------------------
+static void where_apply(const char *text, const SetClause *set, const size_t *positions, size_t count)
+{
+    //The changes, in table order, go through the write set like MERGE
+    size_t clampedCount = 0;
+    int ok = 1;
+    txn_reset();
+    for (size_t i = 0; i < count; i++) {
+        const Student *current = row_at(positions[i]);
+        Student after = *current;
+        if (set != NULL) {
+            int clamped = 0;
+            if (set->markLength > 0) after.mark = expr_eval(set, current->mark, &clamped);
+            if (set->setName) snprintf(after.name, sizeof(after.name), "%s", set->name);
+            if (set->setProgramme) snprintf(after.programme, sizeof(after.programme), "%s", set->programme);
+            clampedCount += (size_t)clamped;
+            if (student_equal(current, &after)) continue;
+        }
+        BatchChange *change = txn_touch(current->id);
+        if (change == NULL) {
+            ok = 0;
+            break;
+        }
+        change->hasAfter = set != NULL;
+        change->after = after;
+    }
+
+    size_t applied = 0;
+    if (!ok || !write_set_apply(set != NULL ? "UPDATE WHERE" : "DELETE WHERE", &applied)) {
+        printf(RED "CMS Error: Out of memory, nothing changed.\n" RESET);
+        txn_reset();
+        return;
+    }
+
+    //One entry per change after the summary, as COMMIT writes them (HISTORY, AS OF)
+    for (size_t i = 0; i < applied; i++) {
+        const BatchChange *change = &last_op.batch[i];
+        if (set != NULL) {
+            txn_log_append("UPDATE %d | \"%s\" -> \"%s\" | \"%s\" -> \"%s\" | %.1f -> %.1f", change->id,
+                           change->before.name, change->after.name, change->before.programme,
+                           change->after.programme, change->before.mark, change->after.mark);
+        }
+        else {
+            txn_log_append("DELETE %d | \"%s\" | \"%s\" | %.1f",
+                           change->id, change->before.name, change->before.programme, change->before.mark);
+        }
+    }
+    if (!audit_log_batch(txn.log, txn.logLength, "%s %s (%zu change(s))",
+                         set != NULL ? "UPDATE SET" : "DELETE WHERE", text, applied)) {
+        write_set_unapply();
+        txn_reset();
+        printf(RED "CMS Error: Audit log not written, no record changed.\n" RESET);
+        return;
+    }
+    txn_reset();
+
+    if (set != NULL) {
+        printf(GREEN "CMS: %zu record(s) updated." RESET, applied);
+        if (count > applied) printf(" %zu already had those values.", count - applied);
+        if (clampedCount) printf(YELLOW " %zu mark(s) clamped to 0-100." RESET, clampedCount);
+        printf("\n");
+    }
+    else {
+        printf(GREEN "CMS: %zu record(s) deleted.\n" RESET, applied);
+    }
+    if (applied) printf("CMS: UNDO reverts the whole %s.\n", set != NULL ? "update" : "delete");
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: where_change
+// PURPOSE : UPDATE SET ... WHERE ... and DELETE WHERE ...: compiles the
+//           command, collects the matches, asks once, then applies them.
+// ACCEPTS : text = the command after "UPDATE SET" / "DELETE WHERE"
+// -----------------------------------------------------------------------------
+void where_change(const char *text, int isUpdate)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (txn.active) { //the batch uses the transaction's write set
+        printf(YELLOW "CMS: Finish the transaction with COMMIT or ROLLBACK first.\n" RESET);
+        return;
+    }
+
+    PredParser *parser = malloc(sizeof(PredParser));
+    Predicate *predicate = malloc(sizeof(Predicate));
+    SetClause *set = malloc(sizeof(SetClause));
+    if (parser == NULL || predicate == NULL || set == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+    }
+    else if (pred_lex(parser, text) && (!isUpdate || set_parse(parser, set)) && pred_compile(parser, predicate)) {
+        size_t *positions = NULL, candidates;
+        PlanKind plan;
+        double started = now_seconds();
+        size_t count = where_collect(predicate, &positions, &plan, &candidates);
+
+        if (count == SIZE_MAX) {
+            printf(RED "CMS Error: Out of memory.\n" RESET);
+        }
+        else if (count == 0) {
+            printf("CMS: No records match (%s, %zu checked, %.3f s).\n",
+                   plan_names[plan], candidates, now_seconds() - started);
+        }
+        else if (where_confirm(isUpdate ? "Update" : "Delete", positions, count, plan, candidates)) {
+            where_apply(text, isUpdate ? set : NULL, positions, count);
+        }
+        free(positions);
+    }
+    free(set);
+    free(predicate);
+    free(parser);
+}
+
+
+/* ---------------------------------------------------- */
+/* Version History (QUERY / SHOW SUMMARY ... AS OF)     */
+/* ---------------------------------------------------- */
+//
+// AS OF reads come from a version store built from the audit log. Every
+// student with logged changes has a chain of versions, oldest first: the
+// first holds the record as it was before its first logged change (the
+// "before" values of an UPDATE/DELETE, or no record for an INSERT), each
+// later one the state from the second of a change on. A read binary
+// searches one chain, so it costs O(log versions) and never replays the
+// log. IDs with no logged change read the table.
+//
+// History belongs to the table that is open: a logged OPEN (or REPLAY, whose
+// commands are not logged) starts it again, since the rows loaded then owe
+// nothing to the changes logged before. AS OF a time before that is refused
+// instead of mixing two tables.
+//
+// The store is built by one pass over the log segments on the first AS OF
+// command and then kept current by log_append(). Every
+// VERSION_COMPACT_EVERY new versions (and on COMPACT) the chains are
+// compacted: versions replaced within the same second can never be read,
+// runs of equal states collapse into one, and values no version uses are
+// freed. The newest two versions of a chain are kept as they are, since a
+// logged UNDO restores the one before the newest.
+
+#define VERSION_ABSENT        UINT32_MAX //version value: no record with this ID
+#define VERSION_COMPACT_EVERY 4096       //new versions between compactions
+
+typedef struct {
+    int64_t from;   //first second of this state (INT64_MIN -> before the log)
+    uint32_t value; //index into version_store.values, or VERSION_ABSENT
+} Version;
+
+typedef struct {
+    int id;
+    Version *items;
+    size_t count, cap;
+} VersionChain;
+
+static struct {
+    int built;
+    VersionChain *chains;
+    size_t chainCount, chainCap;
+    int *slots;             //open addressing: ID -> index in chains, -1 empty
+    size_t slotCap;
+    Student *values;        //record states the versions point to
+    size_t valueCount, valueCap;
+    size_t versionCount;    //versions in all chains
+    size_t sinceCompact;    //versions added since the last compaction
+    int *batch;             //IDs changed by the newest COMMIT / MERGE (UNDO)
+    size_t batchCount, batchCap;
+    int64_t batchTime;
+    int inBatch;            //change lines logged at batchTime belong to the batch
+    int64_t opened;         //time of the OPEN the history starts at (0 -> none logged)
+} version_store;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_store_free
+// -----------------------------------------------------------------------------
+static void version_store_free(void)
+{
+    for (size_t i = 0; i < version_store.chainCount; i++) {
+        free(version_store.chains[i].items);
+    }
+    free(version_store.chains);
+    free(version_store.slots);
+    free(version_store.values);
+    free(version_store.batch);
+    memset(&version_store, 0, sizeof(version_store));
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_store_restart
+// PURPOSE : A logged OPEN or REPLAY: drops every chain, the history starts again at
+//           'opened' (the store stays built).
+// -----------------------------------------------------------------------------
+static void version_store_restart(int64_t opened)
+{
+    int built = version_store.built;
+    version_store_free();
+    version_store.built = built;
+    version_store.opened = opened;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_chain
+// PURPOSE : Finds the chain of a student ID. create -> adds an empty one.
+// RETURNS : chain, or NULL (not found / out of memory)
+// -----------------------------------------------------------------------------
+static VersionChain *version_chain(int id, int create)
+{
+    if (version_store.slotCap > 0) {
+        size_t mask = version_store.slotCap - 1;
+        size_t slot = id_hash(id) & mask;
+        while (version_store.slots[slot] >= 0) {
+            VersionChain *chain = &version_store.chains[version_store.slots[slot]];
+            if (chain->id == id) return chain;
+            slot = (slot + 1) & mask;
+        }
+    }
+    if (!create) return NULL;
+
+    //Grow the slot table (load factor <= 0.5)
+    if ((version_store.chainCount + 1) * 2 > version_store.slotCap) {
+        size_t newCap = version_store.slotCap ? version_store.slotCap * 2 : 256;
+        int *slots = malloc(newCap * sizeof(int));
+        if (slots == NULL) return NULL;
+        for (size_t i = 0; i < newCap; i++) slots[i] = -1;
+        for (size_t i = 0; i < version_store.chainCount; i++) {
+            size_t slot = id_hash(version_store.chains[i].id) & (newCap - 1);
+            while (slots[slot] >= 0) slot = (slot + 1) & (newCap - 1);
+            slots[slot] = (int)i;
+        }
+        free(version_store.slots);
+        version_store.slots = slots;
+        version_store.slotCap = newCap;
+    }
+    if (version_store.chainCount == version_store.chainCap) {
+        size_t newCap = version_store.chainCap ? version_store.chainCap * 2 : 128;
+        VersionChain *grown = realloc(version_store.chains, newCap * sizeof(VersionChain));
+        if (grown == NULL) return NULL;
+        version_store.chains = grown;
+        version_store.chainCap = newCap;
+    }
+
+    size_t slot = id_hash(id) & (version_store.slotCap - 1);
+    while (version_store.slots[slot] >= 0) slot = (slot + 1) & (version_store.slotCap - 1);
+    version_store.slots[slot] = (int)version_store.chainCount;
+
+    VersionChain *chain = &version_store.chains[version_store.chainCount++];
+    memset(chain, 0, sizeof(*chain));
+    chain->id = id;
+    return chain;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_value_add
+// PURPOSE : Stores a record state for versions to point to.
+// RETURNS : 1 -> *value is its index, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int version_value_add(const Student *record, uint32_t *value)
+{
+    if (version_store.valueCount == version_store.valueCap) {
+        size_t newCap = version_store.valueCap ? version_store.valueCap * 2 : 256;
+        if (newCap >= VERSION_ABSENT) return 0;
+        Student *grown = realloc(version_store.values, newCap * sizeof(Student));
+        if (grown == NULL) return 0;
+        version_store.values = grown;
+        version_store.valueCap = newCap;
+    }
+    version_store.values[version_store.valueCount] = *record;
+    *value = (uint32_t)version_store.valueCount++;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_push
+// PURPOSE : Appends the newest version of a chain.
+// RETURNS : 1 -> added, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int version_push(VersionChain *chain, int64_t from, uint32_t value)
+{
+    if (chain->count == chain->cap) {
+        size_t newCap = chain->cap ? chain->cap * 2 : 2;
+        Version *grown = realloc(chain->items, newCap * sizeof(Version));
+        if (grown == NULL) return 0;
+        chain->items = grown;
+        chain->cap = newCap;
+    }
+    chain->items[chain->count].from = from;
+    chain->items[chain->count].value = value;
+    chain->count++;
+    version_store.versionCount++;
+    version_store.sinceCompact++;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_set_before
+// PURPOSE : A logged UPDATE/DELETE names the exact record it replaced. Makes
+//           that the newest state of the chain (or its first version), which
+//           also corrects values taken from an older, unquoted INSERT line.
+// RETURNS : 1 -> done, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int version_set_before(VersionChain *chain, const Student *before)
+{
+    uint32_t value;
+
+    if (chain->count > 0) {
+        uint32_t newest = chain->items[chain->count - 1].value;
+        if (newest != VERSION_ABSENT && student_equal(&version_store.values[newest], before)) return 1;
+        if (!version_value_add(before, &value)) return 0;
+        chain->items[chain->count - 1].value = value;
+        return 1;
+    }
+    return version_value_add(before, &value) && version_push(chain, INT64_MIN, value);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_restore_previous
+// PURPOSE : Logged UNDO of a change: the record goes back to the state
+//           before its newest version.
+// RETURNS : 1 -> done (or nothing to restore), 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int version_restore_previous(int id, int64_t from)
+{
+    VersionChain *chain = version_chain(id, 0);
+    if (chain == NULL || chain->count < 2) return 1;
+    return version_push(chain, from, chain->items[chain->count - 2].value);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_copy_field
+// -----------------------------------------------------------------------------
+static void version_copy_field(char *target, const char *text, size_t length)
+{
+    if (length >= MAX_STR) length = MAX_STR - 1;
+    memcpy(target, text, length);
+    target[length] = '\0';
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_apply
+// PURPOSE : Adds the versions one audit log message creates:
+//           INSERT / UPDATE / DELETE lines, UNDO of them, and UNDO of the
+//           last COMMIT / MERGE / UPDATE SET / DELETE WHERE (its change
+//           lines follow its header line).
+// RETURNS : 1 -> applied (or not a change), 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int version_apply(int64_t timestamp, const char *message, size_t length)
+{
+    char text[1024];
+    if (length >= sizeof(text)) return 1; //audit entries are shorter
+    memcpy(text, message, length);
+    text[length] = '\0';
+
+    int isInsert = strncmp(text, "INSERT ", 7) == 0;
+    int isUpdate = strncmp(text, "UPDATE ", 7) == 0;
+    int isDelete = strncmp(text, "DELETE ", 7) == 0;
+
+    if (strncmp(text, "COMMIT (", 8) == 0 || strncmp(text, "MERGE ", 6) == 0 ||
+        strncmp(text, "UPDATE SET ", 11) == 0 || strncmp(text, "DELETE WHERE ", 13) == 0) {
+        version_store.inBatch = 1;
+        version_store.batchCount = 0;
+        version_store.batchTime = timestamp;
+        return 1;
+    }
+    if (!isInsert && !isUpdate && !isDelete) {
+        version_store.inBatch = 0;
+        if (strncmp(text, "OPEN ", 5) == 0 || strncmp(text, "REPLAY ", 7) == 0) {
+            version_store_restart(timestamp);
+            return 1;
+        }
+        if (strncmp(text, "UNDO ", 5) != 0 || strstr(text, " failed") != NULL) return 1;
+
+        if (strncmp(text, "UNDO INSERT (", 13) == 0) {
+            VersionChain *chain = version_chain(log_message_student_id(text, length), 0);
+            return chain == NULL || version_push(chain, timestamp, VERSION_ABSENT);
+        }
+        if (strncmp(text, "UNDO DELETE (", 13) == 0 || strncmp(text, "UNDO UPDATE (", 13) == 0) {
+            return version_restore_previous(log_message_student_id(text, length), timestamp);
+        }
+        //UNDO COMMIT / MERGE / UPDATE WHERE / DELETE WHERE
+        for (size_t i = 0; i < version_store.batchCount; i++) {
+            if (!version_restore_previous(version_store.batch[i], timestamp)) return 0;
+        }
+        version_store.batchCount = 0;
+        return 1;
+    }
+
+    int id = log_message_student_id(text, length);
+    if (id < 0) return 1;
+
+    //Values: INSERT id "name" "programme" mark
+    //        UPDATE id | "n1" -> "n2" | "p1" -> "p2" | m1 -> m2
+    //        DELETE id | "name" | "programme" | mark
+    const char *fields[4];
+    size_t fieldLengths[4];
+    int found = log_quoted_fields(text, length, fields, fieldLengths, 4);
+    Student before, after;
+    memset(&before, 0, sizeof(before));
+    memset(&after, 0, sizeof(after));
+    before.id = after.id = id;
+    const char *tail = found > 0 ? fields[found - 1] + fieldLengths[found - 1] + 1 : NULL;
+
+    if (isInsert && found == 2) {
+        version_copy_field(after.name, fields[0], fieldLengths[0]);
+        version_copy_field(after.programme, fields[1], fieldLengths[1]);
+        after.mark = strtof(tail, NULL);
+    }
+    else if (isInsert) {
+        //Older "INSERT id name programme mark": the name/programme split is not
+        //logged, so keep the words as the name until a later change names both
+        char *markText = strrchr(text, ' ');
+        char *nameText = strchr(text + 7, ' ');
+        if (markText == NULL || nameText == NULL || nameText >= markText) return 1;
+        after.mark = strtof(markText + 1, NULL);
+        version_copy_field(after.name, nameText + 1, (size_t)(markText - nameText - 1));
+    }
+    else if (isUpdate && found == 4) {
+        const char *bar = strchr(tail, '|');
+        const char *arrow = bar ? strstr(bar, "->") : NULL;
+        if (arrow == NULL) return 1;
+        version_copy_field(before.name, fields[0], fieldLengths[0]);
+        version_copy_field(after.name, fields[1], fieldLengths[1]);
+        version_copy_field(before.programme, fields[2], fieldLengths[2]);
+        version_copy_field(after.programme, fields[3], fieldLengths[3]);
+        before.mark = strtof(bar + 1, NULL);
+        after.mark = strtof(arrow + 2, NULL);
+    }
+    else if (isDelete && found == 2) {
+        const char *bar = strchr(tail, '|');
+        if (bar == NULL) return 1;
+        version_copy_field(before.name, fields[0], fieldLengths[0]);
+        version_copy_field(before.programme, fields[1], fieldLengths[1]);
+        before.mark = strtof(bar + 1, NULL);
+    }
+    else {
+        return 1; //older UPDATE line with only the ID: nothing to rebuild from
+    }
+
+    VersionChain *chain = version_chain(id, 1);
+    if (chain == NULL) return 0;
+
+    uint32_t value = VERSION_ABSENT;
+    if (isInsert) {
+        if (chain->count == 0 && !version_push(chain, INT64_MIN, VERSION_ABSENT)) return 0;
+    }
+    else if (!version_set_before(chain, &before)) {
+        return 0;
+    }
+    if (!isDelete && !version_value_add(&after, &value)) return 0;
+    if (!version_push(chain, timestamp, value)) return 0;
+
+    //Lines right after a COMMIT / MERGE header are that batch
+    if (version_store.inBatch && timestamp == version_store.batchTime) {
+        if (version_store.batchCount == version_store.batchCap) {
+            size_t newCap = version_store.batchCap ? version_store.batchCap * 2 : 64;
+            int *grown = realloc(version_store.batch, newCap * sizeof(int));
+            if (grown == NULL) return 0;
+            version_store.batch = grown;
+            version_store.batchCap = newCap;
+        }
+        version_store.batch[version_store.batchCount++] = id;
+    }
+    else {
+        version_store.inBatch = 0;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_same_state
+// -----------------------------------------------------------------------------
+static int version_same_state(uint32_t a, uint32_t b)
+{
+    if (a == VERSION_ABSENT || b == VERSION_ABSENT) return a == b;
+    return a == b || student_equal(&version_store.values[a], &version_store.values[b]);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_store_compact
+// PURPOSE : Drops versions no AS OF read can return (replaced within the
+//           same second, or equal to the version before), then packs the
+//           values still in use. The newest two versions of each chain stay.
+// RETURNS : number of versions dropped
+// -----------------------------------------------------------------------------
+static size_t version_store_compact(void)
+{
+    size_t dropped = 0;
+
+    for (size_t c = 0; c < version_store.chainCount; c++) {
+        VersionChain *chain = &version_store.chains[c];
+        size_t keep = chain->count >= 2 ? chain->count - 2 : 0;
+        size_t out = 0;
+
+        for (size_t i = 0; i < keep; i++) {
+            const Version *version = &chain->items[i];
+            if (version->from == chain->items[i + 1].from) continue; //never visible
+            if (out > 0 && version_same_state(chain->items[out - 1].value, version->value)) continue;
+            chain->items[out++] = *version;
+        }
+        for (size_t i = keep; i < chain->count; i++) {
+            chain->items[out++] = chain->items[i];
+        }
+        dropped += chain->count - out;
+        chain->count = out;
+
+        if (chain->cap > chain->count) {
+            Version *shrunk = realloc(chain->items, chain->count * sizeof(Version));
+            if (shrunk != NULL) {
+                chain->items = shrunk;
+                chain->cap = chain->count;
+            }
+        }
+    }
+    version_store.versionCount -= dropped;
+    version_store.sinceCompact = 0;
+
+    //Pack the values: remap[old index] = new index, VERSION_ABSENT -> unused
+    uint32_t *remap = malloc((version_store.valueCount ? version_store.valueCount : 1) * sizeof(uint32_t));
+    if (remap == NULL) return dropped;
+    for (size_t i = 0; i < version_store.valueCount; i++) remap[i] = VERSION_ABSENT;
+    for (size_t c = 0; c < version_store.chainCount; c++) {
+        const VersionChain *chain = &version_store.chains[c];
+        for (size_t i = 0; i < chain->count; i++) {
+            if (chain->items[i].value != VERSION_ABSENT) remap[chain->items[i].value] = 0;
+        }
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < version_store.valueCount; i++) {
+        if (remap[i] == VERSION_ABSENT) continue;
+        version_store.values[used] = version_store.values[i];
+        remap[i] = (uint32_t)used++;
+    }
+    for (size_t c = 0; c < version_store.chainCount; c++) {
+        VersionChain *chain = &version_store.chains[c];
+        for (size_t i = 0; i < chain->count; i++) {
+            if (chain->items[i].value != VERSION_ABSENT) chain->items[i].value = remap[chain->items[i].value];
+        }
+    }
+    free(remap);
+
+    version_store.valueCount = used;
+    if (version_store.valueCap > used * 2 && used > 0) {
+        Student *shrunk = realloc(version_store.values, used * sizeof(Student));
+        if (shrunk != NULL) {
+            version_store.values = shrunk;
+            version_store.valueCap = used;
+        }
+    }
+    return dropped;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_store_build
+// PURPOSE : Builds the version store from every log segment, oldest first
+//           (once; log_append() keeps it current afterwards).
+// RETURNS : 1 -> ready, 0 -> out of memory
+// -----------------------------------------------------------------------------
+static int version_store_build(void)
+{
+    if (version_store.built) return 1;
+    log_init();
+
+    int ok = 1;
+    for (uint32_t segment = 1; segment <= log_state.activeSegment && ok; segment++) {
+        char path[64];
+        log_segment_path(segment, path, sizeof(path));
+        FILE *segmentFile = fopen(path, "rb");
+        if (segmentFile == NULL) continue;
+
+        LineReader reader;
+        if (!line_reader_init(&reader, segmentFile)) {
+            fclose(segmentFile);
+            ok = 0;
+            break;
+        }
+
+        const char *line, *message;
+        size_t lineLength, messageLength;
+        time_t timestamp;
+        while (ok && line_reader_next(&reader, &line, &lineLength, NULL)) {
+            if (log_line_parse(line, lineLength, &timestamp, &message, &messageLength)) {
+                ok = version_apply((int64_t)timestamp, message, messageLength);
+            }
+        }
+        line_reader_free(&reader);
+        fclose(segmentFile);
+    }
+
+    if (!ok) {
+        version_store_free();
+        printf(RED "CMS Error: Out of memory building the version history.\n" RESET);
+        return 0;
+    }
+    version_store.built = 1;
+    version_store_compact();
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_store_feed
+// PURPOSE : Adds the versions of lines just written to the log (called by
+//           log_append()); compacts every VERSION_COMPACT_EVERY versions.
+// -----------------------------------------------------------------------------
+static void version_store_feed(const char *entries, size_t length)
+{
+    if (!version_store.built) return;
+
+    const char *line = entries;
+    const char *end = entries + length;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        size_t lineLength = newline ? (size_t)(newline - line) : (size_t)(end - line);
+        const char *message;
+        size_t messageLength;
+        time_t timestamp;
+
+        if (log_line_parse(line, lineLength, &timestamp, &message, &messageLength) &&
+            !version_apply((int64_t)timestamp, message, messageLength)) {
+            version_store_free(); //rebuilt from the log by the next AS OF
+            printf(YELLOW "CMS Warning: Out of memory, version history dropped.\n" RESET);
+            return;
+        }
+        line += lineLength + 1;
+    }
+
+    if (version_store.sinceCompact >= VERSION_COMPACT_EVERY) {
+        version_store_compact();
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_store_bytes
+// RETURNS : memory held by the version store (0 if not built);
+//           *versions = number of versions
+// -----------------------------------------------------------------------------
+static size_t version_store_bytes(size_t *versions)
+{
+    size_t bytes = version_store.chainCap * sizeof(VersionChain) + version_store.slotCap * sizeof(int) +
+                   version_store.valueCap * sizeof(Student) + version_store.batchCap * sizeof(int);
+    for (size_t i = 0; i < version_store.chainCount; i++) {
+        bytes += version_store.chains[i].cap * sizeof(Version);
+    }
+    *versions = version_store.versionCount;
+    return bytes;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_at
+// PURPOSE : State of a chain at 'when': binary search for the newest version
+//           that started at or before it.
+// RETURNS : 1 -> record existed (*out), 0 -> no record,
+//           -1 -> no logged change (chain == NULL): read the table
+// -----------------------------------------------------------------------------
+static int version_at(const VersionChain *chain, time_t when, Student *out)
+{
+    if (chain == NULL || chain->count == 0) return -1;
+
+    //items[low].from <= when < items[high].from (items[0] starts at INT64_MIN, items[count] is "never")
+    size_t low = 0, high = chain->count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (chain->items[mid].from <= (int64_t)when) low = mid;
+        else high = mid;
+    }
+
+    uint32_t value = chain->items[low].value;
+    if (value == VERSION_ABSENT) return 0;
+    *out = version_store.values[value];
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: version_time_valid
+// PURPOSE : AS OF reaches back to the OPEN of the current table, no further.
+// RETURNS : 1 -> 'when' is covered, 0 -> before it (message printed)
+// -----------------------------------------------------------------------------
+static int version_time_valid(time_t when)
+{
+    if ((int64_t)when >= version_store.opened) return 1;
+
+    char stamp[32];
+    time_t opened = (time_t)version_store.opened;
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&opened));
+    printf("CMS: The open table was loaded at %s; AS OF cannot go back before that.\n", stamp);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: query_as_of
+// PURPOSE : QUERY <ID> AS OF <time>. Prints the record as it was then
+//           (committed changes only).
+// -----------------------------------------------------------------------------
+void query_as_of(int studentId, time_t when)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (!version_store_build() || !version_time_valid(when)) return;
+
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&when));
+
+    Student record;
+    int found = version_at(version_chain(studentId, 0), when, &record);
+    if (found < 0) { //never changed: the table holds it
+        const Student *current = NULL;
+        if (db_lazy) {
+            long entry = lazy_find_entry(studentId);
+            current = entry >= 0 ? lazy_fetch((size_t)entry) : NULL;
+        }
+        else {
+            int pos = find_index_by_id(studentId);
+            current = pos >= 0 ? row_at((size_t)pos) : NULL;
+        }
+        found = current != NULL;
+        if (found) record = *current;
+    }
+
+    if (!found) {
+        printf("CMS: The record with ID %d did not exist as of %s.\n", studentId, stamp);
+        return;
+    }
+    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+    print_student_record(&record);
+    printf("CMS: As of %s.\n", stamp);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: summary_as_of
+// PURPOSE : SHOW SUMMARY AS OF <time>. Same figures as SHOW SUMMARY for the
+//           table as it was then: every current row is read through its
+//           chain, then IDs that only the history still holds are added.
+// -----------------------------------------------------------------------------
+void summary_as_of(time_t when)
+{
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (!version_store_build() || !version_time_valid(when)) return;
+
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&when));
+
+    size_t total = 0;
+    double sum = 0.0;
+    Student highest, lowest, state;
+
+    for (size_t i = 0; i < db.size + version_store.chainCount; i++) {
+        const Student *record;
+        if (i < db.size) {
+            record = row_at(i);
+            int found = version_at(version_chain(record->id, 0), when, &state);
+            if (found == 0) continue;
+            if (found > 0) record = &state;
+        }
+        else {
+            const VersionChain *chain = &version_store.chains[i - db.size];
+            if (find_index_by_id(chain->id) >= 0 || version_at(chain, when, &state) <= 0) continue;
+            record = &state;
+        }
+
+        if (total == 0 || record->mark > highest.mark) highest = *record;
+        if (total == 0 || record->mark < lowest.mark) lowest = *record;
+        sum += record->mark;
+        total++;
+    }
+
+    if (total == 0) {
+        printf("No students available as of %s.\n", stamp);
+        return;
+    }
+
+    printf(CYAN "===== Student Summary (as of %s) =====\n" RESET, stamp);
+    printf("Total students :  %zu\n", total);
+    printf("Average mark   :");
+    printf(YELLOW " % .2f\n" RESET, sum / total);
+    printf("Highest mark   : ");
+    printf(GREEN "% .1f (%s)\n" RESET, highest.mark, highest.name);
+    printf("Lowest mark    :");
+    printf(RED   " % .1f (%s)\n" RESET, lowest.mark, lowest.name);
+    printf(CYAN "===========================\n" RESET);
+}
+
+
+/* ---------------------------------------------------- */
+/* Shared-Memory Snapshot (PUBLISH)                     */
+/* ---------------------------------------------------- */
+//
+// PUBLISH copies the table into a POSIX shared-memory segment that other
+// processes map read-only and scan in place (reader library:
+// P9_3_cms_shm.h, example consumer: P9_3_shm_reader.c). The segment is a
+// header page followed by two record slots. A publish fills the slot the
+// header does not point at, then flips header.active to it and bumps
+// header.generation, so readers of the previous snapshot are not disturbed.
+//
+// The header and each slot carry a sequence counter (a seqlock) that is odd
+// while the writer changes what it protects. A reader notes the slot's
+// counter, scans the records and checks the counter again; if it moved,
+// the slot was rewritten meanwhile and the reader retries. When the table
+// outgrows the slots the segment is retired (readers see header.retired
+// and reopen it by name) and a bigger one takes its name.
+//
+// The layout below is shared with P9_3_cms_shm.h: change both together and
+// bump SHM_LAYOUT_VERSION.
+
+#define SHM_DEFAULT_NAME   "/P9_3-CMS"
+#define SHM_MAGIC          0x43333950u //"P93C"
+#define SHM_LAYOUT_VERSION 1
+#define SHM_HEADER_BYTES   4096        //records start on the next page
+
+//One published record (fixed size, no pointers)
+typedef struct {
+    int32_t id;
+    float mark;
+    char name[MAX_STR];
+    char programme[MAX_STR];
+} ShmRecord;
+
+//One snapshot slot
+typedef struct {
+    uint64_t seq;        //seqlock: odd while the slot is written
+    uint64_t generation; //publish that filled the slot
+    uint64_t count;      //records in the slot
+    uint64_t offset;     //byte offset of the records from the segment start
+    int64_t published;   //time of the publish (seconds since epoch)
+} ShmSlot;
+
+typedef struct {
+    uint32_t magic;      //SHM_MAGIC once the header is ready
+    uint32_t layout;     //SHM_LAYOUT_VERSION
+    uint32_t recordSize; //sizeof(ShmRecord)
+    uint32_t retired;    //1 -> replaced by a bigger segment: reopen by name
+    uint64_t capacity;   //records per slot
+    uint64_t seq;        //seqlock over active / generation
+    uint64_t active;     //slot readers should use
+    uint64_t generation; //latest publish (0 -> nothing published yet)
+    ShmSlot slots[2];
+} ShmHeader;
+
+static struct {
+    char name[64];       //segment name, "" -> nothing published
+    unsigned char *base; //writable mapping
+    size_t bytes;
+    uint64_t capacity;
+    uint64_t generation; //keeps counting across segment replacements
+} shm_state;
+
+#ifndef _WIN32
+
+// -----------------------------------------------------------------------------
+// FUNCTION: shm_write_begin / shm_write_end
+// PURPOSE : Seqlock writer side: the counter is odd between the two calls,
+//           and the stores in between are ordered after / before it.
+// -----------------------------------------------------------------------------
+static void shm_write_begin(uint64_t *seq)
+{
+    __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void shm_write_end(uint64_t *seq)
+{
+    __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: shm_release
+// PURPOSE : Marks the published segment retired, unmaps it and, if unlink,
+//           removes its name. Readers that still map it keep their snapshot.
+// -----------------------------------------------------------------------------
+static void shm_release(int unlink)
+{
+    if (shm_state.base == NULL) return;
+
+    ShmHeader *header = (ShmHeader *)shm_state.base;
+    shm_write_begin(&header->seq);
+    __atomic_store_n(&header->retired, 1u, __ATOMIC_RELAXED);
+    shm_write_end(&header->seq);
+
+    munmap(shm_state.base, shm_state.bytes);
+    if (unlink) shm_unlink(shm_state.name);
+    shm_state.base = NULL;
+    shm_state.bytes = 0;
+    shm_state.capacity = 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: shm_create
+// PURPOSE : Creates (or replaces) the segment with room for 'capacity'
+//           records in each of its two slots.
+// RETURNS : 1 -> mapped, 0 -> failed (error printed)
+// -----------------------------------------------------------------------------
+static int shm_create(const char *name, uint64_t capacity)
+{
+    size_t bytes = SHM_HEADER_BYTES + 2 * (size_t)capacity * sizeof(ShmRecord);
+
+    shm_unlink(name); //a replaced segment stays mapped by its readers
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        printf(RED "CMS Error: Cannot create shared memory \"%s\" (%s).\n" RESET, name, strerror(errno));
+        return 0;
+    }
+    if (ftruncate(fd, (off_t)bytes) != 0) {
+        printf(RED "CMS Error: Cannot size shared memory \"%s\" (%s).\n" RESET, name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return 0;
+    }
+    void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf(RED "CMS Error: Cannot map shared memory \"%s\" (%s).\n" RESET, name, strerror(errno));
+        shm_unlink(name);
+        return 0;
+    }
+
+    //The new segment is zero-filled: only the constant fields need setting
+    ShmHeader *header = base;
+    header->layout = SHM_LAYOUT_VERSION;
+    header->recordSize = (uint32_t)sizeof(ShmRecord);
+    header->capacity = capacity;
+    for (int i = 0; i < 2; i++) {
+        header->slots[i].offset = SHM_HEADER_BYTES + (uint64_t)i * capacity * sizeof(ShmRecord);
+    }
+    __atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE); //ready
+
+    snprintf(shm_state.name, sizeof(shm_state.name), "%s", name);
+    shm_state.base = base;
+    shm_state.bytes = bytes;
+    shm_state.capacity = capacity;
+    return 1;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+// FUNCTION: publish_table
+// PURPOSE : PUBLISH [<name>]. Copies the committed table (in its current row
+//           order) into the inactive slot and makes it the active one.
+// -----------------------------------------------------------------------------
+void publish_table(const char *name)
+{
+#ifdef _WIN32
+    (void)name;
+    printf(RED "CMS Error: PUBLISH needs POSIX shared memory, which Windows does not have.\n" RESET);
+#else
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
+    if (name[0] != '/' || strchr(name + 1, '/') != NULL || strlen(name) < 2 || strlen(name) >= sizeof(shm_state.name)) {
+        printf(RED "CMS Error: A shared memory name is \"/name\" (one leading '/', at most %zu characters).\n" RESET,
+               sizeof(shm_state.name) - 1);
+        return;
+    }
+
+    size_t rows = db_lazy ? lazy.count : db.size;
+    if (shm_state.base != NULL && (strcmp(name, shm_state.name) != 0 || rows > shm_state.capacity)) {
+        shm_release(strcmp(name, shm_state.name) != 0); //same name: shm_create replaces it
+    }
+    if (shm_state.base == NULL && !shm_create(name, (uint64_t)(rows + rows / 4 + 1024))) {
+        return;
+    }
+
+    ShmHeader *header = (ShmHeader *)shm_state.base;
+    uint64_t target = __atomic_load_n(&header->generation, __ATOMIC_RELAXED) == 0
+                    ? 0 : 1 - __atomic_load_n(&header->active, __ATOMIC_RELAXED);
+    ShmSlot *slot = &header->slots[target];
+    ShmRecord *records = (ShmRecord *)(shm_state.base + slot->offset);
+    uint64_t generation = ++shm_state.generation;
+
+    shm_write_begin(&slot->seq);
+    size_t count = 0;
+    for (size_t i = 0; i < rows; i++) {
+        const Student *record = db_lazy ? lazy_fetch(i) : row_at(i);
+        if (record == NULL) continue; //lazy row that failed to parse
+
+        ShmRecord *out = &records[count++];
+        out->id = record->id;
+        out->mark = record->mark;
+        strncpy(out->name, record->name, MAX_STR); //zero-pads: no stale bytes are published
+        strncpy(out->programme, record->programme, MAX_STR);
+    }
+    __atomic_store_n(&slot->count, (uint64_t)count, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->generation, generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->published, (int64_t)time(NULL), __ATOMIC_RELAXED);
+    shm_write_end(&slot->seq);
+
+    //Flip readers over to the new snapshot
+    shm_write_begin(&header->seq);
+    __atomic_store_n(&header->active, target, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->generation, generation, __ATOMIC_RELAXED);
+    shm_write_end(&header->seq);
+
+    printf(GREEN "CMS: Published %zu record(s) to shared memory \"%s\" (generation %llu, %.2f MB).\n" RESET,
+           count, shm_state.name, (unsigned long long)generation, shm_state.bytes / (1024.0 * 1024.0));
+    audit_log("PUBLISH %s (%zu records, generation %llu)", shm_state.name, count, (unsigned long long)generation);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: publish_stop
+// PURPOSE : PUBLISH STOP (and EXIT). Retires and removes the segment.
+// -----------------------------------------------------------------------------
+void publish_stop(int verbose)
+{
+#ifndef _WIN32
+    if (shm_state.base != NULL) {
+        if (verbose) printf("CMS: Shared memory \"%s\" removed.\n", shm_state.name);
+        shm_release(1);
+        return;
+    }
+#endif
+    if (verbose) printf(YELLOW "CMS: Nothing is published.\n" RESET);
+}
+
+
+/* ---------------------------------------------------- */
+/* Streaming File Statistics (STAT FILE)                */
+/* ---------------------------------------------------- */
+//
+// STAT FILE <path> summarises a database file without loading it. The file
+// is read in rounds of STAT_ROUND_CHUNKS x STAT_CHUNK_BYTES; every round is
+// cut at line ends into chunks that the thread pool parses in parallel,
+// each into its own StatPartial, and the partials are then merged in file
+// order. Memory stays the same whatever the file size:
+// - count / sum / min / max are exact,
+// - mark quantiles come from a merging t-digest (compression
+//   TDIGEST_COMPRESSION: about that many centroids, most precise at the tails),
+// - distinct programmes from a HyperLogLog with 2^HLL_BITS registers
+//   (HLL_ERROR_PERCENT standard error),
+// - the most frequent programmes from a count-min sketch (CMS_DEPTH rows of
+//   CMS_WIDTH counters, over-counting by at most e*rows/CMS_WIDTH with 98%
+//   confidence) plus the STAT_TOP_CANDIDATES programmes it rated highest.
+// Programmes are compared in collation order (case and spacing ignored).
+
+#define STAT_CHUNK_BYTES     (4u << 20) //bytes parsed by one task
+#define STAT_ROUND_CHUNKS    8          //tasks per round (and partials in memory)
+#define STAT_TOP_SHOW        10         //programmes listed
+#define STAT_TOP_CANDIDATES  32         //programmes tracked per partial
+#define TDIGEST_COMPRESSION  100
+#define TDIGEST_CAPACITY     (2 * TDIGEST_COMPRESSION) //centroids kept after a merge
+#define TDIGEST_BUFFER       512        //values collected before a merge
+#define HLL_BITS             14
+#define HLL_REGISTERS        (1u << HLL_BITS)
+#define HLL_ERROR_PERCENT    0.81       //104 / sqrt(HLL_REGISTERS)
+#define CMS_DEPTH            4
+#define CMS_WIDTH            2048
+
+//t-digest centroid
+typedef struct {
+    double mean;
+    double weight;
+} Centroid;
+
+typedef struct {
+    Centroid centroids[TDIGEST_CAPACITY + TDIGEST_BUFFER]; //merged ones first, then the buffer
+    size_t count;    //merged centroids
+    size_t buffered; //values waiting after them
+    double total;    //weight of the merged centroids
+} TDigest;
+
+//A programme the count-min sketch rates as frequent
+typedef struct {
+    uint64_t hash;
+    uint64_t estimate;
+    char programme[MAX_STR]; //first spelling seen
+} StatCandidate;
+
+//Everything one chunk contributes
+typedef struct {
+    const char *text;     //chunk to parse (set per round)
+    size_t length;
+
+    uint64_t rows, invalid;
+    double sum;
+    Student lowest, highest;
+    TDigest digest;
+    uint8_t hll[HLL_REGISTERS];
+    uint32_t cms[CMS_DEPTH][CMS_WIDTH];
+    StatCandidate top[STAT_TOP_CANDIDATES];
+    int topCount;
+} StatPartial;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_log
+// PURPOSE : Natural logarithm for x > 0 (keeps the build free of libm):
+//           x = m * 2^e with m in [0.75, 1.5), ln m from the atanh series.
+// -----------------------------------------------------------------------------
+static double stat_log(double x)
+{
+    int exponent = 0;
+    while (x >= 1.5) { x /= 2.0; exponent++; }
+    while (x < 0.75) { x *= 2.0; exponent--; }
+
+    double t = (x - 1.0) / (x + 1.0), t2 = t * t;
+    double term = t, sum = 0.0;
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= t2;
+    }
+    return 2.0 * sum + exponent * 0.69314718055994530942;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: tdigest_k
+// PURPOSE : t-digest scale function k2 = norm * ln(q / (1 - q)): a centroid
+//           may span one unit of k, so centroids are small near q = 0 and 1
+//           and about TDIGEST_COMPRESSION / 2 of them cover the rest.
+// -----------------------------------------------------------------------------
+static double tdigest_k(double q, double norm)
+{
+    if (q < 1e-12) q = 1e-12;
+    if (q > 1.0 - 1e-12) q = 1.0 - 1e-12;
+    return norm * stat_log(q / (1.0 - q));
+}
+
+// -----------------------------------------------------------------------------
+// COMPARATOR: compare_centroid
+// -----------------------------------------------------------------------------
+static int compare_centroid(const void *a, const void *b)
+{
+    double x = ((const Centroid *)a)->mean, y = ((const Centroid *)b)->mean;
+    return (x > y) - (x < y);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: tdigest_merge
+// PURPOSE : Folds the buffered values into the centroids: sorts everything
+//           by mean and merges neighbours while the merged centroid spans at
+//           most one unit of tdigest_k().
+// -----------------------------------------------------------------------------
+static void tdigest_merge(TDigest *digest)
+{
+    if (digest->buffered == 0) return;
+
+    size_t n = digest->count + digest->buffered;
+    Centroid *all = digest->centroids;
+    double total = digest->total;
+    for (size_t i = digest->count; i < n; i++) total += all[i].weight;
+    qsort(all, n, sizeof(Centroid), compare_centroid);
+
+    double norm = TDIGEST_COMPRESSION / (4.0 * stat_log(total > TDIGEST_COMPRESSION ? total / TDIGEST_COMPRESSION : 1.0) + 24.0);
+    size_t out = 0;
+    double before = 0.0; //weight left of all[out]
+    double kLeft = tdigest_k(0.0, norm);
+    for (size_t i = 1; i < n; i++) {
+        double merged = all[out].weight + all[i].weight;
+        //The capacity check only matters for pathological inputs
+        if (tdigest_k((before + merged) / total, norm) - kLeft <= 1.0 || out + 1 == TDIGEST_CAPACITY) {
+            all[out].mean += (all[i].mean - all[out].mean) * all[i].weight / merged;
+            all[out].weight = merged;
+        }
+        else {
+            before += all[out].weight;
+            kLeft = tdigest_k(before / total, norm);
+            all[++out] = all[i];
+        }
+    }
+    digest->count = out + 1;
+    digest->buffered = 0;
+    digest->total = total;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: tdigest_add
+// -----------------------------------------------------------------------------
+static void tdigest_add(TDigest *digest, double value, double weight)
+{
+    if (digest->buffered == TDIGEST_BUFFER) tdigest_merge(digest);
+    Centroid *centroid = &digest->centroids[digest->count + digest->buffered++];
+    centroid->mean = value;
+    centroid->weight = weight;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: tdigest_quantile
+// PURPOSE : Value below which fraction q of the weight lies: interpolates
+//           between centroid centres (and the exact min / max at the ends).
+// -----------------------------------------------------------------------------
+static double tdigest_quantile(TDigest *digest, double q, double min, double max)
+{
+    tdigest_merge(digest);
+    if (digest->count == 0) return 0.0;
+
+    const Centroid *c = digest->centroids;
+    double target = q * digest->total;
+    double centre = c[0].weight / 2.0; //cumulative weight at the centre of c[i]
+
+    if (target <= centre) {
+        return min + (c[0].mean - min) * (centre > 0 ? target / centre : 0.0);
+    }
+    for (size_t i = 0; i + 1 < digest->count; i++) {
+        double next = centre + (c[i].weight + c[i + 1].weight) / 2.0;
+        if (target <= next) {
+            return c[i].mean + (c[i + 1].mean - c[i].mean) * (target - centre) / (next - centre);
+        }
+        centre = next;
+    }
+    double rest = digest->total - centre;
+    const Centroid *last = &c[digest->count - 1];
+    return last->mean + (max - last->mean) * (rest > 0 ? (target - centre) / rest : 0.0);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_programme_hash
+// PURPOSE : 64-bit hash of a programme in collation order (FNV-1a, then a
+//           finaliser so every bit is usable by HyperLogLog).
+// -----------------------------------------------------------------------------
+static uint64_t stat_programme_hash(const char *programme)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const char *p = collate_start(programme);
+    int c;
+    while ((c = collate_next(&p)) != 0) {
+        hash = (hash ^ (uint64_t)c) * 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_cms_column
+// PURPOSE : Counter of a hash in one count-min row (h1 + row * h2 from the
+//           two halves of the hash, h2 odd, stands in for independent hashes).
 // -----------------------------------------------------------------------------
-static int prompt_edit_str(const char *fieldLabel, char *stringDestination, size_t cap, const char *current)
+static inline uint32_t stat_cms_column(uint64_t hash, int row)
 {
-    char userBuffer[256];
+    return ((uint32_t)hash + (uint32_t)row * ((uint32_t)(hash >> 32) | 1u)) % CMS_WIDTH;
+}
 
-    printf("%s (Enter to keep \"%s\"): ", fieldLabel, current); //ask user
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_cms_estimate
+// RETURNS : count-min estimate for a hash (never below the true count)
+// -----------------------------------------------------------------------------
+static uint64_t stat_cms_estimate(uint32_t cms[CMS_DEPTH][CMS_WIDTH], uint64_t hash)
+{
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < CMS_DEPTH; row++) {
+        uint32_t column = stat_cms_column(hash, row);
+        if (cms[row][column] < estimate) estimate = cms[row][column];
+    }
+    return estimate;
+}
 
-    //User Input
-    if (!fgets(userBuffer, sizeof(userBuffer), stdin)) { //If read fails(etc interrupts) -> no change
-        return 0;
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_offer_candidate
+// PURPOSE : Keeps the STAT_TOP_CANDIDATES programmes with the highest
+//           estimates: updates a tracked one or replaces the lowest.
+// -----------------------------------------------------------------------------
+static void stat_offer_candidate(StatPartial *partial, uint64_t hash, uint64_t estimate, const char *programme)
+{
+    int lowest = 0;
+    for (int i = 0; i < partial->topCount; i++) {
+        if (partial->top[i].hash == hash) {
+            if (estimate > partial->top[i].estimate) partial->top[i].estimate = estimate;
+            return;
+        }
+        if (partial->top[i].estimate < partial->top[lowest].estimate) lowest = i;
     }
 
-    if (userBuffer[0] == '\n') //User presses enter -> no change
+    StatCandidate *slot;
+    if (partial->topCount < STAT_TOP_CANDIDATES) {
+        slot = &partial->top[partial->topCount++];
+    }
+    else if (estimate > partial->top[lowest].estimate) {
+        slot = &partial->top[lowest];
+    }
+    else {
+        return;
+    }
+    slot->hash = hash;
+    slot->estimate = estimate;
+    snprintf(slot->programme, sizeof(slot->programme), "%s", programme);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_partial_reset
+// -----------------------------------------------------------------------------
+static void stat_partial_reset(StatPartial *partial)
+{
+    const char *text = partial->text;
+    size_t length = partial->length;
+    memset(partial, 0, sizeof(*partial));
+    partial->text = text;
+    partial->length = length;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_chunk_task
+// PURPOSE : Pool task: parses one chunk of complete lines into its partial.
+// -----------------------------------------------------------------------------
+static void stat_chunk_task(void *context, size_t task)
+{
+    StatPartial *partial = &((StatPartial *)context)[task];
+    stat_partial_reset(partial);
+
+    const char *line = partial->text;
+    const char *end = partial->text + partial->length;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        size_t lineLength = newline ? (size_t)(newline - line) : (size_t)(end - line);
+
+        Student record;
+        if (parse_line(line, lineLength, &record)) {
+            if (partial->rows == 0 || record.mark < partial->lowest.mark) partial->lowest = record;
+            if (partial->rows == 0 || record.mark > partial->highest.mark) partial->highest = record;
+            partial->rows++;
+            partial->sum += record.mark;
+            tdigest_add(&partial->digest, record.mark, 1.0);
+
+            uint64_t hash = stat_programme_hash(record.programme);
+
+            //HyperLogLog: register = low HLL_BITS bits, rank = leading zeros of the rest + 1
+            uint64_t rest = hash >> HLL_BITS;
+            uint8_t rank = 1;
+            while (rank <= 64 - HLL_BITS && !(rest & 1)) {
+                rest >>= 1;
+                rank++;
+            }
+            uint8_t *hllRegister = &partial->hll[hash & (HLL_REGISTERS - 1)];
+            if (rank > *hllRegister) *hllRegister = rank;
+
+            for (int row = 0; row < CMS_DEPTH; row++) {
+                partial->cms[row][stat_cms_column(hash, row)]++;
+            }
+            stat_offer_candidate(partial, hash, stat_cms_estimate(partial->cms, hash), record.programme);
+        }
+        else {
+            //Blank lines are not counted as invalid
+            const char *p = line;
+            while (p < line + lineLength && isspace((unsigned char)*p)) p++;
+            if (p < line + lineLength) partial->invalid++;
+        }
+        line += lineLength + 1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_partial_merge
+// PURPOSE : Adds partial 'from' (the next part of the file) into 'into'.
+// -----------------------------------------------------------------------------
+static void stat_partial_merge(StatPartial *into, StatPartial *from)
+{
+    if (from->rows > 0) {
+        if (into->rows == 0 || from->lowest.mark < into->lowest.mark) into->lowest = from->lowest;
+        if (into->rows == 0 || from->highest.mark > into->highest.mark) into->highest = from->highest;
+    }
+    into->rows += from->rows;
+    into->invalid += from->invalid;
+    into->sum += from->sum;
+
+    tdigest_merge(&from->digest);
+    for (size_t i = 0; i < from->digest.count; i++) {
+        tdigest_add(&into->digest, from->digest.centroids[i].mean, from->digest.centroids[i].weight);
+    }
+
+    for (size_t i = 0; i < HLL_REGISTERS; i++) {
+        if (from->hll[i] > into->hll[i]) into->hll[i] = from->hll[i];
+    }
+    for (int row = 0; row < CMS_DEPTH; row++) {
+        for (int column = 0; column < CMS_WIDTH; column++) {
+            into->cms[row][column] += from->cms[row][column];
+        }
+    }
+
+    //Candidates of both, re-rated with the merged counters
+    for (int i = 0; i < into->topCount; i++) {
+        into->top[i].estimate = stat_cms_estimate(into->cms, into->top[i].hash);
+    }
+    for (int i = 0; i < from->topCount; i++) {
+        stat_offer_candidate(into, from->top[i].hash, stat_cms_estimate(into->cms, from->top[i].hash),
+                             from->top[i].programme);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: hll_estimate
+// PURPOSE : HyperLogLog cardinality, with linear counting for small sets.
+// -----------------------------------------------------------------------------
+static double hll_estimate(const uint8_t *registers)
+{
+    double m = HLL_REGISTERS;
+    double harmonic = 0.0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < HLL_REGISTERS; i++) {
+        harmonic += 1.0 / (double)(1ull << registers[i]);
+        zeros += registers[i] == 0;
+    }
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / harmonic;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * stat_log(m / (double)zeros);
+    }
+    return estimate;
+}
+
+// -----------------------------------------------------------------------------
+// COMPARATOR: compare_candidate_desc
+// -----------------------------------------------------------------------------
+static int compare_candidate_desc(const void *a, const void *b)
+{
+    uint64_t x = ((const StatCandidate *)a)->estimate, y = ((const StatCandidate *)b)->estimate;
+    if (x != y) return x < y ? 1 : -1;
+    return collate_compare(((const StatCandidate *)a)->programme, ((const StatCandidate *)b)->programme);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: stat_file
+// PURPOSE : STAT FILE <path>. Streams the file in parallel rounds and prints
+//           the exact and sketched statistics. The table is not touched.
+// -----------------------------------------------------------------------------
+void stat_file(const char *filePath)
+{
+    if (!has_txt_extension(filePath)) {
+        printf("CMS: File is not a txt file.\n");
+        return;
+    }
+    FILE *filePtr = fopen(filePath, "rb");
+    if (!filePtr) {
+        printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
+        return;
+    }
+
+    size_t bufferCap = (size_t)STAT_ROUND_CHUNKS * STAT_CHUNK_BYTES;
+    char *buffer = malloc(bufferCap);
+    StatPartial *partials = malloc((STAT_ROUND_CHUNKS + 1) * sizeof(StatPartial));
+    if (buffer == NULL || partials == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        free(buffer);
+        free(partials);
+        fclose(filePtr);
+        return;
+    }
+    StatPartial *total = &partials[STAT_ROUND_CHUNKS];
+    memset(total, 0, sizeof(*total));
+
+    double started = now_seconds();
+    unsigned long long bytesRead = 0;
+    size_t used = 0;        //bytes in buffer, the tail may be a partial line
+    int headerLines = 5;    //still to skip
+    int skippingLong = 0;   //inside a line longer than the whole buffer
+    int atEnd = 0;
+
+    while (!atEnd || used > 0) {
+        if (!atEnd) {
+            size_t got = fread(buffer + used, 1, bufferCap - used, filePtr);
+            bytesRead += got;
+            used += got;
+            atEnd = used < bufferCap;
+        }
+
+        //Header lines, and the rest of an over-long line, are dropped
+        char *start = buffer;
+        char *end = buffer + used;
+        while ((headerLines > 0 || skippingLong) && start < end) {
+            char *newline = memchr(start, '\n', (size_t)(end - start));
+            if (newline == NULL) {
+                start = end;
+                break;
+            }
+            start = newline + 1;
+            if (skippingLong) skippingLong = 0;
+            else headerLines--;
+        }
+
+        //Complete lines end at the last '\n' (or at the end of the file)
+        char *complete = end;
+        if (!atEnd) {
+            while (complete > start && complete[-1] != '\n') complete--;
+            if (complete == start && (size_t)(end - start) == bufferCap) {
+                total->invalid++; //one line fills the buffer: skip it
+                skippingLong = 1;
+                used = 0;
+                continue;
+            }
+        }
+
+        //Cut into chunks at line ends, parse them in parallel, merge in order
+        size_t chunks = 0;
+        char *p = start;
+        while (p < complete && chunks < STAT_ROUND_CHUNKS) {
+            char *cut = chunks == STAT_ROUND_CHUNKS - 1 || (size_t)(complete - p) <= STAT_CHUNK_BYTES
+                      ? complete : p + STAT_CHUNK_BYTES;
+            while (cut < complete && cut[-1] != '\n') cut++;
+            partials[chunks].text = p;
+            partials[chunks].length = (size_t)(cut - p);
+            chunks++;
+            p = cut;
+        }
+        pool_run(chunks, stat_chunk_task, partials);
+        for (size_t i = 0; i < chunks; i++) {
+            stat_partial_merge(total, &partials[i]);
+        }
+
+        //Keep the partial last line for the next round
+        used = (size_t)(end - complete);
+        memmove(buffer, complete, used);
+        if (atEnd) used = 0;
+    }
+    int readError = ferror(filePtr);
+    fclose(filePtr);
+    free(buffer);
+
+    double seconds = now_seconds() - started;
+    if (readError) {
+        printf(RED "CMS Error: Failed reading \"%s\".\n" RESET, filePath);
+    }
+
+    printf(CYAN "===== STAT FILE %s =====\n" RESET, filePath);
+    printf("Rows           : %llu\n", (unsigned long long)total->rows);
+    if (total->invalid) printf(YELLOW "Invalid lines  : %llu (skipped)\n" RESET, (unsigned long long)total->invalid);
+    if (total->rows > 0) {
+        printf("Sum of marks   : %.1f\n", total->sum);
+        printf("Average mark   :");
+        printf(YELLOW " % .2f\n" RESET, total->sum / (double)total->rows);
+        printf("Highest mark   : ");
+        printf(GREEN "% .1f (%s)\n" RESET, total->highest.mark, total->highest.name);
+        printf("Lowest mark    :");
+        printf(RED " % .1f (%s)\n" RESET, total->lowest.mark, total->lowest.name);
+
+        static const double quantiles[] = {0.01, 0.10, 0.25, 0.50, 0.75, 0.90, 0.99};
+        printf("Mark quantiles :");
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+            printf(" p%02.0f %.1f", quantiles[i] * 100.0,
+                   tdigest_quantile(&total->digest, quantiles[i], total->lowest.mark, total->highest.mark));
+        }
+        printf("   (t-digest, %zu centroids)\n", total->digest.count);
+
+        printf("Programmes     : ~%.0f distinct (HyperLogLog, +/- %.2f%%)\n",
+               hll_estimate(total->hll), HLL_ERROR_PERCENT);
+
+        qsort(total->top, (size_t)total->topCount, sizeof(StatCandidate), compare_candidate_desc);
+        int shown = total->topCount < STAT_TOP_SHOW ? total->topCount : STAT_TOP_SHOW;
+        printf("Top programmes : (count-min estimates, each may be up to %llu too high)\n",
+               (unsigned long long)(2.72 * (double)total->rows / CMS_WIDTH));
+        for (int i = 0; i < shown; i++) {
+            printf("  %-30s %llu\n", total->top[i].programme, (unsigned long long)total->top[i].estimate);
+        }
+    }
+    printf("Memory         : %.2f MB (read buffer + %d partial sketches)\n",
+           (bufferCap + (STAT_ROUND_CHUNKS + 1) * sizeof(StatPartial)) / (1024.0 * 1024.0), STAT_ROUND_CHUNKS + 1);
+    printf("Time           : %.3f s (%.1f MB/s, %d thread(s))\n", seconds,
+           seconds > 0 ? bytesRead / (1024.0 * 1024.0) / seconds : 0.0, pool_size());
+    free(partials);
+}
+
+
+/* ---------------------------------------------------- */
+/* Background Tasks (OPEN <file> & / SAVE &)            */
+/* ---------------------------------------------------- */
+//
+// A trailing '&' runs OPEN or SAVE on a worker thread so the REPL stays
+// usable. A background OPEN fills its own store; the live table is only
+// replaced (on the REPL thread) once the load completes, so CANCEL or
+// Ctrl-C leaves the previous table untouched. A background SAVE writes
+// FILENAME.tmp and renames it over FILENAME only when every row is written;
+// while it runs the table must not change, so only JOBS / WAIT / CANCEL /
+// HELP / EXIT are accepted.
+
+typedef enum { TASK_NONE, TASK_OPEN, TASK_SAVE } TaskKind;
+
+static struct {
+    TaskKind kind;              //TASK_NONE -> no task
+    int lockReady;
+    char path[512];             //OPEN: file being loaded
+    StudentStore staging;       //OPEN: rows loaded so far
+    double started;
+    thread_handle thread;
+    TaskProgress progress;
+} task;
+
+static volatile sig_atomic_t task_running = 0; //read by the Ctrl-C handler
+
+// -----------------------------------------------------------------------------
+// FUNCTION: handle_interrupt
+// PURPOSE : Ctrl-C cancels the background task instead of killing the
+//           program; with no task running it behaves as before.
+// -----------------------------------------------------------------------------
+static void handle_interrupt(int signalNumber)
+{
+    if (task_running) {
+        interrupt_requested = 1;
+        signal(signalNumber, handle_interrupt); //some platforms reset the handler
+        return;
+    }
+    signal(signalNumber, SIG_DFL);
+    raise(signalNumber);
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: task_worker
+// PURPOSE : Worker thread body for the current task.
+// -----------------------------------------------------------------------------
+#ifdef _WIN32
+static DWORD WINAPI task_worker(LPVOID argument)
+#else
+static void *task_worker(void *argument)
+#endif
+{
+    (void)argument;
+    int ok = 0;
+    TRACE_THREAD_NAME("background task");
+
+    if (task.kind == TASK_OPEN) {
+        FILE *filePtr = fopen(task.path, "r");
+        if (filePtr != NULL) {
+            ok = load_rows(&task.staging, filePtr, &task.progress);
+            fclose(filePtr);
+        }
+    }
+    else if (task.kind == TASK_SAVE) {
+        FILE *filePtr = fopen(FILENAME ".tmp", "w");
+        if (filePtr != NULL) {
+            TRACE_BEGIN(span, "save");
+            ok = write_table_file(filePtr, &task.progress);
+            if (fclose(filePtr) != 0) ok = 0;
+            if (ok) {
+                remove(FILENAME); //rename() does not replace files on Windows
+                ok = rename(FILENAME ".tmp", FILENAME) == 0;
+            }
+            if (!ok) remove(FILENAME ".tmp");
+            TRACE_END(span);
+        }
+    }
+    TRACE_THREAD_EXIT();
+
+    thread_mutex_lock(&task.progress.lock);
+    if (ok) {
+        task.progress.rowsDone = task.kind == TASK_OPEN ? task.staging.size : task.progress.rowsTotal;
+        task.progress.bytesDone = task.progress.bytesTotal;
+    }
+    task.progress.finished = 1;
+    task.progress.ok = ok;
+    thread_mutex_unlock(&task.progress.lock);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: task_start
+// PURPOSE : Starts an OPEN (path) or SAVE task on a worker thread.
+// RETURNS : 1 -> started, 0 -> not started (message printed)
+// -----------------------------------------------------------------------------
+static int task_start(TaskKind kind, const char *path)
+{
+    if (task.kind != TASK_NONE) {
+        printf(YELLOW "CMS: A background task is already running (JOBS, WAIT or CANCEL).\n" RESET);
         return 0;
+    }
+    if (!task.lockReady) {
+        thread_mutex_init(&task.progress.lock);
+        task.lockReady = 1;
+    }
 
-    trim_newline(userBuffer);
-    strncpy(stringDestination, userBuffer, cap - 1);
-    stringDestination[cap - 1] = '\0';
+    //Field by field: the lock is live and must not be copied or overwritten
+    task.progress.bytesDone = task.progress.bytesTotal = 0;
+    task.progress.rowsDone = task.progress.rowsTotal = 0;
+    task.progress.skippedLines = 0;
+    task.progress.cancelRequested = 0;
+    task.progress.finished = task.progress.ok = 0;
+    memset(&task.staging, 0, sizeof(task.staging));
+    task.staging.freeHead = NO_HANDLE;
+    task.kind = kind;
+    snprintf(task.path, sizeof(task.path), "%s", path ? path : FILENAME);
+
+    if (kind == TASK_OPEN) {
+        FILE *probe = fopen(task.path, "rb");
+        if (probe) {
+            fseek(probe, 0, SEEK_END);
+            task.progress.bytesTotal = ftell(probe);
+            fclose(probe);
+        }
+    } else {
+        task.progress.rowsTotal = db.size;
+    }
+
+    interrupt_requested = 0;
+    task_running = 1;
+    task.started = now_seconds();
+#ifdef _WIN32
+    task.thread = CreateThread(NULL, 0, task_worker, NULL, 0, NULL);
+    int started = task.thread != NULL;
+#else
+    int started = pthread_create(&task.thread, NULL, task_worker, NULL) == 0;
+#endif
+    if (!started) {
+        task_running = 0;
+        task.kind = TASK_NONE;
+        printf(RED "CMS Error: Could not start a background task.\n" RESET);
+        return 0;
+    }
 
+    printf("CMS: %s running in the background (JOBS for progress, CANCEL to stop).\n",
+           kind == TASK_OPEN ? "OPEN" : "SAVE");
     return 1;
 }
 
+// -----------------------------------------------------------------------------
+// FUNCTION: task_poll
+// PURPOSE : Called by the REPL between commands. When the worker has
+//           finished, joins it and applies the result: installs the loaded
+//           table (unless a transaction is open; then it waits for COMMIT
+//           or ROLLBACK) or reports the save.
+// RETURNS : 1 -> a task is still pending, 0 -> no task
+// -----------------------------------------------------------------------------
+static int task_poll(void)
+{
+    if (task.kind == TASK_NONE) return 0;
+
+    thread_mutex_lock(&task.progress.lock);
+    int finished = task.progress.finished;
+    int ok = task.progress.ok;
+    int cancelled = task.progress.cancelRequested;
+    thread_mutex_unlock(&task.progress.lock);
+
+    if (!finished) return 1;
+    if (task.kind == TASK_OPEN && ok && txn.active) return 1; //install after the transaction
+
+    if (task_running) {
+#ifdef _WIN32
+        WaitForSingleObject(task.thread, INFINITE);
+        CloseHandle(task.thread);
+#else
+        pthread_join(task.thread, NULL);
+#endif
+        task_running = 0;
+    }
+    double seconds = now_seconds() - task.started;
+
+    if (task.kind == TASK_OPEN) {
+        if (ok) {
+            //Swap in the new table; the old one is freed only now
+            lazy_close();
+            store_clear(&db);
+            db = task.staging;
+            table_rebuild_indexes();
+
+            if (task.progress.skippedLines > 0) {
+                printf(YELLOW "CMS Warning: Skipped %zu invalid line(s) in \"%s\".\n" RESET,
+                       task.progress.skippedLines, task.path);
+            }
+            printf("CMS: \"%s\" opened (%zu records) in the background, %.2f s\n", task.path, db.size, seconds);
+            audit_log("OPEN %s (%zu records)", task.path, db.size);
+            snapshot_publish();
+            undo_set(OP_NONE); // Reset Undo history
+            db_opened = 1;
+        } else {
+            store_clear(&task.staging);
+            printf(YELLOW "CMS: Background OPEN of \"%s\" %s; the current table is unchanged.\n" RESET,
+                   task.path, cancelled ? "cancelled" : "failed");
+        }
+    }
+    else {
+        if (ok) {
+            printf("CMS: Saved to \"%s\" in the background, %.2f s\n", FILENAME, seconds);
+            table_unsaved = 0;
+            audit_log("SAVE %s", FILENAME);
+        } else {
+            printf(YELLOW "CMS: Background SAVE %s; \"%s\" is unchanged.\n" RESET,
+                   cancelled ? "cancelled" : "failed", FILENAME);
+        }
+    }
+
+    task.kind = TASK_NONE;
+    return 0;
+}
 
 // -----------------------------------------------------------------------------
-// FUNCTION: prompt_edit_mark
-// PURPOSE : Allows the user to update a student's mark, with validation.
-// USE     : Press ENTER -> keep old mark
-//           Otherwise, must enter a valid number between 0 and 100.
-// RETURNS : 1 -> marks changed
-//           0 -> kept old marks
+// FUNCTION: task_print_progress
+// PURPOSE : One-line progress: rows, bytes/percentage, elapsed time and ETA.
 // -----------------------------------------------------------------------------
-static int prompt_edit_mark(float *outputMark, float currentMark)
+static void task_print_progress(const char *lineEnd)
 {
-    char userBuffer[128];
+    thread_mutex_lock(&task.progress.lock);
+    long long bytesDone = task.progress.bytesDone, bytesTotal = task.progress.bytesTotal;
+    size_t rowsDone = task.progress.rowsDone, rowsTotal = task.progress.rowsTotal;
+    int finished = task.progress.finished;
+    int stopped = task.progress.cancelRequested || (finished && !task.progress.ok);
+    thread_mutex_unlock(&task.progress.lock);
+
+    double elapsed = now_seconds() - task.started;
+    double fraction = 0.0;
+    if (task.kind == TASK_OPEN && bytesTotal > 0) {
+        fraction = (double)bytesDone / (double)bytesTotal;
+    } else if (task.kind == TASK_SAVE && rowsTotal > 0) {
+        fraction = (double)rowsDone / (double)rowsTotal;
+    }
 
-    printf("Mark (Enter to keep %.1f): ", currentMark);
+    const double MB = 1024.0 * 1024.0;
+    if (task.kind == TASK_OPEN) {
+        printf("Background OPEN %s: %zu rows, %.1f / %.1f MB (%.0f%%)", task.path, rowsDone,
+               bytesDone / MB, bytesTotal / MB, fraction * 100.0);
+    } else {
+        printf("Background SAVE %s: %zu / %zu rows (%.0f%%)", FILENAME, rowsDone,
+               rowsTotal, fraction * 100.0);
+    }
+    printf(", %.1f s elapsed", elapsed);
+    if (stopped) {
+        printf(finished ? ", stopped" : ", stopping");
+    } else if (finished) {
+        printf(", done");
+    } else if (fraction > 0.0) {
+        printf(", ETA %.1f s", elapsed * (1.0 - fraction) / fraction);
+    }
+    printf("%s", lineEnd);
+    fflush(stdout);
+}
 
-    if (!fgets(userBuffer, sizeof(userBuffer), stdin) || userBuffer[0] == '\n') //User presses enter -> no change
-    {
-        return 0;
+// -----------------------------------------------------------------------------
+// FUNCTION: task_wait
+// PURPOSE : Blocks until the task ends, redrawing its progress line.
+// -----------------------------------------------------------------------------
+static void task_wait(void)
+{
+    while (task.kind != TASK_NONE) {
+        thread_mutex_lock(&task.progress.lock);
+        int finished = task.progress.finished;
+        thread_mutex_unlock(&task.progress.lock);
+
+        task_print_progress(finished ? "\n" : "\r");
+        if (finished) break;
+        sleep_seconds(0.25);
     }
-    trim_newline(userBuffer);
+    if (task.kind != TASK_NONE && task_poll() && txn.active) {
+        printf("CMS: The loaded table replaces the current one after COMMIT or ROLLBACK.\n");
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: task_cancel
+// PURPOSE : Asks the worker to stop and waits until it has (the worker
+//           checks every TASK_REPORT_ROWS rows).
+// -----------------------------------------------------------------------------
+static void task_cancel(void)
+{
+    if (task.kind == TASK_NONE) {
+        printf("CMS: No background task running.\n");
+        return;
+    }
+    thread_mutex_lock(&task.progress.lock);
+    task.progress.cancelRequested = 1;
+    if (task.progress.finished) {
+        task.progress.ok = 0; //a finished OPEN waiting for the transaction is discarded too
+    }
+    thread_mutex_unlock(&task.progress.lock);
+
+    task_wait();
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: task_finish_for_exit
+// PURPOSE : Before the program exits: a background OPEN is cancelled, a
+//           background SAVE is allowed to finish.
+// -----------------------------------------------------------------------------
+static void task_finish_for_exit(void)
+{
+    if (task.kind == TASK_OPEN) {
+        task_cancel();
+    }
+    else if (task.kind == TASK_SAVE) {
+        printf("CMS: Waiting for the background SAVE to finish...\n");
+        task_wait();
+    }
+}
+
+
+/* ---------------------------------------------------- */
+/* Read Replica (--follow)                              */
+/* ---------------------------------------------------- */
+//
+// Started with --follow, the CMS is a read-only copy of the CMS that owns
+// the audit log in the same directory (the primary). It loads the archive
+// named by the primary's last SNAPSHOT entry (see snapshot_publish), applies
+// the log entries written after it, and then tails the log: a worker thread sleeps
+// on inotify (Linux; elsewhere it checks every FOLLOW_POLL_MS) and applies
+// each new INSERT / UPDATE / DELETE / COMMIT / MERGE / UNDO entry to the
+// table through the same table_* calls a local change uses, so every index
+// stays current. Files are only read: the replica never writes the log or
+// its index, and commands that would change the table are refused.
+//
+// The primary publishes snapshots only after REPLICATE ON. The text database
+// is never read. An OPEN on the primary empties the replica's table until
+// the SNAPSHOT the primary writes right after it, which is then loaded the
+// same way as at start-up.
+
+#define FOLLOW_POLL_MS 500 //longest wait between checks of the log
+
+static struct {
+    int active;              //1 -> running as a --follow replica
+    int stop;                //EXIT: worker thread should finish
+    thread_mutex lock;       //held while a command runs or log entries are applied
+    thread_handle thread;
+    int watching;            //1 -> woken by inotify, 0 -> polling
+
+    uint32_t segment;        //log segment being read: LOGFILE.<n>, or LOGFILE until rotated
+    long long offset;        //next byte to read in it
+    unsigned long long inode; //LOGFILE's inode when last read (0 -> unknown)
+    char *buffer;
+    size_t bufferCap;
+
+    BatchChange *unit;       //last COMMIT / MERGE batch, then any changes right after it
+    size_t unitCount, unitCap;
+    int inBatch;             //1 -> change lines extend the unit instead of starting a new one
+    int waiting;             //1 -> no snapshot of the primary's table yet: changes are skipped
+
+    size_t applied;          //change entries applied
+    size_t reloads;          //snapshots loaded after start-up (OPEN on the primary)
+    int64_t lastEntry;       //timestamp of the last entry applied
+    long lastDelay, maxDelay; //seconds from the primary's write to the replica's apply
+    double lastCheck;        //now_seconds() of the last look at the log
+} follow;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_write
+// PURPOSE : Makes the table hold 'after' for an ID (NULL -> no record).
+// RETURNS : 1 -> the record existed (*before = its old value), 0 -> it did not
+// -----------------------------------------------------------------------------
+static int follow_write(int id, const Student *after, Student *before)
+{
+    int pos = find_index_by_id(id);
+    if (pos >= 0) *before = *row_at((size_t)pos);
+
+    if (after == NULL) {
+        if (pos >= 0) table_remove_at((size_t)pos);
+    }
+    else if (pos >= 0) {
+        table_replace_at((size_t)pos, after);
+    }
+    else {
+        table_append(after);
+    }
+    return pos >= 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_change
+// PURPOSE : Applies one logged change and remembers its old value for UNDO.
+// -----------------------------------------------------------------------------
+static void follow_change(int id, const Student *after)
+{
+    if (follow.unitCount == follow.unitCap) {
+        size_t newCap = follow.unitCap ? follow.unitCap * 2 : 16;
+        BatchChange *grown = realloc(follow.unit, newCap * sizeof(BatchChange));
+        if (grown == NULL) { //UNDO of this change cannot be followed: forget the unit
+            follow.unitCount = 0;
+            Student ignored;
+            follow_write(id, after, &ignored);
+            return;
+        }
+        follow.unit = grown;
+        follow.unitCap = newCap;
+    }
+
+    BatchChange *change = &follow.unit[follow.unitCount++];
+    memset(change, 0, sizeof(*change));
+    change->id = id;
+    change->hadBefore = follow_write(id, after, &change->before);
+    db_opened = 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_clear
+// PURPOSE : Primary replaced its table (OPEN): nothing is served until its
+//           snapshot arrives.
+// -----------------------------------------------------------------------------
+static void follow_clear(void)
+{
+    table_bulk_end(); //deferred index edits of the entries before this one
+    lazy_close();
+    store_clear(&db);
+    table_rebuild_indexes();
+    db_opened = 0;
+    follow.waiting = 1;
+    follow.unitCount = 0;
+    follow.inBatch = 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_reload
+// PURPOSE : Loads the primary's snapshot archive named by a SNAPSHOT entry.
+//           A snapshot already deleted was replaced by a newer one, whose
+//           entry comes later in the log: the replica waits for it.
+// -----------------------------------------------------------------------------
+static void follow_reload(const char *path)
+{
+    follow_clear();
+    FILE *probe = fopen(path, "rb");
+    if (probe == NULL) return;
+    fclose(probe);
+
+    if (open_archive(path)) { //never the text database
+        follow.waiting = 0;
+        follow.reloads++;
+    } else {
+        printf(YELLOW "CMS Warning: Replica could not load the snapshot \"%s\"; waiting for the next one.\n" RESET, path);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_snapshot_path
+// PURPOSE : Reads the file a "SNAPSHOT <path> (<n> records)" entry names.
+// RETURNS : 1 -> *path set, 0 -> not such an entry
+// -----------------------------------------------------------------------------
+static int follow_snapshot_path(const char *message, size_t length, char *path, size_t cap)
+{
+    const char *start = message + 9, *end = message + length;
+    if (length <= 9 || strncmp(message, "SNAPSHOT ", 9) != 0) return 0;
+    while (end > start && *--end != '(') {}
+    if (end == start) return 0;
+    end--; //the space before "("
+    if (end <= start || (size_t)(end - start) >= cap) return 0;
+    memcpy(path, start, (size_t)(end - start));
+    path[end - start] = '\0';
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_apply
+// PURPOSE : Applies one log message of the primary to the replica's table.
+// -----------------------------------------------------------------------------
+static void follow_apply(int64_t timestamp, const char *message, size_t length)
+{
+    char text[1024];
+    if (length >= sizeof(text)) return; //audit entries are shorter
+    memcpy(text, message, length);
+    text[length] = '\0';
+
+    int isInsert = strncmp(text, "INSERT ", 7) == 0;
+    int isUpdate = strncmp(text, "UPDATE ", 7) == 0;
+    int isDelete = strncmp(text, "DELETE ", 7) == 0;
+
+    //Batch headers: the change lines that follow are one UNDO step
+    if (strncmp(text, "COMMIT (", 8) == 0 || strncmp(text, "MERGE ", 6) == 0 ||
+        strncmp(text, "UPDATE SET ", 11) == 0 || strncmp(text, "DELETE WHERE ", 13) == 0) {
+        follow.unitCount = 0;
+        follow.inBatch = 1;
+        return;
+    }
+
+    if (!isInsert && !isUpdate && !isDelete) {
+        char path[512];
+        follow.inBatch = 0;
+        if (follow_snapshot_path(text, length, path, sizeof(path))) {
+            follow_reload(path);
+        }
+        else if (strncmp(text, "OPEN ", 5) == 0 || strncmp(text, "REPLAY ", 7) == 0) {
+            follow_clear(); //the table was replaced: its SNAPSHOT follows
+        }
+        else if (strncmp(text, "UNDO ", 5) == 0 && strstr(text, " failed") == NULL) {
+            //UNDO INSERT / DELETE / UPDATE (ID ...) reverts the last change only,
+            //any other UNDO the batch (as version_apply tells them apart)
+            int single = strncmp(text, "UNDO INSERT (", 13) == 0 || strncmp(text, "UNDO DELETE (", 13) == 0 ||
+                         strncmp(text, "UNDO UPDATE (", 13) == 0;
+            size_t first = single && follow.unitCount > 0 ? follow.unitCount - 1 : 0;
+            for (size_t i = follow.unitCount; i-- > first;) { //newest first
+                const BatchChange *change = &follow.unit[i];
+                Student ignored;
+                follow_write(change->id, change->hadBefore ? &change->before : NULL, &ignored);
+            }
+            follow.unitCount = 0;
+        }
+        return;
+    }
+    if (follow.waiting) return; //the table these changes apply to has not arrived yet
+
+    int id = log_message_student_id(text, length);
+    if (id < 0) return;
+
+    //Values: INSERT id "name" "programme" mark
+    //        UPDATE id | "n1" -> "n2" | "p1" -> "p2" | m1 -> m2
+    const char *fields[4];
+    size_t fieldLengths[4];
+    int found = log_quoted_fields(text, length, fields, fieldLengths, 4);
+    Student after;
+    memset(&after, 0, sizeof(after));
+    after.id = id;
+    if (isInsert && found == 2) {
+        version_copy_field(after.name, fields[0], fieldLengths[0]);
+        version_copy_field(after.programme, fields[1], fieldLengths[1]);
+        after.mark = strtof(fields[1] + fieldLengths[1] + 1, NULL);
+    }
+    else if (isUpdate && found == 4) {
+        const char *arrow = strstr(fields[3] + fieldLengths[3] + 1, "->");
+        if (arrow == NULL) return;
+        version_copy_field(after.name, fields[1], fieldLengths[1]);
+        version_copy_field(after.programme, fields[3], fieldLengths[3]);
+        after.mark = strtof(arrow + 2, NULL);
+    }
+    else if (!isDelete) {
+        return; //older entry with only the ID: nothing to apply
+    }
+
+    if (!follow.inBatch) follow.unitCount = 0; //a change of its own
+    follow_change(id, isDelete ? NULL : &after);
 
-    //Convert string input to number
-    char *endPtr = NULL;
-    double markValue = strtod(userBuffer, &endPtr);
+    long delay = (long)(time(NULL) - (time_t)timestamp);
+    follow.lastDelay = delay > 0 ? delay : 0;
+    if (follow.lastDelay > follow.maxDelay) follow.maxDelay = follow.lastDelay;
+    follow.lastEntry = timestamp;
+    follow.applied++;
+}
 
-    //Validate input:
-    //Check endPtr != '\0' means non-numeric, endPtr == userBuffer means no conversion
-    //Ensures marks are between 0 and 100
-    if (endPtr == userBuffer || *endPtr != '\0' || markValue < 0.0 || markValue > 100.0) {
-        printf(RED "Invalid mark. Please enter a number from 0 to 100.\n" RESET);
-        return prompt_edit_mark(outputMark, currentMark);
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_read
+// PURPOSE : Applies the complete lines of a log segment from follow.offset
+//           on; a line still being written is left for the next read.
+// RETURNS : size of the segment
+// -----------------------------------------------------------------------------
+static long long follow_read(FILE *segmentFile)
+{
+    fseek(segmentFile, 0, SEEK_END);
+    long long size = ftell(segmentFile);
+    if (size <= follow.offset) return size;
+
+    size_t length = (size_t)(size - follow.offset);
+    if (length > follow.bufferCap) {
+        char *grown = realloc(follow.buffer, length);
+        if (grown == NULL) return size; //tried again on the next wake-up
+        follow.buffer = grown;
+        follow.bufferCap = length;
     }
-    *outputMark = (float)markValue;
+    fseek(segmentFile, follow.offset, SEEK_SET);
+    length = fread(follow.buffer, 1, length, segmentFile);
 
-    return 1;
+    size_t lineCount = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (follow.buffer[i] == '\n') lineCount++;
+    }
+    table_bulk_begin(lineCount);
+
+    const char *line = follow.buffer;
+    const char *end = follow.buffer + length;
+    const char *newline;
+    while (line < end && (newline = memchr(line, '\n', (size_t)(end - line))) != NULL) {
+        const char *message;
+        size_t messageLength;
+        time_t timestamp;
+        if (log_line_parse(line, (size_t)(newline - line), &timestamp, &message, &messageLength)) {
+            follow_apply((int64_t)timestamp, message, messageLength);
+        }
+        line = newline + 1;
+    }
+    table_bulk_end();
+
+    if (line > follow.buffer) version_store_free(); //AS OF rebuilds from the log next time
+    follow.offset += (long long)(line - follow.buffer);
+    return size;
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: is_all_digits
-// PURPOSE : Checks if a string consists entirely of digit characters.
-// RETURNS : 1 → all characters are digits
-//           0 → contains non-digit characters or is empty
+// FUNCTION: follow_poll
+// PURPOSE : Catches up with the primary's log: finishes segments rotated
+//           away meanwhile, then reads the active one.
 // -----------------------------------------------------------------------------
-static int is_all_digits(const char *s)
+static void follow_poll(void)
 {
-    if (!s || !*s) return 0;
+    follow.lastCheck = now_seconds();
+    for (int tries = 0; tries < 1000; tries++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s.%u", LOGFILE, (unsigned)follow.segment);
+        FILE *segmentFile = fopen(path, "rb");
+        if (segmentFile != NULL) { //rotated: read what is left, then go on to the next one
+            follow_read(segmentFile);
+            fclose(segmentFile);
+            follow.segment++;
+            follow.offset = 0;
+            follow.inode = 0;
+            continue;
+        }
 
-    for (const char *p = s; *p; ++p) {
-        if (!isdigit((unsigned char)*p)) {
-            return 0;
+        segmentFile = fopen(LOGFILE, "rb");
+        if (segmentFile == NULL) return; //no log yet
+
+        //A different LOGFILE than last time, or a shorter one: rotated since
+        //the check above (look again), or replaced by hand (start it over)
+        unsigned long long inode = 0;
+#ifndef _WIN32
+        struct stat info;
+        if (fstat(fileno(segmentFile), &info) == 0) inode = (unsigned long long)info.st_ino;
+#endif
+        fseek(segmentFile, 0, SEEK_END);
+        int replaced = (follow.inode != 0 && inode != follow.inode) || ftell(segmentFile) < follow.offset;
+        if (replaced) {
+            fclose(segmentFile);
+            segmentFile = fopen(path, "rb");
+            if (segmentFile != NULL) {
+                fclose(segmentFile);
+                continue;
+            }
+            follow.offset = 0;
+            follow.inode = 0;
+            continue;
         }
+
+        follow_read(segmentFile);
+        fclose(segmentFile);
+        follow.inode = inode;
+        if (log_state.ready) log_state.activeSegment = follow.segment; //AS OF reads the right files
+        return;
     }
-    return 1;
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: parse_exact_id_arg
-// PURPOSE : For DELETE / UPDATE where we require an exact 7-digit ID.
-//           - Must be all digits
-//           - Must be length 7
-// RETURNS : 1 on success, 0 on invalid input
+// FUNCTION: follow_behind
+// RETURNS : bytes of the primary's log not applied yet
 // -----------------------------------------------------------------------------
-static int parse_exact_id_arg(const char *arg, int *out_id)
+static long long follow_behind(void)
 {
-    if (!arg || !*arg) {
-        printf("Enter a valid 7-digit ID.\n");
-        return 0;
+    long long behind = 0;
+    for (uint32_t segment = follow.segment; ; segment++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s.%u", LOGFILE, (unsigned)segment);
+        FILE *segmentFile = fopen(path, "rb");
+        int rotated = segmentFile != NULL;
+        if (!rotated) segmentFile = fopen(LOGFILE, "rb");
+        if (segmentFile == NULL) break;
+        fseek(segmentFile, 0, SEEK_END);
+        long long size = ftell(segmentFile);
+        fclose(segmentFile);
+
+        long long from = segment == follow.segment ? follow.offset : 0;
+        if (size > from) behind += size - from;
+        if (!rotated) break;
     }
+    return behind;
+}
 
-    // Check all digits
-    const char *p = arg;
-    int len = 0;
-    while (*p) {
-        if (!isdigit((unsigned char)*p)) {
-            printf(RED "Not a valid ID.\n" RESET);
-            return 0;
-        }
-        len++;
-        p++;
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_worker
+// PURPOSE : Worker thread: waits for the log to change, then applies the
+//           new entries (holding follow.lock, so never during a command).
+// -----------------------------------------------------------------------------
+#ifdef _WIN32
+static DWORD WINAPI follow_worker(LPVOID argument)
+#else
+static void *follow_worker(void *argument)
+#endif
+{
+    (void)argument;
+    TRACE_THREAD_NAME("replica follower");
+#ifdef __linux__
+    //Watch the directory: LOGFILE is renamed away and created again on rotation
+    int watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch >= 0 && inotify_add_watch(watch, ".", IN_MODIFY | IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+        close(watch);
+        watch = -1;
     }
+    thread_mutex_lock(&follow.lock);
+    follow.watching = watch >= 0;
+    thread_mutex_unlock(&follow.lock);
+#endif
 
-    // Enforce exactly 7 digits
-    if (len != 7) {
-        printf("Enter a valid 7-digit ID.\n");
-        return 0;
+    while (1) {
+        thread_mutex_lock(&follow.lock);
+        int stop = follow.stop;
+        if (!stop) {
+            TRACE_BEGIN(span, "follow_poll");
+            follow_poll();
+            TRACE_END(span);
+        }
+        thread_mutex_unlock(&follow.lock);
+        if (stop) break;
+
+#ifdef __linux__
+        if (watch >= 0) {
+            struct pollfd ready = {watch, POLLIN, 0};
+            if (poll(&ready, 1, FOLLOW_POLL_MS) > 0) {
+                char events[4096];
+                while (read(watch, events, sizeof(events)) > 0) {} //one catch-up covers them all
+            }
+            continue;
+        }
+#endif
+        sleep_seconds(FOLLOW_POLL_MS / 1000.0);
     }
 
-    *out_id = atoi(arg);
-    return 1;
+#ifdef __linux__
+    if (watch >= 0) close(watch);
+#endif
+    TRACE_THREAD_EXIT();
+    return 0;
 }
 
-
 // -----------------------------------------------------------------------------
-// FUNCTION: confirm_delete_by_id
-// PURPOSE : Protects against accidental deletion by requiring user to type the exact ID to confirm
-//           Typing 'N' cancels the operation
-// RETURNS : 1 -> confirmed (user entered matching ID)
-//           0 -> cancelled / mismatch
+// FUNCTION: follow_start
+// PURPOSE : --follow: finds the primary's last SNAPSHOT in its log, loads
+//           that archive, applies the entries after it and starts the
+//           worker. Without a snapshot it follows from the end of the log
+//           and waits for the primary's next OPEN.
+// RETURNS : 1 -> following, 0 -> the worker could not be started
 // -----------------------------------------------------------------------------
-static int confirm_delete_by_id(int expectedId)
+static int follow_start(void)
 {
-    printf("Type the ID " BOLD "%d" RESET " to confirm delete (or 'N' to cancel): ", expectedId);
+    thread_mutex_init(&follow.lock);
+    follow.active = 1;
+    log_state.readOnly = 1; //the log belongs to the primary
 
-    char userBuffer[64];
-    if (!fgets(userBuffer, sizeof(userBuffer), stdin)) //check if userbuffer is null
-    {
-        return 0;
+    //The newest segment holding a SNAPSHOT entry has the starting point
+    uint32_t active = 1;
+    while (1) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s.%u", LOGFILE, (unsigned)active);
+        FILE *probe = fopen(path, "rb");
+        if (probe == NULL) break;
+        fclose(probe);
+        active++;
     }
-    trim_newline(userBuffer);
 
-    //Condition for cancelling operation
-    if (userBuffer[0] && (userBuffer[0] == 'n' || userBuffer[0] == 'N') && userBuffer[1] == '\0')
-    {
-        return 0;
+    char base[512] = "";
+    follow.segment = active;
+    follow.offset = 0;
+    for (uint32_t segment = active; segment >= 1 && base[0] == '\0'; segment--) {
+        char path[64];
+        if (segment == active) snprintf(path, sizeof(path), "%s", LOGFILE);
+        else snprintf(path, sizeof(path), "%s.%u", LOGFILE, (unsigned)segment);
+        FILE *segmentFile = fopen(path, "rb");
+        if (segmentFile == NULL) continue;
+
+        LineReader reader;
+        if (line_reader_init(&reader, segmentFile)) {
+            const char *line, *message;
+            size_t lineLength, messageLength;
+            long long lineOffset;
+            time_t timestamp;
+            while (line_reader_next(&reader, &line, &lineLength, &lineOffset)) {
+                if (log_line_parse(line, lineLength, &timestamp, &message, &messageLength) &&
+                    follow_snapshot_path(message, messageLength, base, sizeof(base))) {
+                    follow.segment = segment;
+                    follow.offset = lineOffset + (long long)lineLength + 1;
+                }
+                else if (segment == active && base[0] == '\0') {
+                    follow.offset = lineOffset + (long long)lineLength + 1; //no snapshot: from the end
+                }
+            }
+            line_reader_free(&reader);
+        }
+        fclose(segmentFile);
     }
 
-    //Convert string input to number
-    char *endPtr = NULL;
-    long inputID = strtol(userBuffer, &endPtr, 10);
+    if (base[0] != '\0') follow_reload(base);
+    else follow.waiting = 1;
+    follow.reloads = 0;
+    follow_poll();
+    printf("CMS: Following \"%s\" as a read-only replica (%zu entries applied). REPLICA shows the lag.\n",
+           LOGFILE, follow.applied);
+    if (follow.waiting) {
+        printf(YELLOW "CMS: The primary has not published a snapshot yet; the table fills once it runs REPLICATE ON.\n" RESET);
+    }
 
-    //Check endPtr != '\0' means non-numeric, endPtr == userBuffer means no conversion
-    if (endPtr == userBuffer || *endPtr != '\0')
-    {
+#ifdef _WIN32
+    follow.thread = CreateThread(NULL, 0, follow_worker, NULL, 0, NULL);
+    int started = follow.thread != NULL;
+#else
+    int started = pthread_create(&follow.thread, NULL, follow_worker, NULL) == 0;
+#endif
+    if (!started) {
+        follow.active = 0;
+        printf(RED "CMS Error: Could not start the replica thread.\n" RESET);
         return 0;
     }
+    return 1;
+}
 
-    //Returns TRUE if the number matches expected ID
-    return (inputID == expectedId);
+// -----------------------------------------------------------------------------
+// FUNCTION: follow_stop
+// PURPOSE : Stops the worker thread at EXIT.
+// -----------------------------------------------------------------------------
+static void follow_stop(void)
+{
+    if (!follow.active) return;
+    thread_mutex_lock(&follow.lock);
+    follow.stop = 1;
+    thread_mutex_unlock(&follow.lock);
+#ifdef _WIN32
+    WaitForSingleObject(follow.thread, INFINITE);
+    CloseHandle(follow.thread);
+#else
+    pthread_join(follow.thread, NULL);
+#endif
+    follow.active = 0;
+    free(follow.buffer);
+    free(follow.unit);
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: read_valid_id
-// PURPOSE : Prompts user to enter a valid 7-digit student ID.
-// RETURNS: positive ID on success, -1 on EOF
+// FUNCTION: follow_status
+// PURPOSE : REPLICA: where the replica is in the primary's log and how far
+//           behind it is.
 // -----------------------------------------------------------------------------
-static int read_valid_id(void)
+void follow_status(void)
 {
-    char buf[256];
+    if (!follow.active) {
+        printf("CMS: Not a replica. Start the CMS with --follow to follow another CMS in this directory.\n");
+        return;
+    }
 
-    while (1) {
-        printf("ID: ");
-        if (!fgets(buf, sizeof(buf), stdin)) {
-            // Input stream closed (EOF)
-            return -1;
-        }
+    long long behind = follow_behind();
+    printf(CYAN "===== Replica (--follow) =====\n" RESET);
+    printf("Log            : %s (segment %u, byte %lld)\n", LOGFILE, (unsigned)follow.segment, follow.offset);
+    if (follow.waiting) {
+        printf(YELLOW "Status         : waiting for the primary's snapshot (REPLICATE ON, then every OPEN)\n" RESET);
+    } else if (behind > 0) {
+        printf(YELLOW "Status         : %lld byte(s) behind\n" RESET, behind);
+    } else {
+        printf(GREEN "Status         : caught up\n" RESET);
+    }
+    printf("Entries applied: %zu\n", follow.applied);
+    if (follow.lastEntry != 0) {
+        time_t when = (time_t)follow.lastEntry;
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&when));
+        printf("Last entry     : %s (%ld s ago)\n", stamp, (long)(time(NULL) - when));
+        printf("Apply delay    : %ld s (max %ld s)\n", follow.lastDelay, follow.maxDelay);
+    }
+    printf("Last check     : %.1f s ago (%s)\n", now_seconds() - follow.lastCheck,
+           follow.watching ? "inotify" : "polling");
+    if (follow.reloads) printf("Reloads        : %zu (snapshots after an OPEN on the primary)\n", follow.reloads);
+}
 
-        trim_newline(buf);
+/* ---------------------------------------------------- */
+/* Command Layer                                        */
+/* ---------------------------------------------------- */
+//
+// A typed line is split on ';' (outside double quotes) into commands. Each
+// command is tokenized once into CmdArgs; the first token is looked up in a
+// perfect hash table of CommandDef entries and the handler gets the tokens.
+// PREPARE stores a command with ?/$n placeholders, already resolved to its
+// handler, and EXECUTE only binds the parameters and runs it.
 
-        // Skip leading spaces
-        char *p = buf;
-        while (*p && isspace((unsigned char)*p)) {
-            p++;
-        }
+#define CMD_MAX_TOKENS 32
+#define CMD_HASH_SLOTS 128 //power of two, comfortably more than the number of commands
 
-        // Empty input
-        if (*p == '\0') {
-            printf(RED "Invalid ID. Please enter an ID with 7 digits.\n" RESET);
-            continue;
-        }
+//Tokenized command
+typedef struct {
+    int count;                        //number of tokens, tokens[0] is the command word
+    const char *tokens[CMD_MAX_TOKENS]; //token text, quotes removed
+    const char *raw[CMD_MAX_TOKENS];  //where each token starts in 'text'
+    const char *text;                 //the whole command, trimmed
+} CmdArgs;
+
+//Command flags
+#define CMD_LAZY_OK  1u //works on a lazily opened table without loading every row
+#define CMD_NO_TXN   2u //replaces the table or its history: refused inside a transaction
+                          //and while a background task runs
+#define CMD_TASK_OK  4u //allowed while a background SAVE runs (does not touch the table)
+#define CMD_READ     8u //only reads the table: allowed on a --follow replica
 
-        // Check all characters are digits and length is exactly 7
-        int len = 0;
-        int allDigits = 1;
-        for (; p[len]; len++) {
-            if (!isdigit((unsigned char)p[len])) {
-                allDigits = 0;
-                break;
-            }
-        }
+typedef struct {
+    const char *name;
+    void (*run)(const CmdArgs *args);
+    unsigned flags;
+} CommandDef;
 
-        if (!allDigits || len != 7) {
-            printf(RED "Invalid ID. Please enter an ID with 7 digits.\n" RESET);
-            continue;
-        }
+static int cms_exit_requested = 0; //set by EXIT, stops the command loop
 
-        int id = atoi(p);
+// -----------------------------------------------------------------------------
+// FUNCTION: cmd_arg
+// RETURNS : token i, or "" if the command has fewer tokens
+// -----------------------------------------------------------------------------
+static const char *cmd_arg(const CmdArgs *args, int i)
+{
+    return i < args->count ? args->tokens[i] : "";
+}
 
-        // Check duplicate
-        if (query_exists(id)) {
-            printf(RED "Error: Student with ID %d already exists.\n" RESET, id);
-            continue;
-        }
+// -----------------------------------------------------------------------------
+// FUNCTION: cmd_rest
+// PURPOSE : Free-text argument from token i to the end of the command
+//           (e.g. a programme name with spaces). A single quoted token is
+//           returned without its quotes.
+// -----------------------------------------------------------------------------
+static const char *cmd_rest(const CmdArgs *args, int i)
+{
+    if (i >= args->count) return "";
+    if (i == args->count - 1) return args->tokens[i];
+    return args->raw[i];
+}
 
-        return id;
-    }
+// -----------------------------------------------------------------------------
+// FUNCTION: quote_next
+// PURPOSE : Quote tracking for scanners that must not look inside quoted
+//           text (';' between commands, PREPARE placeholders). 'quote' is
+//           the state before *p: 0 outside, '"' or '\'' inside. A doubled
+//           quote closes and reopens, so it stays inside. A single quote
+//           only opens at the start of a word: O'Neil is a plain name.
+// RETURNS : the state after *p
+// -----------------------------------------------------------------------------
+static char quote_next(char quote, const char *start, const char *p)
+{
+    if (quote) return *p == quote ? 0 : quote;
+    if (*p == '"') return '"';
+    if (*p == '\'' && (p == start || !isalnum((unsigned char)p[-1]))) return '\'';
+    return 0;
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: read_nonempty_field (Name / Programme)
-// PURPOSE: Prompts user to enter a non-empty string for the given label.
-// RETURNS: 1 on success, 0 on EOF
+// FUNCTION: cmd_tokenize
+// PURPOSE : Splits 'text' into tokens on spaces/tabs. "Double quoted" text is
+//           one token ("" inside it stands for one "). Token strings are written to 'storage' (at least
+//           strlen(text) + 1 bytes), so 'text' itself stays intact for cmd_rest.
+// RETURNS : number of tokens
 // -----------------------------------------------------------------------------
-static int read_nonempty_field(const char *label, char *out, size_t cap)
+static int cmd_tokenize(const char *text, char *storage, CmdArgs *args)
 {
-    char buf[256];
+    const char *p = text;
+    char *out = storage;
 
-    while (1) {
-        printf("%s: ", label);
-        if (!fgets(buf, sizeof(buf), stdin)) {
-            return 0;   // EOF
-        }
+    args->count = 0;
+    args->text = text;
 
-        // Check if the input line was longer than our buffer
-        size_t len_buf = strlen(buf);
-        if (len_buf > 0 && buf[len_buf - 1] != '\n') {
-            // Input too long, discard rest of line
-            discard_rest_of_line();
+    while (*p) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0' || args->count == CMD_MAX_TOKENS) break;
+
+        args->raw[args->count] = p;
+        args->tokens[args->count] = out;
+        args->count++;
+
+        while (*p && *p != ' ' && *p != '\t') {
+            if (*p == '"') { //quoted part: copy up to the closing quote
+                p++;
+                while (*p && !(p[0] == '"' && p[1] != '"')) {
+                    if (p[0] == '"') p++; //doubled quote
+                    *out++ = *p++;
+                }
+                if (*p == '"') p++;
+            }
+            else {
+                *out++ = *p++;
+            }
         }
+        *out++ = '\0';
+    }
+    return args->count;
+}
 
-        trim_newline(buf);
+// -----------------------------------------------------------------------------
+// FUNCTION: cmd_hash
+// PURPOSE : Case-insensitive FNV-1a over the command word, mixed with a seed.
+// -----------------------------------------------------------------------------
+static uint32_t cmd_hash(const char *word, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (; *word; word++) {
+        h ^= (uint32_t)toupper((unsigned char)*word);
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
 
-        // Skip leading spaces
-        char *p = buf;
-        while (*p && isspace((unsigned char)*p)) {
-            p++;
-        }
 
-        if (*p == '\0') {
-            printf(RED "Invalid %s. Please enter a valid %s.\n" RESET, label, label);
-            continue;
-        }
+/* ---------------------------------------------------- */
+/* Command Handlers                                     */
+/* ---------------------------------------------------- */
 
-        // If input is longer than our destination buffer, truncate and warn
-        if (strlen(p) >= cap) {
-            printf(YELLOW "%s is too long, it will be truncated to %zu characters.\n" RESET,
-                   label, cap - 1);
-        }
+static const CommandDef *command_lookup(const char *word);
+static void run_command_def(const CommandDef *def, const CmdArgs *args);
+static void replay_workload(const char *logPath, const char *dataset, double speed, int withSave, int verbose);
 
-        strncpy(out, p, cap - 1);
-        out[cap - 1] = '\0';
-        return 1;
+//============================= OPEN =============================
+static void cmd_open(const CmdArgs *args)
+{
+    if (args->count == 3 && strcmp(args->tokens[2], "&") == 0) { //OPEN <filename> & -> background
+        const char *filePath = args->tokens[1];
+        FILE *probe = fopen(filePath, "r");
+        if (!probe) {
+            printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
+        } else if (fclose(probe), !has_txt_extension(filePath)) {
+            printf("CMS: Only .txt files can be opened in the background.\n");
+        } else {
+            task_start(TASK_OPEN, filePath);
+        }
+    }
+    else if (args->count >= 3 && strcasecmp(args->tokens[1], "LAZY") == 0) { //OPEN LAZY <filename>
+        open_db_lazy(args->tokens[2]);
+    }
+    else if (args->count >= 2) { //OPEN <filename>
+        open_db(args->tokens[1]);
+    }
+    else {
+        printf("Usage: OPEN [LAZY] filename | OPEN filename &\n");
     }
 }
 
+//============================= SHOW =============================
 // -----------------------------------------------------------------------------
-// FUNCTION: read_valid_mark (0 to 100, non-empty)
-// PURPOSE: Prompts user to enter a valid mark between 0 and 100.
-// RETURNS: mark value on success, -1.0f on EOF
+// FUNCTION: cmd_parse_limit
+// PURPOSE : Parses "LIMIT <n> [AFTER <ID>]" starting at token 'at', which
+//           must run to the end of the command.
+// RETURNS : 1 -> valid, 0 -> invalid (message printed)
 // -----------------------------------------------------------------------------
-static float read_valid_mark(void)
+static int cmd_parse_limit(const CmdArgs *args, int at, size_t *limit, int *hasAfter, int *afterId)
 {
-    char buf[128];
+    char *endPtr = NULL;
+    const char *limitText = cmd_arg(args, at + 1);
+    long value = strtol(limitText, &endPtr, 10);
+    *hasAfter = args->count == at + 4 && strcasecmp(args->tokens[at + 2], "AFTER") == 0;
 
-    while (1) {
-        printf("Mark: ");
-        if (!fgets(buf, sizeof(buf), stdin)) {
-            return -1.0f;  // EOF
+    if (!limitText[0] || *endPtr != '\0' || value <= 0 || (args->count != at + 2 && !*hasAfter)) {
+        printf("Usage: ... LIMIT <n> [AFTER <ID>]   (n > 0)\n");
+        return 0;
+    }
+    *limit = (size_t)value;
+    return !*hasAfter || parse_exact_id_arg(args->tokens[at + 3], afterId);
+}
+
+static void cmd_show(const CmdArgs *args)
+{
+    const char *what = cmd_arg(args, 1);
+
+    //Case 1: SHOW ALL
+    if (strcasecmp(what, "ALL") == 0) {
+        int limitAt = 2;
+        while (limitAt < args->count && strcasecmp(args->tokens[limitAt], "LIMIT") != 0) limitAt++;
+
+        //Case 1a: SHOW ALL [SORT BY ID|MARK [ASC|DESC]] LIMIT <n> [AFTER <ID>] -> one page
+        if (limitAt < args->count) {
+            int sorted = strcasecmp(cmd_arg(args, 2), "SORT") == 0 && strcasecmp(cmd_arg(args, 3), "BY") == 0;
+            const char *field = sorted ? cmd_arg(args, 4) : "ID";
+            const char *order = sorted && limitAt == 6 ? cmd_arg(args, 5) : "ASC";
+            size_t limit;
+            int afterId;
+            int hasAfter;
+
+            if ((sorted ? limitAt != 5 && limitAt != 6 : limitAt != 2) ||
+                (strcasecmp(field, "ID") != 0 && strcasecmp(field, "MARK") != 0) ||
+                (strcasecmp(order, "ASC") != 0 && strcasecmp(order, "DESC") != 0)) {
+                printf("Usage: SHOW ALL [SORT BY ID|MARK [ASC|DESC]] LIMIT <n> [AFTER <ID>]\n");
+                return;
+            }
+            if (cmd_parse_limit(args, limitAt, &limit, &hasAfter, &afterId)) {
+                show_page(strcasecmp(field, "MARK") == 0 ? PAGE_BY_MARK : PAGE_BY_ID, strcasecmp(order, "DESC") == 0,
+                          NULL, limit, hasAfter ? &afterId : NULL);
+            }
+        }
+        //Case 1b: SHOW ALL SORT BY <field> [ASC|DESC] [, <field> [ASC|DESC]] ...
+        else if (strcasecmp(cmd_arg(args, 2), "SORT") == 0 && strcasecmp(cmd_arg(args, 3), "BY") == 0) {
+            showSorted(cmd_rest(args, 4)); //default order is ASC
+        }
+        //Case 1c: SHOW ALL
+        else {
+            show_all();
         }
+    }
 
-        trim_newline(buf);
+    //Case 2: SHOW SUMMARY [AS OF <time>]
+    else if (strcasecmp(what, "SUMMARY") == 0) {
+        time_t when;
+        if (args->count == 2) {
+            summary();
+        }
+        else if (strcasecmp(cmd_arg(args, 2), "AS") == 0 && strcasecmp(cmd_arg(args, 3), "OF") == 0 &&
+                 parse_log_time(cmd_rest(args, 4), 1, &when)) {
+            summary_as_of(when);
+        }
+        else {
+            printf("Usage: SHOW SUMMARY [AS OF YYYY-MM-DD[ HH:MM[:SS]]]\n");
+        }
+    }
+
+    //Case 3: SHOW TOP|BOTTOM <k> [BY MARK|ID] [IN <programme>]
+    else if (strcasecmp(what, "TOP") == 0 || strcasecmp(what, "BOTTOM") == 0) {
+        const char *kText = cmd_arg(args, 2);
+        char *endPtr = NULL;
+        long k = strtol(kText, &endPtr, 10);
+
+        if (!kText[0] || *endPtr != '\0' || k <= 0) {
+            printf("Usage: SHOW TOP|BOTTOM <k> [BY MARK|ID] [IN <programme>]\n");
+            return;
+        }
+
+        int byMark = 1;
+        const char *programme = NULL;
+        int next = 3; //first token after "SHOW TOP k"
+
+        //Optional: BY MARK|ID
+        if (strcasecmp(cmd_arg(args, next), "BY") == 0) {
+            if (strcasecmp(cmd_arg(args, next + 1), "ID") == 0) {
+                byMark = 0;
+            }
+            else if (strcasecmp(cmd_arg(args, next + 1), "MARK") != 0) {
+                printf("Usage: SHOW TOP|BOTTOM <k> [BY MARK|ID] [IN <programme>]\n");
+                return;
+            }
+            next += 2;
+        }
 
-        // Empty input
-        if (buf[0] == '\0') {
-            printf(RED "Invalid Mark. Please enter a number from 0 to 100.\n" RESET);
-            continue;
+        //Optional: IN <programme> (rest of line, may contain spaces)
+        if (strcasecmp(cmd_arg(args, next), "IN") == 0) {
+            programme = cmd_rest(args, next + 1);
+            if (*programme == '\0') {
+                printf("Usage: SHOW TOP|BOTTOM <k> [BY MARK|ID] [IN <programme>]\n");
+                return;
+            }
+        }
+        else if (next < args->count) { //anything else is not part of the command
+            printf("Usage: SHOW TOP|BOTTOM <k> [BY MARK|ID] [IN <programme>]\n");
+            return;
         }
 
-        char *endp = NULL;
-        double mv = strtod(buf, &endp);
+        show_top_k((size_t)k, byMark, strcasecmp(what, "TOP") == 0, programme);
+    }
 
-        // Invalid number or extra characters or out of range
-        if (endp == buf || *endp != '\0' || mv < 0.0 || mv > 100.0) {
-            printf(RED "Invalid Mark. Please enter a number from 0 to 100.\n" RESET);
-            continue;
+    //Case 4: SHOW WHERE <condition>
+    else if (strcasecmp(what, "WHERE") == 0) {
+        if (args->count < 3) {
+            printf("Usage: SHOW WHERE <condition>\n");
+        } else {
+            show_where(cmd_rest(args, 2));
         }
+    }
 
-        return (float)mv;
+    else {
+        printf("Usage: SHOW ALL | SHOW SUMMARY | SHOW ALL SORT BY ... | SHOW TOP|BOTTOM <k> ... | SHOW WHERE ...\n");
     }
 }
 
+//============================= INSERT =============================
+static void cmd_insert(const CmdArgs *args)
+{
+    (void)args;
+    Student s;
 
-/* ---------------------------------------------------- */
-/* Core Operations                                      */
-/* ---------------------------------------------------- */
-
-// -----------------------------------------------------------------------------
-// FUNCTION: open_db
-// PURPOSE : Opens a .txt database file, reads student records, parses them, and loads them into Student array.
-//
-// DETAILS :
-//   - Validates that the file exists and ends with ".txt"
-//   - Skips the metadata/header (first 5 lines)
-//   - Calls parse_line() to extract data for each line
-//   - Automatically expands the array using ensure_cap()
-//   - Logs the action in the audit log
-//
-// RETURNS : 1 -> success
-//           0 -> failure (file missing or wrong format)
-// -----------------------------------------------------------------------------
+    // Guard: make sure some database is loaded
+    if (!db_opened) {
+        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        return;
+    }
 
-static int db_opened = 0; // Track if a DB is currently opened
-int open_db(const char *filePath) {
-    FILE *filePtr = fopen(filePath, "r"); // open file in read mode
+    // --- ID: must be 7 digits and unique ---
+    s.id = read_valid_id();
+    if (s.id < 0) {
+        // EOF / input error
+        return;
+    }
 
-    if (!filePtr) { // file not found or cannot be opened.
-        printf("CMS: Failed to open \"%s\" file not found!\n", filePath);
-        return 0;
+    // --- Name: must not be empty ---
+    if (!read_nonempty_field("Name", s.name, MAX_STR)) {
+        return;   // EOF
     }
 
-    // Validate .txt extension
-    int filePathLength = (int)strlen(filePath);
-    if (filePathLength <= 4 ||
-        strcmp(filePath + filePathLength - 4, ".txt") != 0) {
+    // --- Programme: must not be empty ---
+    if (!read_nonempty_field("Programme", s.programme, MAX_STR)) {
+        return;   // EOF
+    }
 
-        printf("CMS: File is not a txt file.\n");
-        fclose(filePtr);
-        return 0;
+    // --- Mark: must be numeric 0–100 and not empty ---
+    s.mark = read_valid_mark();
+    if (s.mark < 0.0f) {
+        return;   // EOF
     }
 
-    // Reset Student array length before loading
-    arr_size = 0;
-    char currentFileLine[512];
-    int lineNumber = 0; // Line number tracker, to skip headers
+    // Insert record into array (insert_record still logs + sets undo)
+    insert_record(s);
+}
 
-    while (fgets(currentFileLine, sizeof(currentFileLine), filePtr)) {
-        lineNumber++; // increment per line
-        if (lineNumber <= 5) { // Skip metadata and table header
-            continue;
-        }
+//============================= QUERY =============================
+static void cmd_query(const CmdArgs *args)
+{
+    if (args->count < 2) {
+        printf("Usage: QUERY <ID> [AS OF <time>] | QUERY <ID>,<ID>,... | QUERY FROM <file>\n");
+        return;
+    }
 
-        Student currentStudent;
-        if (parse_line(currentFileLine, &currentStudent)) {
-            ensure_cap();
-            arr[arr_size] = currentStudent;
-            arr_size++;
+    //QUERY FROM <file> / QUERY <ID>,<ID>,...: one batch, one table
+    if (strcasecmp(args->tokens[1], "FROM") == 0) {
+        if (args->count == 3) {
+            query_from_file(args->tokens[2]);
         } else {
-            printf(YELLOW "CMS Warning: Skipping invalid line %d in file.\n" RESET, lineNumber);
+            printf("Usage: QUERY FROM <file>\n");
+        }
+        return;
+    }
+    const char *list = cmd_rest(args, 1);
+    if (strchr(list, ',') != NULL) {
+        IdList ids = {0};
+        if (id_list_add_text(&ids, list, strlen(list))) {
+            query_batch(&ids);
+        } else {
+            printf(RED "CMS Error: Out of memory.\n" RESET);
         }
+        free(ids.ids);
+        return;
     }
 
-    fclose(filePtr);
+    //QUERY <prefix> LIMIT <n> [AFTER <ID>]: one page of the matches, by ID
+    if (strcasecmp(cmd_arg(args, 2), "LIMIT") == 0) {
+        const char *prefix = args->tokens[1];
+        size_t limit;
+        int afterId;
+        int hasAfter;
+        if (!is_all_digits(prefix) || strlen(prefix) < 4 || strlen(prefix) > 6) {
+            printf("Usage: QUERY <4-6 digit prefix> LIMIT <n> [AFTER <ID>]\n");
+        }
+        else if (cmd_parse_limit(args, 2, &limit, &hasAfter, &afterId)) {
+            show_page(PAGE_PREFIX, 0, prefix, limit, hasAfter ? &afterId : NULL);
+        }
+        return;
+    }
 
-    printf("CMS: \"%s\" opened (%zu records)\n", filePath, arr_size);
-    audit_log("OPEN %s (%zu records)", filePath, arr_size);
+    //QUERY <ID> AS OF <time>: the record as it was then (a date alone means its end)
+    if (args->count > 2) {
+        int id;
+        time_t when;
+        if (args->count < 5 || strcasecmp(args->tokens[2], "AS") != 0 || strcasecmp(args->tokens[3], "OF") != 0 ||
+            !parse_log_time(cmd_rest(args, 4), 1, &when)) {
+            printf("Usage: QUERY <ID> AS OF YYYY-MM-DD[ HH:MM[:SS]]\n");
+        }
+        else if (parse_exact_id_arg(args->tokens[1], &id)) {
+            query_as_of(id, when);
+        }
+        return;
+    }
 
-    last_op.op = OP_NONE; // Reset Undo history
+    const char *q = args->tokens[1];
+    size_t len = strlen(q);
 
-    db_opened = 1; // Mark DB as opened
-    return 1;
+    // Must be all digits, at least 4 of them
+    if (!is_all_digits(q) || len < 4) {
+        printf("Enter at least 4 digits for ID search.\n");
+        return;
+    }
+
+    // Full 7-digit ID -> exact match
+    if (len == 7) {
+        int id = atoi(q);
+        query(id);
+    }
+    // 4–6 digits -> prefix search
+    else {
+        query_prefix(q);
+    }
 }
 
+//============================= FIND =============================
+static void cmd_find(const CmdArgs *args)
+{
+    //FIND [FUZZY] NAME|PROGRAMME <text>
+    int fuzzy = strcasecmp(cmd_arg(args, 1), "FUZZY") == 0;
+    const char *field = cmd_arg(args, fuzzy ? 2 : 1);
+    const char *text = cmd_rest(args, fuzzy ? 3 : 2);
 
-// -----------------------------------------------------------------------------
-// FUNCTION: show_all
-// PURPOSE : Prints a nicely formatted table of all student records currently stored in memory.
-// -----------------------------------------------------------------------------
-void show_all(void) {
-    if (!db_opened) { //No records in memory
-        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
-        return;
+    if (strcasecmp(field, "NAME") == 0 && *text) {
+        find_text(0, text, fuzzy);
     }
+    else if (strcasecmp(field, "PROGRAMME") == 0 && *text) {
+        find_text(1, text, fuzzy);
+    }
+    else {
+        printf("Usage: FIND [FUZZY] NAME|PROGRAMME <text>\n");
+    }
+}
 
-    //Print table header with formatting and colour
-    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET,
-           "ID", "Name", "Programme", "Mark");
+//============================= UPDATE =============================
+static void cmd_update(const CmdArgs *args)
+{
+    int id;
+    if (args->count < 2) {
+        printf("Usage: UPDATE <ID> | UPDATE SET <field> = <value> [, ...] WHERE <condition>\n");
+    }
+    else if (strcasecmp(args->tokens[1], "SET") == 0) {
+        where_change(cmd_rest(args, 2), 1);
+    }
+    else if (parse_exact_id_arg(args->tokens[1], &id)) { //invalid ID: message already printed
+        update(id);
+    }
+}
 
-    //Loop through each record and print
-    for (size_t i = 0; i < arr_size; i++) {
-        //Decide colour based on marks
-        const char *colour = RESET;
-        if (arr[i].mark >= 80)
-            colour = GREEN;
-        else if (arr[i].mark < 50)
-            colour = RED;
-        else
-            colour = YELLOW;
+//============================= DELETE =============================
+static void cmd_delete(const CmdArgs *args)
+{
+    int id;
+    if (args->count < 2) {
+        printf("Usage: DELETE <ID> | DELETE WHERE <condition>\n");
+    }
+    else if (strcasecmp(args->tokens[1], "WHERE") == 0) {
+        where_change(cmd_rest(args, 2), 0);
+    }
+    else if (parse_exact_id_arg(args->tokens[1], &id)) { //require exactly 7 numeric digits
+        delete(id);
+    }
+}
 
-        //Print row in formatted columns
-        printf("%-10d %-20s %-30s %s%-6.1f%s\n",
-               arr[i].id,
-               arr[i].name,
-               arr[i].programme,
-               colour, arr[i].mark, RESET);
+//============================= SAVE / ARCHIVE / UNDO =============================
+static void cmd_save(const CmdArgs *args)
+{
+    if (args->count == 2 && strcmp(args->tokens[1], "&") == 0) { //SAVE & -> background
+        if (!db_opened) {
+            printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+        } else {
+            task_start(TASK_SAVE, NULL);
+        }
+    }
+    else {
+        save();
     }
 }
 
-// -----------------------------------------------------------------------------
-// COMPARATOR: idAsc
-// PURPOSE   : Used by qsort() to sort students by ID in ascending order.
-// -----------------------------------------------------------------------------
-int idAsc(const void* a, const void* b) {
-    Student* student_a = (Student*)a;
-    Student* student_b = (Student*)b;
-    return student_a->id - student_b->id;
+static void cmd_archive(const CmdArgs *args)
+{
+    if (args->count >= 2) {
+        archive_db(args->tokens[1]);
+    }
+    else {
+        printf("Usage: ARCHIVE <file>.cmsa\n");
+    }
 }
 
-// -----------------------------------------------------------------------------
-// COMPARATOR: idDesc
-// PURPOSE   : Sort students by ID in descending order.
-// -----------------------------------------------------------------------------
-int idDesc(const void* a, const void* b) {
-    Student* student_a = (Student*)a;
-    Student* student_b = (Student*)b;
-    return student_b->id - student_a->id;
+static void cmd_undo(const CmdArgs *args)
+{
+    (void)args;
+    undo();
 }
 
-// -----------------------------------------------------------------------------
-// COMPARATOR: markAsc
-// PURPOSE   : Sort by mark from lowest -> highest.
-// -----------------------------------------------------------------------------
-int markAsc(const void* a, const void* b) {
-    float mark_a = ((Student*)a)->mark;
-    float mark_b = ((Student*)b)->mark;
+//============================= TRANSACTIONS =============================
+static void cmd_begin(const CmdArgs *args)
+{
+    (void)args;
+    txn_begin();
+}
 
-    if (mark_a > mark_b) return 1;
-    if (mark_a < mark_b) return -1;
-    return 0;   // equal
+static void cmd_commit(const CmdArgs *args)
+{
+    (void)args;
+    txn_commit();
 }
 
-// -----------------------------------------------------------------------------
-// COMPARATOR: markDesc
-// PURPOSE   : Sort by mark from highest -> lowest.
-// -----------------------------------------------------------------------------
-int markDesc(const void* a, const void* b) {
-    float mark_a = ((Student*)a)->mark;
-    float mark_b = ((Student*)b)->mark;
+static void cmd_rollback(const CmdArgs *args)
+{
+    (void)args;
+    txn_rollback();
+}
 
-    if (mark_a > mark_b) return -1;
-    if (mark_a < mark_b) return 1;
-    return 0;
+//============================= BENCH / MEMORY / COMPACT =============================
+static void cmd_bench(const CmdArgs *args)
+{
+    if (args->count >= 3 && strcasecmp(args->tokens[1], "PARSE") == 0) {
+        bench_parse(args->tokens[2]);
+    }
+    else if (args->count == 2 && strcasecmp(args->tokens[1], "SORT") == 0) {
+        bench_sort();
+    }
+    else {
+        printf("Usage: BENCH PARSE <file> | BENCH SORT\n");
+    }
 }
 
-// -----------------------------------------------------------------------------
-// FUNCTION: showSorted
-// PURPOSE : Sorts the array based on user command then reprints all records.
-// ACCEPTS : field = "ID" or "MARK"
-//           order = "ASC" or "DESC"
-// -----------------------------------------------------------------------------
-void showSorted(const char* field, const char* order) {
-    //Determine field to sort by
-    if (strcmp(field, "ID") == 0) {
-        //Determine sort direction
-        if (strcmp(order, "ASC") == 0)
-            qsort(arr, arr_size, sizeof(Student), idAsc);
+static void cmd_memory(const CmdArgs *args)
+{
+    (void)args;
+    show_memory();
+}
 
-        else if (strcmp(order, "DESC") == 0)
-            qsort(arr, arr_size, sizeof(Student), idDesc);
+static void cmd_compact(const CmdArgs *args)
+{
+    (void)args;
+    size_t moved = table_compact();
+    printf("CMS: Compacted storage (%zu record(s) moved).\n", moved);
+    if (version_store.built) {
+        printf("CMS: Compacted version history (%zu version(s) dropped).\n", version_store_compact());
     }
-    else if (strcmp(field, "MARK") == 0) {
-        if (strcmp(order, "ASC") == 0)
-            qsort(arr, arr_size, sizeof(Student), markAsc);
+    show_memory();
+}
 
-        else if (strcmp(order, "DESC") == 0)
-            qsort(arr, arr_size, sizeof(Student), markDesc);
-    }
+//============================= CACHE =============================
+static void cmd_cache(const CmdArgs *args)
+{
+    const char *what = cmd_arg(args, 1);
 
-    //After sorting, print the updated table
-    show_all();
+    if (args->count == 1 || strcasecmp(what, "STATS") == 0) {
+        show_cache_stats();
+    }
+    else if (strcasecmp(what, "CLEAR") == 0) {
+        result_cache_clear();
+        result_cache.hits = result_cache.misses = 0;
+        printf("CMS: Result cache cleared.\n");
+    }
+    else if (strcasecmp(what, "MAX") == 0 && args->count >= 3 && is_all_digits(args->tokens[2])) {
+        result_cache.limit = (size_t)strtoull(args->tokens[2], NULL, 10);
+        result_cache_clear(); //Simplest way to respect a smaller limit
+        printf("CMS: Result cache limit set to %zu bytes%s.\n", result_cache.limit,
+               result_cache.limit == 0 ? " (disabled)" : "");
+    }
+    else {
+        printf("Usage: CACHE [STATS|CLEAR|MAX <bytes>]\n");
+    }
 }
 
-// -----------------------------------------------------------------------------
-// FUNCTION: insert_record
-// PURPOSE : Inserts a new student object into the dynamic array.
-// BEHAVIOUR:
-//   - Prevents duplicate IDs
-//   - Expands array if needed
-//   - Logs the insertion
-//   - Stores undo information
-// -----------------------------------------------------------------------------
-void insert_record(Student studentObject) {
-    if (!db_opened) { //No records in memory
-        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+//============================= THREADS =============================
+static void cmd_threads(const CmdArgs *args)
+{
+    const char *count = cmd_arg(args, 1);
+
+    if (args->count == 2 && is_all_digits(count) && strlen(count) <= 3) {
+        pool_stop();
+        pool_start(atoi(count)); //0 -> one per processor
+    }
+    else if (args->count != 1) {
+        printf("Usage: THREADS [<n>]   (0 = one per processor)\n");
         return;
     }
+    printf("CMS: Parallel sorts use %d thread(s) (%d processor(s)).\n", pool_size(), pool_cpu_count());
+}
 
-    //Reject duplicate IDs
-    if (find_index_by_id(studentObject.id) != -1) {
-        printf("CMS: ID already exists!\n");
+//============================= TRACE =============================
+static void cmd_trace(const CmdArgs *args)
+{
+    const char *what = cmd_arg(args, 1);
+    int start = args->count == 2 && strcasecmp(what, "START") == 0;
+    int stop = (args->count == 2 || args->count == 3) && strcasecmp(what, "STOP") == 0;
+    if (args->count != 1 && !start && !stop) {
+        printf("Usage: TRACE [START | STOP [<file>]]\n");
         return;
     }
+#ifdef CMS_TRACE
+    size_t dropped;
+    int threads;
+    int active = __atomic_load_n(&trace_state.active, __ATOMIC_RELAXED);
+
+    if (args->count == 1) {
+        if (!active) {
+            printf("CMS: Tracing is off. TRACE START begins a recording.\n");
+            return;
+        }
+        size_t spans = trace_spans(&dropped, &threads);
+        printf("CMS: Tracing is on (%zu span(s) from %d thread(s) so far).\n", spans, threads);
+    }
+    else if (start) {
+        if (active) {
+            printf(YELLOW "CMS: Tracing is already on. TRACE STOP [<file>] writes it.\n" RESET);
+            return;
+        }
+        trace_start();
+        printf("CMS: Tracing started. TRACE STOP [<file>] writes the spans as Chrome trace JSON.\n");
+    }
+    else {
+        const char *filePath = args->count == 3 ? args->tokens[2] : TRACE_DEFAULT_FILE;
+        if (!active) {
+            printf(YELLOW "CMS: Tracing is off. TRACE START begins a recording.\n" RESET);
+            return;
+        }
+        if (!trace_stop(filePath)) {
+            printf(RED "CMS Error: Cannot write trace file \"%s\".\n" RESET, filePath);
+            return;
+        }
+        size_t spans = trace_spans(&dropped, &threads);
+        printf("CMS: Trace written to \"%s\" (%zu span(s) from %d thread(s)). Open it in ui.perfetto.dev or chrome://tracing.\n",
+               filePath, spans, threads);
+        if (dropped > 0) {
+            printf(YELLOW "CMS Warning: %zu span(s) dropped (more than %u in one thread).\n" RESET, dropped, TRACE_EVENTS_MAX);
+        }
+    }
+#else
+    printf(YELLOW "CMS: Tracing is not compiled in. Rebuild with -DCMS_TRACE.\n" RESET);
+#endif
+}
 
-    //Ensure array has enough space before insert
-    ensure_cap();
-
-    //Insert new student to the array
-    arr[arr_size] = studentObject;
-    arr_size++;
-
-    printf("CMS: Record inserted successfully!\n");
-
-    audit_log("INSERT %d %s %s %.1f", studentObject.id, studentObject.name, studentObject.programme, studentObject.mark); //Audit Log
-
-    //Prepare for undo
-    last_op.op = OP_INSERT;
-    last_op.after = studentObject;
+//============================= JOBS / WAIT / CANCEL =============================
+static void cmd_jobs(const CmdArgs *args)
+{
+    (void)args;
+    if (task.kind == TASK_NONE) {
+        printf("CMS: No background task running.\n");
+    } else {
+        task_print_progress("\n");
+    }
 }
 
-// -----------------------------------------------------------------------------
-// FUNCTION: query
-// PURPOSE : Looks up a student by ID and prints their record.
-// -----------------------------------------------------------------------------
-void query(int studentId) {
-    if (!db_opened) { //No records in memory
-        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
-        return;
+static void cmd_wait(const CmdArgs *args)
+{
+    (void)args;
+    if (task.kind == TASK_NONE) {
+        printf("CMS: No background task running.\n");
+    } else {
+        task_wait();
     }
+}
 
-    int studentIndex = find_index_by_id(studentId);
+static void cmd_cancel(const CmdArgs *args)
+{
+    (void)args;
+    task_cancel();
+}
 
-    if (studentIndex < 0) { //If student ID not found (-1), exit
-        printf("CMS: The record with ID %d does not exist.\n", studentId);
+//============================= HISTORY / LOG =============================
+static void cmd_history(const CmdArgs *args)
+{
+    const char *id = cmd_arg(args, 1);
+    if (args->count != 2 || !is_all_digits(id) || strlen(id) > 9) {
+        printf("Usage: HISTORY <ID>\n");
         return;
     }
-
-    //Print Header
-    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
-
-    //Decide colour based on marks
-    const char *colour = RESET;
-    if (arr[studentIndex].mark >= 80)
-        colour = GREEN;
-    else if (arr[studentIndex].mark < 50)
-        colour = RED;
-    else
-        colour = YELLOW;
-
-    //Print the student record
-    printf("%-10d %-20s %-30s %s%-6.1f%s\n",
-           arr[studentIndex].id,
-           arr[studentIndex].name,
-           arr[studentIndex].programme,
-           colour, arr[studentIndex].mark, RESET);
+    show_history(atoi(id));
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: query_prefix
-// PURPOSE : Lists all records whose ID starts with the given digit prefix.
-// INPUT   : prefix - a string of 4–6 digits
+// FUNCTION: cmd_log_time
+// PURPOSE : Reads one time argument starting at token *next. A date token
+//           followed by a HH:MM[:SS] token is taken as one time, so quotes
+//           are optional: LOG BETWEEN 2025-11-21 09:00 2025-11-21 17:30
+// RETURNS : 1 -> parsed (advances *next), 0 -> invalid
 // -----------------------------------------------------------------------------
-void query_prefix(const char *prefix)
+static int cmd_log_time(const CmdArgs *args, int *next, int endOfRange, time_t *out)
 {
-    if (!db_opened) {
-        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
-        return;
+    char text[64];
+    const char *date = cmd_arg(args, *next);
+    const char *clock = cmd_arg(args, *next + 1);
+
+    if (strchr(date, ':') == NULL && strchr(clock, ':') != NULL && strchr(clock, '-') == NULL) {
+        snprintf(text, sizeof(text), "%s %s", date, clock);
+        *next += 2;
+    } else {
+        snprintf(text, sizeof(text), "%s", date);
+        *next += 1;
     }
+    return parse_log_time(text, endOfRange, out);
+}
 
-    size_t prefix_len = strlen(prefix);
-    int found = 0;
-
-    // Header
-    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET,
-           "ID", "Name", "Programme", "Mark");
-
-    for (size_t i = 0; i < arr_size; ++i) {
-        char idbuf[32];
-        snprintf(idbuf, sizeof(idbuf), "%d", arr[i].id);
-
-        if (strncmp(idbuf, prefix, prefix_len) == 0) {
-            // Colour logic same as show_all()
-            const char *color = RESET;
-            if (arr[i].mark >= 80)
-                color = GREEN;
-            else if (arr[i].mark < 50)
-                color = RED;
-            else
-                color = YELLOW;
+static void cmd_log(const CmdArgs *args)
+{
+    const char *what = cmd_arg(args, 1);
 
-            printf("%-10d %-20s %-30s %s%-6.1f%s\n",
-                   arr[i].id,
-                   arr[i].name,
-                   arr[i].programme,
-                   color, arr[i].mark, RESET);
+    if (args->count == 1) {
+        show_log_status();
+    }
+    else if (strcasecmp(what, "BETWEEN") == 0) {
+        int next = 2;
+        time_t from, to;
+        if (!cmd_log_time(args, &next, 0, &from) || !cmd_log_time(args, &next, 1, &to) || next != args->count) {
+            printf("Usage: LOG BETWEEN <YYYY-MM-DD [HH:MM[:SS]]> <YYYY-MM-DD [HH:MM[:SS]]>\n");
+            return;
+        }
+        if (to < from) {
+            printf(RED "CMS Error: The end time is before the start time.\n" RESET);
+            return;
+        }
+        show_log_between(from, to);
+    }
+    else if (strcasecmp(what, "ROTATE") == 0) {
+        const char *limit = cmd_arg(args, 2);
+        const char *value = cmd_arg(args, 3);
+        log_init();
+
+        if (args->count == 2) {
+            if (log_state.activeSize == 0) {
+                printf("CMS: The active log segment is empty, nothing to rotate.\n");
+            } else if (log_rotate()) {
+                printf("CMS: Audit log rotated (%s.%u).\n", LOGFILE, (unsigned)(log_state.activeSegment - 1));
+            }
+        }
+        else if (args->count == 4 && strcasecmp(limit, "SIZE") == 0 && is_all_digits(value)) {
+            log_state.maxBytes = strtoll(value, NULL, 10);
+            printf("CMS: Log segments rotate at %lld bytes%s.\n", log_state.maxBytes, log_state.maxBytes == 0 ? " (never)" : "");
+        }
+        else if (args->count == 4 && strcasecmp(limit, "AGE") == 0 && is_all_digits(value)) {
+            log_state.maxAge = strtol(value, NULL, 10);
+            printf("CMS: Log segments rotate after %ld seconds%s.\n", log_state.maxAge, log_state.maxAge == 0 ? " (never)" : "");
+        }
+        else {
+            printf("Usage: LOG ROTATE [SIZE <bytes> | AGE <seconds>]\n");
+        }
+    }
+    else if (strcasecmp(what, "REINDEX") == 0 && args->count == 2) {
+        log_init();
+        printf("CMS: Indexed %zu audit log entries.\n", log_reindex());
+    }
+    else {
+        printf("Usage: LOG [BETWEEN <t1> <t2> | ROTATE [SIZE <bytes> | AGE <seconds>] | REINDEX]\n");
+    }
+}
 
-            found = 1;
+//============================= REPLAY =============================
+static void cmd_replay(const CmdArgs *args)
+{
+    const char *dataset = NULL;
+    double speed = 1.0;
+    int withSave = 0, verbose = 0, valid = args->count >= 2;
+
+    for (int i = 2; i < args->count && valid; i++) {
+        const char *word = args->tokens[i];
+        if (strcasecmp(word, "ON") == 0 && i + 1 < args->count) {
+            dataset = args->tokens[++i];
+        }
+        else if (strcasecmp(word, "FAST") == 0) {
+            speed = 0.0;
+        }
+        else if (strcasecmp(word, "SPEED") == 0 && i + 1 < args->count) {
+            char *endPtr = NULL;
+            speed = strtod(args->tokens[++i], &endPtr);
+            valid = *endPtr == '\0' && speed > 0.0;
+        }
+        else if (strcasecmp(word, "SAVES") == 0) {
+            withSave = 1;
+        }
+        else if (strcasecmp(word, "VERBOSE") == 0) {
+            verbose = 1;
+        }
+        else {
+            valid = 0;
         }
     }
 
-    if (!found) {
-        printf("CMS: No records found with ID starting with %s.\n", prefix);
+    if (!valid) {
+        printf("Usage: REPLAY <log file> [ON <data file>] [FAST | SPEED <x>] [SAVES] [VERBOSE]\n");
+        return;
     }
+    replay_workload(args->tokens[1], dataset, speed, withSave, verbose);
 }
 
-
-
-// -----------------------------------------------------------------------------
-// FUNCTION: update
-// PURPOSE : Modifies an existing student record.
-// DETAILS :
-//   1. Look up student by ID
-//   2. Show current data
-//   3. Ask user which fields to edit
-//   4. Show a BEFORE/AFTER comparison (diff)
-//   5. Ask for confirmation
-//   6. Save changes and update undo log
-// -----------------------------------------------------------------------------
-void update(int studentID) {
-    if (!db_opened) { //No records in memory
-        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+//============================= MERGE =============================
+static void cmd_merge(const CmdArgs *args)
+{
+    MergePolicy policy = MERGE_KEEP;
+    int valid = args->count == 2;
+    if (args->count == 3) {
+        for (int p = 0; p < 3; p++) {
+            if (strcasecmp(args->tokens[2], merge_policy_names[p]) == 0) {
+                policy = (MergePolicy)p;
+                valid = 1;
+            }
+        }
+    }
+    if (!valid) {
+        printf("Usage: MERGE <file> [KEEP|OVERWRITE|HIGHER_MARK]\n");
         return;
     }
+    merge_file(args->tokens[1], policy);
+}
 
-    int studentIndex = find_index_by_id(studentID);
-    if (studentIndex < 0) {
-        printf("CMS: The record with ID %d does not exist.\n", studentID);
+//============================= DIFF =============================
+static void cmd_diff(const CmdArgs *args)
+{
+    int summaryOnly = args->count == 4 && strcasecmp(args->tokens[3], "SUMMARY") == 0;
+    if (args->count != 3 && !summaryOnly) {
+        printf("Usage: DIFF <fileA> <fileB> [SUMMARY]\n");
         return;
     }
+    diff_files(args->tokens[1], args->tokens[2], summaryOnly);
+}
 
-    //Save copies of BEFORE and AFTER states for diff & undo
-    Student before = arr[studentIndex];
-    Student after  = before;
+//============================= PUBLISH =============================
+static void cmd_publish(const CmdArgs *args)
+{
+    if (args->count == 2 && strcasecmp(args->tokens[1], "STOP") == 0) {
+        publish_stop(1);
+    }
+    else if (args->count <= 2) {
+        publish_table(args->count == 2 ? args->tokens[1] : SHM_DEFAULT_NAME);
+    }
+    else {
+        printf("Usage: PUBLISH [/<name>] | PUBLISH STOP\n");
+    }
+}
 
-    //Display current record
-    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+//============================= NEXT =============================
+static void cmd_next(const CmdArgs *args)
+{
+    if (args->count != 1) {
+        printf("Usage: NEXT\n");
+        return;
+    }
+    page_next();
+}
 
-    print_student_record(&before);
+//============================= STAT FILE =============================
+static void cmd_stat(const CmdArgs *args)
+{
+    if (args->count != 3 || strcasecmp(args->tokens[1], "FILE") != 0) {
+        printf("Usage: STAT FILE <file>\n");
+        return;
+    }
+    stat_file(args->tokens[2]);
+}
 
-    //Allow user to edit fields (ENTER == keep old value)
-    int changed = 0;
+//============================= PREPARE / EXECUTE =============================
+#define PREPARED_MAX 32
+#define PREPARED_PARAMS_MAX 9
 
-    changed |= prompt_edit_str("Name",
-                               after.name, MAX_STR,
-                               before.name);
+//Prepared command: template split into literal text and parameter slots
+typedef struct {
+    char name[32];             //"" -> unused
+    const CommandDef *def;     //handler, resolved once at PREPARE time
+    char *text;                //template text with placeholders removed ('\0' separated pieces)
+    size_t pieceCount;         //literal pieces; a parameter goes between piece i and i+1
+    const char **pieces;
+    int *paramOf;              //parameter index (0-based) placed after piece i
+    int paramCount;            //number of distinct parameters ($1..$n)
+} PreparedCommand;
 
-    changed |= prompt_edit_str("Programme",
-                               after.programme, MAX_STR,
-                               before.programme);
+static PreparedCommand prepared[PREPARED_MAX];
 
-    changed |= prompt_edit_mark(&after.mark,
-                                before.mark);
+static void cmd_execute(const CmdArgs *args);
 
-    //If no field changed, abort update
-    if (!changed) {
-        printf(YELLOW "No changes detected. Update cancelled.\n" RESET);
+// -----------------------------------------------------------------------------
+// FUNCTION: prepared_free
+// -----------------------------------------------------------------------------
+static void prepared_free(PreparedCommand *statement)
+{
+    free(statement->text);
+    free(statement->pieces);
+    free(statement->paramOf);
+    memset(statement, 0, sizeof(*statement));
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: cmd_prepare
+// PURPOSE : PREPARE <name> AS <command>. Placeholders are ? (next parameter)
+//           or $1..$9. With no arguments, lists the prepared commands.
+// -----------------------------------------------------------------------------
+static void cmd_prepare(const CmdArgs *args)
+{
+    if (args->count == 1) {
+        int listed = 0;
+        for (int i = 0; i < PREPARED_MAX; i++) {
+            if (!prepared[i].name[0]) continue;
+            printf("%-16s %d parameter(s): %s\n", prepared[i].name, prepared[i].paramCount, prepared[i].def->name);
+            listed++;
+        }
+        if (!listed) printf("CMS: No prepared commands.\n");
         return;
     }
 
-    // --------------------------------------------
-    // Show before/after diff table for confirmation
-    // --------------------------------------------
-    printf("\n" BOLD "Review changes:" RESET "\n");
-    printf("%-12s | %-30s | %-30s\n",
-           "Field", "Before", "After");
-    printf("-------------+--------------------------------+--------------------------------\n");
-
-    print_diff_row("Name",      before.name,      after.name);
-    print_diff_row("Programme", before.programme, after.programme);
-
-    char bmark[32], amark[32];
-    snprintf(bmark, sizeof(bmark), "%.1f", before.mark);
-    snprintf(amark, sizeof(amark), "%.1f", after.mark);
-    print_diff_row("Mark", bmark, amark);
-
-    //Confirm if user wants to apply changes
-    char confirm[32];
-    printf("\nConfirm update (Y/N)? ");
-    if (!fgets(confirm, sizeof(confirm), stdin)) { //Check if NULL
-        printf("Cancelled.\n");
+    if (args->count < 4 || strcasecmp(args->tokens[2], "AS") != 0 || strlen(args->tokens[1]) >= sizeof(prepared[0].name)) {
+        printf("Usage: PREPARE <name> AS <command with ? or $1..$9 placeholders>\n");
         return;
     }
-    //Convert lowercase and check 'y'
-    for (char *confirmPtr = confirm; *confirmPtr; ++confirmPtr)
-    {
-        *confirmPtr = (char)tolower((unsigned char)*confirmPtr);
+
+    const char *body = args->raw[3];
+    const CommandDef *def = command_lookup(args->tokens[3]);
+    if (def == NULL) {
+        printf("CMS: Unknown command \"%s\" in PREPARE.\n", args->tokens[3]);
+        return;
     }
-    if (confirm[0] != 'y') {
-        printf("Cancelled.\n");
+    if (def->run == cmd_prepare || def->run == cmd_execute) { //EXECUTE of itself would never end
+        printf("CMS: %s cannot be prepared.\n", def->name);
         return;
     }
 
-    //Apply changes
-    arr[studentIndex] = after;
+    //Split the template at placeholders (outside quotes)
+    PreparedCommand statement;
+    memset(&statement, 0, sizeof(statement));
+    size_t bodyLength = strlen(body);
+    statement.text = malloc(bodyLength + 1);
+    statement.pieces = malloc((bodyLength / 2 + 2) * sizeof(const char *));
+    statement.paramOf = malloc((bodyLength / 2 + 2) * sizeof(int));
+    if (statement.text == NULL || statement.pieces == NULL || statement.paramOf == NULL) {
+        prepared_free(&statement);
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        return;
+    }
 
-    printf(GREEN "CMS: Record updated.\n" RESET);
+    char *out = statement.text;
+    int nextParam = 0;
+    char quote = 0;
+    statement.pieces[0] = out;
+    statement.pieceCount = 1;
+
+    for (const char *p = body; *p; p++) {
+        int param = -1;
+        quote = quote_next(quote, body, p);
+        if (!quote && *p == '?') {
+            param = nextParam++;
+        }
+        else if (!quote && *p == '$' && p[1] >= '1' && p[1] <= '9') {
+            param = p[1] - '1';
+            p++;
+        }
 
-    //Log update details
-    audit_log("UPDATE %d | \"%s\" -> \"%s\" | \"%s\" -> \"%s\" | %.1f -> %.1f", 
-        studentID,
-        before.name, after.name,
-        before.programme, after.programme,
-        before.mark, after.mark);
+        if (param < 0) {
+            *out++ = *p;
+            continue;
+        }
+        if (param >= PREPARED_PARAMS_MAX) {
+            prepared_free(&statement);
+            printf("CMS: At most %d parameters per prepared command.\n", PREPARED_PARAMS_MAX);
+            return;
+        }
+        *out++ = '\0';
+        statement.paramOf[statement.pieceCount - 1] = param;
+        statement.pieces[statement.pieceCount++] = out;
+        if (param + 1 > statement.paramCount) statement.paramCount = param + 1;
+    }
+    *out = '\0';
+    statement.def = def;
+    snprintf(statement.name, sizeof(statement.name), "%s", args->tokens[1]);
+
+    //Replace a statement with the same name, else take a free slot
+    int slot = -1;
+    for (int i = 0; i < PREPARED_MAX; i++) {
+        if (strcasecmp(prepared[i].name, statement.name) == 0) { slot = i; break; }
+        if (slot < 0 && !prepared[i].name[0]) slot = i;
+    }
+    if (slot < 0) {
+        prepared_free(&statement);
+        printf("CMS: Too many prepared commands (max %d).\n", PREPARED_MAX);
+        return;
+    }
+    prepared_free(&prepared[slot]);
+    prepared[slot] = statement;
 
-    //Prepare for undo
-    last_op.op = OP_UPDATE;
-    last_op.before = before;
-    last_op.after  = after;
+    printf("CMS: Prepared \"%s\" (%s, %d parameter(s)).\n", statement.name, def->name, statement.paramCount);
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: delete
-// PURPOSE : Removes a student record from the system.
-// DETAILS :
-//   1. Look up student by ID
-//   2. Display record about to be deleted
-//   3. Require user to type ID to confirm
-//   4. Remove from array (swap-delete method)
-//   5. Write to audit log
-//   6. Save undo info
+// FUNCTION: cmd_execute
+// PURPOSE : EXECUTE <name> [value ...]. Binds the values (quote values that
+//           contain spaces; "" inside quotes is one ") into the template and
+//           runs the stored handler.
 // -----------------------------------------------------------------------------
-void delete(int studentID) {
-    if (!db_opened) { //No records in memory
-        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
+static void cmd_execute(const CmdArgs *args)
+{
+    if (args->count < 2) {
+        printf("Usage: EXECUTE <name> [value ...]\n");
         return;
     }
 
-    int studentIndex = find_index_by_id(studentID);
-    if (studentIndex < 0) {
-        printf("CMS: The record with ID %d does not exist.\n", studentID);
+    const PreparedCommand *statement = NULL;
+    for (int i = 0; i < PREPARED_MAX; i++) {
+        if (prepared[i].name[0] && strcasecmp(prepared[i].name, args->tokens[1]) == 0) {
+            statement = &prepared[i];
+            break;
+        }
+    }
+    if (statement == NULL) {
+        printf("CMS: No prepared command named \"%s\".\n", args->tokens[1]);
+        return;
+    }
+    if (args->count - 2 != statement->paramCount) {
+        printf("CMS: \"%s\" expects %d parameter(s), got %d.\n", statement->name, statement->paramCount, args->count - 2);
         return;
     }
 
-    //Backup the record so UNDO can restore it
-    Student before = arr[studentIndex];
+    //Bind: literal pieces with the values in between, re-quoted (with any " doubled)
+    //when they contain spaces or quotes so each value stays one token / one string
+    size_t length = 1;
+    for (size_t i = 0; i < statement->pieceCount; i++) {
+        length += strlen(statement->pieces[i]);
+        if (i + 1 < statement->pieceCount) length += 2 * strlen(args->tokens[2 + statement->paramOf[i]]) + 2;
+    }
+    char *bound = malloc(length);
+    char *storage = malloc(length);
+    if (bound == NULL || storage == NULL) {
+        free(bound);
+        free(storage);
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        return;
+    }
 
-    //Show record before deletion
-    printf("\n" BOLD "About to delete this record:" RESET "\n");
-    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+    char *out = bound;
+    for (size_t i = 0; i < statement->pieceCount; i++) {
+        size_t pieceLength = strlen(statement->pieces[i]);
+        memcpy(out, statement->pieces[i], pieceLength);
+        out += pieceLength;
+        if (i + 1 < statement->pieceCount) {
+            const char *value = args->tokens[2 + statement->paramOf[i]];
+            int quote = value[0] == '\0' || value[strcspn(value, " \t\"'")] != '\0';
+            if (quote) *out++ = '"';
+            for (const char *v = value; *v; v++) {
+                if (*v == '"') *out++ = '"';
+                *out++ = *v;
+            }
+            if (quote) *out++ = '"';
+        }
+    }
+    *out = '\0';
 
-    print_student_record(&before);
+    CmdArgs boundArgs;
+    cmd_tokenize(bound, storage, &boundArgs);
+    run_command_def(statement->def, &boundArgs);
 
-    //Require exact ID confirmation
-    if (!confirm_delete_by_id(before.id)) {
-        printf(YELLOW "Cancelled.\n" RESET);
-        return;
+    free(bound);
+    free(storage);
+}
+
+//============================= HELP =============================
+static void cmd_help(const CmdArgs *args)
+{
+    (void)args;
+    printf("Commands:\n"
+           "OPEN [LAZY] <file>\n"
+           "SHOW ALL\n"
+           "SHOW ALL SORT BY ID|NAME|PROGRAMME|MARK [ASC|DESC] [, ...]\n"
+           "SHOW ALL [SORT BY ID|MARK [ASC|DESC]] LIMIT <n> [AFTER <ID>]   (one page; NEXT for the next)\n"
+           "SHOW SUMMARY [AS OF <time>]\n"
+           "SHOW WHERE <condition>   (e.g. PROGRAMME LIKE 'Comp%%' AND MARK >= 80)\n"
+           "SHOW TOP|BOTTOM <k> [BY MARK|ID] [IN <programme>]\n"
+           "INSERT\n"
+           "QUERY <ID> [AS OF YYYY-MM-DD[ HH:MM[:SS]]]\n"
+           "QUERY <ID>,<ID>,... | QUERY FROM <file>\n"
+           "QUERY <4-6 digit prefix> LIMIT <n> [AFTER <ID>]\n"
+           "NEXT\n"
+           "FIND [FUZZY] NAME|PROGRAMME <text>\n"
+           "UPDATE <ID>\n"
+           "UPDATE SET MARK = <expr> | NAME = '<text>' | PROGRAMME = '<text>' [, ...] WHERE <condition>\n"
+           "DELETE <ID>\n"
+           "DELETE WHERE <condition>   (ID/NAME/PROGRAMME/MARK =,!=,<,<=,>,>= with AND, OR, NOT, ( ))\n"
+           "SAVE\n"
+           "OPEN <file> & / SAVE &   (run in the background; JOBS, WAIT, CANCEL)\n"
+           "ARCHIVE <file>.cmsa\n"
+           "MERGE <file> [KEEP|OVERWRITE|HIGHER_MARK]\n"
+           "DIFF <fileA> <fileB> [SUMMARY]\n"
+           "PUBLISH [/<name>] | PUBLISH STOP   (shared-memory snapshot for other programs)\n"
+           "STAT FILE <file>   (statistics of a file without opening it)\n"
+           "REPLICATE [ON | OFF]   (publish the table for --follow replicas after every OPEN)\n"
+           "REPLICA   (started with --follow: position in the primary's log and lag)\n"
+           "UNDO\n"
+           "BEGIN / COMMIT / ROLLBACK\n"
+           "PREPARE <name> AS <command with ? or $1..$9>\n"
+           "EXECUTE <name> [value ...]\n"
+           "MEMORY\n"
+           "BENCH PARSE <file>\n"
+           "BENCH SORT\n"
+           "COMPACT\n"
+           "THREADS [<n>]\n"
+           "TRACE [START | STOP [<file>]]   (build with -DCMS_TRACE: Chrome trace of internal phases)\n"
+           "CACHE [STATS|CLEAR|MAX <bytes>]\n"
+           "HISTORY <ID>\n"
+           "LOG [BETWEEN <t1> <t2> | ROTATE [SIZE <bytes> | AGE <seconds>] | REINDEX]\n"
+           "REPLAY <log file> [ON <data file>] [FAST | SPEED <x>] [SAVES] [VERBOSE]\n"
+           "EXIT\n"
+           "Several commands can be given on one line, separated by ';'.\n");
+}
+
+//============================= REPLICA =============================
+static void cmd_replica(const CmdArgs *args)
+{
+    (void)args;
+    follow_status();
+}
+
+static void cmd_replicate(const CmdArgs *args)
+{
+    if (args->count == 2 && strcasecmp(args->tokens[1], "ON") == 0) {
+        replicate_set(1);
+    }
+    else if (args->count == 2 && strcasecmp(args->tokens[1], "OFF") == 0) {
+        replicate_set(0);
+    }
+    else if (args->count == 1) {
+        printf("CMS: Replication is %s.\n", replication_on ? "on (each OPEN publishes a snapshot)" : "off");
+    }
+    else {
+        printf("Usage: REPLICATE [ON | OFF]\n");
     }
+}
 
-    //Delete by overwriting this index with last record (O(1))
-    arr[studentIndex] = arr[arr_size - 1];
-    arr_size--;
+//============================= EXIT =============================
+static void cmd_exit(const CmdArgs *args)
+{
+    (void)args;
+    if (txn.active) {
+        printf(YELLOW "CMS Warning: Uncommitted transaction discarded.\n" RESET);
+        txn_rollback();
+    }
+    task_finish_for_exit();
+    cms_exit_requested = 1; //Leave main loop
+}
 
-    printf(GREEN "CMS: Record deleted.\n" RESET);
+//Dispatch table
+static const CommandDef command_table[] = {
+    {"OPEN",     cmd_open,     CMD_LAZY_OK | CMD_NO_TXN},
+    {"SHOW",     cmd_show,     CMD_READ},
+    {"INSERT",   cmd_insert,   0},
+    {"QUERY",    cmd_query,    CMD_LAZY_OK | CMD_READ},
+    {"NEXT",     cmd_next,     CMD_LAZY_OK | CMD_READ},
+    {"FIND",     cmd_find,     CMD_READ},
+    {"UPDATE",   cmd_update,   0},
+    {"DELETE",   cmd_delete,   0},
+    {"SAVE",     cmd_save,     CMD_NO_TXN},
+    {"ARCHIVE",  cmd_archive,  CMD_NO_TXN},
+    {"MERGE",    cmd_merge,    CMD_NO_TXN},
+    {"DIFF",     cmd_diff,     CMD_LAZY_OK | CMD_READ},
+    {"PUBLISH",  cmd_publish,  CMD_LAZY_OK | CMD_READ},
+    {"STAT",     cmd_stat,     CMD_LAZY_OK | CMD_READ},
+    {"REPLICA",  cmd_replica,  CMD_LAZY_OK | CMD_READ},
+    {"REPLICATE", cmd_replicate, CMD_LAZY_OK},
+    {"UNDO",     cmd_undo,     CMD_NO_TXN},
+    {"BEGIN",    cmd_begin,    0},
+    {"COMMIT",   cmd_commit,   0},
+    {"ROLLBACK", cmd_rollback, 0},
+    {"PREPARE",  cmd_prepare,  CMD_LAZY_OK | CMD_READ},
+    {"EXECUTE",  cmd_execute,  CMD_LAZY_OK | CMD_READ}, //the bound command applies its own flags
+    {"BENCH",    cmd_bench,    CMD_LAZY_OK | CMD_READ},
+    {"MEMORY",   cmd_memory,   CMD_LAZY_OK | CMD_READ},
+    {"COMPACT",  cmd_compact,  0},
+    {"THREADS",  cmd_threads,  CMD_LAZY_OK | CMD_READ},
+    {"TRACE",    cmd_trace,    CMD_LAZY_OK | CMD_TASK_OK | CMD_READ},
+    {"CACHE",    cmd_cache,    CMD_LAZY_OK | CMD_READ},
+    {"HISTORY",  cmd_history,  CMD_LAZY_OK},
+    {"LOG",      cmd_log,      CMD_LAZY_OK},
+    {"REPLAY",   cmd_replay,   CMD_LAZY_OK | CMD_NO_TXN},
+    {"JOBS",     cmd_jobs,     CMD_LAZY_OK | CMD_TASK_OK | CMD_READ},
+    {"WAIT",     cmd_wait,     CMD_LAZY_OK | CMD_TASK_OK | CMD_READ},
+    {"CANCEL",   cmd_cancel,   CMD_LAZY_OK | CMD_TASK_OK | CMD_READ},
+    {"HELP",     cmd_help,     CMD_LAZY_OK | CMD_TASK_OK | CMD_READ},
+    {"EXIT",     cmd_exit,     CMD_LAZY_OK | CMD_TASK_OK | CMD_READ},
+};
+#define COMMAND_COUNT (sizeof(command_table) / sizeof(command_table[0]))
+
+static uint8_t command_slots[CMD_HASH_SLOTS]; //slot -> command_table index + 1, 0 = empty
+static uint32_t command_seed = 0;
 
-    audit_log("DELETE %d | \"%s\" | \"%s\" | %.1f",
-        before.id, before.name,
-        before.programme, before.mark);
+// -----------------------------------------------------------------------------
+// FUNCTION: command_table_init
+// PURPOSE : Finds a seed for which every command word lands in its own slot
+//           (a perfect hash), so a lookup is one hash and one compare.
+//           Run once at start-up; new commands only need a table entry.
+// -----------------------------------------------------------------------------
+static void command_table_init(void)
+{
+    for (uint32_t seed = 1; ; seed++) {
+        memset(command_slots, 0, sizeof(command_slots));
+        size_t placed = 0;
+        for (; placed < COMMAND_COUNT; placed++) {
+            uint32_t slot = cmd_hash(command_table[placed].name, seed) & (CMD_HASH_SLOTS - 1);
+            if (command_slots[slot]) break; //collision, try the next seed
+            command_slots[slot] = (uint8_t)(placed + 1);
+        }
+        if (placed == COMMAND_COUNT) {
+            command_seed = seed;
+            return;
+        }
+    }
+}
 
-    //Prepare undo record
-    last_op.op = OP_DELETE;
-    last_op.before = before;
+// -----------------------------------------------------------------------------
+// FUNCTION: command_lookup
+// RETURNS : the command definition for 'word' (any case), or NULL
+// -----------------------------------------------------------------------------
+static const CommandDef *command_lookup(const char *word)
+{
+    uint8_t entry = command_slots[cmd_hash(word, command_seed) & (CMD_HASH_SLOTS - 1)];
+    if (entry && strcasecmp(command_table[entry - 1].name, word) == 0) {
+        return &command_table[entry - 1];
+    }
+    return NULL;
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: save
-// PURPOSE : Writes the current student array into a .txt file in formatted table form, with metadata.
-// DETAILS :
-//   - Opens output file in write mode
-//   - Writes database name + author list + table name
-//   - Writes table header
-//   - Writes every student record in formatted columns
-//   - Write to audit log
+// FUNCTION: run_command_def
+// PURPOSE : Runs one tokenized command: loads a lazy table if the command
+//           needs every row, applies the transaction guard and the result
+//           cache, then calls the handler.
 // -----------------------------------------------------------------------------
-void save() {
-    if (!db_opened) { //No records in memory
-        printf("CMS: No records loaded. Use OPEN <filename> first.\n");
-        return;
+static void run_command_def(const CommandDef *def, const CmdArgs *args)
+{
+    //Lazily opened table: only QUERY is answered from the offset index,
+    //every other table command loads all rows first
+    if (db_lazy && !(def->flags & CMD_LAZY_OK)) {
+        TRACE_BEGIN(span, "lazy_materialize");
+        int loaded = lazy_materialize();
+        TRACE_END(span);
+        if (!loaded) return;
     }
 
-    FILE *filePtr = fopen(FILENAME, "w"); //will overwrite existing *.txt file
-    if (filePtr == NULL) {
-        printf("Save failed.\n");
+    //A replica's table changes only through the primary's log
+    if (follow.active && !(def->flags & CMD_READ)) {
+        printf(YELLOW "CMS: %s is not available on a read-only replica (--follow).\n" RESET, def->name);
         return;
     }
 
-    //Write Metadata Headers
-    fprintf(filePtr, "Database Name: P9_3-CMS\n");
-    fprintf(filePtr, "Authors: Ryan, Glenn, Min Han, Jordan, Ben\n");
-    fprintf(filePtr, "Table Name: StudentRecords\n\n");
-
-    //Write Column Header
-    fprintf(filePtr, "%-10s %-15s %-25s %-6s\n", "ID", "Name", "Programme", "Mark");
+    //Commands that replace the table or its history wait for the open transaction
+    if (txn.active && (def->flags & CMD_NO_TXN)) {
+        printf(YELLOW "CMS: Finish the transaction with COMMIT or ROLLBACK first.\n" RESET);
+        return;
+    }
 
-    //Iterate student array and write to each row
-    for (size_t i = 0; i < arr_size; i++) {
-        fprintf(filePtr, "%-10d %-15s %-25s %-6.1f\n",
-            arr[i].id,
-            arr[i].name,
-            arr[i].programme,
-            arr[i].mark);
+    //...and for a background task; a background SAVE needs the table unchanged
+    if (task.kind != TASK_NONE && !(def->flags & CMD_TASK_OK) &&
+        (task.kind == TASK_SAVE || (def->flags & CMD_NO_TXN))) {
+        printf(YELLOW "CMS: Background %s in progress. Use JOBS, WAIT or CANCEL first.\n" RESET,
+               task.kind == TASK_SAVE ? "SAVE" : "OPEN");
+        return;
     }
 
-    fclose(filePtr);
+    //Repeated read commands with an unchanged table are answered from the result cache
+    if (result_cache_begin(args->text, db_opened)) {
+        return;
+    }
 
-    printf("CMS: Saved to \"%s\".\n", FILENAME);
+    TRACE_BEGIN(span, def->name); //one span per command, named after it
+    def->run(args);
+    TRACE_END(span);
 
-    audit_log("SAVE %s", FILENAME); //Audit Logging Purposes
+    result_cache_end(); //Store the output if this command was being cached
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: summary
-// PURPOSE : Displays class-wide statistics including:
-//           - total student count
-//           - average mark
-//           - highest mark + student name
-//           - lowest mark + student name
-// DETAILS :
-//   - Iterate through all records once
-//   - Track running total, max, min, and indices
+// FUNCTION: run_command_line
+// PURPOSE : Splits a line into ';'-separated commands (outside quotes) and
+//           runs them in order. Stops early after EXIT.
 // -----------------------------------------------------------------------------
-void summary() {
-    if (!db_opened) { //No records in memory -> cannot summarise
-        printf("No students available.\n");
-        return;
-    }
-
-    int total = arr_size; //Total number of students
-    double sum = 0.0; //Running total of all marks
-
-    //Initialise highest/lowest values using first student's mark
-    double highest = arr[0].mark;
-    double lowest  = arr[0].mark;
-    size_t hi_index = 0; //Index of student with highest mark
-    size_t lo_index = 0; //Index of student with lowest mark
-
-    // -----------------------------------------------------
-    // Scan through all records to compute statistics
-    // -----------------------------------------------------
-    for (size_t i = 0; i < arr_size; i++) {
+static void run_command_line(char *line)
+{
+    static char *storage = NULL; //token storage, grows with the longest command
+    static size_t storageCap = 0;
+
+    char *command = line;
+    while (command != NULL && !cms_exit_requested) {
+        //Find the end of this command
+        char *end = command;
+        char quote = 0;
+        while (*end && (quote || *end != ';')) {
+            quote = quote_next(quote, command, end);
+            end++;
+        }
+        char *next = *end ? end + 1 : NULL;
+        *end = '\0';
 
-        double m = arr[i].mark;
-        sum += m;     //Add mark to running sum
+        //Trim spaces/CR so rest-of-line arguments (e.g. programme) stay clean
+        while (isspace((unsigned char)*command)) command++;
+        for (size_t len = strlen(command); len > 0 && isspace((unsigned char)command[len - 1]); len--) {
+            command[len - 1] = '\0';
+        }
 
-        //Track highest mark
-        if (m > highest) {
-            highest = m;
-            hi_index = i;
+        size_t needed = strlen(command) + 1;
+        if (needed > storageCap) {
+            char *grown = realloc(storage, needed);
+            if (grown == NULL) {
+                printf(RED "CMS Error: Out of memory.\n" RESET);
+                return;
+            }
+            storage = grown;
+            storageCap = needed;
         }
 
-        //Track lowest mark
-        if (m < lowest) {
-            lowest = m;
-            lo_index = i;
+        task_poll(); //Apply a finished background task before the next command
+
+        CmdArgs args;
+        if (cmd_tokenize(command, storage, &args) > 0) { //Pressed ENTER / empty command -> skip
+            const CommandDef *def = command_lookup(args.tokens[0]);
+            if (def) {
+                run_command_def(def, &args);
+            }
+            else {
+                printf("Unknown command. Type HELP to display available commands.\n");
+            }
         }
+        command = next;
     }
+}
 
-    double average = sum / total;   //Class average
 
-    // -----------------------------------------------------
-    // Print results in colored, formatted output
-    // -----------------------------------------------------
-    printf(CYAN "===== Student Summary =====\n" RESET);
+/* ---------------------------------------------------- */
+/* Workload Replay (REPLAY)                             */
+/* ---------------------------------------------------- */
+//
+// Turns an audit log into the operator commands it records (OPEN, INSERT,
+// UPDATE, DELETE, UNDO, SAVE) and runs them again through run_command_line,
+// timing each one. The INSERT/UPDATE/DELETE prompts are answered from the
+// log entry through read_input_line.
+
+#define REPLAY_MAX_ANSWERS 4
+#define REPLAY_MAX_WAIT 2.0 //seconds; longer gaps between logged commands are shortened to this
+#define REPLAY_PROGRAMMES_MAX 256
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#define dup _dup
+#define dup2 _dup2
+#define close _close
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
 
-    printf("Total students :  %d\n", total);
+typedef enum {
+    REPLAY_OPEN, REPLAY_INSERT, REPLAY_UPDATE, REPLAY_DELETE, REPLAY_UNDO, REPLAY_SAVE, REPLAY_KINDS
+} ReplayKind;
 
-    printf("Average mark   :");
-    printf(YELLOW " % .2f\n" RESET, average);
+static const char *const replay_kind_names[REPLAY_KINDS] = {"OPEN", "INSERT", "UPDATE", "DELETE", "UNDO", "SAVE"};
 
-    printf("Highest mark   : ");
-    printf(GREEN "% .1f (%s)\n" RESET, highest, arr[hi_index].name);
+//One command of the trace. Strings are offsets into the trace's text buffer.
+typedef struct {
+    ReplayKind kind;
+    time_t timestamp;
+    size_t command;
+    size_t answers[REPLAY_MAX_ANSWERS];
+    int answerCount;
+} ReplayOp;
 
-    printf("Lowest mark    :");
-    printf(RED   " % .1f (%s)\n" RESET, lowest, arr[lo_index].name);
+typedef struct {
+    ReplayOp *ops;
+    size_t count, cap;
+    ByteBuf text;             //'\0' terminated strings
+    size_t skipped;           //log lines that are not replayable commands
 
-    printf(CYAN "===========================\n" RESET);
+    char programmes[REPLAY_PROGRAMMES_MAX][MAX_STR]; //known programmes, to split INSERT lines
+    int programmeCount;
+} ReplayTrace;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: replay_text
+// PURPOSE : Copies length bytes of text into the trace buffer.
+// RETURNS : offset of the new string, or (size_t)-1 when out of memory
+// -----------------------------------------------------------------------------
+static size_t replay_text(ReplayTrace *trace, const char *text, size_t length)
+{
+    size_t offset = trace->text.length;
+    if (!bytebuf_put(&trace->text, text, length) || !bytebuf_put(&trace->text, "", 1)) return (size_t)-1;
+    return offset;
 }
 
 // -----------------------------------------------------------------------------
-// FUNCTION: undo
-// PURPOSE : Reverts the last modifying operation.
-// SUPPORTS:
-//   - Undo INSERT: remove the last inserted student
-//   - Undo DELETE: reinsert the deleted student
-//   - Undo UPDATE: restore record to previous state
-//
-// NOTES:
-//   - Only ONE level of undo is supported
-//   - last_op struct stores the type of operation,
-//     and before/after student snapshots
+// FUNCTION: replay_add_programme
+// PURPOSE : Remembers a programme name (case-insensitive, no duplicates).
 // -----------------------------------------------------------------------------
-void undo() {
-    //If no operation to undo
-    if (last_op.op == OP_NONE) {
-        printf(YELLOW "CMS: Nothing to undo.\n" RESET);
-        return;
+static void replay_add_programme(ReplayTrace *trace, const char *programme, size_t length)
+{
+    if (length == 0 || length >= MAX_STR || trace->programmeCount == REPLAY_PROGRAMMES_MAX) return;
+    for (int i = 0; i < trace->programmeCount; i++) {
+        if (strlen(trace->programmes[i]) == length && strncasecmp(trace->programmes[i], programme, length) == 0) return;
     }
+    memcpy(trace->programmes[trace->programmeCount], programme, length);
+    trace->programmes[trace->programmeCount++][length] = '\0';
+}
 
-    //Visual header
-    printf("\n" BOLD "===== Performing UNDO operation =====" RESET "\n");
+// -----------------------------------------------------------------------------
+// FUNCTION: replay_split_insert
+// PURPOSE : "INSERT <id> "<name>" "<programme>" <mark>" splits on the
+//           quotes. Older logs wrote "INSERT <id> <name words> <programme
+//           words> <mark>", which does not mark where the name ends: takes
+//           the longest trailing run of words that is a known programme;
+//           otherwise splits the words in half.
+// RETURNS : 1 -> split into the four INSERT answers, 0 -> malformed
+// -----------------------------------------------------------------------------
+static int replay_split_insert(ReplayTrace *trace, const char *message, size_t length, ReplayOp *op)
+{
+    const char *fields[2];
+    size_t fieldLengths[2];
+    if (log_quoted_fields(message, length, fields, fieldLengths, 2) == 2) {
+        const char *id = message + 7;
+        size_t idLength = (size_t)(fields[0] - 2 - id);
+        const char *mark = fields[1] + fieldLengths[1] + 1;
+        while (mark < message + length && *mark == ' ') mark++;
+
+        op->answers[0] = replay_text(trace, id, idLength);
+        op->answers[1] = replay_text(trace, fields[0], fieldLengths[0]);
+        op->answers[2] = replay_text(trace, fields[1], fieldLengths[1]);
+        op->answers[3] = replay_text(trace, mark, (size_t)(message + length - mark));
+        op->answerCount = 4;
+        op->command = replay_text(trace, "INSERT", 6);
+        return 1;
+    }
 
-    //Print table headers
-    printf(BOLD CYAN "%-10s %-20s %-30s %-6s\n" RESET, "ID", "Name", "Programme", "Mark");
+    const char *words[64];
+    size_t lengths[64];
+    int count = 0;
+    const char *p = message;
+    const char *end = message + length;
+
+    while (p < end && count < 64) {
+        while (p < end && *p == ' ') p++;
+        if (p == end) break;
+        words[count] = p;
+        while (p < end && *p != ' ') p++;
+        lengths[count] = (size_t)(p - words[count]);
+        count++;
+    }
+    if (count < 5) return 0; //INSERT, id, name, programme, mark
+
+    //Words 2 .. count-2 are name + programme
+    int first = 2, last = count - 2;
+    int programmeStart = -1;
+    for (int start = first + 1; start <= last && programmeStart < 0; start++) {
+        size_t programmeLength = (size_t)(words[last] + lengths[last] - words[start]);
+        for (int i = 0; i < trace->programmeCount; i++) {
+            if (strlen(trace->programmes[i]) == programmeLength &&
+                strncasecmp(trace->programmes[i], words[start], programmeLength) == 0) {
+                programmeStart = start;
+                break;
+            }
+        }
+    }
+    if (programmeStart < 0) {
+        programmeStart = first + (last - first + 2) / 2;
+    }
 
-    printf(CYAN "------------------------------------------------------------------\n" RESET);
+    const char *name = words[first];
+    size_t nameLength = (size_t)(words[programmeStart - 1] + lengths[programmeStart - 1] - name);
+    const char *programme = words[programmeStart];
+    size_t programmeLength = (size_t)(words[last] + lengths[last] - programme);
+
+    op->answers[0] = replay_text(trace, words[1], lengths[1]);
+    op->answers[1] = replay_text(trace, name, nameLength);
+    op->answers[2] = replay_text(trace, programme, programmeLength);
+    op->answers[3] = replay_text(trace, words[count - 1], lengths[count - 1]);
+    op->answerCount = 4;
+    op->command = replay_text(trace, "INSERT", 6);
+    return 1;
+}
 
-    // -------------------------------------------------------------------------
-    // CASE 1: Undo INSERT -> Remove the record that was inserted
-    // -------------------------------------------------------------------------
-    if (last_op.op == OP_INSERT) {
+// -----------------------------------------------------------------------------
+// FUNCTION: replay_load
+// PURPOSE : Reads an audit log into a trace. dataset != NULL -> every logged
+//           OPEN opens that file instead. withSave == 0 -> SAVE entries are
+//           skipped (SAVE always writes FILENAME).
+// RETURNS : 1 -> loaded, 0 -> cannot read the log
+// -----------------------------------------------------------------------------
+static int replay_load(ReplayTrace *trace, const char *logPath, const char *dataset, int withSave)
+{
+    FILE *file = fopen(logPath, "rb");
+    if (file == NULL) {
+        printf(RED "CMS Error: Cannot open log \"%s\".\n" RESET, logPath);
+        return 0;
+    }
 
-        //Locate the inserted record using its ID
-        int i = find_index_by_id(last_op.after.id);
+    //Programmes already in the table help split INSERT lines
+    for (size_t i = 0; i < db.size && trace->programmeCount < REPLAY_PROGRAMMES_MAX; i++) {
+        const char *programme = row_at(i)->programme;
+        replay_add_programme(trace, programme, strlen(programme));
+    }
 
-        //Only undo if the record is still present
-        if (i >= 0 && arr_size > 0) {
+    //Pass 1: programmes named in UPDATE/DELETE entries are unambiguous (quoted)
+    for (int pass = 1; pass <= 2; pass++) {
+        LineReader reader;
+        rewind(file);
+        if (!line_reader_init(&reader, file)) {
+            fclose(file);
+            return 0;
+        }
 
-            printf(YELLOW "Removed record:\n" RESET);
-            print_student_record(&arr[i]);
+        const char *line, *message;
+        size_t lineLength, messageLength;
+        long long lineStart;
+        time_t timestamp;
+        while (line_reader_next(&reader, &line, &lineLength, &lineStart)) {
+            if (!log_line_parse(line, lineLength, &timestamp, &message, &messageLength)) {
+                if (pass == 2 && lineLength > 0) trace->skipped++;
+                continue;
+            }
 
-            //Delete using swap-delete for O(1) removal
-            arr[i] = arr[arr_size - 1];
-            arr_size--;
+            if (messageLength > 9 && strncmp(message, "SNAPSHOT ", 9) == 0) {
+                continue; //replica starting point written after an OPEN, not a command
+            }
 
-            printf(GREEN "CMS: Undo INSERT successful (Record ID %d removed).\n" RESET, last_op.after.id);
+            const char *fields[4];
+            size_t fieldLengths[4];
+            int isUpdate = messageLength > 7 && strncmp(message, "UPDATE ", 7) == 0;
+            int isDelete = messageLength > 7 && strncmp(message, "DELETE ", 7) == 0;
+
+            if (pass == 1) {
+                int found = (isUpdate || isDelete) ? log_quoted_fields(message, messageLength, fields, fieldLengths, 4) : 0;
+                if (isUpdate && found == 4) {
+                    replay_add_programme(trace, fields[2], fieldLengths[2]);
+                    replay_add_programme(trace, fields[3], fieldLengths[3]);
+                } else if (isDelete && found == 2) {
+                    replay_add_programme(trace, fields[1], fieldLengths[1]);
+                }
+                continue;
+            }
 
-            audit_log("UNDO INSERT (ID %d removed)", last_op.after.id);
-        }
-        else {
-            printf(RED "CMS Error: Undo failed. Record ID %d not found.\n" RESET, last_op.after.id);
+            if (trace->count == trace->cap) {
+                size_t newCap = trace->cap ? trace->cap * 2 : 256;
+                ReplayOp *grown = realloc(trace->ops, newCap * sizeof(ReplayOp));
+                if (grown == NULL) break;
+                trace->ops = grown;
+                trace->cap = newCap;
+            }
+            ReplayOp *op = &trace->ops[trace->count];
+            memset(op, 0, sizeof(*op));
+            op->timestamp = timestamp;
+
+            //The ID after "UPDATE "/"DELETE "
+            const char *id = message + 7;
+            size_t idLength = 0;
+            while (7 + idLength < messageLength && id[idLength] >= '0' && id[idLength] <= '9') idLength++;
+
+            char command[MAX_STR * 2 + 32];
+            int ok = 1;
+
+            if (messageLength > 5 && strncmp(message, "OPEN ", 5) == 0) {
+                const char *name = message + 5;
+                const char *nameEnd = message + messageLength;
+                int lazyOpen = messageLength > 10 && strncmp(name, "LAZY ", 5) == 0;
+                if (lazyOpen) name += 5;
+                for (const char *q = nameEnd - 1; q > name; q--) {
+                    if (q[0] == '(' && q[-1] == ' ') { nameEnd = q - 1; break; } //drop " (n records)"
+                }
+                op->kind = REPLAY_OPEN;
+                if (dataset) {
+                    snprintf(command, sizeof(command), "OPEN %s\"%s\"", lazyOpen ? "LAZY " : "", dataset);
+                } else {
+                    snprintf(command, sizeof(command), "OPEN %s\"%.*s\"", lazyOpen ? "LAZY " : "", (int)(nameEnd - name), name);
+                }
+                op->command = replay_text(trace, command, strlen(command));
+            }
+            else if (messageLength > 7 && strncmp(message, "INSERT ", 7) == 0) {
+                op->kind = REPLAY_INSERT;
+                ok = replay_split_insert(trace, message, messageLength, op);
+            }
+            else if (isUpdate && idLength > 0) {
+                //"UPDATE id | "n1" -> "n2" | "p1" -> "p2" | m1 -> m2"; older logs have only the ID
+                op->kind = REPLAY_UPDATE;
+                snprintf(command, sizeof(command), "UPDATE %.*s", (int)idLength, id);
+                op->command = replay_text(trace, command, strlen(command));
+
+                const char *newMark = "";
+                size_t newMarkLength = 0;
+                const char *arrow = NULL;
+                for (const char *q = message + messageLength - 3; q > message; q--) {
+                    if (memcmp(q, "-> ", 3) == 0) { arrow = q; break; }
+                }
+                if (log_quoted_fields(message, messageLength, fields, fieldLengths, 4) == 4 && arrow != NULL) {
+                    newMark = arrow + 3;
+                    newMarkLength = (size_t)(message + messageLength - newMark);
+                    op->answers[0] = replay_text(trace, fields[1], fieldLengths[1]);
+                    op->answers[1] = replay_text(trace, fields[3], fieldLengths[3]);
+                } else {
+                    op->answers[0] = replay_text(trace, "", 0); //Enter -> keep
+                    op->answers[1] = replay_text(trace, "", 0);
+                }
+                op->answers[2] = replay_text(trace, newMark, newMarkLength);
+                op->answers[3] = replay_text(trace, "Y", 1);
+                op->answerCount = 4;
+            }
+            else if (isDelete && idLength > 0) {
+                op->kind = REPLAY_DELETE;
+                snprintf(command, sizeof(command), "DELETE %.*s", (int)idLength, id);
+                op->command = replay_text(trace, command, strlen(command));
+                op->answers[0] = replay_text(trace, id, idLength); //type the ID to confirm
+                op->answerCount = 1;
+            }
+            else if (messageLength >= 4 && strncmp(message, "UNDO", 4) == 0) {
+                op->kind = REPLAY_UNDO;
+                op->command = replay_text(trace, "UNDO", 4);
+            }
+            else if (withSave && messageLength >= 4 && strncmp(message, "SAVE", 4) == 0) {
+                op->kind = REPLAY_SAVE;
+                op->command = replay_text(trace, "SAVE", 4);
+            }
+            else {
+                ok = 0; //COMMIT summary, ARCHIVE, ROLLBACK, ... are not operator commands
+            }
 
-            audit_log("UNDO INSERT failed (ID %d not found)", last_op.after.id);
+            if (!ok || op->command == (size_t)-1) {
+                trace->skipped++;
+                continue;
+            }
+            trace->count++;
         }
+        line_reader_free(&reader);
     }
 
-    // -------------------------------------------------------------------------
-    // CASE 2: Undo DELETE -> Re-insert the previously deleted record
-    // -------------------------------------------------------------------------
-    else if (last_op.op == OP_DELETE) {
-        //Ensure enough memory in array before inserting deleted student
-        ensure_cap();
-
-        //Reinsert deleted student
-        arr[arr_size] = last_op.before;
-        arr_size++;
+    fclose(file);
+    return 1;
+}
 
-        printf(GREEN "Re-inserted record:\n" RESET);
-        print_student_record(&last_op.before);
+// -----------------------------------------------------------------------------
+// FUNCTION: compare_double
+// -----------------------------------------------------------------------------
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
 
-        printf(GREEN "CMS: Undo DELETE successful (Record ID %d re-inserted).\n" RESET, last_op.before.id);
+// -----------------------------------------------------------------------------
+// FUNCTION: replay_workload
+// PURPOSE : REPLAY <log> [ON <data file>] [FAST | SPEED <x>] [SAVES] [VERBOSE].
+//           speed <= 0 -> as fast as possible, otherwise the logged gaps
+//           between commands are divided by speed (capped at
+//           REPLAY_MAX_WAIT). Command output is discarded unless verbose.
+//           Prints count, mean and percentile latency per operation.
+// -----------------------------------------------------------------------------
+static void replay_workload(const char *logPathArg, const char *datasetArg, double speed, int withSave, int verbose)
+{
+    //The replayed commands reuse the token storage the arguments point into
+    char logPath[256], datasetCopy[256];
+    const char *dataset = datasetArg ? datasetCopy : NULL;
+    snprintf(logPath, sizeof(logPath), "%s", logPathArg);
+    if (datasetArg) snprintf(datasetCopy, sizeof(datasetCopy), "%s", datasetArg);
+
+    if (db_opened && table_unsaved) { //the replay replaces the table
+        printf(YELLOW "CMS: The table has unsaved changes. SAVE them (or OPEN the file again) before REPLAY.\n" RESET);
+        return;
+    }
 
-        audit_log("UNDO DELETE (ID %d re-inserted)", last_op.before.id);
+    ReplayTrace *trace = calloc(1, sizeof(ReplayTrace));
+    if (trace == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        return;
     }
 
-    // -------------------------------------------------------------------------
-    // CASE 3: Undo UPDATE -> Restore the BEFORE state
-    // -------------------------------------------------------------------------
-    else if (last_op.op == OP_UPDATE) {
+    //The replayed commands are not the operator's: they stay out of the audit
+    //log (HISTORY, AS OF, replicas); one REPLAY entry afterwards records the run
+    log_state.suspended = 1;
+    if (dataset && !open_db(dataset)) {
+        log_state.suspended = 0;
+        free(trace);
+        return;
+    }
+    if (!replay_load(trace, logPath, dataset, withSave) || trace->count == 0) {
+        if (trace->count == 0) printf("CMS: No replayable commands in \"%s\".\n", logPath);
+        log_state.suspended = 0;
+        if (dataset) audit_log("REPLAY %s (0 commands)", logPath); //ON <file> was opened
+        free(trace->ops);
+        free(trace->text.data);
+        free(trace);
+        return;
+    }
 
-        //Find the record using ID from the "after" snapshot
-        //because the user might have edited the name/programme
-        int i = find_index_by_id(last_op.after.id);
+    double *latencies = malloc(trace->count * sizeof(double));
+    size_t *kindCount = calloc(REPLAY_KINDS, sizeof(size_t));
+    char *line = malloc(MAX_STR * 2 + 32);
+    if (latencies == NULL || kindCount == NULL || line == NULL) {
+        printf(RED "CMS Error: Out of memory.\n" RESET);
+        log_state.suspended = 0;
+        if (dataset) audit_log("REPLAY %s (0 commands)", logPath);
+        free(latencies); free(kindCount); free(line);
+        free(trace->ops); free(trace->text.data); free(trace);
+        return;
+    }
 
-        if (i >= 0) {
+    //Send command output to the null device while replaying
+    int savedStdout = -1;
+    if (!verbose) {
+        fflush(stdout);
+        FILE *sink = fopen(NULL_DEVICE, "w");
+        savedStdout = dup(fileno(stdout));
+        if (sink && savedStdout >= 0) dup2(fileno(sink), fileno(stdout));
+        if (sink) fclose(sink);
+    }
 
-            printf(YELLOW "Restoring record from state before update:\n" RESET);
-            print_student_record(&last_op.before);
+    double started = now_seconds();
+    double inCommands = 0.0;
+    for (size_t i = 0; i < trace->count && !cms_exit_requested; i++) {
+        const ReplayOp *op = &trace->ops[i];
 
-            //Restore original version
-            arr[i] = last_op.before;
+        if (speed > 0.0 && i > 0) {
+            double wait = difftime(op->timestamp, trace->ops[i - 1].timestamp) / speed;
+            sleep_seconds(wait < REPLAY_MAX_WAIT ? wait : REPLAY_MAX_WAIT);
+        }
 
-            printf(GREEN "CMS: Undo UPDATE successful (Record ID %d reverted).\n" RESET, last_op.before.id);
+        const char *answers[REPLAY_MAX_ANSWERS + 1];
+        for (int a = 0; a < op->answerCount; a++) answers[a] = (const char *)trace->text.data + op->answers[a];
+        snprintf(line, MAX_STR * 2 + 32, "%s", (const char *)trace->text.data + op->command);
 
-            audit_log("UNDO UPDATE (ID %d restored)", last_op.before.id);
-        }
-        else {
+        scripted_input.answers = answers; //non-NULL even without answers: never read stdin
+        scripted_input.count = (size_t)op->answerCount;
+        scripted_input.next = 0;
 
-            printf(RED "CMS Error: Undo failed. Record ID %d not found.\n" RESET, last_op.after.id);
+        double t0 = now_seconds();
+        run_command_line(line);
+        latencies[i] = now_seconds() - t0;
+        inCommands += latencies[i];
 
-            audit_log("UNDO UPDATE failed (ID %d not found)", last_op.after.id);
-        }
+        scripted_input.answers = NULL;
+        kindCount[op->kind]++;
     }
+    double elapsed = now_seconds() - started;
 
-    //Clear undo history so cannot undo twice
-    printf(BOLD "====================================" RESET "\n");
+    if (savedStdout >= 0) {
+        fflush(stdout);
+        dup2(savedStdout, fileno(stdout));
+        close(savedStdout);
+    }
+    log_state.suspended = 0;
+    audit_log("REPLAY %s (%zu commands)", logPath, trace->count); //the table was replaced, like an OPEN
+    snapshot_publish();
+
+    //Group latencies by kind for the percentiles
+    size_t start[REPLAY_KINDS], fill[REPLAY_KINDS], replayed = 0;
+    for (int k = 0; k < REPLAY_KINDS; k++) {
+        start[k] = fill[k] = replayed;
+        replayed += kindCount[k];
+    }
+    double *grouped = malloc((replayed ? replayed : 1) * sizeof(double));
+    for (size_t i = 0; i < replayed && grouped; i++) {
+        grouped[fill[trace->ops[i].kind]++] = latencies[i];
+    }
 
-    last_op.op = OP_NONE;
+    printf(CYAN "===== Replay =====\n" RESET);
+    printf("Trace          : %s (%zu commands, %zu lines skipped)\n", logPath, trace->count, trace->skipped);
+    printf("Dataset        : %s\n", dataset ? dataset : "files named in the log");
+    if (speed > 0.0) {
+        printf("Mode           : time-scaled x%.2f (gaps capped at %.1f s)\n", speed, REPLAY_MAX_WAIT);
+    } else {
+        printf("Mode           : as fast as possible\n");
+    }
+    printf("Replayed       : %zu commands in %.3f s (%.3f s in commands)\n", replayed, elapsed, inCommands);
+    if (inCommands > 0.0) {
+        printf("Throughput     : %.0f commands/s\n", (double)replayed / inCommands);
+    }
+    printf("%-10s %8s %12s %12s %12s %12s %12s\n", "Operation", "Count", "Mean(us)", "p50(us)", "p95(us)", "p99(us)", "Max(us)");
+    for (int k = 0; k < REPLAY_KINDS && grouped; k++) {
+        size_t n = kindCount[k];
+        if (n == 0) continue;
+        double *sample = grouped + start[k];
+        double total = 0.0;
+        for (size_t i = 0; i < n; i++) total += sample[i];
+        qsort(sample, n, sizeof(double), compare_double);
+        printf("%-10s %8zu %12.1f %12.1f %12.1f %12.1f %12.1f\n", replay_kind_names[k], n,
+               total / (double)n * 1e6,
+               sample[(n - 1) * 50 / 100] * 1e6,
+               sample[(n - 1) * 95 / 100] * 1e6,
+               sample[(n - 1) * 99 / 100] * 1e6,
+               sample[n - 1] * 1e6);
+    }
+    printf(CYAN "==================\n" RESET);
+
+    free(grouped);
+    free(latencies);
+    free(kindCount);
+    free(line);
+    free(trace->ops);
+    free(trace->text.data);
+    free(trace);
 }
 
+// -----------------------------------------------------------------------------
+// FUNCTION: read_command_line
+// PURPOSE : Reads one line of any length from stdin into a growing buffer
+//           (newline removed).
+// RETURNS : 1 -> line read, 0 -> EOF
+// -----------------------------------------------------------------------------
+static int read_command_line(char **buffer, size_t *cap)
+{
+    size_t length = 0;
+
+    while (1) {
+        if (*cap - length < 2) {
+            size_t newCap = *cap ? *cap * 2 : 256;
+            char *grown = realloc(*buffer, newCap);
+            if (grown == NULL) return 0;
+            *buffer = grown;
+            *cap = newCap;
+        }
+        if (!fgets(*buffer + length, (int)(*cap - length), stdin)) {
+            if (length == 0) return 0; //If input fails (EOF), exit loop
+            break;
+        }
+        length += strlen(*buffer + length);
+        if (length > 0 && (*buffer)[length - 1] == '\n') {
+            (*buffer)[--length] = '\0'; //Remove trailing newline
+            break;
+        }
+    }
+    return 1;
+}
 
 /* ---------------------------------------------------- */
 /* Command Loop                                         */
@@ -1294,20 +12904,24 @@ void undo() {
 // FUNCTION: main
 // PURPOSE : Interactive CMS main loop. Waits for user input, identifies the command, and calls the appropriate function.
 // DETAILS :
-//   - Reads and parses commands like OPEN, SHOW, INSERT, DELETE, UPDATE, etc.
-//   - Supports multi-word commands using sscanf()
-//   - Uses strcasecmp() for case-insensitive matching
+//   - Reads lines of any length; ';' separates several commands on one line
+//   - Tokenizes each command once and dispatches through command_table
+//     (perfect hash, case-insensitive)
 //   - Runs until user types EXIT
 // -----------------------------------------------------------------------------
-int main(void) {
+int main(int argc, char **argv) {
     // -------------------------------------------------------------------------
-    // Variable Buffers for reading user commands and breaking them into components
+    // Buffer for the line typed by the user (grows for long pipelines)
     // -------------------------------------------------------------------------
-    char userBuffer[256]; //Full line typed by user
-    char command[64];     //First word of command
-    char arg1[64];        //Optional argument 1
-    char arg2[64];        //Optional argument 2
-    char arg3[64];        //Optional argument 3
+    char *userBuffer = NULL;
+    size_t userBufferCap = 0;
+
+    //--follow: read-only replica of the CMS whose log is in this directory
+    int followMode = argc == 2 && strcmp(argv[1], "--follow") == 0;
+    if (argc > 1 && !followMode) {
+        printf("Usage: %s [--follow]\n", argv[0]);
+        return 1;
+    }
 
     //For printing current time
     time_t now = time(NULL); //Get current time
@@ -1346,249 +12960,40 @@ int main(void) {
     // -------------------------------------------------------------------------
     // MAIN COMMAND LOOP
     // -------------------------------------------------------------------------
-    while (1) {
+    command_table_init();
+    thread_mutex_init(&chunk_pool_lock);
+    TRACE_INIT();
+    TRACE_THREAD_NAME("REPL");
+    signal(SIGINT, handle_interrupt); //Ctrl-C cancels a background task
+    if (followMode && !follow_start()) {
+        return 1;
+    }
+
+    while (!cms_exit_requested) {
         //Will always display the prompt "P9_3>"
         printf("P9_3> ");
 
-        if (!fgets(userBuffer, sizeof(userBuffer), stdin)) //User Input
+        if (!read_command_line(&userBuffer, &userBufferCap)) //User Input
         {
             break; //If input fails (EOF), exit loop
         }
-        userBuffer[strcspn(userBuffer, "\n")] = '\0'; //Remove trailing newline
-
-        //Reset command buffers before parsing
-        command[0] = arg1[0] = arg2[0] = arg3[0] = '\0';
-
-        // ---------------------------------------------------------------------
-        // Parse up to 4 tokens (command + 3 arguments)
-        // Example: SHOW ALL SORT BY MARK DESC
-        // Will map to:
-        //    command = "SHOW"
-        //    arg1    = "ALL"
-        //    arg2    = "SORT"
-        //    arg3    = "BY"
-        // ---------------------------------------------------------------------
-        int commandArgCount = sscanf(userBuffer, "%63s %63s %63s %63s", command, arg1, arg2, arg3);
-
-        //Pressed ENTER -> restart loop
-        if (commandArgCount < 1) continue;
-
-        // ---------------------------------------------------------------------
-        // COMMAND DISPATCHER
-        // ---------------------------------------------------------------------
-
-        //============================= OPEN =============================
-        if (strcasecmp(command, "OPEN") == 0) {
-            if (commandArgCount >= 2) { //OPEN <filename>
-                open_db(arg1);
-            }
-            else {
-                printf("Usage: OPEN filename\n");
-            }
-        }
-
-        //============================= SHOW =============================
-        else if (strcasecmp(command, "SHOW") == 0) {
-            //Case 1: SHOW ALL
-            if (strcasecmp(arg1, "ALL") == 0) {
-
-                //Case 1a: SHOW ALL SORT BY <field> <order>
-                if (strcasecmp(arg2, "SORT") == 0 && strcasecmp(arg3, "BY") == 0) {
-                    
-                    char field[16] = "\0";
-                    char order[16] = "\0";
-
-                    //Extract field + order from the rest of the text input
-                    int numOfArgs = sscanf(userBuffer, "%*s %*s %*s %*s %15s %15s", field, order);
-
-                    if (numOfArgs >= 1) {
-                        //Convert field and order into uppercase
-                        for (int i = 0; field[i]; i++) {
-                            field[i] = toupper(field[i]);
-                        }
-
-                        for (int j = 0; order[j]; j++) {
-                            order[j] = toupper(order[j]);
-                        }
-
-                        //If order provided -> use it
-                        if (order[0]) {
-                            showSorted(field, order);
-                        }
-                        else {
-                            showSorted(field, "ASC"); //default to ASC
-                        }
-                    }
-                }
-                //Case 1b: SHOW ALL
-                else {
-                    show_all();
-                }
-            }
-
-            //Case 2: SHOW SUMMARY
-            else if (strcasecmp(arg1, "SUMMARY") == 0) {
-                summary();
-            }
-
-            else {
-                printf("Usage: SHOW ALL | SHOW SUMMARY | SHOW ALL SORT BY ...\n");
-            }
-        }
-
-        //============================= INSERT =============================
-        else if (strcasecmp(command, "INSERT") == 0) {
-
-            Student s;
-
-            // Guard: make sure some database is loaded
-            if (!db_opened) {
-                printf("CMS: No records loaded. Use OPEN <filename> first.\n");
-                continue;
-            }
-
-            // --- ID: must be 7 digits and unique ---
-            s.id = read_valid_id();
-            if (s.id < 0) {
-                // EOF / input error
-                continue;
-            }
-
-            // --- Name: must not be empty ---
-            if (!read_nonempty_field("Name", s.name, MAX_STR)) {
-                continue;   // EOF
-            }
-
-            // --- Programme: must not be empty ---
-            if (!read_nonempty_field("Programme", s.programme, MAX_STR)) {
-                continue;   // EOF
-            }
-
-            // --- Mark: must be numeric 0–100 and not empty ---
-            s.mark = read_valid_mark();
-            if (s.mark < 0.0f) {
-                continue;   // EOF
-            }
-
-            // Insert record into array (insert_record still logs + sets undo)
-            insert_record(s);
-        }
-
-        //============================= QUERY =============================
-        else if (strcasecmp(command, "QUERY") == 0) {
-
-            if (commandArgCount >= 2) {
-                const char *q = arg1;
-                size_t len = strlen(q);
-
-                // Must be all digits
-                if (!is_all_digits(q)) {
-                    printf("Enter at least 4 digits for ID search.\n");
-                    continue;
-                }
-
-                // Too short
-                if (len < 4) {
-                    printf("Enter at least 4 digits for ID search.\n");
-                    continue;
-                }
-
-                // Full 7-digit ID -> exact match
-                if (len == 7) {
-                    int id = atoi(q);
-                    query(id);
-                }
-                // 4–6 digits -> prefix search
-                else {
-                    query_prefix(q);
-                }
-            }
-            else {
-                printf("Usage: QUERY <ID>\n");
-            }
-        }
-
-        //============================= UPDATE =============================
-        else if (strcasecmp(command, "UPDATE") == 0) {
-
-            if (commandArgCount >= 2) {
-                int id;
-                if (!parse_exact_id_arg(arg1, &id)) {
-                    // invalid ID, message already printed
-                    continue;
-                }
-                update(id);
-            }
-            else {
-                printf("Usage: UPDATE <ID>\n");
-            }
-        }
-
-
-        //============================= DELETE =============================
-        else if (strcasecmp(command, "DELETE") == 0) {
-
-            if (commandArgCount >= 2) {
-                int id;
-
-                // Require exactly 7 numeric digits
-                if (!parse_exact_id_arg(arg1, &id)) {
-                    // Invalid input, message already printed
-                    continue;
-                }
-
-                delete(id);
-            }
-            else {
-                printf("Usage: DELETE <ID>\n");
-            }
-        }
-
-        //============================= SAVE =============================
-        else if (strcasecmp(command, "SAVE") == 0) {
-
-            save();
-        }
 
-        //============================= UNDO =============================
-        else if (strcasecmp(command, "UNDO") == 0) {
-
-            undo();
-        }
-
-        //============================= HELP =============================
-        else if (strcasecmp(command, "HELP") == 0) {
-
-            printf("Commands:\n"
-                   "OPEN <file>\n"
-                   "SHOW ALL\n"
-                   "SHOW ALL SORT BY ID|MARK ASC|DESC\n"
-                   "SHOW SUMMARY\n"
-                   "INSERT\n"
-                   "QUERY <ID>\n"
-                   "UPDATE <ID>\n"
-                   "DELETE <ID>\n"
-                   "SAVE\n"
-                   "UNDO\n"
-                   "EXIT\n");
-        }
-
-        //============================= EXIT =============================
-        else if (strcasecmp(command, "EXIT") == 0) {
-
-            break; //Leave main loop
-        }
-
-        //============================= UNKNOWN =============================
-        else {
-
-            printf("Unknown command. Type HELP to display available commands.\n");
-        }
+        //A replica applies the primary's log between commands, never during one
+        if (follow.active) thread_mutex_lock(&follow.lock);
+        run_command_line(userBuffer);
+        if (follow.active) thread_mutex_unlock(&follow.lock);
     }
-    free(arr); //Free student array before exit
+    follow_stop();
+    task_finish_for_exit(); //EOF with a task still running
+    free(userBuffer);
+    for (int i = 0; i < PREPARED_MAX; i++) {
+        prepared_free(&prepared[i]);
+    }
+    result_cache_clear();
+    publish_stop(0); //readers keep the snapshot they have mapped
+    pool_stop();
+    store_clear(&db); //Free student table before exit
+    chunk_pool_trim();
 
     return 0;
 }
-
-
-
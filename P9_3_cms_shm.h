@@ -0,0 +1,225 @@
+// =============================================================================
+// P9_3_cms_shm.h - reader side of the CMS shared-memory snapshot (PUBLISH)
+//
+// Header-only: #include it in a C program that wants to read the table the
+// CMS published, without parsing the text database. POSIX only (Linux,
+// macOS); link with -lrt on glibc older than 2.34.
+//
+// Usage (see P9_3_shm_reader.c for a complete example):
+//
+//     CmsShmReader reader;
+//     CmsShmView view;
+//     if (cms_shm_open(&reader, "/P9_3-CMS") != 0) ... //errno says why
+//     do {
+//         if (cms_shm_begin(&reader, &view) != 0) ...   //nothing published yet
+//         for (uint64_t i = 0; i < view.count; i++) ... view.records[i] ...
+//     } while (!cms_shm_end(&reader, &view));           //rewritten meanwhile: scan again
+//     cms_shm_close(&reader);
+//
+// The records are read in place (zero-copy). The CMS writes the next
+// snapshot into the other slot, so a scan only has to be repeated when two
+// publishes happen during it. Values read before cms_shm_end() returns 1
+// must not be trusted (a string may be half written).
+//
+// The layout must match the one in P9_3_cms.c (Shared-Memory Snapshot).
+// =============================================================================
+#ifndef P9_3_CMS_SHM_H
+#define P9_3_CMS_SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CMS_SHM_DEFAULT_NAME   "/P9_3-CMS"
+#define CMS_SHM_MAGIC          0x43333950u //"P93C"
+#define CMS_SHM_LAYOUT_VERSION 1
+#define CMS_SHM_MAX_STR        128         //MAX_STR in P9_3_cms.c
+#define CMS_SHM_REOPEN_TRIES   100         //a replaced segment is recreated right away
+#define CMS_SHM_SPIN_LIMIT     1000000     //retries before giving up on a stuck writer
+
+//One published record
+typedef struct {
+    int32_t id;
+    float mark;
+    char name[CMS_SHM_MAX_STR];      //'\0' terminated
+    char programme[CMS_SHM_MAX_STR]; //'\0' terminated
+} CmsShmRecord;
+
+//One snapshot slot
+typedef struct {
+    uint64_t seq;        //seqlock: odd while the slot is written
+    uint64_t generation; //publish that filled the slot
+    uint64_t count;      //records in the slot
+    uint64_t offset;     //byte offset of the records from the segment start
+    int64_t published;   //time of the publish (seconds since epoch)
+} CmsShmSlot;
+
+typedef struct {
+    uint32_t magic;      //CMS_SHM_MAGIC once the header is ready
+    uint32_t layout;     //CMS_SHM_LAYOUT_VERSION
+    uint32_t recordSize; //sizeof(CmsShmRecord)
+    uint32_t retired;    //1 -> replaced by a bigger segment: reopen by name
+    uint64_t capacity;   //records per slot
+    uint64_t seq;        //seqlock over active / generation
+    uint64_t active;     //slot readers should use
+    uint64_t generation; //latest publish (0 -> nothing published yet)
+    CmsShmSlot slots[2];
+} CmsShmHeader;
+
+//An open segment
+typedef struct {
+    char name[64];
+    const unsigned char *base; //read-only mapping
+    size_t bytes;
+} CmsShmReader;
+
+//One snapshot, valid until cms_shm_end() says otherwise
+typedef struct {
+    const CmsShmRecord *records;
+    uint64_t count;
+    uint64_t generation; //increases with every PUBLISH
+    int64_t published;   //time of the PUBLISH
+    int slot;
+    uint64_t seq;        //slot counter when the view was taken
+} CmsShmView;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: cms_shm_close
+// -----------------------------------------------------------------------------
+static inline void cms_shm_close(CmsShmReader *reader)
+{
+    if (reader->base != NULL) munmap((void *)reader->base, reader->bytes);
+    reader->base = NULL;
+    reader->bytes = 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: cms_shm_open
+// PURPOSE : Maps a published segment read-only.
+// RETURNS : 0 -> open, -1 -> failed (errno: ENOENT nothing published under
+//           that name, EPROTO segment from another CMS version, ...)
+// -----------------------------------------------------------------------------
+static inline int cms_shm_open(CmsShmReader *reader, const char *name)
+{
+    memset(reader, 0, sizeof(*reader));
+    strncpy(reader->name, name, sizeof(reader->name) - 1);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return -1;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CmsShmHeader)) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    void *base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+
+    reader->base = base;
+    reader->bytes = (size_t)info.st_size;
+
+    const CmsShmHeader *header = base;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != CMS_SHM_MAGIC ||
+        header->layout != CMS_SHM_LAYOUT_VERSION || header->recordSize != sizeof(CmsShmRecord)) {
+        cms_shm_close(reader);
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: cms_shm_begin
+// PURPOSE : Takes the latest snapshot. Reopens the segment first if the CMS
+//           replaced it with a bigger one.
+// RETURNS : 0 -> *view is set, -1 -> failed (errno: EAGAIN nothing published
+//           yet, EBUSY the CMS stopped half way through a publish, or the
+//           errors of cms_shm_open)
+// -----------------------------------------------------------------------------
+static inline int cms_shm_begin(CmsShmReader *reader, CmsShmView *view)
+{
+    int reopens = 0;
+    for (long spins = 0; spins < CMS_SHM_SPIN_LIMIT; spins++) {
+        if (spins > 0) sched_yield();
+        if (reader->base == NULL) {
+            char name[sizeof(reader->name)];
+            memcpy(name, reader->name, sizeof(name));
+            if (cms_shm_open(reader, name) != 0) {
+                if ((errno != ENOENT && errno != EPROTO) || ++reopens >= CMS_SHM_REOPEN_TRIES) return -1;
+                usleep(1000); //being recreated (missing, or not sized / ready yet)
+                continue;
+            }
+        }
+
+        const CmsShmHeader *header = (const CmsShmHeader *)reader->base;
+
+        //Header seqlock: active/generation/retired as one consistent read
+        uint64_t before = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) continue; //writer mid-flip
+        uint32_t retired = __atomic_load_n(&header->retired, __ATOMIC_RELAXED);
+        uint64_t active = __atomic_load_n(&header->active, __ATOMIC_RELAXED);
+        uint64_t generation = __atomic_load_n(&header->generation, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&header->seq, __ATOMIC_RELAXED) != before) continue;
+
+        if (retired) {
+            cms_shm_close(reader);
+            continue;
+        }
+        if (generation == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        const CmsShmSlot *slot = &header->slots[active & 1];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue; //rewritten already: take the newer snapshot
+
+        uint64_t count = __atomic_load_n(&slot->count, __ATOMIC_RELAXED);
+        uint64_t offset = __atomic_load_n(&slot->offset, __ATOMIC_RELAXED);
+        if (count > header->capacity || offset + count * sizeof(CmsShmRecord) > reader->bytes) continue;
+
+        view->records = (const CmsShmRecord *)(reader->base + offset);
+        view->count = count;
+        view->generation = __atomic_load_n(&slot->generation, __ATOMIC_RELAXED);
+        view->published = __atomic_load_n(&slot->published, __ATOMIC_RELAXED);
+        view->slot = (int)(active & 1);
+        view->seq = seq;
+        return 0;
+    }
+    errno = EBUSY;
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: cms_shm_end
+// PURPOSE : Call after reading a view: checks that the slot was not
+//           rewritten while it was read.
+// RETURNS : 1 -> everything read since cms_shm_begin() is consistent,
+//           0 -> discard it and start again with cms_shm_begin()
+// -----------------------------------------------------------------------------
+static inline int cms_shm_end(const CmsShmReader *reader, const CmsShmView *view)
+{
+    const CmsShmHeader *header = (const CmsShmHeader *)reader->base;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&header->slots[view->slot].seq, __ATOMIC_RELAXED) == view->seq;
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: cms_shm_generation
+// RETURNS : number of the latest publish (cheap check for a new snapshot)
+// -----------------------------------------------------------------------------
+static inline uint64_t cms_shm_generation(const CmsShmReader *reader)
+{
+    const CmsShmHeader *header = (const CmsShmHeader *)reader->base;
+    return reader->base ? __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE) : 0;
+}
+
+#endif
@@ -0,0 +1,130 @@
+// =============================================================================
+// P9_3_shm_reader.c - example consumer of the CMS shared-memory snapshot
+//
+// Prints a report (record count, average / highest / lowest mark, records
+// per programme) straight from the table a running CMS published with
+// PUBLISH, without reading the text database.
+//
+// Build : gcc -O2 -o P9_3_shm_reader P9_3_shm_reader.c   (add -lrt on glibc < 2.34)
+// Run   : ./P9_3_shm_reader [/<name>] [WATCH]
+//         WATCH -> print a new report every time the CMS publishes again
+// =============================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "P9_3_cms_shm.h"
+
+#define REPORT_PROGRAMMES_MAX 64 //programmes listed in the report
+
+typedef struct {
+    uint64_t generation;
+    time_t published;
+    uint64_t count;
+    double sum;
+    CmsShmRecord highest, lowest;
+    char programmes[REPORT_PROGRAMMES_MAX][CMS_SHM_MAX_STR];
+    uint64_t programmeCounts[REPORT_PROGRAMMES_MAX];
+    int programmeCount;
+} Report;
+
+// -----------------------------------------------------------------------------
+// FUNCTION: report_scan
+// PURPOSE : One pass over a snapshot, reading the records in place.
+// -----------------------------------------------------------------------------
+static void report_scan(const CmsShmView *view, Report *report)
+{
+    memset(report, 0, sizeof(*report));
+    report->generation = view->generation;
+    report->published = (time_t)view->published;
+    report->count = view->count;
+
+    for (uint64_t i = 0; i < view->count; i++) {
+        const CmsShmRecord *record = &view->records[i];
+        report->sum += record->mark;
+        if (i == 0 || record->mark > report->highest.mark) report->highest = *record;
+        if (i == 0 || record->mark < report->lowest.mark) report->lowest = *record;
+
+        int p = 0;
+        while (p < report->programmeCount && strcmp(report->programmes[p], record->programme) != 0) p++;
+        if (p == report->programmeCount) {
+            if (p == REPORT_PROGRAMMES_MAX) continue;
+            memcpy(report->programmes[p], record->programme, CMS_SHM_MAX_STR);
+            report->programmes[p][CMS_SHM_MAX_STR - 1] = '\0'; //may be half written: cms_shm_end decides
+            report->programmeCount++;
+        }
+        report->programmeCounts[p]++;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FUNCTION: report_print
+// -----------------------------------------------------------------------------
+static void report_print(const Report *report)
+{
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&report->published));
+
+    printf("===== CMS snapshot (generation %llu, published %s) =====\n",
+           (unsigned long long)report->generation, stamp);
+    printf("Total students : %llu\n", (unsigned long long)report->count);
+    if (report->count > 0) {
+        printf("Average mark   : %.2f\n", report->sum / (double)report->count);
+        printf("Highest mark   : %.1f (%s)\n", report->highest.mark, report->highest.name);
+        printf("Lowest mark    : %.1f (%s)\n", report->lowest.mark, report->lowest.name);
+    }
+    for (int p = 0; p < report->programmeCount; p++) {
+        printf("  %-30s %llu\n", report->programmes[p], (unsigned long long)report->programmeCounts[p]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = CMS_SHM_DEFAULT_NAME;
+    int watch = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcasecmp(argv[i], "WATCH") == 0) watch = 1;
+        else name = argv[i];
+    }
+
+    CmsShmReader reader;
+    if (cms_shm_open(&reader, name) != 0) {
+        fprintf(stderr, "Cannot open shared memory \"%s\": %s (run PUBLISH in the CMS first)\n", name, strerror(errno));
+        return 1;
+    }
+
+    Report *report = malloc(sizeof(Report));
+    if (report == NULL) {
+        cms_shm_close(&reader);
+        return 1;
+    }
+
+    uint64_t shown = 0;
+    int status = 0;
+    do {
+        CmsShmView view;
+        int retries = 0;
+        do { //scan again if the CMS rewrote the slot meanwhile
+            if (cms_shm_begin(&reader, &view) != 0) {
+                fprintf(stderr, "No snapshot in \"%s\": %s\n", name, strerror(errno));
+                status = 1;
+                break;
+            }
+            report_scan(&view, report);
+        } while (!cms_shm_end(&reader, &view) && ++retries);
+        if (status != 0) break;
+
+        if (report->generation != shown) {
+            report_print(report);
+            if (retries > 0) printf("(%d rescan(s): published again while reading)\n", retries);
+            shown = report->generation;
+            fflush(stdout);
+        }
+        if (watch) usleep(200 * 1000);
+    } while (watch);
+
+    free(report);
+    cms_shm_close(&reader);
+    return status;
+}
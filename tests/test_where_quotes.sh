@@ -0,0 +1,57 @@
+#!/bin/sh
+# Single-quoted WHERE text may contain ';' (command separator) and '?'
+# (PREPARE placeholder); neither may be taken out of the quotes. EXECUTE
+# values containing quotes must reach the command unchanged.
+#
+# Run from the repository root: sh tests/test_where_quotes.sh
+set -e
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+gcc -O2 -pthread -o "$work/cms" P9_3_cms.c
+
+cat > "$work/q.txt" <<'EOF'
+Database Name: P9_3-CMS
+Authors: test
+Table Name: StudentRecords
+
+ID         Name            Programme                 Mark
+1000001    a;b X           Law                       50.0
+1000002    what? Y         Law                       60.0
+1000003    O'Neil Z        Law                       70.0
+1000004    Plain Q         Law                       80.0
+1000005    Jo"e W          Law                       40.0
+EOF
+
+cd "$work"
+./cms > out.txt <<'EOF'
+OPEN q.txt
+SHOW WHERE NAME = 'a;b X'; QUERY 1000004
+SHOW WHERE NAME = 'O''Neil Z'
+PREPARE p AS SHOW WHERE NAME = 'what? Y' OR MARK > ?
+EXECUTE p 75
+PREPARE n AS SHOW WHERE NAME = ?
+EXECUTE n "Jo""e W"
+PREPARE loop AS EXECUTE loop
+EXIT
+EOF
+
+fail=0
+check() {
+    if ! grep -q "$1" out.txt; then
+        echo "FAIL: expected \"$1\""
+        fail=1
+    fi
+}
+check '1000001    a;b X'
+check 'Prepared "p" (SHOW, 1 parameter(s))'
+check '2 record(s) match'
+check "1000003    O'Neil Z"
+check '1000005    Jo"e W'
+check 'EXECUTE cannot be prepared'
+if grep -q 'Missing closing quote\|Unknown command' out.txt; then
+    echo "FAIL: a quoted ';' split the command"
+    fail=1
+fi
+[ "$fail" -eq 0 ] && echo "PASS: test_where_quotes"
+exit "$fail"